@@ -1,16 +1,18 @@
 #include "resourceloader.h"
 #include <QFile>
 #include <QTextStream>
+#include <algorithm>
 #include <vector>
 
 ResourceLoader::ResourceLoader()
 {
 }
 
-GLuint ResourceLoader::createShaderProgram(const char *vertexFilePath,const char *fragmentFilePath) {
+GLuint ResourceLoader::createShaderProgram(const char *vertexFilePath,const char *fragmentFilePath,
+                                           const std::string &fragmentDefines) {
     // Create and compile the shaders.
-    GLuint vertexShaderID = createShader(GL_VERTEX_SHADER, vertexFilePath);
-    GLuint fragmentShaderID = createShader(GL_FRAGMENT_SHADER, fragmentFilePath);
+    GLuint vertexShaderID = createShader(GL_VERTEX_SHADER, vertexFilePath, std::string());
+    GLuint fragmentShaderID = createShader(GL_FRAGMENT_SHADER, fragmentFilePath, fragmentDefines);
 
     // Link the shader program.
     GLuint programId = glCreateProgram();
@@ -35,7 +37,7 @@ GLuint ResourceLoader::createShaderProgram(const char *vertexFilePath,const char
     return programId;
 }
 
-GLuint ResourceLoader::createShader(GLenum shaderType, const char *filepath) {
+GLuint ResourceLoader::createShader(GLenum shaderType, const char *filepath, const std::string &defines) {
     GLuint shaderID = glCreateShader(shaderType);
 
     // Read shader file.
@@ -47,6 +49,23 @@ GLuint ResourceLoader::createShader(GLenum shaderType, const char *filepath) {
         code = stream.readAll().toStdString();
     }
 
+    // Defines have to come after #version, which must be the first line.
+    // #line keeps the line numbers in the info log matching the file
+    if (!defines.empty()) {
+        size_t insertAt = 0;
+        size_t versionLine = code.find("#version");
+        if (versionLine != std::string::npos) {
+            size_t lineEnd = code.find('\n', versionLine);
+            if (lineEnd == std::string::npos) {
+                lineEnd = code.size();
+                code += '\n';
+            }
+            insertAt = lineEnd + 1;
+        }
+        int nextLine = 1 + static_cast<int>(std::count(code.begin(), code.begin() + insertAt, '\n'));
+        code.insert(insertAt, defines + "#line " + std::to_string(nextLine) + "\n");
+    }
+
     // Compile shader code.
     printf("Compiling shader: %s\n", filepath);
     const char *codePtr = code.c_str();
@@ -3,14 +3,18 @@
 
 #include "GL/glew.h"
 
+#include <string>
+
 class ResourceLoader {
 public:
     ResourceLoader();
-    static GLuint createShaderProgram(const char * vertex_file_path,const char * fragment_file_path);
+    // fragmentDefines (e.g. "#define USE_AO 1\n") is inserted after the fragment shader's #version line
+    static GLuint createShaderProgram(const char * vertex_file_path,const char * fragment_file_path,
+                                      const std::string &fragmentDefines = std::string());
     static void initializeGlew();
 
 private:
-    static GLuint createShader(GLenum shaderType, const char *filepath);
+    static GLuint createShader(GLenum shaderType, const char *filepath, const std::string &defines);
 };
 
 #endif // SHADER_H
@@ -3,7 +3,7 @@ TARGET = final
 TEMPLATE = app
 
 QMAKE_CXXFLAGS += -std=c++14
-CONFIG += c++14
+CONFIG += c++14 thread
 
 unix:!macx {
     LIBS += -lGLU
@@ -34,6 +34,7 @@ SOURCES += \
     src/gl/datatype/VBOAttribMarker.cpp \
     src/gl/datatype/VAO.cpp \
     src/gl/datatype/IBO.cpp \
+    src/gl/datatype/UBO.cpp \
     src/gl/textures/Texture.cpp \
     src/gl/textures/Texture2D.cpp \
     src/gl/textures/TextureParameters.cpp \
@@ -47,7 +48,30 @@ SOURCES += \
     src/view.cpp \
     src/gl/textures/Texture3D.cpp \
     cs123_lib/TestMatrices.cpp \
-    src/SceneBuilder.cpp
+    src/SceneBuilder.cpp \
+    src/RayBlock.cpp \
+    src/SceneBuffer.cpp \
+    src/Scene.cpp \
+    src/SceneFile.cpp \
+    src/Mesh.cpp \
+    src/MeshBuffer.cpp \
+    src/BVH.cpp \
+    src/OrbitCamera.cpp \
+    src/CPUImages.cpp \
+    src/HeadlessRenderer.cpp \
+    src/FrameStats.cpp \
+    src/AdaptiveSampling.cpp \
+    src/Denoiser.cpp \
+    src/Sampler.cpp \
+    src/gl/datatype/QueryRing.cpp \
+    src/gl/datatype/TimerQueryRing.cpp \
+    src/gl/textures/TextureBuffer.cpp \
+    src/cpu/ThreadPool.cpp \
+    src/cpu/Image.cpp \
+    src/cpu/RayTracer.cpp \
+    src/cpu/PacketTracer.cpp \
+    src/cpu/PacketTracerSSE.cpp \
+    src/cpu/PacketTracerAVX2.cpp
 
 
 HEADERS += \
@@ -60,6 +84,7 @@ HEADERS += \
     src/gl/datatype/VBOAttribMarker.h \
     src/gl/datatype/VAO.h \
     src/gl/datatype/IBO.h \
+    src/gl/datatype/UBO.h \
     src/gl/shaders/ShaderAttribLocations.h \
     src/gl/textures/Texture.h \
     src/gl/textures/Texture2D.h \
@@ -76,7 +101,30 @@ HEADERS += \
     src/gl/textures/Texture3D.h \
     cs123_lib/TestMatrices.h \
     src/SceneBuilder.h \
-    cs123_lib/cube.h
+    src/RayBlock.h \
+    src/SceneBuffer.h \
+    src/Scene.h \
+    src/SceneFile.h \
+    src/Mesh.h \
+    src/MeshBuffer.h \
+    src/BVH.h \
+    src/OrbitCamera.h \
+    src/CPUImages.h \
+    src/HeadlessRenderer.h \
+    src/FrameStats.h \
+    src/AdaptiveSampling.h \
+    src/Denoiser.h \
+    src/Sampler.h \
+    src/gl/datatype/QueryRing.h \
+    src/gl/datatype/TimerQueryRing.h \
+    src/gl/textures/TextureBuffer.h \
+    cs123_lib/cube.h \
+    src/scenedata.h \
+    src/cpu/ThreadPool.h \
+    src/cpu/Image.h \
+    src/cpu/RayTracer.h \
+    src/cpu/PacketTracer.h \
+    src/cpu/PacketKernels.h
 
 FORMS += src/mainwindow.ui
 
@@ -87,6 +135,8 @@ OTHER_FILES += \
     shaders/quad.vert \
     shaders/ray.frag \
     shaders/composite.frag \
+    shaders/denoise.frag \
+    shaders/converged.frag \
     shaders/cube.vert \
     shaders/envMap.frag
 
@@ -3,11 +3,42 @@
 in vec2 uv;
 
 uniform sampler2D tex;
+uniform ivec2 renderSize; // pixels of tex that hold the image, from its bottom left
 
 out vec4 fragColor;
 
+// Display transform for the resolved color. ray.frag already clamps each
+// sample to [0, 1], so this only guards the output range
+vec3 tonemap(vec3 color){
+    return clamp(color, 0.0, 1.0);
+}
+
+// Texels hold a running sum in rgb and the sample count in alpha
+vec3 resolve(ivec2 texel){
+    vec4 accum = texelFetch(tex, clamp(texel, ivec2(0), renderSize - 1), 0);
+    return accum.rgb / max(accum.a, 1.0);
+}
+
+// Bilinear upsampling of a lower resolution render. Texels are resolved before
+// they are blended, since neighbours may hold different sample counts
+vec3 upsample(vec2 uv){
+    vec2 position = uv * vec2(renderSize) - 0.5;
+    ivec2 texel = ivec2(floor(position));
+    vec2 f = position - floor(position);
+    vec3 bottom = mix(resolve(texel), resolve(texel + ivec2(1, 0)), f.x);
+    vec3 top = mix(resolve(texel + ivec2(0, 1)), resolve(texel + ivec2(1, 1)), f.x);
+    return mix(bottom, top, f.y);
+}
+
 void main(){
 
-    // Sample the texture "tex" at the given UV-coordinates.
-    fragColor = texture(tex, uv);
+    // A full resolution render maps texel for pixel
+    vec3 color;
+    if (renderSize == textureSize(tex, 0)){
+        vec4 accum = texture(tex, uv);
+        color = accum.rgb / max(accum.a, 1.0);
+    } else {
+        color = upsample(uv);
+    }
+    fragColor = vec4(tonemap(color), 1.0);
 }
@@ -0,0 +1,15 @@
+#version 400 core
+
+// Passes only the pixels whose moments are marked converged (see AdaptiveSampling),
+// so a GL_SAMPLES_PASSED query around the draw counts them. See View::measureConvergence
+
+uniform sampler2D moments; // 0, the ray FBO's (mean, M2, converged, 0)
+
+out vec4 fragColor;
+
+void main() {
+    if (texelFetch(moments, ivec2(gl_FragCoord.xy), 0).z < 0.5) {
+        discard;
+    }
+    fragColor = vec4(0.0);
+}
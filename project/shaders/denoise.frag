@@ -0,0 +1,123 @@
+#version 400 core
+
+// [DENOISER]
+// One à-trous iteration of the edge-avoiding wavelet filter, run between the ray
+// pass and composite.frag (see View::denoise). Mirrors Denoiser on the C++ side
+
+#define DENOISE_SIGMA_LUMINANCE 4.0
+#define DENOISE_SIGMA_NORMAL 128.0
+#define DENOISE_SIGMA_DEPTH 0.02
+#define DENOISE_SIGMA_ALBEDO 0.01
+#define DENOISE_UNKNOWN_VARIANCE 1.0
+#define DENOISE_SILHOUETTE_WEIGHT 0.5
+
+in vec2 uv;
+
+// The ray FBO's attachments: the accumulated color on the first iteration,
+// then (color, variance) from the previous one
+uniform sampler2D tex; // 0
+uniform sampler2D moments; // 1
+uniform sampler2D geometry; // 2
+uniform sampler2D albedo; // 3
+
+uniform int iteration;
+uniform int lastIteration;
+uniform ivec2 renderSize; // pixels of the attachments that hold the image
+
+out vec4 fragColor;
+
+// 1D B3 spline, by distance from the centre in taps
+const float KERNEL[3] = float[3](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+float luminance(vec3 color){
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Resolved color and the variance of its luminance's mean
+vec4 resolve(vec4 color, vec4 moments){
+    float variance = DENOISE_UNKNOWN_VARIANCE;
+    if (color.a >= 2.0){
+        variance = max(moments.y, 0.0) / ((color.a - 1.0) * color.a);
+    }
+    return vec4(color.rgb / max(color.a, 1.0), variance);
+}
+
+vec4 loadInput(ivec2 pixel){
+    vec4 color = texelFetch(tex, pixel, 0);
+    if (iteration == 0){
+        return resolve(color, texelFetch(moments, pixel, 0));
+    }
+    return color;
+}
+
+// Misses only blend with misses, their albedo (the background) keeps the environment sharp
+float edgeWeight(vec4 geometry, vec4 tapGeometry, vec3 albedo, vec3 tapAlbedo, float offset){
+    if (geometry.w < 0.0 || tapGeometry.w < 0.0){
+        return geometry.w < 0.0 && tapGeometry.w < 0.0 ? 1.0 : 0.0;
+    }
+    float normal = pow(max(dot(geometry.xyz, tapGeometry.xyz), 0.0), DENOISE_SIGMA_NORMAL);
+    float depth = exp(-abs(geometry.w - tapGeometry.w) / (DENOISE_SIGMA_DEPTH * geometry.w * offset));
+    vec3 albedoDifference = albedo - tapAlbedo;
+    return normal * depth * exp(-dot(albedoDifference, albedoDifference) / DENOISE_SIGMA_ALBEDO);
+}
+
+// Pixels whose footprint straddles an edge keep their accumulated color
+bool onSilhouette(ivec2 pixel){
+    const ivec2 offsets[4] = ivec2[4](ivec2(1, 0), ivec2(-1, 0), ivec2(0, 1), ivec2(0, -1));
+    vec4 centre = texelFetch(geometry, pixel, 0);
+    for (int i = 0; i < 4; i++){
+        ivec2 tap = pixel + offsets[i];
+        if (any(lessThan(tap, ivec2(0))) || any(greaterThanEqual(tap, renderSize))){
+            continue;
+        }
+        if (edgeWeight(centre, texelFetch(geometry, tap, 0), vec3(0.0), vec3(0.0), 1.0) < DENOISE_SILHOUETTE_WEIGHT){
+            return true;
+        }
+    }
+    return false;
+}
+
+void main(){
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    int step = 1 << iteration;
+
+    vec4 centre = loadInput(pixel);
+    if (onSilhouette(pixel)){
+        fragColor = lastIteration == 1 ? vec4(centre.rgb, 1.0) : centre;
+        return;
+    }
+    vec4 centreGeometry = texelFetch(geometry, pixel, 0);
+    vec3 centreAlbedo = texelFetch(albedo, pixel, 0).rgb;
+    float centreLuminance = luminance(centre.rgb);
+    float sigma = DENOISE_SIGMA_LUMINANCE * sqrt(max(centre.a, 0.0)) + 1e-4;
+
+    vec3 colorSum = vec3(0.0);
+    float varianceSum = 0.0;
+    float weightSum = 0.0;
+    for (int dy = -2; dy <= 2; dy++){
+        for (int dx = -2; dx <= 2; dx++){
+            ivec2 tap = pixel + ivec2(dx, dy) * step;
+            if (any(lessThan(tap, ivec2(0))) || any(greaterThanEqual(tap, renderSize))){
+                continue;
+            }
+            if ((dx != 0 || dy != 0) && onSilhouette(tap)){
+                continue;
+            }
+            vec4 tapInput = loadInput(tap);
+            float weight = KERNEL[abs(dx)] * KERNEL[abs(dy)];
+            if (dx != 0 || dy != 0){
+                float offset = float(step) * sqrt(float(dx * dx + dy * dy));
+                weight *= edgeWeight(centreGeometry, texelFetch(geometry, tap, 0),
+                                     centreAlbedo, texelFetch(albedo, tap, 0).rgb, offset);
+                weight *= exp(-abs(centreLuminance - luminance(tapInput.rgb)) / sigma);
+            }
+            colorSum += weight * tapInput.rgb;
+            varianceSum += weight * weight * tapInput.a;
+            weightSum += weight;
+        }
+    }
+
+    // composite.frag divides by alpha, so the last iteration leaves a count of 1
+    vec3 color = colorSum / weightSum;
+    fragColor = vec4(color, lastIteration == 1 ? 1.0 : varianceSum / (weightSum * weightSum));
+}
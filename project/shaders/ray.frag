@@ -3,26 +3,69 @@
 #define CUBE 1
 #define CONE 2
 #define CYLINDER 3
-#define NO_INTERSECT 4
-#define LIGHT_POINT 5
-#define LIGHT_DIRECTIONAL 6
+#define MESH 4
+#define NO_INTERSECT 5
+#define LIGHT_POINT 6
+#define LIGHT_DIRECTIONAL 7
 #define SHAPE_EPSILON .001
 #define CONE_SLOPE 2.0
 #define MAX_BOUNCE 3
 #define PI 3.1415
-#define DIFFUSE 7
-#define NORMAL 8
+#define DIFFUSE 8
+#define NORMAL 9
+#define NUM_LIGHTS 3
+#define TEXELS_PER_OBJECT 9
+#define TEXELS_PER_MATERIAL 6
+#define TEXELS_PER_NODE 2
+#define BVH_MAX_LEAF_SIZE 4
+#define MESH_TEXELS_PER_TRIANGLE 3
+#define MESH_TEXELS_PER_VERTEX 2
+
+// Adaptive sampling, the constants of AdaptiveSampling on the C++ side
+#define ADAPTIVE_MIN_SAMPLES 16
+#define ADAPTIVE_MAX_SAMPLES_PER_PASS 4
+#define ADAPTIVE_CONFIDENCE_Z 1.96
+#define ADAPTIVE_MIN_LUMINANCE 0.05
+
+// Reprojection, see the [REPROJECTION] section
+#define REPROJECTION_MAX_SAMPLES 32.0
+#define REPROJECTION_DEPTH_TOLERANCE 0.05  // relative to the distance
+#define REPROJECTION_MIN_NORMAL_DOT 0.9
+
+// Sample dimensions, see the [SAMPLER] section
+#define SAMPLE_AA 0
+#define SAMPLE_DOF 1
+#define SAMPLE_AO 2
+#define SAMPLE_ADAPTIVE 3
+
+// [PERMUTATIONS]
+// View compiles one program per combination of these toggles by defining them
+// to 0 or 1 (see View::getRayProgram), so disabled features are compiled out.
+// Left undefined they fall back to the runtime value in the settings block.
+#ifndef USE_SHADOWS
+#define USE_SHADOWS settings.useShadows
+#endif
+#ifndef USE_REFLECTIONS
+#define USE_REFLECTIONS settings.useReflections
+#endif
+#ifndef USE_AO
+#define USE_AO settings.useAO
+#endif
+#ifndef USE_DOF
+#define USE_DOF settings.useDOF
+#endif
+#ifndef USE_NM
+#define USE_NM settings.useNM
+#endif
+#ifndef USE_TEXTURES
+#define USE_TEXTURES settings.useTextures
+#endif
 
 // [DATA TYPES]
 /////////////////////////////////////////////////////////////////////////
 
-// Scene Object has it's material in the same struct
-// Because passing a struct of structs into a shader seems wild
-struct SceneObject{
-    int primitive; // Can be SPHERE, CUBE, CONE, CYLINDER
-    mat4x4 objectToWorld; // cumulative transformation matrix
-
-    // Material properties
+// Material of a scene object, fetched from materialBuffer only when a hit is shaded
+struct Material{
     vec4 cDiffuse;
     vec4 cAmbient;
     vec4 cSpecular;
@@ -36,20 +79,15 @@ struct SceneObject{
     float repeatV;
 };
 
-// Data structure for intersection test results
+// Data structure for intersection test results. Kept small, since every ray
+// carries one through the traversal; the object's matrices and material are
+// looked up through objectIndex
 struct PrimitiveType{
     float t;
-    int primitive; // Can be SPHERE, CUBE, CONE, CYLINDER, NO_INTERSECT
-    vec4 cDiffuse;
-    vec4 cAmbient;
-    vec4 cSpecular;
-    vec4 cReflective;
-    float shininess;
-    mat4x4 objectToWorld;
-    float blend;
-    int texID;
-    float repeatU;
-    float repeatV;
+    int objectIndex; // -1 for NO_INTERSECT
+    int primitive; // Can be SPHERE, CUBE, CONE, CYLINDER, MESH, NO_INTERSECT
+    int triangle; // MESH only, counted over all meshes of meshBuffer
+    vec2 barycentric; // MESH only, weights of the triangle's second and third vertex
 };
 
 // Final output of data Raytracing spits out to write to color attachments
@@ -61,6 +99,13 @@ struct RayData{
     vec4 rayDirection;
 };
 
+// Where a pixel's samples come from, see the [SAMPLER] section
+struct Sampler{
+    uint seed;  // scrambles every dimension of one pixel
+    uint index; // sample index within the pixel
+    ivec2 pixel;
+};
+
 struct GlobalData{
     float ka; // global ambient coefficient
     float kd; // global diffuse coefficeint
@@ -101,22 +146,34 @@ struct SettingsData{
     int useReflections;
     int useEnvironment;
     int useTextures;
+
+    // Adaptive sampling
+    int useAdaptive;
+    float adaptiveThreshold; // relative confidence interval of a converged pixel
+
+    int useBlueNoise;  // Blue noise sampler, see the [SAMPLER] section
 };
 
 // [INPUT / OUTPUT]
 ////////////////////////////////////////////////////////////////////////////
 in vec2 uv;
 uniform sampler2D prev; // 0
+uniform sampler2D prevMoments; // 10, (mean, M2, converged, 0) of the luminance, see AdaptiveSampling
 uniform samplerCube envMap;
-uniform vec2 dimensions;
+uniform vec2 dimensions; // pixels traced, less than the FBO size while the camera moves
 uniform mat4x4 inverseCam;
 uniform float firstPass;
 uniform int numPasses;
-uniform float time;
+uniform float adaptiveBudget; // average samples per pass of a pixel that has not converged
 
-// Structs sent from view.cpp
-uniform GlobalData globalData;
-uniform SettingsData settings;
+// The previous pass, for reprojecting it after the camera moved
+uniform sampler2D prevGeometry; // 12, (world normal, distance) of each pixel's primary hit
+uniform sampler2D prevAlbedo; // 13, diffuse color of each pixel's primary hit
+uniform mat4x4 prevWorldToFilm; // inverse of the previous pass's inverseCam
+uniform vec4 prevEye;
+uniform vec2 prevDimensions;
+uniform int reproject;      // 1 when the previous pass was traced from another camera
+uniform int traceGeometry;  // 0 when prevGeometry is still up to date
 
 // Textures [1 diffuse, 1 normal atm]
 uniform sampler2D metalDiffuseTex; // 1
@@ -128,31 +185,92 @@ uniform sampler2D woodNormalTex; // 5
 uniform sampler2D plasterDiffuseTex; // 6
 uniform sampler2D plasterNormalTex; // 7
 
-// Light objects [max 3 atm]
-uniform LightObject lightObject1;
-uniform LightObject lightObject2;
-uniform LightObject lightObject3;
+// Tiles of ranked blue noise, one per layer (made by tools/bluenoise)
+uniform sampler2DArray blueNoise; // 11
 
-// Scene objects [max 5 atm]
-uniform SceneObject sceneObject1;
-uniform SceneObject sceneObject2;
-uniform SceneObject sceneObject3;
-uniform SceneObject sceneObject4;
-uniform SceneObject sceneObject5;
-uniform SceneObject sceneObject6;
+// [SCENE DATA]
+////////////////////////////////////////////////////////////////////////////
 
-// Output location
-out vec4 fragColor;
+// Lights and settings sent from view.cpp as one std140 block
+// (packed by RayBlock on the C++ side, re-uploaded only when it changes)
+layout(std140) uniform RayBlock {
+    LightObject sceneLights[NUM_LIGHTS];
+    GlobalData globalData;
+    SettingsData settings;
+    int numObjects;
+    int numBVHNodes;
+};
 
+// Scene objects, TEXELS_PER_OBJECT texels each (packed by SceneBuffer on the C++ side)
+uniform samplerBuffer sceneObjectBuffer; // 8
 
-// [SCENE DATA]
-////////////////////////////////////////////////////////////////////////////
+// The scene's distinct materials, TEXELS_PER_MATERIAL texels each, indexed by the objects
+uniform samplerBuffer materialBuffer; // 14
+
+// BVH nodes in depth first order, TEXELS_PER_NODE texels each (packed by BVH on the C++ side):
+// (min.xyz, miss index), (max.xyz, -1 for inner nodes or first * BVH_MAX_LEAF_SIZE + count - 1)
+uniform samplerBuffer bvhBuffer; // 9
 
-// Object list (initialized in main)
-SceneObject[6] sceneObjects;
+// Triangle meshes (packed by MeshBuffer on the C++ side): a header node whose first texel
+// holds where the triangles and vertices start, every mesh's BVH nodes laid out like bvhBuffer's,
+// MESH_TEXELS_PER_TRIANGLE texels per triangle: (v0, vertex 0), (v1 - v0, vertex 1), (v2 - v0, vertex 2)
+// and MESH_TEXELS_PER_VERTEX per vertex: (normal, 0), (uv, 0, 0)
+uniform samplerBuffer meshBuffer; // 15
+
+// Every part of an object is fetched on its own, so traversal only reads the
+// primitive and worldToObject, and shading only what it uses
+int getObjectPrimitive(int index){
+    return int(texelFetch(sceneObjectBuffer, index * TEXELS_PER_OBJECT + 8).x);
+}
+
+mat4x4 getObjectToWorld(int index){
+    int base = index * TEXELS_PER_OBJECT;
+    return mat4x4(texelFetch(sceneObjectBuffer, base),
+                  texelFetch(sceneObjectBuffer, base + 1),
+                  texelFetch(sceneObjectBuffer, base + 2),
+                  texelFetch(sceneObjectBuffer, base + 3));
+}
+
+mat4x4 getObjectWorldToObject(int index){
+    int base = index * TEXELS_PER_OBJECT;
+    return mat4x4(texelFetch(sceneObjectBuffer, base + 4),
+                  texelFetch(sceneObjectBuffer, base + 5),
+                  texelFetch(sceneObjectBuffer, base + 6),
+                  texelFetch(sceneObjectBuffer, base + 7));
+}
+
+// BVH root node of a MESH object's mesh in meshBuffer
+int getObjectMeshRoot(int index){
+    return int(texelFetch(sceneObjectBuffer, index * TEXELS_PER_OBJECT + 8).z);
+}
+
+// transpose(mat3x3(worldToObject)), as Scene::normalToWorld on the C++ side
+mat3x3 getObjectNormalToWorld(int index){
+    return transpose(mat3x3(getObjectWorldToObject(index)));
+}
+
+Material getObjectMaterial(int index){
+    int material = int(texelFetch(sceneObjectBuffer, index * TEXELS_PER_OBJECT + 8).y);
+    int base = material * TEXELS_PER_MATERIAL;
+    vec4 properties = texelFetch(materialBuffer, base + 4);
+    vec4 repeat = texelFetch(materialBuffer, base + 5);
+    return Material(texelFetch(materialBuffer, base),
+                    texelFetch(materialBuffer, base + 1),
+                    texelFetch(materialBuffer, base + 2),
+                    texelFetch(materialBuffer, base + 3),
+                    properties.x,
+                    properties.y,
+                    int(properties.z),
+                    repeat.x,
+                    repeat.y);
+}
+
+// Output locations, the color attachments of the ray FBOs
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec4 fragMoments;
+layout(location = 2) out vec4 fragGeometry;
+layout(location = 3) out vec4 fragAlbedo;
 
-// Light list (initialized in main)
-LightObject sceneLights[3];
 
 // [SHAPES]
 /////////////////////////////////////////////////////////////////////////
@@ -809,16 +927,92 @@ vec2 cylinderUV(vec4 objectSpacePoint, vec4 objectSpaceDirection, float t){
 // [RAY TRACING]
 /////////////////////////////////////////////////////////////////////////
 
-// Random number for noise
-// Returns a pseudo-random value between 0.0 and 1.0
-// Using single seed
-float randValue1(float seed) {
-    return -1.0 + 2.0 * fract(sin(seed * 127.1f + -seed * 311.7f) * 43758.5453123f);
+// [SAMPLER]
+// Random numbers come from the first two dimensions of the Sobol sequence,
+// shuffled and Owen scrambled per pixel and dimension (Burley 2020, "Practical
+// Hash-based Owen Scrambling"), so every dimension stays stratified over a
+// pixel's samples. With settings.useBlueNoise they come from the blueNoise
+// tiles instead, shifted along the golden ratio sequence every sample.
+// Mirrors Sampler on the C++ side bit for bit
+
+// lowbias32 integer hash (Chris Wellons)
+uint hashUint(uint x){
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint hashCombine(uint seed, uint v){
+    return seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+uint laineKarrasPermutation(uint x, uint seed){
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint nestedUniformScramble(uint x, uint seed){
+    return bitfieldReverse(laineKarrasPermutation(bitfieldReverse(x), seed));
+}
+
+// Second Sobol dimension, the first is bitfieldReverse(index)
+uint sobolSecondDimension(uint index){
+    uint result = 0u;
+    for (uint v = 1u << 31; index != 0u; index >>= 1, v ^= v >> 1){
+        if ((index & 1u) != 0u){
+            result ^= v;
+        }
+    }
+    return result;
+}
+
+// 2^32 / golden ratio, the R1 sequence in 0.32 fixed point
+#define GOLDEN_RATIO_FIXED 2654435769u
+
+// Top 24 bits, exactly representable as a float in [0, 1)
+float toUnitFloat(uint x){
+    return float(x >> 8) * (1.0 / 16777216.0);
+}
+
+Sampler samplerForPixel(ivec2 pixel, uint index){
+    return Sampler(hashUint(uint(pixel.x) ^ hashUint(uint(pixel.y))), index, pixel);
+}
+
+// Sub-samples (the i of sample2D) read the tiles at different positions, and every
+// sample index moves the values along the golden ratio sequence
+vec2 blueNoise2D(Sampler sampler, int dimension, int i){
+    ivec3 size = textureSize(blueNoise, 0);
+    uint offset = hashUint(uint(dimension) * 0x9e3779b9u + uint(i));
+    ivec2 texel = (sampler.pixel + ivec2(offset & 0xffffu, offset >> 16)) % size.x;
+    uint x = uint(texelFetch(blueNoise, ivec3(texel, (2 * dimension) % size.z), 0).r * 255.0 + 0.5);
+    uint y = uint(texelFetch(blueNoise, ivec3(texel, (2 * dimension + 1) % size.z), 0).r * 255.0 + 0.5);
+    uint shift = sampler.index * GOLDEN_RATIO_FIXED;
+    return vec2(toUnitFloat((x << 24) + shift), toUnitFloat((y << 24) + shift));
+}
+
+// A point in [0, 1)^2. Nested loops draw count points per sample, i picks one
+// (e.g. the i-th of count AO rays)
+vec2 sample2D(Sampler sampler, int dimension, int i, int count){
+    if (settings.useBlueNoise == 1){
+        return blueNoise2D(sampler, dimension, i);
+    }
+    uint dimensionSeed = hashCombine(sampler.seed, hashUint(uint(dimension)));
+    uint shuffled = nestedUniformScramble(sampler.index * uint(count) + uint(i), dimensionSeed);
+    uint x = nestedUniformScramble(bitfieldReverse(shuffled), hashCombine(dimensionSeed, 0u));
+    uint y = nestedUniformScramble(sobolSecondDimension(shuffled), hashCombine(dimensionSeed, 1u));
+    return vec2(toUnitFloat(x), toUnitFloat(y));
 }
-// Returns a pseudo-random value between 0.0 and 1.0
-// Using 2 seeds
-float randValue2(float seed1, float seed2) {
-    return fract(sin(dot(vec2(seed1, seed2), vec2(12.9898, 78.233))) * 43758.5453);
+
+// The sampler for the i-th of count sub-samples (e.g. DOF rays within a sample)
+Sampler splitSampler(Sampler sampler, int i, int count){
+    return Sampler(sampler.seed, sampler.index * uint(count) + uint(i), sampler.pixel);
 }
 
 // Get light vector, based on lightObject struct point and a world space point of intersection
@@ -844,78 +1038,223 @@ float getLightDistance(LightObject light, vec4 offsetIntersection){
 }
 
 // Given an object space point/direction and primitive type, test if there is an intersection
-// Returns a PrimitiveType struct, with the t value, and object information.
-// intersectionType and t will tell if there has been an intersection or not
-PrimitiveType checkObjectIntersection(vec4 objectSpacePoint, vec4 objectSpaceDirection, SceneObject obj){
-    float closestT = -1.0;
-    int intersectionType = NO_INTERSECT;
+// Returns the t value, or -1.0 if there is no intersection
+float checkObjectIntersection(vec4 objectSpacePoint, vec4 objectSpaceDirection, int primitive){
     float objectT = -1.0;
-    if (obj.primitive == SPHERE){
+    if (primitive == SPHERE){
         objectT = sphere(objectSpacePoint, objectSpaceDirection);
-    }else if (obj.primitive == CONE){
+    }else if (primitive == CONE){
         objectT = cone(objectSpacePoint, objectSpaceDirection);
-    }else if (obj.primitive == CYLINDER){
+    }else if (primitive == CYLINDER){
         objectT = cylinder(objectSpacePoint, objectSpaceDirection);
-    }else if (obj.primitive == CUBE){
+    }else if (primitive == CUBE){
         objectT = cube(objectSpacePoint, objectSpaceDirection);
     }
-    if (objectT > 0.0){
-        closestT = objectT;
-        intersectionType = obj.primitive;
+    return objectT > 0.0 ? objectT : -1.0;
+}
+
+// slab test of the ray segment [0, tMax] against a world space box
+bool intersectsBox(vec3 boxMin, vec3 boxMax, vec3 origin, vec3 invDir, float tMax)
+{
+    vec3 t0 = (boxMin - origin) * invDir;
+    vec3 t1 = (boxMax - origin) * invDir;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+    float enter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+    float exit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+    return enter <= exit;
+}
+
+// Moller-Trumbore against a triangle of meshBuffer. Returns t, or -1.0 if the ray is parallel
+// to the triangle or passes outside it, and the weights of the second and third vertex
+float meshTriangle(int triangle, int triangleBase, vec3 origin, vec3 direction, out vec2 barycentric)
+{
+    int base = triangleBase + triangle * MESH_TEXELS_PER_TRIANGLE;
+    vec3 v0 = texelFetch(meshBuffer, base).xyz;
+    vec3 e1 = texelFetch(meshBuffer, base + 1).xyz;
+    vec3 e2 = texelFetch(meshBuffer, base + 2).xyz;
+
+    barycentric = vec2(0.0);
+    vec3 p = cross(direction, e2);
+    float det = dot(e1, p);
+    if (det == 0.0) {
+        return -1.0;
+    }
+    float invDet = 1.0 / det;
+    vec3 s = origin - v0;
+    float u = dot(s, p) * invDet;
+    if (u < 0.0 || u > 1.0) {
+        return -1.0;
     }
-    return PrimitiveType(closestT, intersectionType,
-                         obj.cDiffuse,
-                         obj.cAmbient,
-                         obj.cSpecular,
-                         obj.cReflective,
-                         obj.shininess,
-                         obj.objectToWorld,
-                         obj.blend,
-                         obj.texID,
-                         obj.repeatU,
-                         obj.repeatV);
-}
-
-// returns a primitiveType of the intersected object in the scene.
-PrimitiveType getIntersection(vec4 worldSpacePoint, vec4 worldSpaceDir)
+    vec3 q = cross(s, e1);
+    float v = dot(direction, q) * invDet;
+    if (v < 0.0 || u + v > 1.0) {
+        return -1.0;
+    }
+    barycentric = vec2(u, v);
+    return dot(e2, q) * invDet;
+}
+
+// Walks the mesh's BVH from rootNode like getIntersection walks the scene's, for the object
+// space ray. Returns the t of the closest triangle with 0 < t < tMax, or -1.0. With anyHit
+// it returns the first one found instead
+float intersectMesh(int rootNode, vec4 objectSpacePoint, vec4 objectSpaceDirection, float tMax, bool anyHit,
+                    out int triangle, out vec2 barycentric)
 {
-    vec4 objectSpacePoint = vec4(0.0);
-    vec4 objectSpaceDirection = vec4(0.0);
+    int triangleBase = int(texelFetch(meshBuffer, 0).x);
+    vec3 origin = objectSpacePoint.xyz;
+    vec3 direction = objectSpaceDirection.xyz;
+    vec3 invDir = 1.0 / direction;
 
     float bestT = -1.0;
-    PrimitiveType intersectObject = PrimitiveType(bestT, NO_INTERSECT,
-                                                  vec4(0.0), vec4(0.0),
-                                                  vec4(0.0), vec4(0.0), 0.0,
-                                                  mat4x4(1.0), 0.0, 0, 0.0, 0.0);
+    triangle = -1;
+    barycentric = vec2(0.0);
+
+    int nodeIndex = rootNode;
+    while (nodeIndex >= 0) {
+        vec4 nodeMin = texelFetch(meshBuffer, nodeIndex * TEXELS_PER_NODE);
+        vec4 nodeMax = texelFetch(meshBuffer, nodeIndex * TEXELS_PER_NODE + 1);
+        int missIndex = int(nodeMin.w);
+
+        if (!intersectsBox(nodeMin.xyz, nodeMax.xyz, origin, invDir, bestT > 0.0 ? bestT : tMax)) {
+            nodeIndex = missIndex;
+            continue;
+        }
+        if (nodeMax.w < 0.0) {
+            nodeIndex++;
+            continue;
+        }
 
+        int leaf = int(nodeMax.w);
+        int first = leaf / BVH_MAX_LEAF_SIZE;
+        int last = first + leaf % BVH_MAX_LEAF_SIZE;
+        for (int i = first; i <= last; i++) {
+            vec2 hit;
+            float t = meshTriangle(i, triangleBase, origin, direction, hit);
+            if (t > 0.0 && t < tMax && (bestT < 0.0 || t < bestT)) {
+                bestT = t;
+                triangle = i;
+                barycentric = hit;
+                if (anyHit) {
+                    return bestT;
+                }
+            }
+        }
+        nodeIndex = missIndex;
+    }
+    return bestT;
+}
 
-    for (int i = 0; i < sceneObjects.length(); i++) {
+// returns a primitiveType of the closest intersected object in the scene.
+PrimitiveType getIntersection(vec4 worldSpacePoint, vec4 worldSpaceDir)
+{
+    float bestT = -1.0;
+    int bestIndex = -1;
+    int bestTriangle = -1;
+    vec2 bestBarycentric = vec2(0.0);
+
+    vec3 origin = worldSpacePoint.xyz;
+    vec3 invDir = 1.0 / worldSpaceDir.xyz;
+
+    // walk the BVH without a stack: the left child is the next node and
+    // every node knows where to go when it is missed or finished
+    int nodeIndex = numBVHNodes > 0 ? 0 : -1;
+    while (nodeIndex >= 0) {
+        vec4 nodeMin = texelFetch(bvhBuffer, nodeIndex * TEXELS_PER_NODE);
+        vec4 nodeMax = texelFetch(bvhBuffer, nodeIndex * TEXELS_PER_NODE + 1);
+        int missIndex = int(nodeMin.w);
+
+        float tMax = bestT > 0.0 ? bestT : 1e30;
+        if (!intersectsBox(nodeMin.xyz, nodeMax.xyz, origin, invDir, tMax)) {
+            nodeIndex = missIndex;
+            continue;
+        }
+        if (nodeMax.w < 0.0) {
+            nodeIndex++;
+            continue;
+        }
 
-        SceneObject curObj = sceneObjects[i];
-        objectSpacePoint = inverse(curObj.objectToWorld) * worldSpacePoint;
-        objectSpaceDirection = inverse(curObj.objectToWorld) * worldSpaceDir;
+        int leaf = int(nodeMax.w);
+        int first = leaf / BVH_MAX_LEAF_SIZE;
+        int last = first + leaf % BVH_MAX_LEAF_SIZE;
+        for (int i = first; i <= last; i++) {
+            mat4x4 worldToObject = getObjectWorldToObject(i);
+            int primitive = getObjectPrimitive(i);
+            int triangle = -1;
+            vec2 barycentric = vec2(0.0);
+            float t;
+            if (primitive == MESH) {
+                t = intersectMesh(getObjectMeshRoot(i), worldToObject * worldSpacePoint, worldToObject * worldSpaceDir,
+                                  bestT > 0.0 ? bestT : 1e30, false, triangle, barycentric);
+            } else {
+                t = checkObjectIntersection(worldToObject * worldSpacePoint,
+                                            worldToObject * worldSpaceDir,
+                                            primitive);
+            }
 
-        PrimitiveType currentIntersection = checkObjectIntersection(objectSpacePoint,
-                                                                    objectSpaceDirection, curObj);
+            // keep the closest valid intersection
+            if (t > 0.0 && (bestT < 0.0 || t < bestT)) {
+                bestT = t;
+                bestIndex = i;
+                bestTriangle = triangle;
+                bestBarycentric = barycentric;
+            }
+        }
+        nodeIndex = missIndex;
+    }
 
-        // compare current intersection object with best intersection object
-        if (currentIntersection.t >= 0.0) {
-            if (bestT >= 0) {
-                // compare to current best intersection. both bestT and currentT are valid
+    if (bestIndex < 0) {
+        return PrimitiveType(-1.0, -1, NO_INTERSECT, -1, vec2(0.0));
+    }
+    return PrimitiveType(bestT, bestIndex, getObjectPrimitive(bestIndex), bestTriangle, bestBarycentric);
+}
 
-                if (bestT > currentIntersection.t) {
-                    // currentIntersection is closer;
-                    bestT = currentIntersection.t;
-                    intersectObject = currentIntersection;
-                }
+// returns true if any object is hit closer than tMax. Unlike getIntersection this
+// stops at the first hit and never fetches the object's material
+bool isOccluded(vec4 worldSpacePoint, vec4 worldSpaceDir, float tMax)
+{
+    vec3 origin = worldSpacePoint.xyz;
+    vec3 invDir = 1.0 / worldSpaceDir.xyz;
+
+    int nodeIndex = numBVHNodes > 0 ? 0 : -1;
+    while (nodeIndex >= 0) {
+        vec4 nodeMin = texelFetch(bvhBuffer, nodeIndex * TEXELS_PER_NODE);
+        vec4 nodeMax = texelFetch(bvhBuffer, nodeIndex * TEXELS_PER_NODE + 1);
+        int missIndex = int(nodeMin.w);
+
+        if (!intersectsBox(nodeMin.xyz, nodeMax.xyz, origin, invDir, tMax)) {
+            nodeIndex = missIndex;
+            continue;
+        }
+        if (nodeMax.w < 0.0) {
+            nodeIndex++;
+            continue;
+        }
+
+        int leaf = int(nodeMax.w);
+        int first = leaf / BVH_MAX_LEAF_SIZE;
+        int last = first + leaf % BVH_MAX_LEAF_SIZE;
+        for (int i = first; i <= last; i++) {
+            mat4x4 worldToObject = getObjectWorldToObject(i);
+            int primitive = getObjectPrimitive(i);
+            float t;
+            if (primitive == MESH) {
+                int triangle;
+                vec2 barycentric;
+                t = intersectMesh(getObjectMeshRoot(i), worldToObject * worldSpacePoint,
+                                  worldToObject * worldSpaceDir, tMax, true, triangle, barycentric);
             } else {
-                // currentIntersection is best option
-                bestT = currentIntersection.t;
-                intersectObject = currentIntersection;
+                t = checkObjectIntersection(worldToObject * worldSpacePoint,
+                                            worldToObject * worldSpaceDir,
+                                            primitive);
+            }
+            if (t > 0.0 && t < tMax) {
+                return true;
             }
         }
+        nodeIndex = missIndex;
     }
-    return intersectObject;
+    return false;
 }
 
 // Get object bitangent, based on object space intersection point
@@ -974,6 +1313,68 @@ vec2 getObjectUV(vec4 objectSpacePoint, vec4 objectSpaceDirection, float t, int
 
 }
 
+// The three vertex indices of a meshBuffer triangle
+ivec3 getMeshTriangleVertices(int triangle){
+    int base = int(texelFetch(meshBuffer, 0).x) + triangle * MESH_TEXELS_PER_TRIANGLE;
+    return ivec3(texelFetch(meshBuffer, base).w,
+                 texelFetch(meshBuffer, base + 1).w,
+                 texelFetch(meshBuffer, base + 2).w);
+}
+
+// Texel of a vertex's (normal, 0), its (uv, 0, 0) is the next one
+int getMeshVertexTexel(int vertex){
+    return int(texelFetch(meshBuffer, 0).y) + vertex * MESH_TEXELS_PER_VERTEX;
+}
+
+// Interpolated vertex normal of a mesh hit, on the side the ray came from (as Mesh::normal)
+vec3 getMeshNormal(int triangle, vec2 barycentric, vec4 objectSpaceDirection)
+{
+    int base = int(texelFetch(meshBuffer, 0).x) + triangle * MESH_TEXELS_PER_TRIANGLE;
+    vec4 edge1 = texelFetch(meshBuffer, base + 1);
+    vec4 edge2 = texelFetch(meshBuffer, base + 2);
+    vec3 geometric = cross(edge1.xyz, edge2.xyz);
+    if (dot(geometric, objectSpaceDirection.xyz) > 0.0) {
+        geometric = -geometric;
+    }
+
+    ivec3 vertices = ivec3(texelFetch(meshBuffer, base).w, edge1.w, edge2.w);
+    vec3 n = (1.0 - barycentric.x - barycentric.y) * texelFetch(meshBuffer, getMeshVertexTexel(vertices.x)).xyz +
+             barycentric.x * texelFetch(meshBuffer, getMeshVertexTexel(vertices.y)).xyz +
+             barycentric.y * texelFetch(meshBuffer, getMeshVertexTexel(vertices.z)).xyz;
+    if (dot(n, n) == 0.0) {
+        n = geometric;
+    }
+    n = normalize(n);
+    return dot(n, geometric) < 0.0 ? -n : n;
+}
+
+// Interpolated vertex uv of a mesh hit
+vec2 getMeshUV(int triangle, vec2 barycentric)
+{
+    ivec3 vertices = getMeshTriangleVertices(triangle);
+    return (1.0 - barycentric.x - barycentric.y) * texelFetch(meshBuffer, getMeshVertexTexel(vertices.x) + 1).xy +
+           barycentric.x * texelFetch(meshBuffer, getMeshVertexTexel(vertices.y) + 1).xy +
+           barycentric.y * texelFetch(meshBuffer, getMeshVertexTexel(vertices.z) + 1).xy;
+}
+
+// Direction v grows in across a mesh triangle (as Mesh::bitangent)
+vec3 getMeshBitangent(int triangle)
+{
+    int base = int(texelFetch(meshBuffer, 0).x) + triangle * MESH_TEXELS_PER_TRIANGLE;
+    vec3 e1 = texelFetch(meshBuffer, base + 1).xyz;
+    vec3 e2 = texelFetch(meshBuffer, base + 2).xyz;
+    ivec3 vertices = getMeshTriangleVertices(triangle);
+    vec2 uv0 = texelFetch(meshBuffer, getMeshVertexTexel(vertices.x) + 1).xy;
+    vec2 uv1 = texelFetch(meshBuffer, getMeshVertexTexel(vertices.y) + 1).xy - uv0;
+    vec2 uv2 = texelFetch(meshBuffer, getMeshVertexTexel(vertices.z) + 1).xy - uv0;
+    float det = uv1.x * uv2.y - uv2.x * uv1.y;
+    if (det == 0.0) {
+        // No uvs to follow, any direction in the triangle will do
+        return normalize(e1);
+    }
+    return normalize((e2 * uv1.x - e1 * uv2.x) / det);
+}
+
 // Tangent to object space transformation matrix
 // TBN (Tangent, BiTangent, Normal)
 mat3x3 tangentToObject(vec3 objectSpaceTangent, vec3 objectSpaceBitangent, vec3 objectSpaceNormal){
@@ -983,10 +1384,8 @@ mat3x3 tangentToObject(vec3 objectSpaceTangent, vec3 objectSpaceBitangent, vec3
 // returns the world space intersection point of an object and the ray that hit it
 vec4 getWorldSpaceIntersectionPt(PrimitiveType obj, vec4 worldSpacePoint, vec4 worldSpaceDir)
 {
-    vec4 objSpaceIntersectionPt = (inverse(obj.objectToWorld) * worldSpacePoint) +
-                                    (obj.t * (inverse(obj.objectToWorld) * worldSpaceDir));
-
-    return obj.objectToWorld * objSpaceIntersectionPt;
+    // object space t is world space t, the transformation is affine
+    return worldSpacePoint + (obj.t * worldSpaceDir);
 }
 
 // checks for shadow intersection and returns appropriate light color.
@@ -1002,39 +1401,33 @@ vec4 getLightContribution(PrimitiveType obj, vec4 worldPoint, vec4 worldDirectio
     // get ray going from world space intersection pt to light position
     vec4 rayToLight = getLightVector(light, worldSpaceIntersectionPt); //normalize(light.pos - worldSpaceIntersectionPt);
 
-    // distance to light from object
+    // distance to light from object, in units of rayToLight (infinite for directional lights)
     float maxDistance = getLightDistance(light, raisedStartPt);
+    float tMax = maxDistance / length(rayToLight);
 
-    // check for intersection with objects
-    PrimitiveType obstructingObj = getIntersection(raisedStartPt, rayToLight);
-
-    // find distance between object and obstructing object
-    vec4 currIntersection = getWorldSpaceIntersectionPt(obstructingObj, raisedStartPt, rayToLight);
-    float currDistance = length(raisedStartPt - currIntersection);
-
-    // Check if closest intersected object is in front of or behind the light source
-    int shadowCastingTrue = int(obstructingObj.t > 0 && currDistance < maxDistance);
-    int shadowCastingFalse = abs(shadowCastingTrue-1);
-
-    vec4 shadowColor = vec4(0.0, 0.0, 0.0, 1.0);
-    return (shadowCastingTrue * shadowColor) + (shadowCastingFalse * light.color);
+    // any object between the point and the light casts a shadow, the closest one doesn't matter
+    if (isOccluded(raisedStartPt, rayToLight, tMax)) {
+        return vec4(0.0, 0.0, 0.0, 1.0);
+    }
+    return light.color;
 }
 
 // Texture Mapping
 // Sample a texture, given a material's textureMap and a object space intersection point
-vec4 sampleTexture(vec4 objectSpacePoint, vec4 objectSpaceDirection, PrimitiveType obj, int textureType)
+vec4 sampleTexture(vec4 objectSpacePoint, vec4 objectSpaceDirection, PrimitiveType obj, Material material, int textureType)
 {
     int type = obj.primitive;
-    int texID = obj.texID;
+    int texID = material.texID;
     float t = obj.t;
     vec4 textureColor = vec4(0.f);
 
-    float j = obj.repeatU;
-    float k = obj.repeatV;
+    float j = material.repeatU;
+    float k = material.repeatV;
 
     float w = 1.0;
     float h = 1.0;
-    vec2 uv = getObjectUV(objectSpacePoint, objectSpaceDirection, t, type);
+    vec2 uv = type == MESH ? getMeshUV(obj.triangle, obj.barycentric)
+                           : getObjectUV(objectSpacePoint, objectSpaceDirection, t, type);
     float uIndex = uv[0];
     float vIndex = uv[1];
 
@@ -1067,19 +1460,22 @@ vec4 sampleTexture(vec4 objectSpacePoint, vec4 objectSpaceDirection, PrimitiveTy
     return textureColor;
 }
 
-vec4 getNormalMappedNormal(PrimitiveType obj, vec4 worldNormal, vec4 worldPoint, vec4 worldDirection)
+vec4 getNormalMappedNormal(PrimitiveType obj, Material material, vec4 worldNormal, vec4 worldPoint, vec4 worldDirection)
 {
-    vec4 objectSpacePoint = inverse(obj.objectToWorld) * worldPoint;
-    vec4 objectSpaceDirection = inverse(obj.objectToWorld) * worldDirection;
+    mat4x4 objWorldToObject = getObjectWorldToObject(obj.objectIndex);
+    vec4 objectSpacePoint = objWorldToObject * worldPoint;
+    vec4 objectSpaceDirection = objWorldToObject * worldDirection;
 
-    mat3x3 worldToObject = inverse(transpose(mat3x3(inverse(obj.objectToWorld))));
+    // inverse of normalToWorld, takes the normal back to object space
+    mat3x3 worldToObject = transpose(mat3x3(getObjectToWorld(obj.objectIndex)));
     vec3 objectSpaceNormal = worldToObject * vec3(worldNormal);
-    vec3 objectSpaceBitangent = getObjectBitangent(objectSpacePoint, objectSpaceDirection, obj.t, obj.primitive);
+    vec3 objectSpaceBitangent = obj.primitive == MESH ? getMeshBitangent(obj.triangle)
+                                : getObjectBitangent(objectSpacePoint, objectSpaceDirection, obj.t, obj.primitive);
     vec3 objectSpaceTangent = getObjectTangent(objectSpaceNormal, objectSpaceBitangent);
     mat3x3 tangentToObject = tangentToObject(objectSpaceTangent, objectSpaceBitangent, objectSpaceNormal);
 
     // Sample normal map
-    vec4 textureColor = sampleTexture(objectSpacePoint, objectSpaceDirection, obj, NORMAL);//obj.t, obj.primitive, NORMAL, obj.texID);
+    vec4 textureColor = sampleTexture(objectSpacePoint, objectSpaceDirection, obj, material, NORMAL);
     // Remap tangent space texture data into normal domain [-1, 1]
     float x = (textureColor.r * 2.0) - 1.0;
     float y = (textureColor.g * 2.0) - 1.0;
@@ -1089,8 +1485,7 @@ vec4 getNormalMappedNormal(PrimitiveType obj, vec4 worldNormal, vec4 worldPoint,
 
     // Convert tangent space to object space to normal space
     objectSpaceNormal = tangentToObject * tangentNormal;
-    mat3x3 objectToWorld = transpose(mat3x3(inverse(obj.objectToWorld)));
-    worldNormal = vec4(objectToWorld * objectSpaceNormal, 0.0);
+    worldNormal = vec4(getObjectNormalToWorld(obj.objectIndex) * objectSpaceNormal, 0.0);
 
     return worldNormal;
 }
@@ -1100,13 +1495,12 @@ vec4 getNormalMappedNormal(PrimitiveType obj, vec4 worldNormal, vec4 worldPoint,
 vec4 calculateLighting(vec4 worldNormal, vec4 worldPoint, vec4 worldDirection, PrimitiveType obj){
 
     vec4 worldIntersection = worldPoint + (obj.t * worldDirection);
-    vec4 objectSpacePoint = inverse(obj.objectToWorld) * worldPoint;
-    vec4 objectSpaceDirection = inverse(obj.objectToWorld) * worldDirection;
 
-    // Object material constants
-    vec4 objAmb = obj.cAmbient;
-    vec4 objSpec = obj.cSpecular;
-    vec4 objDiffuse = globalData.kd * obj.cDiffuse; // apply global diffuse before we texture map
+    // Object material constants, fetched once for this hit
+    Material material = getObjectMaterial(obj.objectIndex);
+    vec4 objAmb = material.cAmbient;
+    vec4 objSpec = material.cSpecular;
+    vec4 objDiffuse = globalData.kd * material.cDiffuse; // apply global diffuse before we texture map
 
     // --------- AMBIENT ---------
     int usingAmbient = int(settings.useAmbient == 1);
@@ -1116,19 +1510,20 @@ vec4 calculateLighting(vec4 worldNormal, vec4 worldPoint, vec4 worldDirection, P
 
     // --------- TEXTURE MAPPING ---------
     // If using texture mapping and material has a texture map
-    if (settings.useTextures == 1){
-        vec4 objectSpacePoint = inverse(obj.objectToWorld) * worldPoint;
-        vec4 objectSpaceDirection = inverse(obj.objectToWorld) * worldDirection;
+    if (USE_TEXTURES == 1){
+        mat4x4 worldToObject = getObjectWorldToObject(obj.objectIndex);
+        vec4 objectSpacePoint = worldToObject * worldPoint;
+        vec4 objectSpaceDirection = worldToObject * worldDirection;
 
-        vec4 textureColor = sampleTexture(objectSpacePoint, objectSpaceDirection, obj, DIFFUSE);
-        float blend = obj.blend;
+        vec4 textureColor = sampleTexture(objectSpacePoint, objectSpaceDirection, obj, material, DIFFUSE);
+        float blend = material.blend;
         objDiffuse = blend * textureColor + (1.f - blend) * objDiffuse;
     }
 
     // --------- NORMAL MAPPING ---------
     // If normal mapping, use Nu Nv Nw (r, g, b) in tangent space instead of the worldNormal argument
-    if (settings.useNM == 1 && obj.blend > 0.0){
-        worldNormal = getNormalMappedNormal(obj, worldNormal, worldPoint, worldDirection);
+    if (USE_NM == 1 && material.blend > 0.0){
+        worldNormal = getNormalMappedNormal(obj, material, worldNormal, worldPoint, worldDirection);
     }
 
     vec4 sum = vec4(0.0);
@@ -1143,10 +1538,11 @@ vec4 calculateLighting(vec4 worldNormal, vec4 worldPoint, vec4 worldDirection, P
 
         // --------- SHADOWS ---------
         // aka: if using shadows, get light intenisty from 'getLightContribution', if not, use sceneLights[i].color
-        int usingShadows = int(settings.useShadows == 1);
-        int notUsingShadows = int(settings.useShadows != 1);
-        vec4 lightIntensity = (usingShadows * getLightContribution(obj, worldPoint, worldDirection, worldNormal, sceneLights[i])) +
-                (notUsingShadows * sceneLights[i].color);
+        // (a real branch, so no shadow ray is traced when shadows are off)
+        vec4 lightIntensity = sceneLights[i].color;
+        if (USE_SHADOWS == 1){
+            lightIntensity = getLightContribution(obj, worldPoint, worldDirection, worldNormal, sceneLights[i]);
+        }
 
         // Scale lightIntensity by UI setting
         lightIntensity *= sceneLights[i].lightIntensitySetting;
@@ -1167,7 +1563,7 @@ vec4 calculateLighting(vec4 worldNormal, vec4 worldPoint, vec4 worldDirection, P
         vec4 lineOfSight = worldPoint - worldIntersection;
         float specularDot = clamp(dot(normalize(reflectedLightRay), normalize(lineOfSight)), 0.0, 1.0);
 
-        vec4 withSpec = clamp(objSpec * globalData.ks * pow(specularDot, obj.shininess), 0.0, 1.0);
+        vec4 withSpec = clamp(objSpec * globalData.ks * pow(specularDot, material.shininess), 0.0, 1.0);
         vec4 noSpec = vec4(0.0);
 
         int usingSpec = int(settings.useSpecular == 1);
@@ -1200,80 +1596,43 @@ vec4 calculateLighting(vec4 worldNormal, vec4 worldPoint, vec4 worldDirection, P
 // returns the world space normal from an intersection point of the given world space ray and obj.
 vec4 getWorldSpaceNormal(PrimitiveType obj, vec4 worldSpacePoint, vec4 worldSpaceDir)
 {
-    vec4 objSpacePoint = inverse(obj.objectToWorld) * worldSpacePoint;
-    vec4 objSpaceDir = inverse(obj.objectToWorld) * worldSpaceDir;
-
-    vec4 objNormal = vec4(getObjectNormal(objSpacePoint,
-                                          objSpaceDir,
-                                          obj.t,
-                                          obj.primitive), 0.0);
+    mat4x4 worldToObject = getObjectWorldToObject(obj.objectIndex);
+    vec4 objSpacePoint = worldToObject * worldSpacePoint;
+    vec4 objSpaceDir = worldToObject * worldSpaceDir;
 
-    mat3x3 objectToWorld = transpose(mat3x3(inverse(obj.objectToWorld)));
+    vec4 objNormal = obj.primitive == MESH ? vec4(getMeshNormal(obj.triangle, obj.barycentric, objSpaceDir), 0.0)
+                                           : vec4(getObjectNormal(objSpacePoint,
+                                                                  objSpaceDir,
+                                                                  obj.t,
+                                                                  obj.primitive), 0.0);
 
-    vec4 worldNormal = vec4(objectToWorld * vec3(objNormal), 0.0);
+    vec4 worldNormal = vec4(getObjectNormalToWorld(obj.objectIndex) * vec3(objNormal), 0.0);
     return worldNormal;
 }
 
 
-// returns a 4x4 matrix that will rotate the input vector
-// to the z axis.
-mat4x4 getZaxisAlignmentRotation(vec4 worldNormal)
+// orthonormal basis with the given normal as its z axis, without branching on or
+// normalizing anything (Duff et al. 2017, "Building an Orthonormal Basis, Revisited")
+mat3x3 getNormalBasis(vec3 n)
 {
-    if (worldNormal.z == 1.f) {
-        // normal is already z+, no transformation necessary
-        return mat4x4(1.f);
-    } else if (worldNormal.z == -1.f) {
-
-        // normal is in z- direction, rotate by 180 about x axis
-        float phi = PI;
-        mat4x4 zNegMat = mat4x4(1.0, 0.0, 0.0, 0.0,
-                                  0.0, cos(phi), -1.0 * sin(phi), 0.0,
-                                  0.0, sin(phi), cos(phi), 0.0,
-                                  0.0, 0.0, 0.0, 1.0);
-
-        zNegMat = transpose(zNegMat);
-        return zNegMat;
-    } else {
-        // rotation about z axis
-        float zProjDist = sqrt(pow(worldNormal.x, 2) + pow(worldNormal.y, 2));
-
-        float sinThet = -1.f * (worldNormal.y/zProjDist);
-        float cosThet = worldNormal.x/zProjDist;
-
-        mat4x4 r1 = mat4x4(cosThet, -1.0 * sinThet, 0.0, 0.0,
-                           sinThet, cosThet, 0.0, 0.0,
-                           0.0, 0.0, 1.0, 0.0,
-                           0.0, 0.0, 0.0, 1.0);
-        r1 = transpose(r1);
-
-        // rotation about y axis
-        float yProjDist = sqrt(pow(worldNormal.x, 2) +
-                               pow(worldNormal.y, 2) +
-                               pow(worldNormal.z, 2));
-
-        float sinPhi = -1.f * ((sqrt(pow(worldNormal.x, 2) + pow(worldNormal.y, 2)))/yProjDist);
-        float cosPhi = (worldNormal.z)/yProjDist;
-
-        mat4x4 r2 = mat4x4(cosPhi, 0.0, sinPhi, 0.0,
-                           0.0, 1.0, 0.0, 0.0,
-                           -1.0 * sinPhi, 0.0, cosPhi, 0.0,
-                           0.0, 0.0, 0.0, 1.0);
-        r2 = transpose(r2);
-
-        return (r2 * r1);
-    }
+    float s = n.z >= 0.0 ? 1.0 : -1.0;
+    float a = -1.0 / (s + n.z);
+    float b = n.x * n.y * a;
+    return mat3x3(vec3(1.0 + s * n.x * n.x * a, s * b, -s * n.x),
+                  vec3(b, s + n.y * n.y * a, -n.y),
+                  n);
 }
 
-// given an intersected object, the eye point and direction of the original ray casted, and
-// the normal of the object at the point of intersection, finds the AO contribution
-float getAOcontribution(vec4 worldSpacePoint, vec4 worldSpaceDir, vec2 randomSeed)
+// given the closest intersected object of the ray worldSpacePoint/Dir, finds the
+// fraction of cosine weighted directions above the hit that are open for maxDist
+float getAOcontribution(PrimitiveType intersectObject, vec4 worldSpacePoint, vec4 worldSpaceDir, Sampler sampler)
 {
-    PrimitiveType intersectObject = getIntersection(worldSpacePoint, worldSpaceDir);
-
     vec4 worldNormal = getWorldSpaceNormal(intersectObject, worldSpacePoint, worldSpaceDir);
-    if (settings.useNM == 1 && intersectObject.blend > 0.0){
-        worldNormal = getNormalMappedNormal(intersectObject, worldNormal, worldSpacePoint, worldSpaceDir);
+    Material material = getObjectMaterial(intersectObject.objectIndex);
+    if (USE_NM == 1 && material.blend > 0.0){
+        worldNormal = getNormalMappedNormal(intersectObject, material, worldNormal, worldSpacePoint, worldSpaceDir);
     }
+    worldNormal = normalize(worldNormal);
 
     // find worldSpace Intersection point
     vec4 worldSpaceIntersectionPt = worldSpacePoint + (intersectObject.t * worldSpaceDir);
@@ -1281,8 +1640,8 @@ float getAOcontribution(vec4 worldSpacePoint, vec4 worldSpaceDir, vec2 randomSee
     // raise the intersection point by epsilon
     vec4 raisedIntersectionPt = worldSpaceIntersectionPt + (SHAPE_EPSILON/2.f * worldNormal);
 
-    // find the matrix that will transform a vector to align with the z axis
-    mat4x4 worldToZaxis = getZaxisAlignmentRotation(worldNormal);
+    // takes hemisphere directions around z+ to directions around the normal
+    mat3x3 normalBasis = getNormalBasis(worldNormal.xyz);
 
     // pre-sets for AO results
     float maxDist = 1.5;
@@ -1292,52 +1651,20 @@ float getAOcontribution(vec4 worldSpacePoint, vec4 worldSpaceDir, vec2 randomSee
         sampleNum = settings.numSamples;
     }
 
-    float sampleNumFloat = float(sampleNum);
-    float intersectionCount = 0.0;
-
-    // generate random value for generating samples
-    float randVal = randValue2(randomSeed.x, randomSeed.y);
-
+    int occludedCount = 0;
     for (int i = 0; i < sampleNum; i++) {
+        vec2 xi = sample2D(sampler, SAMPLE_AO, i, sampleNum);
 
-        // random theta s.t. 0 < theta < pi/2 ( rotating z+ normal away from z axis)
-        float maxTheta = PI/2.0 /*- SHAPE_EPSILON*/;
-        float theta = randValue2(i, randVal) * maxTheta;
-
-        // random phi s.t. 0 < theta < 2*pi (rotating about z axis
-        float maxPhi = (2.0 * PI);
-        float phi = randValue2(i, randVal) * maxPhi;
-
-        float newX = cos(phi)/cos(theta);
-        float newY = sin(phi)/cos(theta);
-        float newZ = sin(theta);
-
-        vec4 hemisphereVec = vec4(newX, newY, newZ, 0.0);
-        hemisphereVec = normalize(hemisphereVec);
-
-        vec4 transformedSamplerVec = inverse(worldToZaxis) * hemisphereVec;
-        transformedSamplerVec = normalize(transformedSamplerVec);
+        // cosine weighted: a uniform point on the disk, projected up onto the hemisphere
+        float r = sqrt(xi.x);
+        float phi = 2.0 * PI * xi.y;
+        vec3 hemisphereVec = vec3(r * cos(phi), r * sin(phi), sqrt(max(0.0, 1.0 - xi.x)));
 
-        PrimitiveType sampledObj = getIntersection(raisedIntersectionPt, transformedSamplerVec);
-
-        if (sampledObj.t > 0) {
-            float dotProd = dot(transformedSamplerVec, worldNormal);
-
-            float clampedT = clamp(sampledObj.t, 0.0, maxDist);
-
-            float scaledT = (1.0 - (clampedT/maxDist));
-
-            // [alternate option to scale by dotProduct]
-            // scaledT = scaledT * dotProd;
-
-            intersectionCount += scaledT;
-        }
+        vec4 sampleDir = vec4(normalBasis * hemisphereVec, 0.0);
+        occludedCount += int(isOccluded(raisedIntersectionPt, sampleDir, maxDist));
     }
 
-    float normalizedIntersectionCount = 1.0 - (intersectionCount/sampleNumFloat);
-
-    return normalizedIntersectionCount;
-
+    return 1.0 - float(occludedCount) / float(sampleNum);
 }
 
 // assuming an intersection of worldSpacePoint/Dir and intersectObject, finds
@@ -1348,13 +1675,20 @@ vec4 getColor(PrimitiveType intersectObject, vec4 worldSpacePoint, vec4 worldSpa
     return calculateLighting(worldNormal, worldSpacePoint, worldSpaceDir, intersectObject);
 }
 
-vec4 recursiveRayTrace(vec4 worldSpacePoint, vec4 worldSpaceDir)
-{
-    vec4 backgroundColor = vec4(0.8, 0.8, 0.8, 1.0);
-
+// Color of a ray that misses everything
+vec4 getBackgroundColor(vec4 worldSpaceDir){
+    // default background color is a light gray
+    vec4 outColor = vec4(0.8, 0.8, 0.8, 1.0);
     if (settings.useEnvironment == 1){
-        backgroundColor = vec4(texture(envMap, vec3(worldSpaceDir)).bgr, 1.0);
+        outColor = vec4(texture(envMap, vec3(worldSpaceDir)).bgr, 1.0);
     }
+    return outColor;
+}
+
+// firstHit is the closest intersection of worldSpacePoint/Dir, already traced by shootRay
+vec4 recursiveRayTrace(vec4 worldSpacePoint, vec4 worldSpaceDir, PrimitiveType firstHit)
+{
+    vec4 backgroundColor = getBackgroundColor(worldSpaceDir);
     // intersected object info for this recursive iteration
 
     // incoming rays on first iteration are eye point + direction of start ray.
@@ -1376,8 +1710,10 @@ vec4 recursiveRayTrace(vec4 worldSpacePoint, vec4 worldSpaceDir)
     // calculate reflected ray path!!
     for (int i = 0; i < MAX_BOUNCE; i++) {
 
-        PrimitiveType intersectedObj = getIntersection(worldSpaceIncomingPt,
-                                                    worldSpaceIncomingDir);
+        PrimitiveType intersectedObj = firstHit;
+        if (i > 0) {
+            intersectedObj = getIntersection(worldSpaceIncomingPt, worldSpaceIncomingDir);
+        }
 
         if (intersectedObj.t > 0) { // object intersection for current incoming ray
 
@@ -1393,9 +1729,10 @@ vec4 recursiveRayTrace(vec4 worldSpacePoint, vec4 worldSpaceDir)
             cumB += (curBscalar * color.z);
 
             // get current object's reflective scalars
-            float redReflScalar = intersectedObj.cReflective.x * globalData.ks;
-            float greenReflScalar = intersectedObj.cReflective.y * globalData.ks;
-            float blueReflScalar = intersectedObj.cReflective.z * globalData.ks;
+            vec4 cReflective = getObjectMaterial(intersectedObj.objectIndex).cReflective;
+            float redReflScalar = cReflective.x * globalData.ks;
+            float greenReflScalar = cReflective.y * globalData.ks;
+            float blueReflScalar = cReflective.z * globalData.ks;
 
             // update our current scalars by current color
             curRscalar = curRscalar * redReflScalar;
@@ -1451,33 +1788,32 @@ vec4 recursiveRayTrace(vec4 worldSpacePoint, vec4 worldSpaceDir)
 // Returns a vec4 (r, g, b, a);
 // This takes in vec4 point and vec4 direction in WORLD SPACE
 // And per object converts into objectspace
-vec4 shootRay(vec4 worldSpacePoint, vec4 worldSpaceDir, vec2 randomSeed){
+vec4 shootRay(vec4 worldSpacePoint, vec4 worldSpaceDir, Sampler sampler){
 
-    // default background color is a light gray
-    vec4 outColor = vec4(0.8, 0.8, 0.8, 1.0);
-    if (settings.useEnvironment == 1){
-        outColor = vec4(texture(envMap, vec3(worldSpaceDir)).bgr, 1.0);
-    }
-    if (settings.useReflections == 1) {
-        outColor = recursiveRayTrace(worldSpacePoint, worldSpaceDir);
-    } else {
-        // get the closest intersected object with helper method
-        PrimitiveType intersectObject = getIntersection(worldSpacePoint, worldSpaceDir);
+    vec4 outColor = getBackgroundColor(worldSpaceDir);
+    // get the closest intersected object with helper method, shared by lighting,
+    // reflections and AO
+    PrimitiveType intersectObject = getIntersection(worldSpacePoint, worldSpaceDir);
 
+    if (USE_REFLECTIONS == 1) {
+        outColor = recursiveRayTrace(worldSpacePoint, worldSpaceDir, intersectObject);
+    } else if (intersectObject.primitive != NO_INTERSECT){
         // If primitive has an intersection, calculate lighting
-        if (intersectObject.primitive != NO_INTERSECT){
-            outColor = getColor(intersectObject, worldSpacePoint, worldSpaceDir);
-        }
+        outColor = getColor(intersectObject, worldSpacePoint, worldSpaceDir);
     }
 
-    if (settings.useAO == 1) {
-        float aoContribution = getAOcontribution(worldSpacePoint, worldSpaceDir, randomSeed);
+    if (USE_AO == 1) {
+        // rays that miss everything are unoccluded
+        float aoContribution = 1.0;
+        if (intersectObject.primitive != NO_INTERSECT){
+            aoContribution = getAOcontribution(intersectObject, worldSpacePoint, worldSpaceDir, sampler);
+        }
 
         // If no lighting features are enabled, make the color _just_ AO
         if (settings.useAmbient == 0 &&
                 settings.useDiffuse == 0 &&
                 settings.useSpecular == 0 &&
-                settings.useReflections == 0) {
+                USE_REFLECTIONS == 0) {
             outColor = vec4(aoContribution, aoContribution, aoContribution, 1.0);
         } else {
 
@@ -1492,12 +1828,12 @@ vec4 shootRay(vec4 worldSpacePoint, vec4 worldSpaceDir, vec2 randomSeed){
 // Given a camera space eye point and a camera space film point
 // Begin the ray tracing process by either shooting from a locally
 // randomized eye point (DOF) or the regular eye point.
-vec4 rayTrace(vec4 cameraSpaceEye, vec4 cameraSpaceFilmPoint){
+vec4 rayTrace(vec4 cameraSpaceEye, vec4 cameraSpaceFilmPoint, Sampler sampler){
     vec4 eye;
     vec4 filmPoint;
     vec4 outColor = vec4(0.0,0.0,0.0,1.0);
 
-    if (settings.useDOF == 1) {
+    if (USE_DOF == 1) {
         int numSamples = 1;
         if (settings.useStochastic == 0) {
             numSamples = settings.numSamples;
@@ -1510,13 +1846,14 @@ vec4 rayTrace(vec4 cameraSpaceEye, vec4 cameraSpaceFilmPoint){
             vec4 xDelta = vec4(float(settings.aperture)/50000.0f, 0.0, 0.0, 0.0);
             vec4 yDelta = vec4(0.0, float(settings.aperture)/50000.0f, 0.0, 0.0);
 
-            float randX = randValue2(i, cameraSpaceFilmPoint.x);// * 2 -1.0;
-            float randY = randValue2(i, cameraSpaceFilmPoint.y);// * 2 - 1.0;
+            vec2 lens = sample2D(sampler, SAMPLE_DOF, i, numSamples) * 2.0 - 1.0;
+            float randX = lens.x;
+            float randY = lens.y;
 
             eye = inverseCam * (cameraSpaceEye + randX * xDelta + randY * yDelta);
             filmPoint = inverseCam * (vec4(vec3(cameraSpaceFilmPoint) * (float(settings.focalLength)/100.0), 1));
             vec4 rayDirection = filmPoint - eye;
-            outColor = outColor + shootRay(eye, rayDirection, filmPoint.xy);
+            outColor = outColor + shootRay(eye, rayDirection, splitSampler(sampler, i, numSamples));
         }
         outColor = vec4(vec3(outColor) / float(numSamples), 1.0);
 
@@ -1525,48 +1862,169 @@ vec4 rayTrace(vec4 cameraSpaceEye, vec4 cameraSpaceFilmPoint){
         eye = inverseCam * cameraSpaceEye;
         filmPoint = inverseCam * cameraSpaceFilmPoint;
         vec4 rayDirection = filmPoint - eye;
-        outColor = shootRay(eye, rayDirection, filmPoint.xy);
+        outColor = shootRay(eye, rayDirection, sampler);
     }
 
     return outColor;
 }
 
-// Assemble scene objects and light lists from uniforms
-// FBO pipeline
-void main(){
+// [ADAPTIVE SAMPLING]
+// Mirrors AdaptiveSampling on the C++ side
+
+float luminance(vec3 color){
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Welford update of the (mean, M2) moments, count includes the new sample
+vec4 addSample(vec4 moments, float count, vec3 color){
+    float value = luminance(color);
+    float delta = value - moments.x;
+    moments.x += delta / count;
+    moments.y += delta * (value - moments.x);
+    return moments;
+}
+
+// Confidence interval of the mean over the interval a converged pixel may have
+float noiseRatio(vec4 moments, float count){
+    if (count < ADAPTIVE_MIN_SAMPLES){
+        return 1.0;
+    }
+    float variance = moments.y / (count - 1.0);
+    float interval = ADAPTIVE_CONFIDENCE_Z * sqrt(max(variance, 0.0) / count);
+    return interval / (settings.adaptiveThreshold * max(moments.x, ADAPTIVE_MIN_LUMINANCE));
+}
+
+bool isConverged(vec4 moments, float count){
+    return count >= ADAPTIVE_MIN_SAMPLES && noiseRatio(moments, count) <= 1.0;
+}
+
+// Noisier pixels take more of the budget, rand dithers the rounding
+int samplesThisPass(vec4 moments, float count, float rand){
+    float share = adaptiveBudget * clamp(noiseRatio(moments, count), 0.5, 2.0);
+    return clamp(int(floor(share + rand)), 1, ADAPTIVE_MAX_SAMPLES_PER_PASS);
+}
+
+// Scale frag coord to canonical view volume film plane
+// Positioned at z = -1.0
+vec2 toFilmPlane(vec2 fragCoord, vec2 size){
+    vec2 film = fragCoord / size * 2.0 - 1.0;
+    film.x *= size.x / size.y; // Scale uv.x by screenwidth/screenheight
+    return film;
+}
+
+vec2 fromFilmPlane(vec2 film, vec2 size){
+    film.x *= size.y / size.x;
+    return (film + 1.0) * 0.5 * size;
+}
+
+// [REPROJECTION]
+// Every pass keeps the world space normal and distance of the primary hit through
+// each pixel's centre, (0, 0, 0, -1) for a miss, and its albedo (the denoiser's
+// guides, see Denoiser on the C++ side). After the camera moves, a pixel
+// looks its primary hit up in the previous pass, and carries on from that pixel's
+// samples if the geometry there matches. At most REPROJECTION_MAX_SAMPLES of them
+// are kept, so the history, which was traced for a slightly different footprint,
+// fades out as new samples come in
+
+// Diffuse color of a hit, with the texture blended in like calculateLighting does
+vec4 getAlbedo(PrimitiveType obj, vec4 worldPoint, vec4 worldDirection){
+    Material material = getObjectMaterial(obj.objectIndex);
+    vec4 albedo = material.cDiffuse;
+    if (USE_TEXTURES == 1){
+        mat4x4 worldToObject = getObjectWorldToObject(obj.objectIndex);
+        vec4 objectSpacePoint = worldToObject * worldPoint;
+        vec4 objectSpaceDirection = worldToObject * worldDirection;
+        vec4 textureColor = sampleTexture(objectSpacePoint, objectSpaceDirection, obj, material, DIFFUSE);
+        albedo = material.blend * textureColor + (1.0 - material.blend) * albedo;
+    }
+    return albedo;
+}
+
+// worldPoint is the hit point, or for a miss the ray direction (a point at infinity).
+// The albedo of a miss is the background
+vec4 primaryGeometry(vec2 fragCoord, out vec4 worldPoint, out vec4 albedo){
+    vec4 eye = inverseCam * vec4(0.0, 0.0, 0.0, 1.0);
+    vec4 dir = inverseCam * vec4(toFilmPlane(fragCoord, dimensions), -1.0, 1.0) - eye;
+    PrimitiveType hit = getIntersection(eye, dir);
+    if (hit.primitive == NO_INTERSECT){
+        worldPoint = vec4(normalize(dir.xyz), 0.0);
+        albedo = getBackgroundColor(dir);
+        return vec4(0.0, 0.0, 0.0, -1.0);
+    }
+    worldPoint = eye + hit.t * dir;
+    albedo = getAlbedo(hit, eye, dir);
+    vec3 normal = normalize(vec3(getWorldSpaceNormal(hit, eye, dir)));
+    return vec4(normal, hit.t * length(dir));
+}
 
-    // initialize scene list
-    sceneObjects[0] = sceneObject1;
-    sceneObjects[1] = sceneObject2;
-    sceneObjects[2] = sceneObject3;
-    sceneObjects[3] = sceneObject4;
-    sceneObjects[4] = sceneObject5;
-    sceneObjects[5] = sceneObject6;
+// Whether prevPixel of the previous pass saw the same geometry, i.e. was not disoccluded
+bool matchesHistory(ivec2 prevPixel, vec4 worldPoint, vec4 geometry){
+    if (any(lessThan(prevPixel, ivec2(0))) || any(greaterThanEqual(prevPixel, ivec2(prevDimensions)))){
+        return false;
+    }
+    vec4 prevHit = texelFetch(prevGeometry, prevPixel, 0);
+    if (geometry.w < 0.0 || prevHit.w < 0.0){
+        return geometry.w < 0.0 && prevHit.w < 0.0;
+    }
+    float expected = distance(worldPoint, prevEye);
+    return abs(prevHit.w - expected) <= REPROJECTION_DEPTH_TOLERANCE * expected &&
+           dot(geometry.xyz, prevHit.xyz) >= REPROJECTION_MIN_NORMAL_DOT;
+}
 
-    // initialize light list
-    sceneLights[0] = lightObject1;
-    sceneLights[1] = lightObject2;
-    sceneLights[2] = lightObject3;
+// The previous pass's samples at the point it saw worldPoint, bilinearly from the
+// pixels around it that saw the same geometry. Pixels are resolved before they are
+// blended, and the sample count is blended with the same weights. Nothing (zero
+// samples) when the point was out of view or disoccluded
+void reprojectHistory(vec4 worldPoint, vec4 geometry, out vec4 color, out vec4 moments){
+    color = vec4(0.0);
+    moments = vec4(0.0);
+    vec4 p = prevWorldToFilm * worldPoint;
+    if (p.z >= 0.0){
+        return; // behind the previous camera
+    }
+    vec2 position = fromFilmPlane(p.xy / -p.z, prevDimensions) - 0.5;
+    ivec2 corner = ivec2(floor(position));
+    vec2 f = position - floor(position);
+
+    float totalWeight = 0.0;
+    vec3 mean = vec3(0.0);
+    for (int i = 0; i < 4; i++){
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        float weight = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+        if (weight > 0.0 && matchesHistory(corner + offset, worldPoint, geometry)){
+            vec4 tapColor = texelFetch(prev, corner + offset, 0);
+            mean += weight * tapColor.rgb / max(tapColor.a, 1.0);
+            color.a += weight * tapColor.a;
+            moments += weight * texelFetch(prevMoments, corner + offset, 0);
+            totalWeight += weight;
+        }
+    }
+    if (totalWeight > 0.0){
+        color.a = floor(color.a / totalWeight + 0.5);
+        color.rgb = mean / totalWeight * color.a;
+        moments /= totalWeight;
+    }
+}
+
+// Scales a reprojected pixel down to REPROJECTION_MAX_SAMPLES. It has to converge
+// again with samples of the new view
+void clampHistory(inout vec4 color, inout vec4 moments){
+    float keep = min(color.a, REPROJECTION_MAX_SAMPLES) / max(color.a, 1.0);
+    color *= keep;
+    moments.y *= keep; // M2 sums over the samples, the mean stays
+    moments.z = 0.0;
+}
 
-    // Use lightIntensitySetting from UI (passed in from view)
-    sceneLights[0].lightIntensitySetting = settings.l1Intensity;
-    sceneLights[1].lightIntensitySetting = settings.l2Intensity;
-    sceneLights[2].lightIntensitySetting = settings.l3Intensity;
+// Traces one sample of the pixel at (xFragCoord, yFragCoord)
+vec4 tracePixel(float xFragCoord, float yFragCoord, Sampler sampler){
 
     float width = dimensions[0];
     float height = dimensions[1];
 
-    float xFragCoord = gl_FragCoord[0];
-    float yFragCoord = gl_FragCoord[1];
-
-    // Scale frag coord to canonical view volume film plane
-    // Positioned at z = -1.0
-    float u = xFragCoord / width;
-    float v = yFragCoord / height;
-    u = (u*2.0) - 1.0;
-    v = (v*2.0) - 1.0;
-    u = u * width/height; // Scale uv.x by screenwidth/screenheight
-    // u and v now represent a point on the film plane in world space
+    // u and v represent a point on the film plane in world space
+    vec2 film = toFilmPlane(vec2(xFragCoord, yFragCoord), dimensions);
+    float u = film.x;
+    float v = film.y;
 
     // If using stochastic, instead of sampling in the center of the fragCoord 'pixel'
     // Randomly sample by an offset within this 'pixel'
@@ -1574,8 +2032,9 @@ void main(){
         float sizeAcross = 2.f/width;
         float sizeDown = 2.f/height; // size of a 'pixel' on the fragQuad
         // jitter the ray origin from the center of this pixel to within the pixel bounds
-        float randU = randValue2(u, time) * 2 -1.0; // scale rand value to [-1.0, 1.0]
-        float randV = randValue2(v, time) * 2 -1.0;
+        vec2 jitter = sample2D(sampler, SAMPLE_AA, 0, 1) * 2.0 - 1.0; // scale to [-1.0, 1.0]
+        float randU = jitter.x;
+        float randV = jitter.y;
         float horizontalRandom = randU * (sizeAcross/2); // Scale by half the size of the frag 'pixel'
         float verticalRandom = randV * (sizeDown/2);
         u = u + horizontalRandom;
@@ -1586,15 +2045,64 @@ void main(){
     vec4 eye = vec4(0.0, 0.0, 0.0, 1.0);
 
     // Begin raytracing
-    vec4 currColor = rayTrace(eye, filmPoint);
-    vec4 nextColor = currColor;
+    return rayTrace(eye, filmPoint, sampler);
+}
 
-    // If not first pass, sample from previous pass
-    // and scale according to numPasses
-    if (settings.useStochastic == 1){
-        // Sample prev FBO for this FBO
-        float contribution = 1.0/(numPasses+1);
-        nextColor =  mix(texture(prev, uv), currColor, contribution);
+// FBO pipeline
+void main(){
+
+    // The FBOs hold a running sum in rgb and the number of samples in alpha,
+    // composite.frag divides it out. Without stochastic sampling (or right after
+    // a reset) the previous pass is dropped
+    // The previous pass is read by pixel rather than by uv, since a lower resolution
+    // pass (see View::drawRayScene) only covers the bottom left of the FBOs
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 geometry;
+    vec4 albedo;
+    vec4 worldPoint = vec4(0.0);
+    if (traceGeometry == 1 || reproject == 1){
+        geometry = primaryGeometry(gl_FragCoord.xy, worldPoint, albedo);
+    } else {
+        geometry = texelFetch(prevGeometry, pixel, 0);
+        albedo = texelFetch(prevAlbedo, pixel, 0);
+    }
+    fragGeometry = geometry;
+    fragAlbedo = albedo;
+
+    vec4 nextColor = vec4(0.0);
+    vec4 moments = vec4(0.0);
+    if (settings.useStochastic == 1 && numPasses > 0){
+        if (reproject == 1){
+            reprojectHistory(worldPoint, geometry, nextColor, moments);
+            clampHistory(nextColor, moments);
+        } else {
+            nextColor = texelFetch(prev, pixel, 0);
+            moments = texelFetch(prevMoments, pixel, 0);
+        }
     }
+
+    // Converged pixels are carried over untouched, the others may take a few
+    // samples this pass to use up the time the converged ones free
+    // Each sample is numbered by how many the pixel has accumulated before it
+    int numPixelSamples = 1;
+    if (settings.useAdaptive == 1 && settings.useStochastic == 1){
+        if (moments.z > 0.5){
+            fragColor = nextColor;
+            fragMoments = moments;
+            return;
+        }
+        Sampler sampler = samplerForPixel(pixel, uint(nextColor.a));
+        numPixelSamples = samplesThisPass(moments, nextColor.a, sample2D(sampler, SAMPLE_ADAPTIVE, 0, 1).x);
+    }
+
+    for (int i = 0; i < numPixelSamples; i++){
+        vec4 currColor = tracePixel(gl_FragCoord[0], gl_FragCoord[1],
+                                    samplerForPixel(pixel, uint(nextColor.a)));
+        nextColor += vec4(currColor.rgb, 1.0);
+        moments = addSample(moments, nextColor.a, currColor.rgb);
+    }
+    moments.z = isConverged(moments, nextColor.a) ? 1.0 : 0.0;
+
     fragColor = nextColor;
+    fragMoments = moments;
 }
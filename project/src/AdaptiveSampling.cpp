@@ -0,0 +1,43 @@
+#include "AdaptiveSampling.h"
+
+#include <algorithm>
+#include <cmath>
+
+const float AdaptiveSampling::CONFIDENCE_Z = 1.96f;
+const float AdaptiveSampling::MIN_LUMINANCE = .05f;
+
+void AdaptiveSampling::addSample(glm::vec4 &moments, float count, const glm::vec3 &color) {
+    float value = luminance(color);
+    float delta = value - moments.x;
+    moments.x += delta / count;
+    moments.y += delta * (value - moments.x);
+}
+
+float AdaptiveSampling::noiseRatio(const glm::vec4 &moments, float count, float threshold) {
+    if (count < MIN_SAMPLES) {
+        return 1.f;
+    }
+    float variance = moments.y / (count - 1.f);
+    float interval = CONFIDENCE_Z * std::sqrt(std::max(variance, 0.f) / count);
+    return interval / (threshold * std::max(moments.x, MIN_LUMINANCE));
+}
+
+bool AdaptiveSampling::isConverged(const glm::vec4 &moments, float count, float threshold) {
+    return count >= MIN_SAMPLES && noiseRatio(moments, count, threshold) <= 1.f;
+}
+
+int AdaptiveSampling::samplesThisPass(const glm::vec4 &moments, float count, float threshold,
+                                      float budget, float rand) {
+    float share = budget * glm::clamp(noiseRatio(moments, count, threshold), .5f, 2.f);
+    int samples = static_cast<int>(std::floor(share + rand));
+    return glm::clamp(samples, 1, static_cast<int>(MAX_SAMPLES_PER_PASS));
+}
+
+float AdaptiveSampling::budget(float convergedFraction) {
+    float active = 1.f - glm::clamp(convergedFraction, 0.f, 1.f);
+    return std::min(1.f / std::max(active, 1e-3f), static_cast<float>(MAX_SAMPLES_PER_PASS));
+}
+
+float AdaptiveSampling::luminance(const glm::vec3 &color) {
+    return glm::dot(color, glm::vec3(.2126f, .7152f, .0722f));
+}
@@ -0,0 +1,49 @@
+#ifndef ADAPTIVESAMPLING_H
+#define ADAPTIVESAMPLING_H
+
+#include "glm/glm.hpp"
+
+/**
+  [ADAPTIVE SAMPLING]
+  Per-pixel convergence test for stochastic sampling. Each pixel keeps running
+  moments of its samples' luminance next to its color sum:
+
+    (mean, M2, converged, 0)   with the sample count in the color's alpha
+
+  M2 is Welford's sum of squared differences from the mean, so the variance is
+  M2 / (n - 1). A pixel has converged once the 95% confidence interval of its
+  mean is within threshold of the mean; it is then skipped, and the passes it
+  frees go to the pixels that are still noisy.
+
+  ray.frag repeats these functions (and the constants as ADAPTIVE_* defines),
+  keep them in step. The CPU ray tracer and View use this class.
+**/
+class AdaptiveSampling {
+public:
+    // Adds a sample to the moments. count includes the new sample
+    static void addSample(glm::vec4 &moments, float count, const glm::vec3 &color);
+
+    // Confidence interval of the mean over the interval a converged pixel may have,
+    // 1 when the pixel has too few samples to tell
+    static float noiseRatio(const glm::vec4 &moments, float count, float threshold);
+
+    static bool isConverged(const glm::vec4 &moments, float count, float threshold);
+
+    // Samples a pixel that has not converged takes this pass. Noisier pixels take
+    // more of the budget, and rand in [0, 1) dithers the rounding
+    static int samplesThisPass(const glm::vec4 &moments, float count, float threshold,
+                               float budget, float rand);
+
+    // Average samples per pass for the pixels that have not converged, so every
+    // pass traces about as many samples as a non-adaptive one
+    static float budget(float convergedFraction);
+
+    static float luminance(const glm::vec3 &color);
+
+    static const int MIN_SAMPLES = 16;          // before a pixel may converge
+    static const int MAX_SAMPLES_PER_PASS = 4;
+    static const float CONFIDENCE_Z;            // 95% confidence interval
+    static const float MIN_LUMINANCE;           // dark pixels are compared against this
+};
+
+#endif // ADAPTIVESAMPLING_H
@@ -0,0 +1,229 @@
+#include "BVH.h"
+
+#include <algorithm>
+
+#include "Scene.h"
+
+namespace {
+    // SAH costs relative to one object intersection
+    const float TRAVERSAL_COST = 1.f;
+    const float INTERSECTION_COST = 1.f;
+}
+
+AABB AABB::empty() {
+    float inf = std::numeric_limits<float>::infinity();
+    return { glm::vec3(inf), glm::vec3(-inf) };
+}
+
+void AABB::grow(const glm::vec3 &point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void AABB::grow(const AABB &box) {
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+}
+
+glm::vec3 AABB::center() const {
+    return 0.5f * (min + max);
+}
+
+float AABB::surfaceArea() const {
+    glm::vec3 d = glm::max(max - min, glm::vec3(0.f));
+    return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+bool AABB::intersects(const glm::vec3 &origin, const glm::vec3 &invDir, float tMax) const {
+    glm::vec3 t0 = (min - origin) * invDir;
+    glm::vec3 t1 = (max - origin) * invDir;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return enter <= exit;
+}
+
+void BVH::build(const Scene &scene) {
+    build(scene.bounds);
+}
+
+void BVH::build(const std::vector<AABB> &bounds) {
+    int numObjects = static_cast<int>(bounds.size());
+
+    m_nodes.clear();
+    m_objectOrder.resize(numObjects);
+    m_objectBounds = bounds;
+    m_centers.resize(numObjects);
+    for (int i = 0; i < numObjects; i++) {
+        m_objectOrder[i] = i;
+        m_centers[i] = m_objectBounds[i].center();
+    }
+
+    if (numObjects == 0) {
+        return;
+    }
+    m_nodes.reserve(2 * numObjects - 1);
+    buildNode(0, numObjects);
+    setMissIndices(0, -1);
+}
+
+int BVH::buildNode(int first, int count) {
+    int index = static_cast<int>(m_nodes.size());
+    m_nodes.push_back(Node());
+
+    AABB bounds = AABB::empty();
+    AABB centerBounds = AABB::empty();
+    for (int i = first; i < first + count; i++) {
+        bounds.grow(m_objectBounds[m_objectOrder[i]]);
+        centerBounds.grow(m_centers[m_objectOrder[i]]);
+    }
+    m_nodes[index].bounds = bounds;
+    m_nodes[index].rightChild = -1;
+    m_nodes[index].first = first;
+    m_nodes[index].count = count;
+
+    if (count == 1) {
+        return index;
+    }
+
+    // Bin the object centers along each axis and sweep the bin boundaries for the cheapest split
+    int bestAxis = -1;
+    int bestSplit = 0;
+    float bestCost = std::numeric_limits<float>::infinity();
+    glm::vec3 extent = centerBounds.max - centerBounds.min;
+    for (int axis = 0; axis < 3; axis++) {
+        if (extent[axis] <= 0.f) {
+            continue;
+        }
+
+        AABB binBounds[NUM_BINS];
+        int binCounts[NUM_BINS] = {};
+        std::fill(binBounds, binBounds + NUM_BINS, AABB::empty());
+        float binScale = NUM_BINS / extent[axis];
+        for (int i = first; i < first + count; i++) {
+            int obj = m_objectOrder[i];
+            int bin = std::min(NUM_BINS - 1, static_cast<int>((m_centers[obj][axis] - centerBounds.min[axis]) * binScale));
+            binCounts[bin]++;
+            binBounds[bin].grow(m_objectBounds[obj]);
+        }
+
+        // rightArea/rightCount[i] cover bins i and up
+        float rightArea[NUM_BINS];
+        int rightCount[NUM_BINS];
+        AABB right = AABB::empty();
+        int rightSum = 0;
+        for (int bin = NUM_BINS - 1; bin > 0; bin--) {
+            right.grow(binBounds[bin]);
+            rightSum += binCounts[bin];
+            rightArea[bin] = right.surfaceArea();
+            rightCount[bin] = rightSum;
+        }
+
+        AABB left = AABB::empty();
+        int leftSum = 0;
+        for (int split = 1; split < NUM_BINS; split++) {
+            left.grow(binBounds[split - 1]);
+            leftSum += binCounts[split - 1];
+            if (leftSum == 0 || rightCount[split] == 0) {
+                continue;
+            }
+            float cost = left.surfaceArea() * leftSum + rightArea[split] * rightCount[split];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = split;
+            }
+        }
+    }
+
+    float leafCost = INTERSECTION_COST * count;
+    float splitCost = TRAVERSAL_COST + INTERSECTION_COST * bestCost / bounds.surfaceArea();
+    if (count <= MAX_LEAF_SIZE && (bestAxis < 0 || splitCost >= leafCost)) {
+        return index;
+    }
+
+    int *begin = m_objectOrder.data() + first;
+    int *end = begin + count;
+    int *middle;
+    if (bestAxis >= 0) {
+        float binScale = NUM_BINS / extent[bestAxis];
+        float minCenter = centerBounds.min[bestAxis];
+        middle = std::partition(begin, end, [&](int obj) {
+            int bin = std::min(NUM_BINS - 1, static_cast<int>((m_centers[obj][bestAxis] - minCenter) * binScale));
+            return bin < bestSplit;
+        });
+    } else {
+        // Every center is in the same spot, any split is as good as another
+        middle = begin + count / 2;
+    }
+    int leftCount = static_cast<int>(middle - begin);
+
+    m_nodes[index].first = 0;
+    m_nodes[index].count = 0;
+    buildNode(first, leftCount);
+    int rightChild = buildNode(first + leftCount, count - leftCount);
+    m_nodes[index].rightChild = rightChild;
+    return index;
+}
+
+void BVH::setMissIndices(int index, int missIndex) {
+    Node &node = m_nodes[index];
+    node.missIndex = missIndex;
+    if (!node.isLeaf()) {
+        setMissIndices(index + 1, node.rightChild);
+        setMissIndices(node.rightChild, missIndex);
+    }
+}
+
+void BVH::refit(const Scene &scene) {
+    if (scene.size() != numObjects()) {
+        build(scene);
+        return;
+    }
+
+    m_objectBounds = scene.bounds;
+
+    // Children always come after their parent, so a backwards sweep is bottom up
+    for (int index = static_cast<int>(m_nodes.size()) - 1; index >= 0; index--) {
+        Node &node = m_nodes[index];
+        if (node.isLeaf()) {
+            node.bounds = AABB::empty();
+            for (int i = node.first; i < node.first + node.count; i++) {
+                node.bounds.grow(m_objectBounds[m_objectOrder[i]]);
+            }
+        } else {
+            node.bounds = m_nodes[index + 1].bounds;
+            node.bounds.grow(m_nodes[node.rightChild].bounds);
+        }
+    }
+}
+
+void BVH::assign(const Node *nodes, int numNodes, const int *objectOrder, int numObjects) {
+    m_nodes.assign(nodes, nodes + numNodes);
+    m_objectOrder.assign(objectOrder, objectOrder + numObjects);
+}
+
+const std::vector<BVH::Node>& BVH::nodes() const {
+    return m_nodes;
+}
+
+const std::vector<int>& BVH::objectOrder() const {
+    return m_objectOrder;
+}
+
+int BVH::numObjects() const {
+    return static_cast<int>(m_objectOrder.size());
+}
+
+void BVH::pack(std::vector<glm::vec4> &texels, int nodeOffset, int objectOffset) const {
+    texels.resize(TEXELS_PER_NODE * (nodeOffset + m_nodes.size()));
+    glm::vec4 *out = texels.data() + TEXELS_PER_NODE * nodeOffset;
+    for (size_t i = 0; i < m_nodes.size(); i++) {
+        const Node &node = m_nodes[i];
+        int missIndex = node.missIndex >= 0 ? node.missIndex + nodeOffset : -1;
+        float leaf = node.isLeaf() ? static_cast<float>((node.first + objectOffset) * MAX_LEAF_SIZE + node.count - 1) : -1.f;
+        out[TEXELS_PER_NODE * i]     = glm::vec4(node.bounds.min, static_cast<float>(missIndex));
+        out[TEXELS_PER_NODE * i + 1] = glm::vec4(node.bounds.max, leaf);
+    }
+}
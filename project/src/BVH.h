@@ -0,0 +1,174 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <limits>
+#include <vector>
+
+#include "scenedata.h"
+
+struct Scene;
+
+// Axis-aligned bounding box, in world space unless said otherwise
+struct AABB{
+    glm::vec3 min;
+    glm::vec3 max;
+
+    static AABB empty();
+    void grow(const glm::vec3 &point);
+    void grow(const AABB &box);
+    glm::vec3 center() const;
+    float surfaceArea() const;
+
+    // Slab test against the ray segment [0, tMax], invDir is 1/direction
+    bool intersects(const glm::vec3 &origin, const glm::vec3 &invDir, float tMax) const;
+};
+
+/**
+  [BVH]
+  Bounding volume hierarchy over the world space bounds of the scene objects
+  (Scene::bounds), built with binned SAH. Nodes are stored in depth first order
+  (a node's left child is the next node) and each node keeps a miss index, the
+  node to go to when its box is missed or its leaf is done. That lets ray.frag
+  walk the tree in a plain loop without a stack.
+
+  Leaves refer to a range of objectOrder(), and the GPU scene buffer is packed
+  in that order, so on the GPU a leaf's objects are simply [first, first + count).
+
+  With animation, refit() recomputes the boxes for the same tree each frame
+  instead of rebuilding it.
+
+  Each triangle mesh has a tree of its own over its triangles, in object space
+  (see [MESH]). Those are built from a list of boxes and packed at an offset
+  into the mesh buffer.
+**/
+class BVH {
+public:
+    // Leaf sizes are packed as (count - 1) in ray.frag, see pack()
+    static const int MAX_LEAF_SIZE = 4;
+    static const int NUM_BINS = 12;
+    static const int TEXELS_PER_NODE = 2;
+
+    // pack's texels are floats, exact up to 2^24, and a leaf holds first * MAX_LEAF_SIZE
+    static const int MAX_PACKED_OBJECTS = (1 << 24) / MAX_LEAF_SIZE;
+
+    struct Node{
+        AABB bounds;
+        int rightChild; // internal nodes only, the left child is the next node
+        int missIndex;  // next node when this one is missed or finished, -1 ends traversal
+        int first;      // leaves only, into objectOrder()
+        int count;      // 0 for internal nodes
+
+        bool isLeaf() const { return count > 0; }
+    };
+
+    void build(const Scene &scene);
+
+    // Over any list of boxes, the "objects" are their indices
+    void build(const std::vector<AABB> &bounds);
+
+    // Same tree, new object transforms. Falls back to build() if the object count changed
+    void refit(const Scene &scene);
+
+    // Takes over a tree built earlier for the same objects, e.g. from a scene file's cache
+    void assign(const Node *nodes, int numNodes, const int *objectOrder, int numObjects);
+
+    const std::vector<Node>& nodes() const;
+    const std::vector<int>& objectOrder() const;
+    int numObjects() const;
+
+    // Two RGBA32F texels per node for ray.frag's bvhBuffer:
+    // (min.xyz, missIndex), (max.xyz, -1 or first * MAX_LEAF_SIZE + count - 1)
+    // The nodes go to [nodeOffset, nodeOffset + nodes().size()) of a buffer holding
+    // more than one tree, with nodeOffset added to their miss indices and objectOffset
+    // to their leaves' first. texels is resized to end with these nodes
+    void pack(std::vector<glm::vec4> &texels, int nodeOffset = 0, int objectOffset = 0) const;
+
+    // Walks the tree and calls intersectObject(objectIndex) for each object in a leaf
+    // the ray reaches. intersectObject returns t, or a value <= 0 for a miss.
+    // Returns the index of the closest object with t > 0 (or -1) and its t in bestT
+    template <typename IntersectObject>
+    int closestHit(const glm::vec4 &origin, const glm::vec4 &direction, float &bestT,
+                   IntersectObject intersectObject) const;
+
+    // Same walk, but returns as soon as any object has 0 < t < tMax
+    template <typename IntersectObject>
+    bool anyHit(const glm::vec4 &origin, const glm::vec4 &direction, float tMax,
+                IntersectObject intersectObject) const;
+
+private:
+    int buildNode(int first, int count);
+    void setMissIndices(int index, int missIndex);
+
+    std::vector<Node> m_nodes;
+    std::vector<int> m_objectOrder;
+
+    // Scratch space for the build and refit
+    std::vector<AABB> m_objectBounds;
+    std::vector<glm::vec3> m_centers;
+};
+
+template <typename IntersectObject>
+int BVH::closestHit(const glm::vec4 &origin, const glm::vec4 &direction, float &bestT,
+                    IntersectObject intersectObject) const
+{
+    glm::vec3 o(origin);
+    glm::vec3 invDir = 1.f / glm::vec3(direction);
+
+    int bestIndex = -1;
+    bestT = -1.f;
+
+    int nodeIndex = m_nodes.empty() ? -1 : 0;
+    while (nodeIndex >= 0) {
+        const Node &node = m_nodes[nodeIndex];
+        float tMax = bestT > 0.f ? bestT : std::numeric_limits<float>::infinity();
+        if (!node.bounds.intersects(o, invDir, tMax)) {
+            nodeIndex = node.missIndex;
+            continue;
+        }
+        if (!node.isLeaf()) {
+            nodeIndex++;
+            continue;
+        }
+        for (int i = node.first; i < node.first + node.count; i++) {
+            int objectIndex = m_objectOrder[i];
+            float t = intersectObject(objectIndex);
+            if (t > 0.f && (bestT < 0.f || t < bestT)) {
+                bestT = t;
+                bestIndex = objectIndex;
+            }
+        }
+        nodeIndex = node.missIndex;
+    }
+    return bestIndex;
+}
+
+template <typename IntersectObject>
+bool BVH::anyHit(const glm::vec4 &origin, const glm::vec4 &direction, float tMax,
+                 IntersectObject intersectObject) const
+{
+    glm::vec3 o(origin);
+    glm::vec3 invDir = 1.f / glm::vec3(direction);
+
+    int nodeIndex = m_nodes.empty() ? -1 : 0;
+    while (nodeIndex >= 0) {
+        const Node &node = m_nodes[nodeIndex];
+        if (!node.bounds.intersects(o, invDir, tMax)) {
+            nodeIndex = node.missIndex;
+            continue;
+        }
+        if (!node.isLeaf()) {
+            nodeIndex++;
+            continue;
+        }
+        for (int i = node.first; i < node.first + node.count; i++) {
+            float t = intersectObject(m_objectOrder[i]);
+            if (t > 0.f && t < tMax) {
+                return true;
+            }
+        }
+        nodeIndex = node.missIndex;
+    }
+    return false;
+}
+
+#endif // BVH_H
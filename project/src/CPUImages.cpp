@@ -0,0 +1,38 @@
+#include "CPUImages.h"
+
+namespace CS123 { namespace CPU {
+
+Image toCPUImage(const QImage &image) {
+    Image out;
+    if (image.isNull()) {
+        return out;
+    }
+    out.width = image.width();
+    out.height = image.height();
+    out.rgba.resize(4 * out.width * out.height);
+    for (int y = 0; y < out.height; y++) {
+        const QRgb *line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+        for (int x = 0; x < out.width; x++) {
+            unsigned char *p = &out.rgba[4 * (y * out.width + x)];
+            p[0] = qRed(line[x]);
+            p[1] = qGreen(line[x]);
+            p[2] = qBlue(line[x]);
+            p[3] = qAlpha(line[x]);
+        }
+    }
+    return out;
+}
+
+CubeMap toCPUCubeMap(const QImage &front, const QImage &back, const QImage &top,
+                     const QImage &bottom, const QImage &left, const QImage &right) {
+    CubeMap out;
+    out.faces[CubeMap::POSITIVE_X] = toCPUImage(right);
+    out.faces[CubeMap::NEGATIVE_X] = toCPUImage(left);
+    out.faces[CubeMap::POSITIVE_Y] = toCPUImage(top);
+    out.faces[CubeMap::NEGATIVE_Y] = toCPUImage(bottom);
+    out.faces[CubeMap::POSITIVE_Z] = toCPUImage(back);
+    out.faces[CubeMap::NEGATIVE_Z] = toCPUImage(front);
+    return out;
+}
+
+}}
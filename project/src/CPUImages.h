@@ -0,0 +1,19 @@
+#ifndef CPUIMAGES_H
+#define CPUIMAGES_H
+
+#include <QImage>
+
+#include "cpu/Image.h"
+
+namespace CS123 { namespace CPU {
+
+// Copies a QImage into the CPU tracer's image type (true RGB, rows top to bottom)
+Image toCPUImage(const QImage &image);
+
+// Faces are named as in View::buildEnvMap (front is -Z, right is +X)
+CubeMap toCPUCubeMap(const QImage &front, const QImage &back, const QImage &top,
+                     const QImage &bottom, const QImage &left, const QImage &right);
+
+}}
+
+#endif // CPUIMAGES_H
@@ -0,0 +1,104 @@
+#include "Denoiser.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "AdaptiveSampling.h"
+
+const float Denoiser::SIGMA_LUMINANCE = 4.f;
+const float Denoiser::SIGMA_NORMAL = 128.f;
+const float Denoiser::SIGMA_DEPTH = .02f;
+const float Denoiser::SIGMA_ALBEDO = .01f;
+const float Denoiser::UNKNOWN_VARIANCE = 1.f;
+const float Denoiser::SILHOUETTE_WEIGHT = .5f;
+
+namespace {
+
+// 1D B3 spline, by distance from the centre in taps
+const float KERNEL[3] = {3.f / 8.f, 1.f / 4.f, 1.f / 16.f};
+
+} // namespace
+
+glm::vec4 Denoiser::resolve(const glm::vec4 &color, const glm::vec4 &moments) {
+    float variance = UNKNOWN_VARIANCE;
+    if (color.a >= 2.f) {
+        variance = std::max(moments.y, 0.f) / ((color.a - 1.f) * color.a);
+    }
+    return glm::vec4(glm::vec3(color) / std::max(color.a, 1.f), variance);
+}
+
+glm::vec4 Denoiser::filterPixel(int x, int y, int step, int width, int height,
+                                const glm::vec4 *input, const glm::vec4 *geometry,
+                                const glm::vec4 *albedo) {
+    int centre = y * width + x;
+    if (onSilhouette(x, y, width, height, geometry)) {
+        return input[centre];
+    }
+    float luminance = AdaptiveSampling::luminance(glm::vec3(input[centre]));
+    float sigma = SIGMA_LUMINANCE * std::sqrt(std::max(input[centre].a, 0.f)) + 1e-4f;
+
+    glm::vec3 colorSum(0.f);
+    float varianceSum = 0.f;
+    float weightSum = 0.f;
+    for (int dy = -2; dy <= 2; dy++) {
+        int ty = y + dy * step;
+        if (ty < 0 || ty >= height) {
+            continue;
+        }
+        for (int dx = -2; dx <= 2; dx++) {
+            int tx = x + dx * step;
+            if (tx < 0 || tx >= width) {
+                continue;
+            }
+            int tap = ty * width + tx;
+            if (tap != centre && onSilhouette(tx, ty, width, height, geometry)) {
+                continue;
+            }
+            const glm::vec4 &tapInput = input[tap];
+            float weight = KERNEL[std::abs(dx)] * KERNEL[std::abs(dy)];
+            if (tap != centre) {
+                float offset = step * std::sqrt(static_cast<float>(dx * dx + dy * dy));
+                weight *= edgeWeight(geometry[centre], geometry[tap],
+                                     glm::vec3(albedo[centre]), glm::vec3(albedo[tap]), offset);
+                float tapLuminance = AdaptiveSampling::luminance(glm::vec3(tapInput));
+                weight *= std::exp(-std::abs(luminance - tapLuminance) / sigma);
+            }
+            colorSum += weight * glm::vec3(tapInput);
+            varianceSum += weight * weight * tapInput.a;
+            weightSum += weight;
+        }
+    }
+    return glm::vec4(colorSum / weightSum, varianceSum / (weightSum * weightSum));
+}
+
+// Misses only blend with misses, their albedo (the background) keeps the environment sharp
+float Denoiser::edgeWeight(const glm::vec4 &geometry, const glm::vec4 &tapGeometry,
+                           const glm::vec3 &albedo, const glm::vec3 &tapAlbedo, float offset) {
+    if (geometry.w < 0.f || tapGeometry.w < 0.f) {
+        return geometry.w < 0.f && tapGeometry.w < 0.f ? 1.f : 0.f;
+    }
+    float normal = std::pow(std::max(glm::dot(glm::vec3(geometry), glm::vec3(tapGeometry)), 0.f), SIGMA_NORMAL);
+    float depth = std::exp(-std::abs(geometry.w - tapGeometry.w) / (SIGMA_DEPTH * geometry.w * offset));
+    glm::vec3 albedoDifference = albedo - tapAlbedo;
+    return normal * depth * std::exp(-glm::dot(albedoDifference, albedoDifference) / SIGMA_ALBEDO);
+}
+
+// The accumulated color of a pixel covers its whole footprint, the guides only its
+// centre. Where the footprint straddles an edge the color is a mix that no
+// neighbour shares, so these pixels are left out of the filter altogether
+bool Denoiser::onSilhouette(int x, int y, int width, int height, const glm::vec4 *geometry) {
+    const int offsets[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+    const glm::vec4 &centre = geometry[y * width + x];
+    for (const int *offset : offsets) {
+        int tx = x + offset[0];
+        int ty = y + offset[1];
+        if (tx < 0 || tx >= width || ty < 0 || ty >= height) {
+            continue;
+        }
+        if (edgeWeight(centre, geometry[ty * width + tx], glm::vec3(0.f), glm::vec3(0.f), 1.f) < SILHOUETTE_WEIGHT) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,56 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "glm/glm.hpp"
+
+/**
+  [DENOISER]
+  Edge-avoiding à-trous wavelet filter for the accumulated ray passes, after
+  SVGF (Schied et al. 2017, "Spatiotemporal Variance-Guided Filtering"). Each
+  iteration blurs with a 5x5 B3 spline kernel whose taps are step = 2^i pixels
+  apart, so a few iterations cover a wide footprint at 25 taps each. Every tap
+  is weighted down where the guides differ from the centre pixel's:
+
+    geometry   normal and distance of the primary hit (see [REPROJECTION] in ray.frag)
+    albedo     diffuse color of the primary hit, so texture detail is kept
+    luminance  compared against the standard error of the pixel's mean, taken
+               from the adaptive sampling moments. The filter fades out as a
+               pixel converges, and is strongest on the first passes
+
+  The variance is filtered along with the color (with squared weights), so
+  later iterations see how much noise the earlier ones took out. Pixels on a
+  silhouette or crease are left as they are (see onSilhouette).
+
+  Buffers are laid out like the ray FBO's attachments, row 0 at the bottom.
+  denoise.frag repeats these functions (and the constants as DENOISE_* defines),
+  keep them in step. The CPU ray tracer runs the iterations over its buffers.
+**/
+class Denoiser {
+public:
+    // Input of the first iteration: the resolved color of an accumulated pixel
+    // (sum in rgb, count in alpha) and in alpha the variance of its luminance's mean
+    static glm::vec4 resolve(const glm::vec4 &color, const glm::vec4 &moments);
+
+    // One iteration at pixel (x, y) of width x height buffers, with taps step pixels
+    // apart. input holds (color, variance) per pixel, returns the same for (x, y)
+    static glm::vec4 filterPixel(int x, int y, int step, int width, int height,
+                                 const glm::vec4 *input, const glm::vec4 *geometry,
+                                 const glm::vec4 *albedo);
+
+    // How much a tap offset pixels away counts, from the guides alone
+    static float edgeWeight(const glm::vec4 &geometry, const glm::vec4 &tapGeometry,
+                            const glm::vec3 &albedo, const glm::vec3 &tapAlbedo, float offset);
+
+    // True if the geometry of a pixel next to (x, y) weighs less than SILHOUETTE_WEIGHT
+    static bool onSilhouette(int x, int y, int width, int height, const glm::vec4 *geometry);
+
+    static const int MAX_ITERATIONS = 5;
+    static const float SIGMA_LUMINANCE;     // in standard errors of the mean
+    static const float SIGMA_NORMAL;        // exponent of the normals' cosine
+    static const float SIGMA_DEPTH;         // relative distance change per pixel of offset
+    static const float SIGMA_ALBEDO;        // squared albedo difference
+    static const float UNKNOWN_VARIANCE;    // of a pixel with fewer than two samples
+    static const float SILHOUETTE_WEIGHT;
+};
+
+#endif // DENOISER_H
@@ -0,0 +1,149 @@
+#include "FrameStats.h"
+
+#include <algorithm>
+#include <fstream>
+
+double FrameTiming::raysPerSecond() const {
+    double ms = cpuRenderer ? traceMs : gpuRayMs;
+    if (ms <= 0.0) {
+        return 0.0;
+    }
+    return static_cast<double>(width) * height * samples / (ms / 1000.0);
+}
+
+FrameStats::FrameStats(int capacity) :
+    m_capacity(capacity)
+{
+}
+
+FrameTiming& FrameStats::addFrame(int frame, bool cpuRenderer, int width, int height) {
+    if (static_cast<int>(m_frames.size()) == m_capacity) {
+        m_frames.pop_front();
+    }
+    FrameTiming timing = {};
+    timing.frame = frame;
+    timing.cpuRenderer = cpuRenderer;
+    timing.width = width;
+    timing.height = height;
+    timing.samples = 1.0;
+    timing.gpuRayMs = -1.0;
+    timing.gpuCompositeMs = -1.0;
+    m_frames.push_back(timing);
+    return m_frames.back();
+}
+
+FrameTiming* FrameStats::findFrame(int frame) {
+    // Frames are added in order, and lookups are almost always for recent ones
+    for (auto it = m_frames.rbegin(); it != m_frames.rend(); ++it) {
+        if (it->frame == frame) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+FrameTiming FrameStats::average(int count) const {
+    FrameTiming mean = {};
+    mean.gpuRayMs = -1.0;
+    mean.gpuCompositeMs = -1.0;
+    if (m_frames.empty()) {
+        return mean;
+    }
+
+    int first = std::max(0, static_cast<int>(m_frames.size()) - count);
+    int numFrames = 0;
+    int numRay = 0;
+    int numComposite = 0;
+    double gpuRayMs = 0.0;
+    double gpuCompositeMs = 0.0;
+    for (int i = first; i < static_cast<int>(m_frames.size()); i++) {
+        const FrameTiming &timing = m_frames[i];
+        mean.sceneMs += timing.sceneMs;
+        mean.uploadMs += timing.uploadMs;
+        mean.submitMs += timing.submitMs;
+        mean.traceMs += timing.traceMs;
+        mean.samples += timing.samples;
+        numFrames++;
+        if (timing.gpuRayMs >= 0.0) {
+            gpuRayMs += timing.gpuRayMs;
+            numRay++;
+        }
+        if (timing.gpuCompositeMs >= 0.0) {
+            gpuCompositeMs += timing.gpuCompositeMs;
+            numComposite++;
+        }
+    }
+
+    const FrameTiming &last = m_frames.back();
+    mean.frame = last.frame;
+    mean.cpuRenderer = last.cpuRenderer;
+    mean.width = last.width;
+    mean.height = last.height;
+    mean.samples /= numFrames;
+    mean.sceneMs /= numFrames;
+    mean.uploadMs /= numFrames;
+    mean.submitMs /= numFrames;
+    mean.traceMs /= numFrames;
+    if (numRay > 0) {
+        mean.gpuRayMs = gpuRayMs / numRay;
+    }
+    if (numComposite > 0) {
+        mean.gpuCompositeMs = gpuCompositeMs / numComposite;
+    }
+    return mean;
+}
+
+bool FrameStats::writeCSV(const std::string &path) const {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    out << "frame,renderer,width,height,samples,scene_ms,upload_ms,submit_ms,trace_ms,"
+           "gpu_ray_ms,gpu_composite_ms,rays_per_second\n";
+    for (const FrameTiming &timing : m_frames) {
+        out << timing.frame << ','
+            << (timing.cpuRenderer ? "cpu" : "gpu") << ','
+            << timing.width << ',' << timing.height << ',' << timing.samples << ','
+            << timing.sceneMs << ',' << timing.uploadMs << ','
+            << timing.submitMs << ',' << timing.traceMs << ',';
+        // Unknown GPU times are left empty
+        if (timing.gpuRayMs >= 0.0) out << timing.gpuRayMs;
+        out << ',';
+        if (timing.gpuCompositeMs >= 0.0) out << timing.gpuCompositeMs;
+        out << ',' << timing.raysPerSecond() << '\n';
+    }
+    return static_cast<bool>(out);
+}
+
+bool FrameStats::writeJSON(const std::string &path) const {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    out << "{\n  \"frames\": [";
+    bool first = true;
+    for (const FrameTiming &timing : m_frames) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "    {\"frame\": " << timing.frame
+            << ", \"renderer\": \"" << (timing.cpuRenderer ? "cpu" : "gpu") << "\""
+            << ", \"width\": " << timing.width
+            << ", \"height\": " << timing.height
+            << ", \"samples\": " << timing.samples
+            << ", \"scene_ms\": " << timing.sceneMs
+            << ", \"upload_ms\": " << timing.uploadMs
+            << ", \"submit_ms\": " << timing.submitMs
+            << ", \"trace_ms\": " << timing.traceMs
+            << ", \"gpu_ray_ms\": ";
+        if (timing.gpuRayMs >= 0.0) out << timing.gpuRayMs; else out << "null";
+        out << ", \"gpu_composite_ms\": ";
+        if (timing.gpuCompositeMs >= 0.0) out << timing.gpuCompositeMs; else out << "null";
+        out << ", \"rays_per_second\": " << timing.raysPerSecond() << "}";
+    }
+    out << "\n  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+double FrameStats::millisecondsSince(const Clock::time_point &start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
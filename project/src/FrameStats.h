@@ -0,0 +1,63 @@
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <chrono>
+#include <deque>
+#include <string>
+
+// Per-frame timings, in milliseconds. GPU times arrive a few frames late
+// (see TimerQueryRing) and stay negative until then
+struct FrameTiming{
+    int frame;
+    bool cpuRenderer;   // traced by the CPU ray tracer instead of the ray program
+    int width;
+    int height;
+    double samples;     // passes traced this frame; in the GUI 1, or the part of a pass
+                        // the GPU traced when it is split into tiles (see View::drawRayScene)
+
+    // CPU side
+    double sceneMs;     // SceneBuilder::getScene and the BVH update
+    double uploadMs;    // packing and uploading the scene buffers and RayBlock
+    double submitMs;    // issuing the ray and composite passes
+    double traceMs;     // CPU ray tracer only
+
+    // GPU side
+    double gpuRayMs;
+    double gpuCompositeMs;
+
+    // Primary rays (one per pixel and sample) per second of ray tracing, 0 if not known yet
+    double raysPerSecond() const;
+};
+
+/**
+  [FRAME STATS]
+  The timings of the last few hundred frames, for the timings overlay and for
+  dumping to CSV or JSON to compare runs.
+**/
+class FrameStats {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit FrameStats(int capacity = 600);
+
+    // Adds a frame with every time zeroed (GPU times unknown), dropping the oldest if full.
+    // The reference stays valid until that frame is dropped
+    FrameTiming& addFrame(int frame, bool cpuRenderer, int width, int height);
+
+    // nullptr if the frame was dropped (or never added)
+    FrameTiming* findFrame(int frame);
+
+    // Mean of the last count frames; GPU times only over frames that have them
+    FrameTiming average(int count) const;
+
+    bool writeCSV(const std::string &path) const;
+    bool writeJSON(const std::string &path) const;
+
+    static double millisecondsSince(const Clock::time_point &start);
+
+private:
+    std::deque<FrameTiming> m_frames;
+    int m_capacity;
+};
+
+#endif // FRAMESTATS_H
@@ -0,0 +1,396 @@
+#include "HeadlessRenderer.h"
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "BVH.h"
+#include "CPUImages.h"
+#include "Denoiser.h"
+#include "Scene.h"
+#include "SceneBuilder.h"
+#include "SceneFile.h"
+#include "settings.h"
+
+bool HeadlessRenderer::isRequested(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--headless") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Turns on exactly the listed features of the global settings
+static bool setFeatures(const QStringList &features, QString &error) {
+    struct Feature { const char *name; bool *value; };
+    Feature all[] = {
+        {"stochastic", &settings.useStochastic}, {"ao", &settings.useAO},
+        {"nm", &settings.useNM}, {"dof", &settings.useDOF},
+        {"ambient", &settings.useAmbient}, {"diffuse", &settings.useDiffuse},
+        {"specular", &settings.useSpecular}, {"shadows", &settings.useShadows},
+        {"reflections", &settings.useReflections}, {"textures", &settings.useTextures},
+        {"environment", &settings.useEnvironment}, {"bluenoise", &settings.useBlueNoise}
+    };
+    for (Feature &feature : all) {
+        *feature.value = false;
+    }
+    for (const QString &name : features) {
+        bool found = false;
+        for (Feature &feature : all) {
+            if (name == feature.name) {
+                *feature.value = true;
+                found = true;
+            }
+        }
+        if (!found) {
+            error = QString("Unknown feature '%1'").arg(name);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HeadlessRenderer::parseArguments(const QStringList &arguments, Options &options, QString &error) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders the ray traced scenes to image files without a window.");
+    parser.addHelpOption();
+
+    QCommandLineOption headlessOption("headless", "Render to files instead of opening the window.");
+    QCommandLineOption sceneOption("scene", "Scene to render (0-2).", "id", "0");
+    QCommandLineOption sceneFileOption("scene-file", "Scene file to render instead of --scene.", "file");
+    QCommandLineOption sizeOption("size", "Image size.", "WxH", "800x600");
+    QCommandLineOption angleXOption("angle-x", "Camera orbit around the y axis, in radians.", "angle", "0");
+    QCommandLineOption angleYOption("angle-y", "Camera orbit around the x axis, in radians.", "angle", "0");
+    QCommandLineOption zoomOption("zoom", "Camera distance from the origin.", "distance", "10");
+    QCommandLineOption samplesOption("samples", "Samples per pixel. More than one turns on stochastic sampling.", "count", "1");
+    QCommandLineOption timeOption("time", "Animation time of the first frame, in seconds.", "seconds", "0");
+    QCommandLineOption framesOption("frames", "Number of animation frames to render.", "count", "1");
+    QCommandLineOption fpsOption("fps", "Animation frames per second.", "fps", "60");
+    QCommandLineOption featuresOption("features",
+            "Features to turn on, all others are turned off: stochastic, ao, nm, dof, ambient, "
+            "diffuse, specular, shadows, reflections, textures, environment, bluenoise.", "list");
+    QCommandLineOption lightsOption("lights", "Light intensities (0-100).", "l1,l2,l3");
+    QCommandLineOption apertureOption("aperture", "Depth of field aperture.", "size");
+    QCommandLineOption focalOption("focal-length", "Depth of field focal length.", "length");
+    QCommandLineOption dataOption("data", "Directory holding the texture images.", "dir", "../data");
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+            "Image to write (.png, .jpg, ... or .pfm for float). With several frames, "
+            "the frame number is appended to the name.", "file", "render.png");
+    QCommandLineOption adaptiveOption("adaptive",
+            "Adaptive sampling: stop tracing pixels whose noise is below this percent of their value.",
+            "percent");
+    QCommandLineOption stopAtOption("stop-at",
+            "With --adaptive, end a frame once this fraction of the pixels has converged.",
+            "fraction", "1");
+    QCommandLineOption denoiseOption("denoise",
+            "Denoise each frame with this many filter iterations (0 turns the denoiser off).",
+            "iterations");
+    QCommandLineOption simdOption("simd",
+            "Instruction set of the CPU ray packets: scalar, sse or avx2. Defaults to the best "
+            "one the CPU supports.", "isa");
+    QCommandLineOption timingsOption("timings", "Per-frame timings to write (.csv or .json).", "file");
+    parser.addOptions({headlessOption, sceneOption, sceneFileOption, sizeOption, angleXOption,
+                       angleYOption, zoomOption, samplesOption, timeOption, framesOption, fpsOption,
+                       featuresOption, lightsOption, apertureOption, focalOption,
+                       dataOption, outputOption, adaptiveOption, stopAtOption, denoiseOption,
+                       simdOption, timingsOption});
+
+    // Handles --help and unknown options itself
+    parser.process(arguments);
+
+    settings.loadSettingsOrDefaults();
+
+    bool ok = true;
+    options.scene = parser.value(sceneOption).toInt(&ok);
+    if (!ok || options.scene < 0 || options.scene >= NUM_MODES) {
+        error = "--scene must be between 0 and " + QString::number(NUM_MODES - 1);
+        return false;
+    }
+    settings.modeScene = options.scene;
+    options.sceneFile = parser.value(sceneFileOption);
+    settings.sceneFile = options.sceneFile;
+
+    QStringList size = parser.value(sizeOption).split('x');
+    bool heightOk = false;
+    options.width = size.value(0).toInt(&ok);
+    options.height = size.value(1).toInt(&heightOk);
+    if (size.size() != 2 || !ok || !heightOk || options.width <= 0 || options.height <= 0) {
+        error = "--size must look like 800x600";
+        return false;
+    }
+
+    options.camera.angleX = parser.value(angleXOption).toFloat();
+    options.camera.angleY = parser.value(angleYOption).toFloat();
+    options.camera.zoom = parser.value(zoomOption).toFloat();
+    options.cameraSet = parser.isSet(angleXOption) || parser.isSet(angleYOption) || parser.isSet(zoomOption);
+    options.samples = std::max(1, parser.value(samplesOption).toInt());
+    options.time = parser.value(timeOption).toFloat();
+    options.frames = std::max(1, parser.value(framesOption).toInt());
+    options.fps = parser.value(fpsOption).toFloat();
+    if (options.fps <= 0.f) {
+        error = "--fps must be positive";
+        return false;
+    }
+    options.dataDir = parser.value(dataOption);
+    options.output = parser.value(outputOption);
+    options.timingsPath = parser.value(timingsOption);
+    QString timingsFormat = QFileInfo(options.timingsPath).suffix().toLower();
+    if (!options.timingsPath.isEmpty() && timingsFormat != "csv" && timingsFormat != "json") {
+        error = "--timings must name a .csv or .json file";
+        return false;
+    }
+
+    if (parser.isSet(featuresOption) &&
+            !setFeatures(parser.value(featuresOption).split(',', QString::SkipEmptyParts), error)) {
+        return false;
+    }
+    if (parser.isSet(lightsOption)) {
+        QStringList lights = parser.value(lightsOption).split(',');
+        if (lights.size() != 3) {
+            error = "--lights takes three intensities, e.g. 100,50,50";
+            return false;
+        }
+        settings.l1Intensity = lights[0].toInt();
+        settings.l2Intensity = lights[1].toInt();
+        settings.l3Intensity = lights[2].toInt();
+    }
+    if (parser.isSet(apertureOption)) {
+        settings.aperture = parser.value(apertureOption).toInt();
+    }
+    if (parser.isSet(focalOption)) {
+        settings.focalLength = parser.value(focalOption).toInt();
+    }
+    if (parser.isSet(adaptiveOption)) {
+        settings.useAdaptive = true;
+        settings.adaptiveThreshold = parser.value(adaptiveOption).toInt();
+        if (settings.adaptiveThreshold <= 0) {
+            error = "--adaptive must be a positive percentage";
+            return false;
+        }
+    }
+    options.stopAt = parser.value(stopAtOption).toFloat();
+    if (parser.isSet(denoiseOption)) {
+        int iterations = parser.value(denoiseOption).toInt(&ok);
+        if (!ok || iterations < 0 || iterations > Denoiser::MAX_ITERATIONS) {
+            error = "--denoise must be between 0 and " + QString::number(Denoiser::MAX_ITERATIONS);
+            return false;
+        }
+        settings.useDenoiser = iterations > 0;
+        settings.denoiseIterations = std::max(iterations, 1);
+    }
+
+    using CS123::CPU::PacketTracer;
+    options.simd = PacketTracer::bestSupported();
+    if (parser.isSet(simdOption)) {
+        QString simd = parser.value(simdOption);
+        PacketTracer::Isa all[] = {PacketTracer::Isa::SCALAR, PacketTracer::Isa::SSE, PacketTracer::Isa::AVX2};
+        bool found = false;
+        for (PacketTracer::Isa isa : all) {
+            if (simd == PacketTracer::name(isa)) {
+                options.simd = isa;
+                found = true;
+            }
+        }
+        if (!found) {
+            error = "--simd must be scalar, sse or avx2";
+            return false;
+        }
+        if (!PacketTracer::isSupported(options.simd)) {
+            error = QString("This CPU does not support %1").arg(simd);
+            return false;
+        }
+    }
+
+    // Passes are only accumulated with stochastic sampling
+    if (options.samples > 1) {
+        settings.useStochastic = true;
+    }
+    return true;
+}
+
+HeadlessRenderer::HeadlessRenderer(const Options &options) :
+    m_options(options),
+    m_tracer(std::make_unique<CS123::CPU::RayTracer>()),
+    m_scene(std::make_unique<Scene>()),
+    m_bvh(std::make_unique<BVH>()),
+    m_frameStats(options.frames)
+{
+}
+
+HeadlessRenderer::~HeadlessRenderer()
+{
+}
+
+int HeadlessRenderer::run() {
+    if (!m_options.sceneFile.isEmpty()) {
+        m_sceneFile = std::make_unique<SceneFile>();
+        QString error;
+        if (!m_sceneFile->load(m_options.sceneFile, *m_scene, *m_bvh, error)) {
+            std::cerr << error.toStdString() << std::endl;
+            return 1;
+        }
+        if (!m_sceneFile->cacheWarning().isEmpty()) {
+            std::cerr << "Warning: " << m_sceneFile->cacheWarning().toStdString()
+                      << ", loaded without a cache" << std::endl;
+        }
+        if (m_sceneFile->hasCamera() && !m_options.cameraSet) {
+            m_options.camera = m_sceneFile->camera();
+        }
+    }
+
+    loadImages();
+    m_tracer->resize(m_options.width, m_options.height);
+    m_tracer->setSimd(m_options.simd);
+    std::cout << "Rendering with " << m_tracer->numThreads() << " threads, "
+              << CS123::CPU::PacketTracer::name(m_tracer->simd()) << " packets" << std::endl;
+
+    for (int frame = 0; frame < m_options.frames; frame++) {
+        QElapsedTimer timer;
+        timer.start();
+        int passes = renderFrame(frame);
+        if (!writeFrame(frame)) {
+            std::cerr << "Failed to write " << framePath(frame).toStdString() << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << framePath(frame).toStdString() << " ("
+                  << m_options.width << "x" << m_options.height << ", "
+                  << passes << " passes) in " << timer.elapsed() << " ms" << std::endl;
+        if (settings.useAdaptive && settings.useStochastic) {
+            std::cout << "  " << 100.f * m_tracer->convergedFraction() << "% of pixels converged" << std::endl;
+        }
+    }
+    if (!m_options.timingsPath.isEmpty()) {
+        if (!writeTimings()) {
+            std::cerr << "Failed to write " << m_options.timingsPath.toStdString() << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << m_options.timingsPath.toStdString() << std::endl;
+    }
+    return 0;
+}
+
+// Same images as View::initializeGL; missing ones are reported and render black
+void HeadlessRenderer::loadImages() {
+    QDir data(m_options.dataDir);
+    auto load = [&](const char *name) {
+        QImage image(data.filePath(name));
+        if (image.isNull()) {
+            std::cerr << "Failed to load texture: " << data.filePath(name).toStdString() << std::endl;
+        }
+        return image;
+    };
+
+    using namespace CS123::CPU;
+    m_tracer->setTexture(0, toCPUImage(load("metal_diffuse.jpg")), toCPUImage(load("metal_normal.jpg")));
+    m_tracer->setTexture(1, toCPUImage(load("wood_diffuse.jpg")), toCPUImage(load("wood_normal.jpg")));
+    m_tracer->setTexture(2, toCPUImage(load("plaster_diffuse.jpg")), toCPUImage(load("plaster_normal.jpg")));
+    m_tracer->setBlueNoise(toCPUImage(load("bluenoise.pgm").convertToFormat(QImage::Format_RGB32)));
+
+    int environment = m_sceneFile ? m_sceneFile->environment() : SceneBuilder::getEnvironment();
+    if (environment == 2) {
+        m_envMap = toCPUCubeMap(load("negz1.jpg"), load("posz1.jpg"), load("posy1.jpg"),
+                                load("negy1.jpg"), load("negx1.jpg"), load("posx1.jpg"));
+    } else {
+        m_envMap = toCPUCubeMap(load("negz.jpg"), load("posz.jpg"), load("posy.jpg"),
+                                load("negy.jpg"), load("negx.jpg"), load("posx.jpg"));
+    }
+}
+
+int HeadlessRenderer::renderFrame(int frame) {
+    FrameTiming &timing = m_frameStats.addFrame(frame, true, m_options.width, m_options.height);
+
+    FrameStats::Clock::time_point sceneStart = FrameStats::Clock::now();
+    float animationTime = m_options.time + frame / m_options.fps;
+    if (!m_sceneFile) {
+        m_scene->assign(SceneBuilder::getScene(animationTime));
+        m_bvh->build(*m_scene);
+    }
+    timing.sceneMs = FrameStats::millisecondsSince(sceneStart);
+
+    glm::mat4x4 inverseCam = m_options.camera.inverseCam(m_options.width, m_options.height);
+    SettingsData data = settings.getSettingsData();
+    FrameStats::Clock::time_point traceStart = FrameStats::Clock::now();
+    int pass = 0;
+    while (pass < m_options.samples) {
+        m_tracer->render(*m_scene, *m_bvh, data, m_envMap, inverseCam, pass);
+        pass++;
+        if (data.useAdaptive == 1 && data.useStochastic == 1 &&
+                m_tracer->convergedFraction() >= m_options.stopAt) {
+            break;
+        }
+    }
+    if (settings.useDenoiser) {
+        m_tracer->denoise(settings.denoiseIterations);
+    }
+    timing.traceMs = FrameStats::millisecondsSince(traceStart);
+    timing.samples = pass;
+    return pass;
+}
+
+// The resolve of composite.frag: the sum divided by the sample count, clamped
+// for 8 bit formats and left as is for .pfm. Denoised frames are resolved already
+bool HeadlessRenderer::writeFrame(int frame) const {
+    int width = m_tracer->width();
+    int height = m_tracer->height();
+    const std::vector<glm::vec4> &color = settings.useDenoiser ? m_tracer->denoisedBuffer()
+                                                               : m_tracer->colorBuffer();
+    QString path = framePath(frame);
+
+    if (QFileInfo(path).suffix().toLower() == "pfm") {
+        // Portable float map: RGB floats, bottom row first like the color buffer,
+        // negative scale for little endian
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly)) {
+            return false;
+        }
+        file.write(QString("PF\n%1 %2\n-1.0\n").arg(width).arg(height).toLatin1());
+        std::vector<float> rgb(3 * color.size());
+        for (size_t i = 0; i < color.size(); i++) {
+            glm::vec3 resolved = glm::vec3(color[i]) / std::max(color[i].a, 1.f);
+            rgb[3 * i] = resolved.r;
+            rgb[3 * i + 1] = resolved.g;
+            rgb[3 * i + 2] = resolved.b;
+        }
+        qint64 bytes = static_cast<qint64>(rgb.size() * sizeof(float));
+        return file.write(reinterpret_cast<const char*>(rgb.data()), bytes) == bytes;
+    }
+
+    QImage image(width, height, QImage::Format_RGB32);
+    for (int y = 0; y < height; y++) {
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(height - 1 - y));
+        for (int x = 0; x < width; x++) {
+            const glm::vec4 &sum = color[y * width + x];
+            glm::vec3 resolved = glm::clamp(glm::vec3(sum) / std::max(sum.a, 1.f), 0.f, 1.f);
+            glm::ivec3 rgb = glm::ivec3(resolved * 255.f + .5f);
+            line[x] = qRgb(rgb.r, rgb.g, rgb.b);
+        }
+    }
+    return image.save(path);
+}
+
+QString HeadlessRenderer::framePath(int frame) const {
+    if (m_options.frames == 1) {
+        return m_options.output;
+    }
+    QFileInfo info(m_options.output);
+    QString name = QString("%1_%2").arg(info.completeBaseName()).arg(frame, 4, 10, QChar('0'));
+    if (!info.suffix().isEmpty()) {
+        name += "." + info.suffix();
+    }
+    return info.dir().filePath(name);
+}
+
+bool HeadlessRenderer::writeTimings() const {
+    std::string path = m_options.timingsPath.toStdString();
+    if (QFileInfo(m_options.timingsPath).suffix().toLower() == "json") {
+        return m_frameStats.writeJSON(path);
+    }
+    return m_frameStats.writeCSV(path);
+}
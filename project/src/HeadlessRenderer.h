@@ -0,0 +1,87 @@
+#ifndef HEADLESSRENDERER_H
+#define HEADLESSRENDERER_H
+
+#include <QImage>
+#include <QString>
+#include <QStringList>
+
+#include <memory>
+#include <vector>
+
+#include "FrameStats.h"
+#include "OrbitCamera.h"
+#include "cpu/RayTracer.h"
+
+struct Scene;
+class BVH;
+class SceneFile;
+
+/**
+  [HEADLESS RENDERER]
+  Renders image files without a window, GL context or event loop, e.g. on
+  render farm nodes:
+
+    final --headless --scene 1 --size 1280x720 --samples 64 --output shot.png
+
+  Frames are traced with the CPU ray tracer (same output as the ray program)
+  back to back, as fast as the machine allows. Settings start from the ones
+  the GUI saved and are overridden by the command line; run with --help for
+  the full list. Images are written with QImage (png, jpg, ...), or as 32 bit
+  float .pfm to keep the unclamped values. --timings dumps the per-frame
+  scene and trace times like the GUI's Save timings button.
+  --denoise N runs the denoiser over each frame before it is written.
+  --simd picks the instruction set of the ray packets (see [PACKET TRACING]).
+  --scene-file renders a scene file (see [SCENE FILES]) instead of --scene,
+  from its camera unless the command line sets one.
+**/
+class HeadlessRenderer {
+public:
+    struct Options {
+        int scene;
+        QString sceneFile;  // rendered instead of scene if set
+        int width;
+        int height;
+        OrbitCamera camera;
+        bool cameraSet;     // camera given on the command line, which a scene file's doesn't override
+        int samples;
+        float time;     // animation time of the first frame, in seconds
+        int frames;
+        float fps;      // animation time step between frames
+        QString dataDir;
+        QString output;
+        QString timingsPath;    // .csv or .json, empty to skip
+        float stopAt;           // with adaptive sampling, converged fraction that ends a frame early
+        CS123::CPU::PacketTracer::Isa simd;
+    };
+
+    // True if the command line asks for a headless render (--headless)
+    static bool isRequested(int argc, char *argv[]);
+
+    // Parses the command line into options and the global settings.
+    // Returns false and fills in error if the arguments are invalid
+    static bool parseArguments(const QStringList &arguments, Options &options, QString &error);
+
+    explicit HeadlessRenderer(const Options &options);
+    ~HeadlessRenderer();
+
+    // Renders every frame and writes it out. Returns the process exit code
+    int run();
+
+private:
+    void loadImages();
+    // Returns the number of passes traced, fewer than samples if adaptive sampling stopped early
+    int renderFrame(int frame);
+    bool writeFrame(int frame) const;
+    QString framePath(int frame) const;
+    bool writeTimings() const;
+
+    Options m_options;
+    std::unique_ptr<CS123::CPU::RayTracer> m_tracer;
+    CS123::CPU::CubeMap m_envMap;
+    std::unique_ptr<Scene> m_scene;
+    std::unique_ptr<BVH> m_bvh;
+    std::unique_ptr<SceneFile> m_sceneFile; // null for the preset scenes
+    FrameStats m_frameStats;
+};
+
+#endif // HEADLESSRENDERER_H
@@ -0,0 +1,666 @@
+#include "Mesh.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+    // Triangle boxes grow by this much of the mesh's size, so triangles lying
+    // flat in a box face aren't culled by rounding
+    const float TRIANGLE_BOUNDS_EPSILON = 1e-5f;
+
+    // Moller-Trumbore. Returns t, or -1 if the ray is parallel to the triangle or
+    // passes outside it, and the weights of the second and third vertex at the hit
+    float intersectTriangle(const glm::vec3 &v0, const glm::vec3 &e1, const glm::vec3 &e2,
+                            const glm::vec3 &origin, const glm::vec3 &direction, glm::vec2 &barycentric) {
+        glm::vec3 p = glm::cross(direction, e2);
+        float det = glm::dot(e1, p);
+        if (det == 0.f) {
+            return -1.f;
+        }
+        float invDet = 1.f / det;
+        glm::vec3 s = origin - v0;
+        float u = glm::dot(s, p) * invDet;
+        if (u < 0.f || u > 1.f) {
+            return -1.f;
+        }
+        glm::vec3 q = glm::cross(s, e1);
+        float v = glm::dot(direction, q) * invDet;
+        if (v < 0.f || u + v > 1.f) {
+            return -1.f;
+        }
+        barycentric = glm::vec2(u, v);
+        return glm::dot(e2, q) * invDet;
+    }
+
+    bool readFile(const std::string &path, std::string &contents) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        std::ostringstream stream;
+        stream << file.rdbuf();
+        contents = stream.str();
+        return true;
+    }
+
+    bool endsWith(const std::string &text, const char *suffix) {
+        size_t length = std::strlen(suffix);
+        if (text.size() < length) {
+            return false;
+        }
+        for (size_t i = 0; i < length; i++) {
+            if (std::tolower(static_cast<unsigned char>(text[text.size() - length + i])) != suffix[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Copies the line starting at pos into line, without its end of line, and moves pos past it
+    bool nextLine(const std::string &text, size_t &pos, std::string &line) {
+        if (pos >= text.size()) {
+            return false;
+        }
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        line.assign(text, pos, end - pos);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        pos = end + 1;
+        return true;
+    }
+
+    const char* skipSpaces(const char *c) {
+        while (*c == ' ' || *c == '\t') {
+            c++;
+        }
+        return c;
+    }
+
+    // Reads count floats from c. strtof would skip line ends too, but the line is a string of its own
+    bool readFloats(const char *c, int count, float *out) {
+        for (int i = 0; i < count; i++) {
+            char *next;
+            out[i] = std::strtof(c, &next);
+            if (next == c) {
+                return false;
+            }
+            c = next;
+        }
+        return true;
+    }
+
+    // [OBJ]
+    /////////////////////////////////////////////////////////////////////////
+
+    // A face corner: indices into the file's v, vt and vn lists, -1 where left out
+    struct ObjCorner {
+        int position;
+        int uv;
+        int normal;
+
+        bool operator==(const ObjCorner &that) const {
+            return position == that.position && uv == that.uv && normal == that.normal;
+        }
+    };
+
+    struct ObjCornerHash {
+        size_t operator()(const ObjCorner &corner) const {
+            return (static_cast<size_t>(corner.position) * 73856093u) ^
+                   (static_cast<size_t>(corner.uv) * 19349663u) ^
+                   (static_cast<size_t>(corner.normal) * 83492791u);
+        }
+    };
+
+    // An OBJ index is 1 based, or counts back from the end of the list when negative
+    bool readObjIndex(const char *&c, int listSize, int &index) {
+        char *next;
+        long value = std::strtol(c, &next, 10);
+        if (next == c) {
+            return false;
+        }
+        c = next;
+        long resolved = value > 0 ? value - 1 : listSize + value;
+        if (value == 0 || resolved < 0 || resolved >= listSize) {
+            return false;
+        }
+        index = static_cast<int>(resolved);
+        return true;
+    }
+
+    // v, vt, vn and f (as i, i/t, i//n or i/t/n, any number of corners). Everything else,
+    // groups and materials included, is skipped
+    bool loadObj(const std::string &text, Mesh &mesh, std::string &error) {
+        std::vector<glm::vec3> filePositions;
+        std::vector<glm::vec2> fileUVs;
+        std::vector<glm::vec3> fileNormals;
+        std::unordered_map<ObjCorner, int, ObjCornerHash> vertices;
+        std::vector<int> face;
+        bool hasNormals = false;
+
+        std::string line;
+        size_t pos = 0;
+        int lineNumber = 0;
+        while (nextLine(text, pos, line)) {
+            lineNumber++;
+            const char *c = skipSpaces(line.c_str());
+            const char *keyword = c;
+            while (*c != '\0' && *c != ' ' && *c != '\t') {
+                c++;
+            }
+            std::string word(keyword, c);
+            float v[3];
+
+            if (word == "v") {
+                if (!readFloats(c, 3, v)) {
+                    error = std::to_string(lineNumber) + ": v takes x y z";
+                    return false;
+                }
+                filePositions.push_back(glm::vec3(v[0], v[1], v[2]));
+            } else if (word == "vt") {
+                if (!readFloats(c, 2, v)) {
+                    error = std::to_string(lineNumber) + ": vt takes u v";
+                    return false;
+                }
+                fileUVs.push_back(glm::vec2(v[0], 1.f - v[1]));
+            } else if (word == "vn") {
+                if (!readFloats(c, 3, v)) {
+                    error = std::to_string(lineNumber) + ": vn takes x y z";
+                    return false;
+                }
+                fileNormals.push_back(glm::vec3(v[0], v[1], v[2]));
+            } else if (word == "f") {
+                face.clear();
+                for (c = skipSpaces(c); *c != '\0'; c = skipSpaces(c)) {
+                    ObjCorner corner = {-1, -1, -1};
+                    bool valid = readObjIndex(c, static_cast<int>(filePositions.size()), corner.position);
+                    if (valid && *c == '/') {
+                        c++;
+                        if (*c != '/') {
+                            valid = readObjIndex(c, static_cast<int>(fileUVs.size()), corner.uv);
+                        }
+                        if (valid && *c == '/') {
+                            c++;
+                            valid = readObjIndex(c, static_cast<int>(fileNormals.size()), corner.normal);
+                        }
+                    }
+                    if (!valid) {
+                        error = std::to_string(lineNumber) + ": f refers to a vertex that isn't there";
+                        return false;
+                    }
+
+                    auto vertex = vertices.emplace(corner, static_cast<int>(mesh.positions.size()));
+                    if (vertex.second) {
+                        mesh.positions.push_back(filePositions[corner.position]);
+                        mesh.uvs.push_back(corner.uv >= 0 ? fileUVs[corner.uv] : glm::vec2(0.f));
+                        mesh.normals.push_back(corner.normal >= 0 ? fileNormals[corner.normal] : glm::vec3(0.f));
+                        hasNormals = hasNormals || corner.normal >= 0;
+                    }
+                    face.push_back(vertex.first->second);
+                }
+                if (face.size() < 3) {
+                    error = std::to_string(lineNumber) + ": f takes at least 3 vertices";
+                    return false;
+                }
+
+                // Faces are taken to be convex and fanned out from their first corner
+                for (size_t i = 2; i < face.size(); i++) {
+                    mesh.triangles.push_back(glm::ivec3(face[0], face[i - 1], face[i]));
+                }
+            }
+        }
+
+        if (!hasNormals) {
+            mesh.normals.clear();
+        }
+        return true;
+    }
+
+    // [PLY]
+    /////////////////////////////////////////////////////////////////////////
+
+    enum PlyFormat { PLY_ASCII, PLY_BINARY_LITTLE_ENDIAN, PLY_BINARY_BIG_ENDIAN };
+
+    // The scalar types of a PLY property, by both of their names
+    struct PlyType {
+        const char *name;
+        const char *sizedName;
+        int size;
+        bool isFloat;
+        bool isSigned;
+    };
+
+    const PlyType PLY_TYPES[] = {
+        {"char", "int8", 1, false, true},      {"uchar", "uint8", 1, false, false},
+        {"short", "int16", 2, false, true},    {"ushort", "uint16", 2, false, false},
+        {"int", "int32", 4, false, true},      {"uint", "uint32", 4, false, false},
+        {"float", "float32", 4, true, true},   {"double", "float64", 8, true, true}
+    };
+    const int NUM_PLY_TYPES = sizeof(PLY_TYPES) / sizeof(PLY_TYPES[0]);
+
+    int plyType(const std::string &name) {
+        for (int i = 0; i < NUM_PLY_TYPES; i++) {
+            if (name == PLY_TYPES[i].name || name == PLY_TYPES[i].sizedName) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    struct PlyProperty {
+        std::string name;
+        int type;
+        int countType; // -1 unless the property is a list
+    };
+
+    struct PlyElement {
+        std::string name;
+        long count;
+        std::vector<PlyProperty> properties;
+    };
+
+    // Values of the body one at a time, in whatever format the header said
+    struct PlyReader {
+        const char *data;
+        const char *end;
+        PlyFormat format;
+
+        bool read(int type, double &value) {
+            if (format == PLY_ASCII) {
+                char *next;
+                value = std::strtod(data, &next);
+                if (next == data) {
+                    return false;
+                }
+                data = next;
+                return true;
+            }
+
+            const PlyType &plyType = PLY_TYPES[type];
+            if (end - data < plyType.size) {
+                return false;
+            }
+            unsigned char bytes[8];
+            std::memcpy(bytes, data, plyType.size);
+            data += plyType.size;
+
+            uint16_t one = 1;
+            bool littleEndianHost = *reinterpret_cast<const unsigned char*>(&one) == 1;
+            if (littleEndianHost != (format == PLY_BINARY_LITTLE_ENDIAN)) {
+                std::reverse(bytes, bytes + plyType.size);
+            }
+
+            if (plyType.isFloat) {
+                if (plyType.size == 4) {
+                    float f;
+                    std::memcpy(&f, bytes, 4);
+                    value = f;
+                } else {
+                    std::memcpy(&value, bytes, 8);
+                }
+                return true;
+            }
+            uint32_t bits = 0;
+            std::memcpy(&bits, bytes, plyType.size); // the low bytes on a little endian host
+            if (!littleEndianHost) {
+                bits >>= 8 * (4 - plyType.size);
+            }
+            if (plyType.isSigned) {
+                int shift = 8 * (4 - plyType.size);
+                value = static_cast<int32_t>(bits << shift) >> shift;
+            } else {
+                value = bits;
+            }
+            return true;
+        }
+    };
+
+    int propertyIndex(const PlyElement &element, std::initializer_list<const char*> names) {
+        for (size_t i = 0; i < element.properties.size(); i++) {
+            for (const char *name : names) {
+                if (element.properties[i].name == name) {
+                    return static_cast<int>(i);
+                }
+            }
+        }
+        return -1;
+    }
+
+    // The vertex element's x y z, nx ny nz and u v (or s t, texture_u texture_v) and the
+    // face element's vertex_indices list, any other element or property is skipped
+    bool loadPly(const std::string &text, Mesh &mesh, std::string &error) {
+        std::string line;
+        size_t pos = 0;
+        if (!nextLine(text, pos, line) || line != "ply") {
+            error = "not a PLY file";
+            return false;
+        }
+
+        PlyReader reader = {};
+        bool hasFormat = false;
+        std::vector<PlyElement> elements;
+        while (true) {
+            if (!nextLine(text, pos, line)) {
+                error = "the header has no end_header";
+                return false;
+            }
+            std::istringstream words(line);
+            std::string keyword;
+            words >> keyword;
+            if (keyword == "end_header") {
+                break;
+            } else if (keyword == "format") {
+                std::string format;
+                words >> format;
+                hasFormat = true;
+                if (format == "ascii") {
+                    reader.format = PLY_ASCII;
+                } else if (format == "binary_little_endian") {
+                    reader.format = PLY_BINARY_LITTLE_ENDIAN;
+                } else if (format == "binary_big_endian") {
+                    reader.format = PLY_BINARY_BIG_ENDIAN;
+                } else {
+                    error = "unknown format " + format;
+                    return false;
+                }
+            } else if (keyword == "element") {
+                PlyElement element;
+                if (!(words >> element.name >> element.count) || element.count < 0) {
+                    error = "element takes a name and a count";
+                    return false;
+                }
+                elements.push_back(element);
+            } else if (keyword == "property") {
+                PlyProperty property;
+                std::string type;
+                words >> type;
+                if (type == "list") {
+                    std::string countType;
+                    words >> countType >> type;
+                    property.countType = plyType(countType);
+                    if (property.countType < 0 || PLY_TYPES[property.countType].isFloat) {
+                        error = "unknown list count type " + countType;
+                        return false;
+                    }
+                } else {
+                    property.countType = -1;
+                }
+                property.type = plyType(type);
+                words >> property.name;
+                if (property.type < 0 || elements.empty()) {
+                    error = "unknown property " + line;
+                    return false;
+                }
+                elements.back().properties.push_back(property);
+            }
+        }
+        if (!hasFormat) {
+            error = "the header has no format";
+            return false;
+        }
+        reader.data = text.c_str() + std::min(pos, text.size());
+        reader.end = text.c_str() + text.size();
+
+        int numVertices = 0;
+        bool hasVertices = false;
+        std::vector<double> values;
+        std::vector<int> face;
+        for (const PlyElement &element : elements) {
+            bool isVertex = element.name == "vertex";
+            bool isFace = element.name == "face";
+            int position = propertyIndex(element, {"x"});
+            int normal = propertyIndex(element, {"nx"});
+            int uv = propertyIndex(element, {"u", "s", "texture_u"});
+            int indices = propertyIndex(element, {"vertex_indices", "vertex_index"});
+            const PlyProperty *indexList = isFace && indices >= 0 ? &element.properties[indices] : nullptr;
+            if (isVertex) {
+                if (position < 0 || propertyIndex(element, {"y"}) != position + 1 ||
+                    propertyIndex(element, {"z"}) != position + 2) {
+                    error = "vertices need x y z";
+                    return false;
+                }
+                normal = normal >= 0 && propertyIndex(element, {"ny"}) == normal + 1 &&
+                         propertyIndex(element, {"nz"}) == normal + 2 ? normal : -1;
+                uv = uv >= 0 && propertyIndex(element, {"v", "t", "texture_v"}) == uv + 1 ? uv : -1;
+                numVertices = static_cast<int>(element.count);
+                hasVertices = true;
+            }
+
+            for (long item = 0; item < element.count; item++) {
+                values.clear();
+                for (const PlyProperty &property : element.properties) {
+                    double value;
+                    int count = 1;
+                    if (property.countType >= 0) {
+                        if (!reader.read(property.countType, value) || value < 0) {
+                            error = "the " + element.name + " data ends early";
+                            return false;
+                        }
+                        count = static_cast<int>(value);
+                        if (&property == indexList) {
+                            face.clear();
+                        }
+                    }
+                    for (int i = 0; i < count; i++) {
+                        if (!reader.read(property.type, value)) {
+                            error = "the " + element.name + " data ends early";
+                            return false;
+                        }
+                        if (property.countType < 0) {
+                            values.push_back(value);
+                        } else if (&property == indexList) {
+                            face.push_back(static_cast<int>(value));
+                        }
+                    }
+                    if (property.countType >= 0) {
+                        values.push_back(0.0); // keeps the scalar properties at their index
+                    }
+                }
+
+                if (isVertex) {
+                    mesh.positions.push_back(glm::vec3(values[position], values[position + 1], values[position + 2]));
+                    if (normal >= 0) {
+                        mesh.normals.push_back(glm::vec3(values[normal], values[normal + 1], values[normal + 2]));
+                    }
+                    if (uv >= 0) {
+                        mesh.uvs.push_back(glm::vec2(values[uv], 1.0 - values[uv + 1]));
+                    }
+                } else if (indexList) {
+                    for (int index : face) {
+                        if (!hasVertices || index < 0 || index >= numVertices) {
+                            error = "a face refers to a vertex that isn't there";
+                            return false;
+                        }
+                    }
+                    for (size_t i = 2; i < face.size(); i++) {
+                        mesh.triangles.push_back(glm::ivec3(face[0], face[i - 1], face[i]));
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    struct PositionHash {
+        size_t operator()(const glm::vec3 &p) const {
+            uint32_t bits[3];
+            std::memcpy(bits, &p, sizeof(bits));
+            return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        }
+    };
+}
+
+bool Mesh::load(const std::string &path, Mesh &mesh, std::string &error) {
+    std::string contents;
+    if (!readFile(path, contents)) {
+        error = "Can't read " + path;
+        return false;
+    }
+
+    mesh = Mesh();
+    bool loaded;
+    if (endsWith(path, ".obj")) {
+        loaded = loadObj(contents, mesh, error);
+    } else if (endsWith(path, ".ply")) {
+        loaded = loadPly(contents, mesh, error);
+    } else {
+        error = "not an .obj or .ply file";
+        loaded = false;
+    }
+    if (loaded && mesh.triangles.empty()) {
+        error = "no triangles";
+        loaded = false;
+    }
+    if (!loaded) {
+        error = path + ": " + error;
+        return false;
+    }
+    mesh.build();
+    return true;
+}
+
+void Mesh::build() {
+    if (uvs.size() != positions.size()) {
+        uvs.assign(positions.size(), glm::vec2(0.f));
+    }
+    if (normals.size() != positions.size()) {
+        computeNormals();
+    }
+
+    bounds = AABB::empty();
+    for (const glm::vec3 &position : positions) {
+        bounds.grow(position);
+    }
+    glm::vec3 epsilon(TRIANGLE_BOUNDS_EPSILON * glm::length(bounds.max - bounds.min));
+
+    std::vector<AABB> triangleBounds(triangles.size());
+    for (size_t i = 0; i < triangles.size(); i++) {
+        AABB &box = triangleBounds[i];
+        box = AABB::empty();
+        for (int corner = 0; corner < 3; corner++) {
+            box.grow(positions[triangles[i][corner]]);
+        }
+        box.min -= epsilon;
+        box.max += epsilon;
+    }
+    bvh.build(triangleBounds);
+}
+
+int Mesh::numTriangles() const {
+    return static_cast<int>(triangles.size());
+}
+
+float Mesh::closestHit(const glm::vec4 &origin, const glm::vec4 &direction,
+                       int &triangle, glm::vec2 &barycentric) const
+{
+    glm::vec3 o(origin);
+    glm::vec3 d(direction);
+
+    // BVH::closestHit keeps the same closest t, this also keeps where on the triangle it was
+    float closestT = -1.f;
+    float bestT;
+    triangle = bvh.closestHit(origin, direction, bestT, [&](int i) {
+        const glm::ivec3 &corners = triangles[i];
+        const glm::vec3 &v0 = positions[corners[0]];
+        glm::vec2 hit;
+        float t = intersectTriangle(v0, positions[corners[1]] - v0, positions[corners[2]] - v0, o, d, hit);
+        if (t > 0.f && (closestT < 0.f || t < closestT)) {
+            closestT = t;
+            barycentric = hit;
+        }
+        return t;
+    });
+    return bestT;
+}
+
+float Mesh::anyHit(const glm::vec4 &origin, const glm::vec4 &direction, float tMax) const {
+    glm::vec3 o(origin);
+    glm::vec3 d(direction);
+
+    float hitT = -1.f;
+    bvh.anyHit(origin, direction, tMax, [&](int i) {
+        const glm::ivec3 &corners = triangles[i];
+        const glm::vec3 &v0 = positions[corners[0]];
+        glm::vec2 hit;
+        float t = intersectTriangle(v0, positions[corners[1]] - v0, positions[corners[2]] - v0, o, d, hit);
+        if (t > 0.f && t < tMax) {
+            hitT = t;
+        }
+        return t;
+    });
+    return hitT;
+}
+
+glm::vec3 Mesh::normal(int triangle, const glm::vec2 &barycentric, const glm::vec4 &direction) const {
+    const glm::ivec3 &corners = triangles[triangle];
+    const glm::vec3 &v0 = positions[corners[0]];
+    glm::vec3 geometric = glm::cross(positions[corners[1]] - v0, positions[corners[2]] - v0);
+    if (glm::dot(geometric, glm::vec3(direction)) > 0.f) {
+        geometric = -geometric;
+    }
+
+    glm::vec3 n = (1.f - barycentric.x - barycentric.y) * normals[corners[0]] +
+                  barycentric.x * normals[corners[1]] + barycentric.y * normals[corners[2]];
+    if (glm::dot(n, n) == 0.f) {
+        n = geometric;
+    }
+    n = glm::normalize(n);
+    return glm::dot(n, geometric) < 0.f ? -n : n;
+}
+
+// Along which the texture's v grows, the way the other primitives' bitangents run
+glm::vec3 Mesh::bitangent(int triangle) const {
+    const glm::ivec3 &corners = triangles[triangle];
+    glm::vec3 e1 = positions[corners[1]] - positions[corners[0]];
+    glm::vec3 e2 = positions[corners[2]] - positions[corners[0]];
+    glm::vec2 uv1 = uvs[corners[1]] - uvs[corners[0]];
+    glm::vec2 uv2 = uvs[corners[2]] - uvs[corners[0]];
+    float det = uv1.x * uv2.y - uv2.x * uv1.y;
+    if (det == 0.f) {
+        // No uvs to follow, any direction in the triangle will do
+        return glm::normalize(e1);
+    }
+    return glm::normalize((e2 * uv1.x - e1 * uv2.x) / det);
+}
+
+glm::vec2 Mesh::uv(int triangle, const glm::vec2 &barycentric) const {
+    const glm::ivec3 &corners = triangles[triangle];
+    return (1.f - barycentric.x - barycentric.y) * uvs[corners[0]] +
+           barycentric.x * uvs[corners[1]] + barycentric.y * uvs[corners[2]];
+}
+
+// Area weighted: the cross product of two edges is as long as twice the triangle's
+// area. Vertices at the same position share the sum, so uv seams don't crease the shading
+void Mesh::computeNormals() {
+    std::unordered_map<glm::vec3, int, PositionHash> shared;
+    std::vector<int> first(positions.size());
+    for (size_t i = 0; i < positions.size(); i++) {
+        // + 0 turns -0 into 0, which compares equal and must hash the same
+        first[i] = shared.emplace(positions[i] + glm::vec3(0.f), static_cast<int>(i)).first->second;
+    }
+
+    std::vector<glm::vec3> sums(positions.size(), glm::vec3(0.f));
+    for (const glm::ivec3 &corners : triangles) {
+        const glm::vec3 &v0 = positions[corners[0]];
+        glm::vec3 n = glm::cross(positions[corners[1]] - v0, positions[corners[2]] - v0);
+        for (int corner = 0; corner < 3; corner++) {
+            sums[first[corners[corner]]] += n;
+        }
+    }
+
+    normals.resize(positions.size());
+    for (size_t i = 0; i < positions.size(); i++) {
+        const glm::vec3 &sum = sums[first[i]];
+        normals[i] = glm::dot(sum, sum) > 0.f ? glm::normalize(sum) : glm::vec3(0.f);
+    }
+}
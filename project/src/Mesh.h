@@ -0,0 +1,63 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <string>
+#include <vector>
+
+#include "scenedata.h"
+#include "BVH.h"
+
+/**
+  [MESH]
+  A triangle mesh in object space, loaded from an OBJ or PLY file into indexed
+  buffers. MESH objects instance one through their objectToWorld like any other
+  primitive, so a mesh placed many times is stored once (see Scene::meshes).
+
+  Every mesh has a BVH of its own over its triangles, built once on load. A ray
+  that reaches a MESH object in the scene's BVH goes to object space and walks
+  the mesh's tree, testing triangles with Moller-Trumbore. ray.frag walks the
+  same trees, packed into its meshBuffer by MeshBuffer.
+
+  Vertices are the distinct (position, normal, uv) combinations of the file.
+  A file without normals gets area weighted vertex normals, one without uvs
+  gets (0, 0). v is flipped on load, since the textures run top down in the
+  other primitives' uvs.
+**/
+class Mesh {
+public:
+    // Per vertex
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec2> uvs;
+
+    std::vector<glm::ivec3> triangles; // vertex indices
+    BVH bvh;                           // over triangles
+    AABB bounds;                       // of the positions
+
+    // Reads an .obj or .ply (ascii or binary) file and builds the mesh.
+    // Returns false and fills in error if it can't be read or has no triangles
+    static bool load(const std::string &path, Mesh &mesh, std::string &error);
+
+    // Derives bounds, the BVH and any missing normals from the buffers
+    void build();
+
+    int numTriangles() const;
+
+    // Closest triangle with t > 0 of an object space ray, like checkObjectIntersection
+    // for the other primitives. Returns t or -1, and which triangle and where on it
+    float closestHit(const glm::vec4 &origin, const glm::vec4 &direction,
+                     int &triangle, glm::vec2 &barycentric) const;
+
+    // t of the first triangle found with 0 < t < tMax, or -1
+    float anyHit(const glm::vec4 &origin, const glm::vec4 &direction, float tMax) const;
+
+    // At a hit of closestHit. The normal is on the side direction came from
+    glm::vec3 normal(int triangle, const glm::vec2 &barycentric, const glm::vec4 &direction) const;
+    glm::vec3 bitangent(int triangle) const;
+    glm::vec2 uv(int triangle, const glm::vec2 &barycentric) const;
+
+private:
+    void computeNormals();
+};
+
+#endif // MESH_H
@@ -0,0 +1,88 @@
+#include "MeshBuffer.h"
+
+#include "Scene.h"
+#include "BVH.h"
+#include "Mesh.h"
+
+void MeshBuffer::pack(const Scene &scene) {
+    std::vector<int> roots = rootNodes(scene);
+
+    // The header, then the trees
+    texels.assign(BVH::TEXELS_PER_NODE, glm::vec4(0.f));
+    int numTriangles = 0;
+    int numVertices = 0;
+    for (size_t i = 0; i < scene.meshes.size(); i++) {
+        const Mesh &mesh = *scene.meshes[i];
+        mesh.bvh.pack(texels, roots[i], numTriangles);
+        numTriangles += mesh.numTriangles();
+        numVertices += static_cast<int>(mesh.positions.size());
+    }
+
+    int triangleBase = static_cast<int>(texels.size());
+    int vertexBase = triangleBase + numTriangles * TEXELS_PER_TRIANGLE;
+    texels[0] = glm::vec4(static_cast<float>(triangleBase), static_cast<float>(vertexBase), 0.f, 0.f);
+    texels.resize(vertexBase + numVertices * TEXELS_PER_VERTEX);
+
+    glm::vec4 *out = texels.data() + triangleBase;
+    int firstVertex = 0;
+    for (const std::shared_ptr<const Mesh> &mesh : scene.meshes) {
+        // In the order of the BVH's leaves, as SceneBuffer does the objects
+        for (int triangle : mesh->bvh.objectOrder()) {
+            const glm::ivec3 &corners = mesh->triangles[triangle];
+            const glm::vec3 &v0 = mesh->positions[corners[0]];
+            out[0] = glm::vec4(v0, static_cast<float>(firstVertex + corners[0]));
+            out[1] = glm::vec4(mesh->positions[corners[1]] - v0, static_cast<float>(firstVertex + corners[1]));
+            out[2] = glm::vec4(mesh->positions[corners[2]] - v0, static_cast<float>(firstVertex + corners[2]));
+            out += TEXELS_PER_TRIANGLE;
+        }
+        firstVertex += static_cast<int>(mesh->positions.size());
+    }
+
+    for (const std::shared_ptr<const Mesh> &mesh : scene.meshes) {
+        for (size_t i = 0; i < mesh->positions.size(); i++) {
+            out[0] = glm::vec4(mesh->normals[i], 0.f);
+            out[1] = glm::vec4(mesh->uvs[i], 0.f, 0.f);
+            out += TEXELS_PER_VERTEX;
+        }
+    }
+}
+
+int MeshBuffer::sizeInBytes() const {
+    return static_cast<int>(texels.size() * sizeof(glm::vec4));
+}
+
+std::vector<int> MeshBuffer::rootNodes(const Scene &scene) {
+    std::vector<int> roots(scene.meshes.size());
+    int numNodes = 1;
+    for (size_t i = 0; i < scene.meshes.size(); i++) {
+        roots[i] = numNodes;
+        numNodes += static_cast<int>(scene.meshes[i]->bvh.nodes().size());
+    }
+    return roots;
+}
+
+bool MeshBuffer::fits(const std::vector<std::shared_ptr<const Mesh>> &meshes, std::string &error) {
+    long long numNodes = 1;
+    long long numTriangles = 0;
+    long long numVertices = 0;
+    for (const std::shared_ptr<const Mesh> &mesh : meshes) {
+        numNodes += static_cast<long long>(mesh->bvh.nodes().size());
+        numTriangles += mesh->numTriangles();
+        numVertices += static_cast<long long>(mesh->positions.size());
+    }
+
+    long long vertexBase = numNodes * BVH::TEXELS_PER_NODE + numTriangles * TEXELS_PER_TRIANGLE;
+    if (numTriangles > MAX_INDEX / BVH::MAX_LEAF_SIZE) {
+        error = "The meshes have " + std::to_string(numTriangles) + " triangles, at most " +
+                std::to_string(MAX_INDEX / BVH::MAX_LEAF_SIZE) + " fit the GPU buffer";
+    } else if (numVertices > MAX_INDEX) {
+        error = "The meshes have " + std::to_string(numVertices) + " vertices, at most " +
+                std::to_string(MAX_INDEX) + " fit the GPU buffer";
+    } else if (vertexBase > MAX_INDEX) {
+        error = "The meshes' triangles and BVH nodes take " + std::to_string(vertexBase) + " texels, at most " +
+                std::to_string(MAX_INDEX) + " fit the GPU buffer";
+    } else {
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,52 @@
+#ifndef MESHBUFFER_H
+#define MESHBUFFER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "scenedata.h"
+
+struct Scene;
+class Mesh;
+
+/**
+  [MESH BUFFER]
+  The triangle meshes of a scene (see [MESH]) flattened into RGBA32F texels for
+  ray.frag's meshBuffer, in three sections:
+
+    nodes       every mesh's BVH as BVH::pack lays it out, one tree after the other
+    triangles   TEXELS_PER_TRIANGLE each, every mesh's in its BVH's objectOrder():
+                (v0, vertex 0), (v1 - v0, vertex 1), (v2 - v0, vertex 2)
+    vertices    TEXELS_PER_VERTEX each: (normal, 0), (uv, 0, 0)
+
+  Node 0 is a header instead of a node, its first texel holds the texel the
+  triangles start at and the one the vertices start at. A mesh's root is the
+  index of its first node (rootNodes), which SceneBuffer stores with the
+  objects that instance it. Leaves and triangles refer to triangles and
+  vertices counted over all meshes, from the start of their section.
+
+  The indices are floats like the rest of the texels, exact up to 2^24 (MAX_INDEX).
+  That allows 2^24 vertices over all meshes, 2^24 / BVH::MAX_LEAF_SIZE (4M)
+  triangles, the limit of a leaf's packed first triangle, and nodes and triangles
+  up to where the vertices start at texel 2^24. fits checks meshes against this
+  before they are packed, past it ray.frag would fetch the wrong texels.
+**/
+struct MeshBuffer{
+    static const int TEXELS_PER_TRIANGLE = 3;
+    static const int TEXELS_PER_VERTEX = 2;
+    static const int MAX_INDEX = 1 << 24;
+
+    std::vector<glm::vec4> texels;
+
+    void pack(const Scene &scene);
+    int sizeInBytes() const;
+
+    // Where each of Scene::meshes has its root node
+    static std::vector<int> rootNodes(const Scene &scene);
+
+    // False, and what is over in error, if the meshes need indices past MAX_INDEX
+    static bool fits(const std::vector<std::shared_ptr<const Mesh>> &meshes, std::string &error);
+};
+
+#endif // MESHBUFFER_H
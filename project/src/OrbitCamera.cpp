@@ -0,0 +1,28 @@
+#include "OrbitCamera.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#include "glm/gtx/transform.hpp"
+
+const float OrbitCamera::CAMERA_FAR = 50.f;
+const float OrbitCamera::CAMERA_NEAR = 0.1f;
+const float OrbitCamera::CAMERA_FOV = 45.f;
+
+glm::mat4x4 OrbitCamera::viewMatrix() const {
+    return glm::translate(glm::vec3(0, 0, -zoom)) *
+           glm::rotate(angleY, glm::vec3(1.f,0.f,0.f)) *
+           glm::rotate(angleX, glm::vec3(0.f,1.f,0.f));
+}
+
+glm::mat4x4 OrbitCamera::scaleMatrix(int width, int height) const {
+    float farPlane = std::max(CAMERA_FAR, CAMERA_NEAR + 100.f * FLT_EPSILON);
+    float h = farPlane * glm::tan(glm::radians(CAMERA_FOV/2));
+    float aspectRatio = width/height;
+    float w = aspectRatio * h;
+    return glm::scale(glm::vec3(1.f/w, 1.f/h, 1.f/farPlane));
+}
+
+glm::mat4x4 OrbitCamera::inverseCam(int width, int height) const {
+    return glm::inverse(viewMatrix()) * glm::inverse(scaleMatrix(width, height));
+}
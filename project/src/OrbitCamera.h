@@ -0,0 +1,29 @@
+#ifndef ORBITCAMERA_H
+#define ORBITCAMERA_H
+
+#include "glm/glm.hpp"
+
+/**
+  [ORBIT CAMERA]
+  The camera View's mouse handlers drive, kept out of View so the headless
+  renderer frames its shots the same way.
+**/
+struct OrbitCamera{
+    float angleX;
+    float angleY;
+    float zoom;
+
+    glm::mat4x4 viewMatrix() const;
+
+    // Scales the view frustum of a width x height viewport to the unit film plane
+    glm::mat4x4 scaleMatrix(int width, int height) const;
+
+    // inverse(view) * inverse(scale), the inverseCam uniform of ray.frag
+    glm::mat4x4 inverseCam(int width, int height) const;
+
+    static const float CAMERA_FAR;
+    static const float CAMERA_NEAR;
+    static const float CAMERA_FOV;
+};
+
+#endif // ORBITCAMERA_H
@@ -0,0 +1,37 @@
+#include "RayBlock.h"
+
+#include <cstring>
+
+static LightObjectStd140 packLight(const LightObject &light, float intensity) {
+    LightObjectStd140 out = {};
+    out.color = light.color;
+    out.pos = light.pos;
+    out.dir = light.dir;
+    out.function = light.function;
+    out.lightIntensitySetting = intensity;
+    out.type = static_cast<int>(light.type);
+    return out;
+}
+
+void RayBlock::pack(const LightObject *lights, int numSceneObjects, int numNodes,
+                    const SettingsData &settingsData) {
+    // Zero the padding too, so unchanged frames compare equal
+    std::memset(static_cast<void*>(this), 0, sizeof(RayBlock));
+
+    sceneLights[0] = packLight(lights[0], settingsData.l1Intensity);
+    sceneLights[1] = packLight(lights[1], settingsData.l2Intensity);
+    sceneLights[2] = packLight(lights[2], settingsData.l3Intensity);
+
+    globalData = ::globalData;
+    settings.data = settingsData;
+    numObjects = numSceneObjects;
+    numBVHNodes = numNodes;
+}
+
+bool RayBlock::operator==(const RayBlock &that) const {
+    return std::memcmp(this, &that, sizeof(RayBlock)) == 0;
+}
+
+bool RayBlock::operator!=(const RayBlock &that) const {
+    return !(*this == that);
+}
@@ -0,0 +1,51 @@
+#ifndef RAYBLOCK_H
+#define RAYBLOCK_H
+
+#include "scenedata.h"
+
+// [STD140 LAYOUT]
+//////////////////////////////////////////
+// C++ mirrors of the structs in ray.frag's RayBlock uniform block.
+// Every member sits at its std140 offset; the explicit padding also means
+// there are no hidden bytes, so two blocks can be compared with memcmp.
+
+struct LightObjectStd140{
+    glm::vec4 color;
+    glm::vec4 pos;
+    glm::vec4 dir;
+    glm::vec3 function;
+    float lightIntensitySetting;
+    int type;
+    int pad0[3];
+};
+static_assert(sizeof(LightObjectStd140) == 80, "LightObject std140 size");
+
+struct SettingsDataStd140{
+    SettingsData data;
+};
+static_assert(sizeof(SettingsDataStd140) == 80, "SettingsData std140 size");
+static_assert(sizeof(GlobalData) == 16, "GlobalData std140 size");
+
+/**
+  [RAY BLOCK]
+  Lights, global data and settings for the ray program, packed so they can be
+  uploaded to a UBO in a single call. The objects themselves go in a SceneBuffer
+  and the BVH over them in its own buffer texture.
+**/
+struct RayBlock{
+    LightObjectStd140 sceneLights[NUM_SCENE_LIGHTS];
+    GlobalData globalData;
+    SettingsDataStd140 settings;
+    int numObjects;
+    int numBVHNodes;
+    int pad0[2];
+
+    // lights holds NUM_SCENE_LIGHTS lights (Scene::lights)
+    void pack(const LightObject *lights, int numSceneObjects, int numNodes,
+              const SettingsData &settingsData);
+
+    bool operator==(const RayBlock &that) const;
+    bool operator!=(const RayBlock &that) const;
+};
+
+#endif // RAYBLOCK_H
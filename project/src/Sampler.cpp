@@ -0,0 +1,109 @@
+#include "Sampler.h"
+
+#include <algorithm>
+
+namespace {
+
+// lowbias32 integer hash (Chris Wellons)
+uint32_t hashUint(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t hashCombine(uint32_t seed, uint32_t v) {
+    return seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+// bitfieldReverse in GLSL
+uint32_t reverseBits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+    return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+// Second Sobol dimension, the first is reverseBits(index)
+uint32_t sobolSecondDimension(uint32_t index) {
+    uint32_t result = 0u;
+    for (uint32_t v = 1u << 31; index != 0u; index >>= 1, v ^= v >> 1) {
+        if (index & 1u) {
+            result ^= v;
+        }
+    }
+    return result;
+}
+
+// 2^32 / golden ratio, the R1 sequence in 0.32 fixed point
+const uint32_t GOLDEN_RATIO_FIXED = 2654435769u;
+
+// Top 24 bits, exactly representable as a float in [0, 1)
+float toUnitFloat(uint32_t x) {
+    return static_cast<float>(x >> 8) * (1.f / 16777216.f);
+}
+
+} // namespace
+
+Sampler Sampler::forPixel(int x, int y, uint32_t index, const CS123::CPU::Image *blueNoise) {
+    Sampler sampler;
+    sampler.seed = hashUint(static_cast<uint32_t>(x) ^ hashUint(static_cast<uint32_t>(y)));
+    sampler.index = index;
+    sampler.x = x;
+    sampler.y = y;
+    sampler.blueNoise = blueNoise && !blueNoise->isNull() ? blueNoise : nullptr;
+    return sampler;
+}
+
+glm::vec2 Sampler::get2D(SampleDimension dimension, int i, int count) const {
+    if (blueNoise) {
+        return getBlueNoise2D(dimension, i);
+    }
+    uint32_t dimensionSeed = hashCombine(seed, hashUint(static_cast<uint32_t>(dimension)));
+    uint32_t shuffled = nestedUniformScramble(index * static_cast<uint32_t>(count) + static_cast<uint32_t>(i),
+                                              dimensionSeed);
+    uint32_t x = nestedUniformScramble(reverseBits(shuffled), hashCombine(dimensionSeed, 0u));
+    uint32_t y = nestedUniformScramble(sobolSecondDimension(shuffled), hashCombine(dimensionSeed, 1u));
+    return glm::vec2(toUnitFloat(x), toUnitFloat(y));
+}
+
+// Sub-samples (the i of get2D) read the tiles at different positions, and every
+// sample index moves the values along the golden ratio sequence
+glm::vec2 Sampler::getBlueNoise2D(SampleDimension dimension, int i) const {
+    int size = blueNoise->width;
+    int numLayers = std::max(blueNoise->height / size, 1);
+    uint32_t offset = hashUint(static_cast<uint32_t>(dimension) * 0x9e3779b9u + static_cast<uint32_t>(i));
+    int tx = (x + static_cast<int>(offset & 0xffffu)) % size;
+    int ty = (y + static_cast<int>(offset >> 16)) % size;
+    int layer = (2 * dimension) % numLayers;
+    int nextLayer = (2 * dimension + 1) % numLayers;
+
+    auto texel = [&](int l) {
+        return static_cast<uint32_t>(blueNoise->rgba[4 * ((l * size + ty) * size + tx)]);
+    };
+    uint32_t shift = index * GOLDEN_RATIO_FIXED;
+    return glm::vec2(toUnitFloat((texel(layer) << 24) + shift),
+                     toUnitFloat((texel(nextLayer) << 24) + shift));
+}
+
+Sampler Sampler::split(int i, int count) const {
+    Sampler sampler = *this;
+    sampler.index = index * static_cast<uint32_t>(count) + static_cast<uint32_t>(i);
+    return sampler;
+}
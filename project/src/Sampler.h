@@ -0,0 +1,58 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+#include "cpu/Image.h"
+
+// What a sample is drawn for; each gets its own scrambling, so they are uncorrelated
+enum SampleDimension {
+    SAMPLE_AA,          // jitter within the pixel
+    SAMPLE_DOF,         // position on the lens
+    SAMPLE_AO,          // AO ray direction
+    SAMPLE_ADAPTIVE     // dithering of the adaptive sample count
+};
+
+/**
+  [SAMPLER]
+  Random numbers for the ray tracers. A draw is addressed by pixel, the pixel's
+  sample index and a SampleDimension, and comes from the first two dimensions
+  of the Sobol sequence, shuffled and Owen scrambled per pixel and dimension
+  (Burley 2020, "Practical Hash-based Owen Scrambling"). Each dimension stays
+  stratified over a pixel's samples, so accumulated passes converge faster
+  than with independent random numbers, and neighbouring pixels are not
+  correlated.
+
+  With a blue noise texture set, draws instead come from its tiles (layers of
+  size x size, stacked top to bottom): each dimension reads a pair of layers at
+  a shifted position and adds a golden ratio offset per sample index, so one
+  sample per pixel already has its error at high frequencies, where a blur or
+  temporal filter removes it cheaply. data/bluenoise.pgm has a pair of layers
+  for every SampleDimension; a set with fewer wraps around, and the dimensions
+  that share layers are then correlated.
+
+  ray.frag has the same functions in its [SAMPLER] section and gets the same bits.
+**/
+struct Sampler {
+    uint32_t seed;      // scrambles every dimension of one pixel
+    uint32_t index;     // sample index within the pixel
+    int x;
+    int y;
+    const CS123::CPU::Image *blueNoise; // nullptr for the Sobol sampler
+
+    static Sampler forPixel(int x, int y, uint32_t index, const CS123::CPU::Image *blueNoise = nullptr);
+
+    // A point in [0, 1)^2. Nested loops draw count points per sample, i picks one
+    // (e.g. the i-th of count AO rays)
+    glm::vec2 get2D(SampleDimension dimension, int i = 0, int count = 1) const;
+
+    // The sampler for the i-th of count sub-samples (e.g. DOF rays within a sample)
+    Sampler split(int i, int count) const;
+
+private:
+    glm::vec2 getBlueNoise2D(SampleDimension dimension, int i) const;
+};
+
+#endif // SAMPLER_H
@@ -0,0 +1,73 @@
+#include "Scene.h"
+
+namespace {
+    // Keeps surfaces that lie exactly on a box face from being culled by rounding
+    const float BOUNDS_EPSILON = 1e-4f;
+
+    bool sameMaterial(const Material &a, const Material &b) {
+        return a.cDiffuse == b.cDiffuse && a.cAmbient == b.cAmbient &&
+               a.cSpecular == b.cSpecular && a.cReflective == b.cReflective &&
+               a.shininess == b.shininess && a.blend == b.blend && a.texID == b.texID &&
+               a.repeatU == b.repeatU && a.repeatV == b.repeatV;
+    }
+}
+
+void Scene::assign(const std::vector<SceneObject> &objects) {
+    size_t numObjects = objects.size();
+    primitives.resize(numObjects);
+    objectToWorld.resize(numObjects);
+    worldToObject.resize(numObjects);
+    normalToWorld.resize(numObjects);
+    bounds.resize(numObjects);
+    materialIndex.resize(numObjects);
+    meshIndex.resize(numObjects);
+    materials.clear();
+
+    // Done once per object per frame here so the ray program never inverts a matrix
+    for (size_t i = 0; i < numObjects; i++) {
+        const SceneObject &obj = objects[i];
+        primitives[i] = obj.primitive;
+        objectToWorld[i] = obj.objectToWorld;
+        worldToObject[i] = glm::inverse(obj.objectToWorld);
+        normalToWorld[i] = glm::transpose(glm::mat3x3(worldToObject[i]));
+        meshIndex[i] = obj.primitive == ShapeType::MESH ? obj.mesh : -1;
+        bounds[i] = meshIndex[i] >= 0 ? objectBounds(obj.objectToWorld, meshes[meshIndex[i]]->bounds)
+                                      : objectBounds(obj.objectToWorld);
+
+        // A scene has a handful of materials, a linear search beats hashing them
+        int material = 0;
+        while (material < static_cast<int>(materials.size()) &&
+               !sameMaterial(materials[material], obj.material)) {
+            material++;
+        }
+        if (material == static_cast<int>(materials.size())) {
+            materials.push_back(obj.material);
+        }
+        materialIndex[i] = material;
+    }
+}
+
+int Scene::size() const {
+    return static_cast<int>(primitives.size());
+}
+
+const Material& Scene::material(int object) const {
+    return materials[materialIndex[object]];
+}
+
+AABB Scene::objectBounds(const glm::mat4x4 &objectToWorld) {
+    return objectBounds(objectToWorld, {glm::vec3(-.5f), glm::vec3(.5f)});
+}
+
+AABB Scene::objectBounds(const glm::mat4x4 &objectToWorld, const AABB &objectSpaceBounds) {
+    AABB box = AABB::empty();
+    for (int i = 0; i < 8; i++) {
+        glm::vec4 corner(i & 1 ? objectSpaceBounds.max.x : objectSpaceBounds.min.x,
+                         i & 2 ? objectSpaceBounds.max.y : objectSpaceBounds.min.y,
+                         i & 4 ? objectSpaceBounds.max.z : objectSpaceBounds.min.z, 1.f);
+        box.grow(glm::vec3(objectToWorld * corner));
+    }
+    box.min -= glm::vec3(BOUNDS_EPSILON);
+    box.max += glm::vec3(BOUNDS_EPSILON);
+    return box;
+}
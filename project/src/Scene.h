@@ -0,0 +1,61 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <memory>
+#include <vector>
+
+#include "scenedata.h"
+#include "BVH.h"
+#include "Mesh.h"
+
+/**
+  [SCENE]
+  The objects SceneBuilder puts out, in structure of arrays layout. This is the
+  runtime form of a scene: the BVH, both ray tracers and SceneBuffer (the GPU
+  upload) all read it, and nothing past SceneBuilder sees a SceneObject.
+
+  An intersection test only needs an object's primitive and worldToObject
+  matrix, so those get arrays of their own and a BVH leaf's tests touch 68
+  bytes an object instead of a whole SceneObject. Shading looks up the
+  materials table through materialIndex once the closest hit is known.
+
+  The table holds each distinct material once. The preset scenes reuse a few
+  materials across their objects, and a large scene is mostly copies of a few
+  looks, so an object costs its matrices plus an index.
+
+  Triangle meshes are shared the same way: MESH objects refer to one of meshes,
+  which copies of the scene (the CPU tracer keeps one) share instead of copying.
+**/
+struct Scene{
+    // Per object, all of size()
+    std::vector<ShapeType> primitives;
+    std::vector<glm::mat4x4> objectToWorld;
+    std::vector<glm::mat4x4> worldToObject; // inverse(objectToWorld)
+    std::vector<glm::mat3x3> normalToWorld; // transpose(mat3x3(worldToObject))
+    std::vector<AABB> bounds;               // world space, see objectBounds
+    std::vector<int> materialIndex;         // into materials
+    std::vector<int> meshIndex;             // into meshes, -1 unless the primitive is MESH
+
+    std::vector<Material> materials;
+
+    // Set before assign, which needs their bounds
+    std::vector<std::shared_ptr<const Mesh>> meshes;
+
+    // The preset scenes all share these, a scene file brings its own
+    LightObject lights[NUM_SCENE_LIGHTS] = {lightObject1, lightObject2, lightObject3};
+
+    // Replaces the contents with objects, deriving the inverse matrices and bounds
+    // and collecting the distinct materials in order of first use. The arrays keep
+    // their storage, so an animated scene can be assigned every frame
+    void assign(const std::vector<SceneObject> &objects);
+
+    int size() const;
+    const Material& material(int object) const;
+
+    // World space bounds of an object, from the unit cube every primitive fits in
+    // or from a mesh's object space bounds
+    static AABB objectBounds(const glm::mat4x4 &objectToWorld);
+    static AABB objectBounds(const glm::mat4x4 &objectToWorld, const AABB &objectSpaceBounds);
+};
+
+#endif // SCENE_H
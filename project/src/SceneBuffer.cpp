@@ -0,0 +1,46 @@
+#include "SceneBuffer.h"
+
+#include "Scene.h"
+#include "MeshBuffer.h"
+
+void SceneBuffer::pack(const Scene &scene, const std::vector<int> &order) {
+    texels.resize(order.size() * TEXELS_PER_OBJECT);
+    std::vector<int> meshRoots = MeshBuffer::rootNodes(scene);
+
+    glm::vec4 *out = texels.data();
+    for (int index : order) {
+        for (int col = 0; col < 4; col++) {
+            out[col] = scene.objectToWorld[index][col];
+            out[4 + col] = scene.worldToObject[index][col];
+        }
+        int mesh = scene.meshIndex[index];
+        out[8] = glm::vec4(static_cast<float>(scene.primitives[index]),
+                           static_cast<float>(scene.materialIndex[index]),
+                           mesh >= 0 ? static_cast<float>(meshRoots[mesh]) : 0.f, 0.f);
+        out += TEXELS_PER_OBJECT;
+    }
+
+    materialTexels.resize(scene.materials.size() * TEXELS_PER_MATERIAL);
+    out = materialTexels.data();
+    for (const Material &material : scene.materials) {
+        out[0] = material.cDiffuse;
+        out[1] = material.cAmbient;
+        out[2] = material.cSpecular;
+        out[3] = material.cReflective;
+        out[4] = glm::vec4(material.shininess, material.blend, static_cast<float>(material.texID), 0.f);
+        out[5] = glm::vec4(material.repeatU, material.repeatV, 0.f, 0.f);
+        out += TEXELS_PER_MATERIAL;
+    }
+}
+
+int SceneBuffer::numObjects() const {
+    return static_cast<int>(texels.size()) / TEXELS_PER_OBJECT;
+}
+
+int SceneBuffer::sizeInBytes() const {
+    return static_cast<int>(texels.size() * sizeof(glm::vec4));
+}
+
+int SceneBuffer::materialsSizeInBytes() const {
+    return static_cast<int>(materialTexels.size() * sizeof(glm::vec4));
+}
@@ -0,0 +1,50 @@
+#ifndef SCENEBUFFER_H
+#define SCENEBUFFER_H
+
+#include <vector>
+
+#include "scenedata.h"
+
+struct Scene;
+
+/**
+  [SCENE BUFFER]
+  A scene (see [SCENE]) flattened into RGBA32F texels for two of ray.frag's
+  samplerBuffers, so scenes can hold any number of objects and materials.
+  Each object takes TEXELS_PER_OBJECT consecutive texels of sceneObjectBuffer;
+  the getObject* functions in ray.frag read them back in the same order:
+
+    0-3   objectToWorld columns
+    4-7   worldToObject columns (ray.frag derives normalToWorld from these)
+    8     primitive, material index, root node of the mesh (MESH only, see MeshBuffer)
+
+  Objects are packed in BVH::objectOrder(), so the BVH's leaves can address
+  them by position.
+
+  The material table goes to materialBuffer, TEXELS_PER_MATERIAL texels each,
+  in the scene's order:
+
+    0     cDiffuse
+    1     cAmbient
+    2     cSpecular
+    3     cReflective
+    4     shininess, blend, texID
+    5     repeatU, repeatV
+
+  Materials don't change while a scene animates, so View only uploads them
+  again when the scene does.
+**/
+struct SceneBuffer{
+    static const int TEXELS_PER_OBJECT = 9;
+    static const int TEXELS_PER_MATERIAL = 6;
+
+    std::vector<glm::vec4> texels;
+    std::vector<glm::vec4> materialTexels;
+
+    void pack(const Scene &scene, const std::vector<int> &order);
+    int numObjects() const;
+    int sizeInBytes() const;
+    int materialsSizeInBytes() const;
+};
+
+#endif // SCENEBUFFER_H
@@ -14,13 +14,21 @@ SceneBuilder::SceneBuilder()
 
 std::vector<SceneObject> SceneBuilder::getScene(float time)
 {
+    std::vector<SceneObject> scene;
     if (settings.modeScene == 0) {
-        return SceneBuilder::buildScene0(time);
+        scene = SceneBuilder::buildScene0(time);
     } else if (settings.modeScene == 1) {
-        return SceneBuilder::buildScene1(time);
+        scene = SceneBuilder::buildScene1(time);
     } else {
-        return SceneBuilder::buildScene2(time);
+        scene = SceneBuilder::buildScene2(time);
     }
+    return scene;
+}
+
+// The first scene uses the second environment map
+int SceneBuilder::getEnvironment()
+{
+    return settings.modeScene == 0 ? 2 : 1;
 }
 
 std::vector<SceneObject> SceneBuilder::buildScene0(float time)
@@ -9,8 +9,12 @@ class SceneBuilder
 public:
     SceneBuilder();
 
+    // The objects of the current scene mode, for Scene::assign
     static std::vector<SceneObject> getScene(float time);
 
+    // Environment map of the current scene mode, 1 or 2 like a scene file's
+    static int getEnvironment();
+
     static std::vector<SceneObject> buildScene0(float time);
 
     static std::vector<SceneObject> buildScene1(float time);
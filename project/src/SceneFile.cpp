@@ -0,0 +1,705 @@
+#include "SceneFile.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QMap>
+#include <QStringList>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "glm/gtx/transform.hpp"  // glm::translate, scale, rotate
+#include "glm/gtc/type_ptr.hpp"   // glm::make_mat4
+
+#include "Scene.h"
+#include "SceneBuffer.h"
+#include "MeshBuffer.h"
+#include "BVH.h"
+#include "Mesh.h"
+
+namespace {
+    const char CACHE_MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+
+    // Sections of the cache, the first four are SceneFile::Texels
+    enum Section {
+        PRIMITIVES = SceneFile::MESH_TEXELS + 1,
+        OBJECT_TO_WORLD,
+        WORLD_TO_OBJECT,
+        NORMAL_TO_WORLD,
+        BOUNDS,
+        MATERIAL_INDEX,
+        MATERIALS,
+        LIGHTS,
+        BVH_NODES,
+        OBJECT_ORDER,
+        MESH_INDEX,
+        MESHES,              // a CachedMesh each
+        MESH_SOURCES,        // their files' paths, one per line
+        MESH_POSITIONS,      // the buffers of every mesh, one mesh after the other
+        MESH_NORMALS,
+        MESH_UVS,
+        MESH_TRIANGLES,
+        MESH_NODES,
+        MESH_TRIANGLE_ORDER, // the meshes' BVH::objectOrder()
+        NUM_SECTIONS
+    };
+
+    // What the cache keeps of a mesh besides its buffers
+    struct CachedMesh {
+        qint32 numVertices;
+        qint32 numTriangles;
+        qint32 numNodes;
+        qint32 padding;
+
+        // The file it was loaded from
+        qint64 sourceSize;
+        qint64 sourceModified;
+
+        AABB bounds;
+    };
+
+    // Sections start on 16 bytes, so the texels are aligned like any vec4 array
+    qint64 alignSection(qint64 offset) {
+        return (offset + 15) & ~qint64(15);
+    }
+
+    const Material DEFAULT_MATERIAL = {glm::vec4(1.f), glm::vec4(0.f, 0.f, 0.f, 1.f),
+                                       glm::vec4(0.f, 0.f, 0.f, 1.f), glm::vec4(0.f, 0.f, 0.f, 1.f),
+                                       1.f, 0.f, 0, 1.f, 1.f};
+
+    // texID by name, see RayTracer::setTexture
+    const char *TEXTURE_NAMES[3] = {"metal", "wood", "plaster"};
+
+    const char *PRIMITIVE_NAMES[4] = {"sphere", "cube", "cone", "cylinder"};
+
+    // Reads words[first, first + count) into out, false unless that is all of them and all are numbers
+    bool toNumbers(const QStringList &words, int first, int count, float *out) {
+        if (words.size() != first + count) {
+            return false;
+        }
+        bool ok = true;
+        for (int i = 0; i < count && ok; i++) {
+            out[i] = words[first + i].toFloat(&ok);
+        }
+        return ok;
+    }
+
+    int indexOf(const char *const *names, int numNames, const QString &name) {
+        for (int i = 0; i < numNames; i++) {
+            if (name == names[i]) {
+                return i;
+            }
+        }
+        return -1;
+    }
+}
+
+struct SceneFile::Header {
+    char magic[8];
+    qint32 version;
+    qint32 environment;
+
+    // The text the cache was compiled from
+    qint64 sourceSize;
+    qint64 sourceModified; // ms since the epoch
+
+    qint32 hasCamera;
+    float camera[3];       // angleX, angleY, zoom
+
+    qint64 offsets[NUM_SECTIONS];
+    qint64 sizes[NUM_SECTIONS];
+};
+
+struct SceneFile::Description {
+    std::vector<SceneObject> objects;
+    std::vector<std::shared_ptr<const Mesh>> meshes;
+    QStringList meshPaths;
+    LightObject lights[NUM_SCENE_LIGHTS];
+    int environment;
+    bool hasCamera;
+    OrbitCamera camera;
+};
+
+SceneFile::SceneFile() :
+    m_mapping(nullptr),
+    m_header(nullptr),
+    m_environment(1),
+    m_hasCamera(false),
+    m_camera({0.f, 0.f, 10.f}),
+    m_bytesSaved(0)
+{
+}
+
+SceneFile::~SceneFile()
+{
+    unmap();
+}
+
+bool SceneFile::load(const QString &path, Scene &scene, BVH &bvh, QString &error) {
+    m_bytesSaved = 0;
+    m_cacheWarning.clear();
+    QString cache = cachePath(path);
+    if (!map(cache) || !upToDate(path)) {
+        // parse takes the meshes that didn't change out of the old cache, so it stays mapped until then
+        Description description;
+        bool parsed = parse(path, description, error);
+        unmap();
+        if (!parsed) {
+            return false;
+        }
+        QByteArray contents = compile(description, path);
+        if (!save(cache, contents, m_cacheWarning) || !map(cache) || !upToDate(path)) {
+            if (m_cacheWarning.isEmpty()) {
+                m_cacheWarning = "Can't read back " + cache;
+            }
+            useCompiled(contents);
+        }
+    }
+
+    int count;
+    const ShapeType *primitives = section<ShapeType>(PRIMITIVES, count);
+    scene.primitives.assign(primitives, primitives + count);
+    const glm::mat4x4 *objectToWorld = section<glm::mat4x4>(OBJECT_TO_WORLD, count);
+    scene.objectToWorld.assign(objectToWorld, objectToWorld + count);
+    const glm::mat4x4 *worldToObject = section<glm::mat4x4>(WORLD_TO_OBJECT, count);
+    scene.worldToObject.assign(worldToObject, worldToObject + count);
+    const glm::mat3x3 *normalToWorld = section<glm::mat3x3>(NORMAL_TO_WORLD, count);
+    scene.normalToWorld.assign(normalToWorld, normalToWorld + count);
+    const AABB *bounds = section<AABB>(BOUNDS, count);
+    scene.bounds.assign(bounds, bounds + count);
+    const int *materialIndex = section<int>(MATERIAL_INDEX, count);
+    scene.materialIndex.assign(materialIndex, materialIndex + count);
+    const Material *materials = section<Material>(MATERIALS, count);
+    scene.materials.assign(materials, materials + count);
+    const LightObject *lights = section<LightObject>(LIGHTS, count);
+    std::copy(lights, lights + count, scene.lights);
+    const int *meshIndex = section<int>(MESH_INDEX, count);
+    scene.meshIndex.assign(meshIndex, meshIndex + count);
+
+    int numMeshes;
+    section<CachedMesh>(MESHES, numMeshes);
+    scene.meshes.clear();
+    for (int i = 0; i < numMeshes; i++) {
+        scene.meshes.push_back(cachedMesh(i));
+    }
+
+    int numNodes;
+    const BVH::Node *nodes = section<BVH::Node>(BVH_NODES, numNodes);
+    const int *objectOrder = section<int>(OBJECT_ORDER, count);
+    bvh.assign(nodes, numNodes, objectOrder, count);
+
+    m_environment = m_header->environment;
+    m_hasCamera = m_header->hasCamera != 0;
+    m_camera = {m_header->camera[0], m_header->camera[1], m_header->camera[2]};
+    return true;
+}
+
+int SceneFile::environment() const {
+    return m_environment;
+}
+
+bool SceneFile::hasCamera() const {
+    return m_hasCamera;
+}
+
+const OrbitCamera& SceneFile::camera() const {
+    return m_camera;
+}
+
+const void* SceneFile::texels(Texels buffer) const {
+    return m_mapping + m_header->offsets[buffer];
+}
+
+int SceneFile::texelsSizeInBytes(Texels buffer) const {
+    return static_cast<int>(m_header->sizes[buffer]);
+}
+
+qint64 SceneFile::bytesSaved() const {
+    return m_bytesSaved;
+}
+
+const QString& SceneFile::cacheWarning() const {
+    return m_cacheWarning;
+}
+
+QString SceneFile::cachePath(const QString &path) {
+    return path + ".bin";
+}
+
+bool SceneFile::parse(const QString &path, Description &description, QString &error) const {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        error = "Can't read " + path;
+        return false;
+    }
+
+    description.objects.clear();
+    description.meshes.clear();
+    description.meshPaths.clear();
+    std::fill(description.lights, description.lights + NUM_SCENE_LIGHTS, lightObjectOff);
+    description.environment = 1;
+    description.hasCamera = false;
+    description.camera = m_camera;
+
+    QMap<QString, Material> materials;
+    QMap<QString, int> meshes;   // into description.meshes
+    QString currentMaterial;     // the one the indented statements set, if any
+    int currentObject = -1;      // same for objects
+    int numLights = 0;
+
+    // Materials may be defined after the objects that use them, so names are looked up at the end
+    QStringList objectMaterials;
+    std::vector<int> objectLines;
+
+    int lineNumber = 0;
+    auto fail = [&](const QString &message) {
+        error = QString("%1:%2: %3").arg(path).arg(lineNumber).arg(message);
+        return false;
+    };
+
+    while (!file.atEnd()) {
+        QString line = QString::fromUtf8(file.readLine());
+        lineNumber++;
+        int comment = line.indexOf('#');
+        if (comment >= 0) {
+            line.truncate(comment);
+        }
+        QStringList words = line.simplified().split(' ', QString::SkipEmptyParts);
+        if (words.isEmpty()) {
+            continue;
+        }
+        QString keyword = words.takeFirst();
+        float v[16];
+
+        if (keyword == "camera") {
+            if (!toNumbers(words, 0, 3, v)) {
+                return fail("camera takes angleX angleY zoom");
+            }
+            description.hasCamera = true;
+            description.camera = {v[0], v[1], v[2]};
+        } else if (keyword == "environment") {
+            bool ok = false;
+            int environment = words.value(0).toInt(&ok);
+            if (words.size() != 1 || !ok || environment < 1 || environment > 2) {
+                return fail("environment is 1 or 2");
+            }
+            description.environment = environment;
+        } else if (keyword == "light") {
+            if (numLights == NUM_SCENE_LIGHTS) {
+                return fail(QString("A scene has at most %1 lights").arg(NUM_SCENE_LIGHTS));
+            }
+            LightObject light = lightObjectOff;
+            if (words.value(0) == "point" && toNumbers(words, 1, 9, v)) {
+                light.pos = glm::vec4(v[3], v[4], v[5], 1.f);
+                light.function = glm::vec3(v[6], v[7], v[8]);
+            } else if (words.value(0) == "directional" && toNumbers(words, 1, 6, v)) {
+                light.dir = glm::vec4(v[3], v[4], v[5], 0.f);
+                light.type = ShapeType::LIGHT_DIRECTIONAL;
+            } else {
+                return fail("light takes point <r g b> <x y z> <a b c> or directional <r g b> <x y z>");
+            }
+            light.color = glm::vec4(v[0], v[1], v[2], 1.f);
+            description.lights[numLights++] = light;
+        } else if (keyword == "material") {
+            if (words.size() != 1) {
+                return fail("material takes a name");
+            }
+            currentMaterial = words[0];
+            currentObject = -1;
+            materials[currentMaterial] = DEFAULT_MATERIAL;
+        } else if (keyword == "mesh") {
+            if (words.size() < 2) {
+                return fail("mesh takes a name and an .obj or .ply file");
+            }
+            if (indexOf(PRIMITIVE_NAMES, 4, words[0]) >= 0 || meshes.contains(words[0])) {
+                return fail("There is a primitive or mesh named " + words[0] + " already");
+            }
+            QString meshPath = QFileInfo(path).absoluteDir().filePath(words.mid(1).join(' '));
+            std::shared_ptr<const Mesh> mesh = unchangedMesh(meshPath);
+            std::string meshError;
+            if (!mesh) {
+                std::shared_ptr<Mesh> loaded = std::make_shared<Mesh>();
+                if (!Mesh::load(meshPath.toStdString(), *loaded, meshError)) {
+                    return fail(QString::fromStdString(meshError));
+                }
+                mesh = loaded;
+            }
+            meshes[words[0]] = static_cast<int>(description.meshes.size());
+            description.meshes.push_back(mesh);
+            description.meshPaths.append(meshPath);
+            if (!MeshBuffer::fits(description.meshes, meshError)) {
+                return fail(QString::fromStdString(meshError));
+            }
+            currentObject = -1;
+            currentMaterial.clear();
+        } else if (keyword == "object") {
+            int primitive = indexOf(PRIMITIVE_NAMES, 4, words.value(0));
+            int mesh = meshes.value(words.value(0), -1);
+            if (words.size() != 2 || (primitive < 0 && mesh < 0)) {
+                return fail("object takes <sphere|cube|cone|cylinder|mesh name> <material>");
+            }
+            if (static_cast<int>(description.objects.size()) == BVH::MAX_PACKED_OBJECTS) {
+                return fail(QString("A scene has at most %1 objects, as many as the GPU BVH can index")
+                            .arg(BVH::MAX_PACKED_OBJECTS));
+            }
+            ShapeType shape = primitive >= 0 ? static_cast<ShapeType>(primitive) : ShapeType::MESH;
+            description.objects.push_back({shape, glm::mat4x4(1.f), DEFAULT_MATERIAL, mesh});
+            objectMaterials.append(words[1]);
+            objectLines.push_back(lineNumber);
+            currentObject = static_cast<int>(description.objects.size()) - 1;
+            currentMaterial.clear();
+        } else if (keyword == "diffuse" || keyword == "ambient" || keyword == "specular" ||
+                   keyword == "reflective" || keyword == "shininess" || keyword == "texture") {
+            if (currentMaterial.isEmpty()) {
+                return fail(keyword + " belongs to a material");
+            }
+            Material &material = materials[currentMaterial];
+            if (keyword == "shininess" && toNumbers(words, 0, 1, v)) {
+                material.shininess = v[0];
+            } else if (keyword == "texture" && indexOf(TEXTURE_NAMES, 3, words.value(0)) >= 0 &&
+                       toNumbers(words, 1, 3, v)) {
+                material.texID = indexOf(TEXTURE_NAMES, 3, words[0]);
+                material.blend = v[0];
+                material.repeatU = v[1];
+                material.repeatV = v[2];
+            } else if (toNumbers(words, 0, 3, v) || toNumbers(words, 0, 4, v)) {
+                glm::vec4 color(v[0], v[1], v[2], words.size() == 4 ? v[3] : 1.f);
+                if (keyword == "diffuse") {
+                    material.cDiffuse = color;
+                } else if (keyword == "ambient") {
+                    material.cAmbient = color;
+                } else if (keyword == "specular") {
+                    material.cSpecular = color;
+                } else if (keyword == "reflective") {
+                    material.cReflective = color;
+                } else {
+                    return fail("Wrong values for " + keyword);
+                }
+            } else {
+                return fail("Wrong values for " + keyword);
+            }
+        } else if (keyword == "translate" || keyword == "rotate" || keyword == "scale" || keyword == "matrix") {
+            if (currentObject < 0) {
+                return fail(keyword + " belongs to an object");
+            }
+            glm::mat4x4 &ctm = description.objects[currentObject].objectToWorld;
+            if (keyword == "translate" && toNumbers(words, 0, 3, v)) {
+                ctm = glm::translate(ctm, glm::vec3(v[0], v[1], v[2]));
+            } else if (keyword == "rotate" && toNumbers(words, 0, 4, v)) {
+                ctm = glm::rotate(ctm, glm::radians(v[0]), glm::vec3(v[1], v[2], v[3]));
+            } else if (keyword == "scale" && toNumbers(words, 0, 3, v)) {
+                ctm = glm::scale(ctm, glm::vec3(v[0], v[1], v[2]));
+            } else if (keyword == "scale" && toNumbers(words, 0, 1, v)) {
+                ctm = glm::scale(ctm, glm::vec3(v[0]));
+            } else if (keyword == "matrix" && toNumbers(words, 0, 16, v)) {
+                ctm = ctm * glm::transpose(glm::make_mat4(v));
+            } else {
+                return fail("Wrong values for " + keyword);
+            }
+        } else {
+            return fail("Unknown statement " + keyword);
+        }
+    }
+
+    for (size_t i = 0; i < description.objects.size(); i++) {
+        QMap<QString, Material>::const_iterator material = materials.constFind(objectMaterials[i]);
+        if (material == materials.constEnd()) {
+            lineNumber = objectLines[i];
+            return fail("No material named " + objectMaterials[i]);
+        }
+        description.objects[i].material = *material;
+    }
+    return true;
+}
+
+// Everything a load needs, computed the way View and HeadlessRenderer do for the preset scenes
+QByteArray SceneFile::compile(const Description &description, const QString &path) const {
+    Scene scene;
+    scene.meshes = description.meshes;
+    scene.assign(description.objects);
+    std::copy(description.lights, description.lights + NUM_SCENE_LIGHTS, scene.lights);
+    BVH bvh;
+    bvh.build(scene);
+    SceneBuffer sceneBuffer;
+    sceneBuffer.pack(scene, bvh.objectOrder());
+    std::vector<glm::vec4> bvhTexels;
+    bvh.pack(bvhTexels);
+    MeshBuffer meshBuffer;
+    meshBuffer.pack(scene);
+
+    // The meshes' buffers end to end, load splits them up again by their counts
+    std::vector<CachedMesh> meshes;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::ivec3> triangles;
+    std::vector<BVH::Node> meshNodes;
+    std::vector<int> triangleOrder;
+    for (size_t i = 0; i < description.meshes.size(); i++) {
+        const Mesh &mesh = *description.meshes[i];
+        QFileInfo source(description.meshPaths[static_cast<int>(i)]);
+        meshes.push_back({static_cast<qint32>(mesh.positions.size()), mesh.numTriangles(),
+                          static_cast<qint32>(mesh.bvh.nodes().size()), 0,
+                          source.size(), source.lastModified().toMSecsSinceEpoch(), mesh.bounds});
+        positions.insert(positions.end(), mesh.positions.begin(), mesh.positions.end());
+        normals.insert(normals.end(), mesh.normals.begin(), mesh.normals.end());
+        uvs.insert(uvs.end(), mesh.uvs.begin(), mesh.uvs.end());
+        triangles.insert(triangles.end(), mesh.triangles.begin(), mesh.triangles.end());
+        meshNodes.insert(meshNodes.end(), mesh.bvh.nodes().begin(), mesh.bvh.nodes().end());
+        triangleOrder.insert(triangleOrder.end(), mesh.bvh.objectOrder().begin(), mesh.bvh.objectOrder().end());
+    }
+    QByteArray meshSources = description.meshPaths.join('\n').toUtf8();
+
+    const void *data[NUM_SECTIONS];
+    qint64 sizes[NUM_SECTIONS];
+    auto add = [&](int index, const void *sectionData, size_t size) {
+        data[index] = sectionData;
+        sizes[index] = static_cast<qint64>(size);
+    };
+    add(OBJECT_TEXELS, sceneBuffer.texels.data(), sceneBuffer.sizeInBytes());
+    add(MATERIAL_TEXELS, sceneBuffer.materialTexels.data(), sceneBuffer.materialsSizeInBytes());
+    add(BVH_TEXELS, bvhTexels.data(), bvhTexels.size() * sizeof(glm::vec4));
+    add(MESH_TEXELS, meshBuffer.texels.data(), meshBuffer.sizeInBytes());
+    add(PRIMITIVES, scene.primitives.data(), scene.primitives.size() * sizeof(ShapeType));
+    add(OBJECT_TO_WORLD, scene.objectToWorld.data(), scene.objectToWorld.size() * sizeof(glm::mat4x4));
+    add(WORLD_TO_OBJECT, scene.worldToObject.data(), scene.worldToObject.size() * sizeof(glm::mat4x4));
+    add(NORMAL_TO_WORLD, scene.normalToWorld.data(), scene.normalToWorld.size() * sizeof(glm::mat3x3));
+    add(BOUNDS, scene.bounds.data(), scene.bounds.size() * sizeof(AABB));
+    add(MATERIAL_INDEX, scene.materialIndex.data(), scene.materialIndex.size() * sizeof(int));
+    add(MATERIALS, scene.materials.data(), scene.materials.size() * sizeof(Material));
+    add(LIGHTS, scene.lights, sizeof(scene.lights));
+    add(BVH_NODES, bvh.nodes().data(), bvh.nodes().size() * sizeof(BVH::Node));
+    add(OBJECT_ORDER, bvh.objectOrder().data(), bvh.objectOrder().size() * sizeof(int));
+    add(MESH_INDEX, scene.meshIndex.data(), scene.meshIndex.size() * sizeof(int));
+    add(MESHES, meshes.data(), meshes.size() * sizeof(CachedMesh));
+    add(MESH_SOURCES, meshSources.constData(), meshSources.size());
+    add(MESH_POSITIONS, positions.data(), positions.size() * sizeof(glm::vec3));
+    add(MESH_NORMALS, normals.data(), normals.size() * sizeof(glm::vec3));
+    add(MESH_UVS, uvs.data(), uvs.size() * sizeof(glm::vec2));
+    add(MESH_TRIANGLES, triangles.data(), triangles.size() * sizeof(glm::ivec3));
+    add(MESH_NODES, meshNodes.data(), meshNodes.size() * sizeof(BVH::Node));
+    add(MESH_TRIANGLE_ORDER, triangleOrder.data(), triangleOrder.size() * sizeof(int));
+
+    Header header;
+    std::memset(&header, 0, sizeof(Header));
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.environment = description.environment;
+    QFileInfo source(path);
+    header.sourceSize = source.size();
+    header.sourceModified = source.lastModified().toMSecsSinceEpoch();
+    header.hasCamera = description.hasCamera ? 1 : 0;
+    header.camera[0] = description.camera.angleX;
+    header.camera[1] = description.camera.angleY;
+    header.camera[2] = description.camera.zoom;
+
+    qint64 offset = alignSection(sizeof(Header));
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        header.offsets[i] = offset;
+        header.sizes[i] = sizes[i];
+        offset = alignSection(offset + sizes[i]);
+    }
+
+    QByteArray contents(static_cast<int>(offset), '\0');
+    std::memcpy(contents.data(), &header, sizeof(Header));
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        if (sizes[i] > 0) {
+            std::memcpy(contents.data() + header.offsets[i], data[i], sizes[i]);
+        }
+    }
+    return contents;
+}
+
+// A cache of the same size is patched through a mapping, page by page, and only
+// where the bytes differ. The header's page goes last: a save that is cut short
+// leaves the old header, which no longer matches the text, so the next load compiles again
+bool SceneFile::save(const QString &cachePath, const QByteArray &contents, QString &error) {
+    QFile file(cachePath);
+    if (file.size() == contents.size() && file.open(QIODevice::ReadWrite)) {
+        uchar *cache = file.map(0, file.size());
+        if (cache) {
+            qint64 size = contents.size();
+            for (qint64 page = (size - 1) / CACHE_PAGE_SIZE; page >= 0; page--) {
+                qint64 offset = page * CACHE_PAGE_SIZE;
+                size_t length = static_cast<size_t>(std::min<qint64>(CACHE_PAGE_SIZE, size - offset));
+                if (std::memcmp(cache + offset, contents.constData() + offset, length) != 0) {
+                    std::memcpy(cache + offset, contents.constData() + offset, length);
+                    m_bytesSaved += length;
+                }
+            }
+            file.unmap(cache);
+            return true;
+        }
+        file.close();
+    }
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(contents) != contents.size()) {
+        error = "Can't write " + cachePath;
+        return false;
+    }
+    m_bytesSaved = contents.size();
+    return true;
+}
+
+// False if there is no cache, or it is from another version or its sections don't fit the file
+bool SceneFile::map(const QString &cachePath) {
+    unmap();
+    m_cache.setFileName(cachePath);
+    if (!m_cache.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    qint64 size = m_cache.size();
+    if (size >= static_cast<qint64>(sizeof(Header))) {
+        m_mapping = m_cache.map(0, size);
+    }
+    if (!m_mapping) {
+        unmap();
+        return false;
+    }
+    m_header = reinterpret_cast<const Header*>(m_mapping);
+
+    bool valid = std::memcmp(m_header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+                 m_header->version == CACHE_VERSION &&
+                 m_header->sizes[LIGHTS] == static_cast<qint64>(sizeof(Scene::lights));
+    for (int i = 0; i < NUM_SECTIONS && valid; i++) {
+        valid = m_header->offsets[i] % 16 == 0 && m_header->sizes[i] >= 0 &&
+                m_header->offsets[i] + m_header->sizes[i] <= size;
+    }
+    valid = valid && validMeshes();
+    if (!valid) {
+        unmap();
+    }
+    return valid;
+}
+
+// The mapped cache was compiled from the text path holds now, and from the mesh files as they are now
+bool SceneFile::upToDate(const QString &path) const {
+    QFileInfo source(path);
+    if (m_header->sourceSize != source.size() ||
+        m_header->sourceModified != source.lastModified().toMSecsSinceEpoch()) {
+        return false;
+    }
+    QStringList paths = meshSources();
+    for (int i = 0; i < paths.size(); i++) {
+        if (!meshUnchanged(i, paths[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The mesh sections hold the buffers their table says
+bool SceneFile::validMeshes() const {
+    int numMeshes;
+    const CachedMesh *meshes = section<CachedMesh>(MESHES, numMeshes);
+    if (meshSources().size() != numMeshes) {
+        return false;
+    }
+
+    qint64 numVertices = 0;
+    qint64 numTriangles = 0;
+    qint64 numNodes = 0;
+    for (int i = 0; i < numMeshes; i++) {
+        const CachedMesh &mesh = meshes[i];
+        if (mesh.numVertices < 0 || mesh.numTriangles < 0 || mesh.numNodes < 0) {
+            return false;
+        }
+        numVertices += mesh.numVertices;
+        numTriangles += mesh.numTriangles;
+        numNodes += mesh.numNodes;
+    }
+    const qint64 *sizes = m_header->sizes;
+    return sizes[MESH_POSITIONS] == numVertices * static_cast<qint64>(sizeof(glm::vec3)) &&
+           sizes[MESH_NORMALS] == numVertices * static_cast<qint64>(sizeof(glm::vec3)) &&
+           sizes[MESH_UVS] == numVertices * static_cast<qint64>(sizeof(glm::vec2)) &&
+           sizes[MESH_TRIANGLES] == numTriangles * static_cast<qint64>(sizeof(glm::ivec3)) &&
+           sizes[MESH_NODES] == numNodes * static_cast<qint64>(sizeof(BVH::Node)) &&
+           sizes[MESH_TRIANGLE_ORDER] == numTriangles * static_cast<qint64>(sizeof(int));
+}
+
+// The files the mapped cache's meshes were loaded from, in order
+QStringList SceneFile::meshSources() const {
+    int size;
+    const char *sources = section<char>(MESH_SOURCES, size);
+    return size > 0 ? QString::fromUtf8(sources, size).split('\n') : QStringList();
+}
+
+// Mesh index of the mapped cache was loaded from meshPath as that file is now
+bool SceneFile::meshUnchanged(int index, const QString &meshPath) const {
+    int numMeshes;
+    const CachedMesh &mesh = section<CachedMesh>(MESHES, numMeshes)[index];
+    QFileInfo source(meshPath);
+    return source.size() == mesh.sourceSize && source.lastModified().toMSecsSinceEpoch() == mesh.sourceModified;
+}
+
+// Copies mesh index out of the mapped cache. Its buffers follow those of the meshes before it
+std::shared_ptr<Mesh> SceneFile::cachedMesh(int index) const {
+    int count;
+    const CachedMesh *meshes = section<CachedMesh>(MESHES, count);
+    const glm::vec3 *positions = section<glm::vec3>(MESH_POSITIONS, count);
+    const glm::vec3 *normals = section<glm::vec3>(MESH_NORMALS, count);
+    const glm::vec2 *uvs = section<glm::vec2>(MESH_UVS, count);
+    const glm::ivec3 *triangles = section<glm::ivec3>(MESH_TRIANGLES, count);
+    const BVH::Node *nodes = section<BVH::Node>(MESH_NODES, count);
+    const int *triangleOrder = section<int>(MESH_TRIANGLE_ORDER, count);
+    for (int i = 0; i < index; i++) {
+        positions += meshes[i].numVertices;
+        normals += meshes[i].numVertices;
+        uvs += meshes[i].numVertices;
+        triangles += meshes[i].numTriangles;
+        nodes += meshes[i].numNodes;
+        triangleOrder += meshes[i].numTriangles;
+    }
+
+    const CachedMesh &cached = meshes[index];
+    std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+    mesh->positions.assign(positions, positions + cached.numVertices);
+    mesh->normals.assign(normals, normals + cached.numVertices);
+    mesh->uvs.assign(uvs, uvs + cached.numVertices);
+    mesh->triangles.assign(triangles, triangles + cached.numTriangles);
+    mesh->bvh.assign(nodes, cached.numNodes, triangleOrder, cached.numTriangles);
+    mesh->bounds = cached.bounds;
+    return mesh;
+}
+
+// The mapped cache's mesh from meshPath if that file hasn't changed since, so a
+// text edit doesn't load and build it again. nullptr if there is none
+std::shared_ptr<const Mesh> SceneFile::unchangedMesh(const QString &meshPath) const {
+    if (!m_header) {
+        return nullptr;
+    }
+    QStringList paths = meshSources();
+    for (int i = 0; i < paths.size(); i++) {
+        if (paths[i] == meshPath && meshUnchanged(i, meshPath)) {
+            return cachedMesh(i);
+        }
+    }
+    return nullptr;
+}
+
+// Reads the sections out of contents instead of a mapping of the cache, which
+// has the same layout. QByteArray's data is aligned well enough for every section
+void SceneFile::useCompiled(const QByteArray &contents) {
+    unmap();
+    m_compiled = contents;
+    m_mapping = reinterpret_cast<const uchar*>(m_compiled.constData());
+    m_header = reinterpret_cast<const Header*>(m_mapping);
+}
+
+void SceneFile::unmap() {
+    if (m_mapping && m_compiled.isEmpty()) {
+        m_cache.unmap(const_cast<uchar*>(m_mapping));
+    }
+    m_cache.close();
+    m_compiled.clear();
+    m_mapping = nullptr;
+    m_header = nullptr;
+}
+
+template <typename T>
+const T* SceneFile::section(int index, int &count) const {
+    count = static_cast<int>(m_header->sizes[index] / static_cast<qint64>(sizeof(T)));
+    return reinterpret_cast<const T*>(m_mapping + m_header->offsets[index]);
+}
@@ -0,0 +1,121 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+
+#include <memory>
+
+#include "OrbitCamera.h"
+#include "scenedata.h"
+
+struct Scene;
+class BVH;
+class Mesh;
+
+/**
+  [SCENE FILES]
+  Scenes described in a text file instead of SceneBuilder code, picked with
+  --scene-file. One statement per line, # starts a comment:
+
+    camera <angleX> <angleY> <zoom>          the orbit camera to start from
+    environment <1|2>                        cube map negz.jpg ... or negz1.jpg ...
+    light point <r g b> <x y z> <a b c>      attenuation 1 / (a + b d + c d^2)
+    light directional <r g b> <x y z>
+    material <name>
+      diffuse|ambient|specular|reflective <r g b [a]>
+      shininess <n>
+      texture <metal|wood|plaster> <blend> <repeatU> <repeatV>
+    mesh <name> <file>                       an .obj or .ply, relative to the scene file
+    object <sphere|cube|cone|cylinder|mesh name> <material name>
+      translate <x y z>
+      rotate <degrees> <x y z>
+      scale <x y z> or <s>
+      matrix <16 numbers, row by row>
+
+  The indented statements set the fields of the material or object above them.
+  An object's transforms multiply onto the right of the ones before, like the
+  glm calls in SceneBuilder. Up to NUM_SCENE_LIGHTS lights, the ones left out
+  are off. A mesh is named before the objects that place it, any number of
+  objects can share one (see [MESH]). Scene files are static: nothing animates.
+  Textures and the environment are picked from the ones View loads on its fixed
+  texture units, a scene file can't name image files of its own.
+
+  The text is only parsed when it or one of its meshes changed, and meshes whose
+  files didn't change come out of the old cache then. What comes out
+  is compiled into a binary cache next to it (cachePath): the Scene arrays, the
+  meshes with their BVHs, the scene's BVH and the texels of the four GPU
+  buffers (SceneBuffer, BVH::pack, MeshBuffer), a section each. Loading maps
+  the cache, copies the Scene and BVHs out of it and leaves the GPU sections in
+  the mapping, where View uploads them from, so a large scene loads in a few
+  memcpys and a large mesh without building its BVH again. After an edit the
+  cache is saved again in place, writing only the pages that changed, unless a
+  section changed size. The cache is only an optimisation: when it can't be
+  written (a read-only directory, say) the compiled scene is used from memory
+  and cacheWarning says why.
+**/
+class SceneFile {
+public:
+    // The GPU buffers in the cache, as SceneBuffer, BVH::pack and MeshBuffer lay them out
+    enum Texels { OBJECT_TEXELS, MATERIAL_TEXELS, BVH_TEXELS, MESH_TEXELS };
+
+    SceneFile();
+    ~SceneFile();
+
+    // Loads path into scene and bvh, from the cache if it was compiled from
+    // the file as it is now, and otherwise from the text, saving the cache again.
+    // Returns false and fills in error if the file can't be read or has a mistake
+    bool load(const QString &path, Scene &scene, BVH &bvh, QString &error);
+
+    // Of the last load that succeeded. The texels stay in the cache's mapping,
+    // which the next load drops, so upload them before loading again
+    int environment() const;
+    bool hasCamera() const;
+    const OrbitCamera& camera() const;
+    const void* texels(Texels buffer) const;
+    int texelsSizeInBytes(Texels buffer) const;
+
+    // Bytes the last load wrote to the cache, 0 if it was up to date
+    qint64 bytesSaved() const;
+
+    // Why the last load couldn't save or map its cache, empty if it could
+    const QString& cacheWarning() const;
+
+    // <path>.bin
+    static QString cachePath(const QString &path);
+
+    static const int CACHE_VERSION = 2;
+    static const int CACHE_PAGE_SIZE = 4096;
+
+private:
+    struct Header;
+    struct Description;
+
+    bool parse(const QString &path, Description &description, QString &error) const;
+    QByteArray compile(const Description &description, const QString &path) const;
+    bool save(const QString &cachePath, const QByteArray &contents, QString &error);
+    void useCompiled(const QByteArray &contents);
+    bool map(const QString &cachePath);
+    bool upToDate(const QString &path) const;
+    bool validMeshes() const;
+    QStringList meshSources() const;
+    bool meshUnchanged(int index, const QString &meshPath) const;
+    std::shared_ptr<Mesh> cachedMesh(int index) const;
+    std::shared_ptr<const Mesh> unchangedMesh(const QString &meshPath) const;
+    void unmap();
+    template <typename T> const T* section(int index, int &count) const;
+
+    QFile m_cache;
+    const uchar *m_mapping;   // into m_cache, or m_compiled when there is no cache to map
+    const Header *m_header;
+    QByteArray m_compiled;
+    QString m_cacheWarning;
+    int m_environment;
+    bool m_hasCamera;
+    OrbitCamera m_camera;
+    qint64 m_bytesSaved;
+};
+
+#endif // SCENEFILE_H
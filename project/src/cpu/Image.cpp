@@ -0,0 +1,85 @@
+#include "Image.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace CS123 { namespace CPU {
+
+bool Image::isNull() const {
+    return width <= 0 || height <= 0 || rgba.empty();
+}
+
+glm::vec4 Image::texel(int x, int y) const {
+    const unsigned char *p = &rgba[4 * (y * width + x)];
+    return glm::vec4(p[0], p[1], p[2], p[3]) / 255.f;
+}
+
+glm::vec4 Image::sample(const glm::vec2 &uv) const {
+    if (isNull()) {
+        return glm::vec4(0.f);
+    }
+    int x = static_cast<int>(std::floor(uv.x * width)) % width;
+    int y = static_cast<int>(std::floor(uv.y * height)) % height;
+    if (x < 0) x += width;
+    if (y < 0) y += height;
+    return texel(x, y);
+}
+
+bool CubeMap::isNull() const {
+    for (int i = 0; i < NUM_FACES; i++) {
+        if (faces[i].isNull()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Face selection and (s, t) from the cube map table in the GL spec
+glm::vec4 CubeMap::sample(const glm::vec3 &d) const {
+    if (isNull()) {
+        return glm::vec4(0.f);
+    }
+
+    glm::vec3 a = glm::abs(d);
+    int face;
+    float sc, tc, ma;
+    if (a.x >= a.y && a.x >= a.z) {
+        face = d.x >= 0.f ? POSITIVE_X : NEGATIVE_X;
+        sc = d.x >= 0.f ? -d.z : d.z;
+        tc = -d.y;
+        ma = a.x;
+    } else if (a.y >= a.z) {
+        face = d.y >= 0.f ? POSITIVE_Y : NEGATIVE_Y;
+        sc = d.x;
+        tc = d.y >= 0.f ? d.z : -d.z;
+        ma = a.y;
+    } else {
+        face = d.z >= 0.f ? POSITIVE_Z : NEGATIVE_Z;
+        sc = d.z >= 0.f ? d.x : -d.x;
+        tc = -d.y;
+        ma = a.z;
+    }
+    if (ma == 0.f) {
+        return glm::vec4(0.f);
+    }
+
+    const Image &img = faces[face];
+    float s = 0.5f * (sc / ma + 1.f) * img.width - 0.5f;
+    float t = 0.5f * (tc / ma + 1.f) * img.height - 0.5f;
+
+    // GL_LINEAR with GL_CLAMP_TO_EDGE
+    int x0 = static_cast<int>(std::floor(s));
+    int y0 = static_cast<int>(std::floor(t));
+    float fx = s - x0;
+    float fy = t - y0;
+    int x1 = std::min(std::max(x0 + 1, 0), img.width - 1);
+    int y1 = std::min(std::max(y0 + 1, 0), img.height - 1);
+    x0 = std::min(std::max(x0, 0), img.width - 1);
+    y0 = std::min(std::max(y0, 0), img.height - 1);
+
+    glm::vec4 top = glm::mix(img.texel(x0, y0), img.texel(x1, y0), fx);
+    glm::vec4 bottom = glm::mix(img.texel(x0, y1), img.texel(x1, y1), fx);
+    return glm::mix(top, bottom, fy);
+}
+
+}}
@@ -0,0 +1,42 @@
+#ifndef CPU_IMAGE_H
+#define CPU_IMAGE_H
+
+#include <vector>
+
+#include "glm/glm.hpp"
+
+namespace CS123 { namespace CPU {
+
+/**
+ * 8-bit RGBA image sampled the way the ray program samples its sampler2Ds
+ * (nearest filtering, repeat wrapping). Rows are stored top to bottom, like QImage.
+ * Channels are true RGB, i.e. what ray.frag gets back after its .bgr swizzle.
+ */
+struct Image {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> rgba;
+
+    bool isNull() const;
+    glm::vec4 texel(int x, int y) const;
+
+    // Nearest sample with GL_REPEAT wrapping, uv = (0, 0) is the first row
+    glm::vec4 sample(const glm::vec2 &uv) const;
+};
+
+/**
+ * Six faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X order (+X, -X, +Y, -Y, +Z, -Z),
+ * sampled bilinearly with clamp to edge like the envMap samplerCube.
+ */
+struct CubeMap {
+    enum Face { POSITIVE_X, NEGATIVE_X, POSITIVE_Y, NEGATIVE_Y, POSITIVE_Z, NEGATIVE_Z, NUM_FACES };
+
+    Image faces[NUM_FACES];
+
+    bool isNull() const;
+    glm::vec4 sample(const glm::vec3 &direction) const;
+};
+
+}}
+
+#endif // CPU_IMAGE_H
@@ -0,0 +1,524 @@
+#ifndef CPU_PACKETKERNELS_H
+#define CPU_PACKETKERNELS_H
+
+// The packet kernels of PacketTracer, written once against Vec and compiled by
+// each file that includes this one for its own instruction set. Define before
+// including:
+//
+//   PACKET_WIDTH   1 (plain floats), 4 (SSE2) or 8 (AVX2)
+//   PACKET_KERNEL  qualifiers of every function here, inline plus the target
+//                  attribute of the instruction set where the compiler needs one
+//
+// Everything is in an unnamed namespace, so each file gets its own copy.
+//
+// The arithmetic follows the scalar shapes in RayTracer.cpp operation for
+// operation (glm's evaluation order included) and selects between their
+// branches, so every lane rounds exactly like a single ray would. Keep them in
+// step. Nothing here may be contracted into fused multiply-adds, which is why
+// the AVX2 target does not include FMA.
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#if PACKET_WIDTH == 4
+#include <emmintrin.h>
+#elif PACKET_WIDTH == 8
+#include <immintrin.h>
+#endif
+
+#include "glm/glm.hpp"
+
+#include "Scene.h"
+#include "BVH.h"
+#include "cpu/PacketTracer.h"
+
+namespace CS123 { namespace CPU {
+
+namespace {
+
+// [VECTOR]
+/////////////////////////////////////////////////////////////////////////
+// Masks are Vecs too, all bits set in the lanes where they hold
+
+#if PACKET_WIDTH == 1
+
+// A mask lane is 1 or 0
+struct Vec { float v; };
+
+PACKET_KERNEL Vec splat(float x) { return {x}; }
+PACKET_KERNEL Vec load(const float *p) { return {*p}; }
+PACKET_KERNEL void store(float *p, Vec a) { *p = a.v; }
+
+PACKET_KERNEL Vec operator+(Vec a, Vec b) { return {a.v + b.v}; }
+PACKET_KERNEL Vec operator-(Vec a, Vec b) { return {a.v - b.v}; }
+PACKET_KERNEL Vec operator*(Vec a, Vec b) { return {a.v * b.v}; }
+PACKET_KERNEL Vec operator/(Vec a, Vec b) { return {a.v / b.v}; }
+PACKET_KERNEL Vec operator-(Vec a) { return {-a.v}; }
+PACKET_KERNEL Vec sqrt(Vec a) { return {std::sqrt(a.v)}; }
+
+PACKET_KERNEL Vec operator<(Vec a, Vec b) { return {a.v < b.v ? 1.f : 0.f}; }
+PACKET_KERNEL Vec operator<=(Vec a, Vec b) { return {a.v <= b.v ? 1.f : 0.f}; }
+PACKET_KERNEL Vec operator>(Vec a, Vec b) { return {a.v > b.v ? 1.f : 0.f}; }
+PACKET_KERNEL Vec operator>=(Vec a, Vec b) { return {a.v >= b.v ? 1.f : 0.f}; }
+
+PACKET_KERNEL Vec operator&(Vec a, Vec b) { return {a.v != 0.f && b.v != 0.f ? 1.f : 0.f}; }
+PACKET_KERNEL Vec operator|(Vec a, Vec b) { return {a.v != 0.f || b.v != 0.f ? 1.f : 0.f}; }
+PACKET_KERNEL Vec andNot(Vec a, Vec b) { return {a.v == 0.f && b.v != 0.f ? 1.f : 0.f}; }
+PACKET_KERNEL Vec select(Vec mask, Vec a, Vec b) { return mask.v != 0.f ? a : b; }
+PACKET_KERNEL unsigned int moveMask(Vec mask) { return mask.v != 0.f ? 1u : 0u; }
+
+// std::min(a, b) and std::max(a, b)
+PACKET_KERNEL Vec minOf(Vec a, Vec b) { return b.v < a.v ? b : a; }
+PACKET_KERNEL Vec maxOf(Vec a, Vec b) { return a.v < b.v ? b : a; }
+
+#elif PACKET_WIDTH == 4
+
+struct Vec { __m128 v; };
+
+PACKET_KERNEL Vec splat(float x) { return {_mm_set1_ps(x)}; }
+PACKET_KERNEL Vec load(const float *p) { return {_mm_load_ps(p)}; }
+PACKET_KERNEL void store(float *p, Vec a) { _mm_store_ps(p, a.v); }
+
+PACKET_KERNEL Vec operator+(Vec a, Vec b) { return {_mm_add_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator-(Vec a, Vec b) { return {_mm_sub_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator*(Vec a, Vec b) { return {_mm_mul_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator/(Vec a, Vec b) { return {_mm_div_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator-(Vec a) { return {_mm_xor_ps(a.v, _mm_set1_ps(-0.f))}; }
+PACKET_KERNEL Vec sqrt(Vec a) { return {_mm_sqrt_ps(a.v)}; }
+
+PACKET_KERNEL Vec operator<(Vec a, Vec b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator<=(Vec a, Vec b) { return {_mm_cmple_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator>(Vec a, Vec b) { return {_mm_cmpgt_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator>=(Vec a, Vec b) { return {_mm_cmpge_ps(a.v, b.v)}; }
+
+PACKET_KERNEL Vec operator&(Vec a, Vec b) { return {_mm_and_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator|(Vec a, Vec b) { return {_mm_or_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec andNot(Vec a, Vec b) { return {_mm_andnot_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec select(Vec mask, Vec a, Vec b) {
+    return {_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v))};
+}
+PACKET_KERNEL unsigned int moveMask(Vec mask) { return static_cast<unsigned int>(_mm_movemask_ps(mask.v)); }
+
+// std::min(a, b) and std::max(a, b). minps/maxps return their second operand
+// unless the first one wins, so the operands are swapped
+PACKET_KERNEL Vec minOf(Vec a, Vec b) { return {_mm_min_ps(b.v, a.v)}; }
+PACKET_KERNEL Vec maxOf(Vec a, Vec b) { return {_mm_max_ps(b.v, a.v)}; }
+
+#elif PACKET_WIDTH == 8
+
+struct Vec { __m256 v; };
+
+PACKET_KERNEL Vec splat(float x) { return {_mm256_set1_ps(x)}; }
+PACKET_KERNEL Vec load(const float *p) { return {_mm256_load_ps(p)}; }
+PACKET_KERNEL void store(float *p, Vec a) { _mm256_store_ps(p, a.v); }
+
+PACKET_KERNEL Vec operator+(Vec a, Vec b) { return {_mm256_add_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator-(Vec a, Vec b) { return {_mm256_sub_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator*(Vec a, Vec b) { return {_mm256_mul_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator/(Vec a, Vec b) { return {_mm256_div_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator-(Vec a) { return {_mm256_xor_ps(a.v, _mm256_set1_ps(-0.f))}; }
+PACKET_KERNEL Vec sqrt(Vec a) { return {_mm256_sqrt_ps(a.v)}; }
+
+PACKET_KERNEL Vec operator<(Vec a, Vec b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+PACKET_KERNEL Vec operator<=(Vec a, Vec b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+PACKET_KERNEL Vec operator>(Vec a, Vec b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+PACKET_KERNEL Vec operator>=(Vec a, Vec b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+
+PACKET_KERNEL Vec operator&(Vec a, Vec b) { return {_mm256_and_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec operator|(Vec a, Vec b) { return {_mm256_or_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec andNot(Vec a, Vec b) { return {_mm256_andnot_ps(a.v, b.v)}; }
+PACKET_KERNEL Vec select(Vec mask, Vec a, Vec b) { return {_mm256_blendv_ps(b.v, a.v, mask.v)}; }
+PACKET_KERNEL unsigned int moveMask(Vec mask) { return static_cast<unsigned int>(_mm256_movemask_ps(mask.v)); }
+
+// std::min(a, b) and std::max(a, b), see the SSE versions
+PACKET_KERNEL Vec minOf(Vec a, Vec b) { return {_mm256_min_ps(b.v, a.v)}; }
+PACKET_KERNEL Vec maxOf(Vec a, Vec b) { return {_mm256_max_ps(b.v, a.v)}; }
+
+#else
+#error "PACKET_WIDTH must be 1, 4 or 8"
+#endif
+
+// Lanes [0, PACKET_WIDTH) of a RayPacket::active style bit mask
+PACKET_KERNEL Vec laneMask(unsigned int bits) {
+    alignas(32) float lanes[PACKET_WIDTH];
+    for (int i = 0; i < PACKET_WIDTH; i++) {
+        lanes[i] = (bits >> i) & 1u ? 1.f : 0.f;
+    }
+    return load(lanes) > splat(0.f);
+}
+
+// glm's mat4 * vec4, rounded the same way: (m[0] x + m[1] y) + (m[2] z + m[3] w)
+PACKET_KERNEL void transform(const glm::mat4x4 &m, const Vec in[4], Vec out[3]) {
+    for (int i = 0; i < 3; i++) {
+        out[i] = (splat(m[0][i]) * in[0] + splat(m[1][i]) * in[1]) +
+                 (splat(m[2][i]) * in[2] + splat(m[3][i]) * in[3]);
+    }
+}
+
+// [SHAPES]
+/////////////////////////////////////////////////////////////////////////
+
+// cap() with normal (0, side, 0) through (0, side / 2, 0). The dot products with
+// the axis aligned normal leave just the y terms
+PACKET_KERNEL Vec cap(const Vec o[3], const Vec d[3], float side)
+{
+    Vec t = (splat(.5f) - splat(side) * o[1]) / (splat(side) * d[1]);
+    Vec x = o[0] + t * d[0];
+    Vec z = o[2] + t * d[2];
+    return select(x * x + z * z <= splat(.25f), t, splat(-1.f));
+}
+
+PACKET_KERNEL Vec sphere(const Vec o[3], const Vec d[3])
+{
+    Vec two = splat(2.f);
+    Vec a = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    Vec b = (two * d[0] * o[0]) + (two * d[1] * o[1]) + (two * d[2] * o[2]);
+    Vec c = o[0] * o[0] + o[1] * o[1] + o[2] * o[2] - splat(.25f);
+    Vec discriminant = b * b - (splat(4.f) * a * c);
+
+    Vec t1 = (-b + sqrt(discriminant)) / (two * a);
+    Vec t2 = (-b - sqrt(discriminant)) / (two * a);
+
+    Vec zero = splat(0.f);
+    Vec t = select((t1 > zero) & (t2 > zero), minOf(t1, t2),
+                   select((t1 < zero) & (t2 < zero), splat(-1.f), maxOf(t1, t2)));
+    return select(discriminant >= zero, t, splat(-1.f));
+}
+
+PACKET_KERNEL Vec cylinderBody(const Vec o[3], const Vec d[3])
+{
+    Vec two = splat(2.f);
+    Vec a = d[0] * d[0] + d[2] * d[2];
+    Vec b = (two * d[0] * o[0]) + (two * d[2] * o[2]);
+    Vec c = o[0] * o[0] + o[2] * o[2] - splat(.25f);
+    Vec discriminant = b * b - (splat(4.f) * a * c);
+
+    Vec t1 = (-b + sqrt(discriminant)) / (two * a);
+    Vec t2 = (-b - sqrt(discriminant)) / (two * a);
+
+    Vec t3 = minOf(t1, t2);
+    Vec y = o[1] + (t3 * d[1]);
+    Vec withinBounds = (y >= splat(-.5f)) & (y <= splat(.5f));
+
+    Vec zero = splat(0.f);
+    Vec hit = (discriminant >= zero) & andNot((t1 < zero) & (t2 < zero), withinBounds);
+    return select(hit, t3, splat(-1.f));
+}
+
+// t if it is a hit (>= 0) closer than current, where current <= 0 counts as no hit yet
+PACKET_KERNEL Vec closerOf(Vec current, Vec t)
+{
+    Vec zero = splat(0.f);
+    return select(t >= zero, select(current > zero, minOf(current, t), t), current);
+}
+
+PACKET_KERNEL Vec cylinder(const Vec o[3], const Vec d[3])
+{
+    Vec bodyT = cylinderBody(o, d);
+    Vec currentT = select(bodyT >= splat(0.f), bodyT, splat(-1.f));
+    currentT = closerOf(currentT, cap(o, d, 1.f));
+    return closerOf(currentT, cap(o, d, -1.f));
+}
+
+PACKET_KERNEL Vec coneBody(const Vec o[3], const Vec d[3])
+{
+    Vec two = splat(2.f);
+    Vec quarter = splat(.25f);
+    Vec a = d[0] * d[0] + d[2] * d[2] - (quarter * d[1] * d[1]);
+    Vec b = (two * o[0] * d[0]) + (two * o[2] * d[2]) -
+            (splat(.5f) * o[1] * d[1]) + (quarter * d[1]);
+    Vec c = o[0] * o[0] + o[2] * o[2] -
+            (quarter * o[1] * o[1]) + (quarter * o[1]) - splat(1.f/16.f);
+    Vec discriminant = b * b - (splat(4.f) * a * c);
+
+    Vec t1 = (-b + sqrt(discriminant)) / (two * a);
+    Vec t2 = (-b - sqrt(discriminant)) / (two * a);
+
+    Vec y1 = o[1] + (t1 * d[1]);
+    Vec y2 = o[1] + (t2 * d[1]);
+    Vec y1Valid = (y1 >= splat(-.5f)) & (y1 <= splat(.5f));
+    Vec y2Valid = (y2 >= splat(-.5f)) & (y2 <= splat(.5f));
+
+    Vec zero = splat(0.f);
+    Vec none = splat(-1.f);
+    Vec bothValid = select((t1 > zero) & (t2 > zero), minOf(t1, t2),
+                           select((t1 <= zero) & (t2 <= zero), none, maxOf(t1, t2)));
+    Vec t = select(y1Valid & y2Valid, bothValid,
+                   select(y1Valid, select(t1 > zero, t1, none),
+                          select(y2Valid, select(t2 > zero, t2, none), none)));
+    return select(discriminant >= zero, t, none);
+}
+
+PACKET_KERNEL Vec cone(const Vec o[3], const Vec d[3])
+{
+    Vec bodyT = coneBody(o, d);
+    Vec currentT = select(bodyT >= splat(0.f), bodyT, splat(-1.f));
+    return closerOf(currentT, cap(o, d, -1.f));
+}
+
+// plane() of the cube face with normal side along axis, through side / 2
+PACKET_KERNEL Vec plane(const Vec o[3], const Vec d[3], int axis, float side)
+{
+    Vec t = (splat(.5f) - splat(side) * o[axis]) / (splat(side) * d[axis]);
+
+    // the two coordinates that must fall inside the face
+    int i = axis == 0 ? 1 : 0;
+    int j = axis == 2 ? 1 : 2;
+    Vec pi = o[i] + t * d[i];
+    Vec pj = o[j] + t * d[j];
+    Vec inFace = (pi >= splat(-.5f)) & (pi <= splat(.5f)) & (pj >= splat(-.5f)) & (pj <= splat(.5f));
+    return select(inFace, t, splat(-1.f));
+}
+
+PACKET_KERNEL Vec cube(const Vec o[3], const Vec d[3])
+{
+    Vec currentT = splat(-1.f);
+    for (int axis = 0; axis < 3; axis++) {
+        for (float side = 1.f; side >= -1.f; side -= 2.f) {
+            currentT = closerOf(currentT, plane(o, d, axis, side));
+        }
+    }
+    return currentT;
+}
+
+// checkObjectIntersection() for object space rays
+PACKET_KERNEL Vec checkObjectIntersection(const Vec o[3], const Vec d[3], ShapeType primitive)
+{
+    switch (primitive) {
+    case ShapeType::SPHERE:   return sphere(o, d);
+    case ShapeType::CONE:     return cone(o, d);
+    case ShapeType::CYLINDER: return cylinder(o, d);
+    case ShapeType::CUBE:     return cube(o, d);
+    default:                  return splat(-1.f);
+    }
+}
+
+// [TRAVERSAL]
+/////////////////////////////////////////////////////////////////////////
+
+// AABB::intersects for every lane. glm::min(t0, t1) is std::min(t1, t0)
+PACKET_KERNEL Vec intersectsBox(const AABB &box, const Vec o[3], const Vec invDir[3], Vec tMax)
+{
+    Vec tNear[3];
+    Vec tFar[3];
+    for (int i = 0; i < 3; i++) {
+        Vec t0 = (splat(box.min[i]) - o[i]) * invDir[i];
+        Vec t1 = (splat(box.max[i]) - o[i]) * invDir[i];
+        tNear[i] = minOf(t1, t0);
+        tFar[i] = maxOf(t1, t0);
+    }
+    Vec enter = maxOf(maxOf(tNear[0], tNear[1]), maxOf(tNear[2], splat(0.f)));
+    Vec exit = minOf(minOf(tFar[0], tFar[1]), minOf(tFar[2], tMax));
+    return enter <= exit;
+}
+
+// The lanes [lane, lane + PACKET_WIDTH) of a packet, in world space
+struct PacketRays {
+    Vec origin[4];
+    Vec direction[4];
+    Vec invDir[3];
+    Vec active;
+};
+
+PACKET_KERNEL void loadRays(const RayPacket &packet, int lane, PacketRays &rays)
+{
+    for (int i = 0; i < 4; i++) {
+        rays.origin[i] = load(packet.origin[i] + lane);
+        rays.direction[i] = load(packet.direction[i] + lane);
+    }
+    for (int i = 0; i < 3; i++) {
+        rays.invDir[i] = splat(1.f) / rays.direction[i];
+    }
+    rays.active = laneMask(packet.active >> lane);
+}
+
+// t of every lane against one object
+PACKET_KERNEL Vec intersectObject(const glm::mat4x4 &worldToObject, ShapeType primitive,
+                                  const PacketRays &rays)
+{
+    Vec objectSpacePoint[3];
+    Vec objectSpaceDirection[3];
+    transform(worldToObject, rays.origin, objectSpacePoint);
+    transform(worldToObject, rays.direction, objectSpaceDirection);
+    return checkObjectIntersection(objectSpacePoint, objectSpaceDirection, primitive);
+}
+
+// Object space rays of every lane, as the scalar tracer computes them
+PACKET_KERNEL void toObjectSpace(const glm::mat4x4 &worldToObject, const PacketRays &rays,
+                                 float origin[3][PACKET_WIDTH], float direction[3][PACKET_WIDTH])
+{
+    Vec objectSpacePoint[3];
+    Vec objectSpaceDirection[3];
+    transform(worldToObject, rays.origin, objectSpacePoint);
+    transform(worldToObject, rays.direction, objectSpaceDirection);
+    for (int i = 0; i < 3; i++) {
+        store(origin[i], objectSpacePoint[i]);
+        store(direction[i], objectSpaceDirection[i]);
+    }
+}
+
+// Mesh::closestHit of the lanes in reached, one at a time. t is -1 in the other lanes
+PACKET_KERNEL Vec intersectMesh(const Mesh &mesh, const glm::mat4x4 &worldToObject, const PacketRays &rays,
+                                Vec reached, int triangle[PACKET_WIDTH], glm::vec2 barycentric[PACKET_WIDTH])
+{
+    alignas(32) float origin[3][PACKET_WIDTH];
+    alignas(32) float direction[3][PACKET_WIDTH];
+    alignas(32) float t[PACKET_WIDTH];
+    toObjectSpace(worldToObject, rays, origin, direction);
+    unsigned int lanes = moveMask(reached);
+    for (int i = 0; i < PACKET_WIDTH; i++) {
+        t[i] = -1.f;
+        if ((lanes >> i) & 1u) {
+            t[i] = mesh.closestHit(glm::vec4(origin[0][i], origin[1][i], origin[2][i], 1.f),
+                                   glm::vec4(direction[0][i], direction[1][i], direction[2][i], 0.f),
+                                   triangle[i], barycentric[i]);
+        }
+    }
+    return load(t);
+}
+
+// Mesh::anyHit of the lanes in reached, one at a time
+PACKET_KERNEL Vec meshOccludes(const Mesh &mesh, const glm::mat4x4 &worldToObject, const PacketRays &rays,
+                               Vec reached, const float *tMax)
+{
+    alignas(32) float origin[3][PACKET_WIDTH];
+    alignas(32) float direction[3][PACKET_WIDTH];
+    alignas(32) float t[PACKET_WIDTH];
+    toObjectSpace(worldToObject, rays, origin, direction);
+    unsigned int lanes = moveMask(reached);
+    for (int i = 0; i < PACKET_WIDTH; i++) {
+        t[i] = -1.f;
+        if ((lanes >> i) & 1u) {
+            t[i] = mesh.anyHit(glm::vec4(origin[0][i], origin[1][i], origin[2][i], 1.f),
+                               glm::vec4(direction[0][i], direction[1][i], direction[2][i], 0.f), tMax[i]);
+        }
+    }
+    return load(t);
+}
+
+// BVH::closestHit for lanes [lane, lane + PACKET_WIDTH). The packet walks every
+// node one of its rays reaches, a ray only takes hits in leaves it reaches itself
+PACKET_KERNEL void closestHitKernel(const BVH &bvh, const Scene &scene, const RayPacket &packet,
+                                    int lane, PacketHits &hits)
+{
+    PacketRays rays;
+    loadRays(packet, lane, rays);
+
+    const std::vector<BVH::Node> &nodes = bvh.nodes();
+    const std::vector<int> &objectOrder = bvh.objectOrder();
+    Vec zero = splat(0.f);
+    Vec infinity = splat(std::numeric_limits<float>::infinity());
+    Vec bestT = splat(-1.f);
+    Vec bestIndex = splat(-1.f); // exact up to 2^24 objects
+    int triangle[PACKET_WIDTH];
+    glm::vec2 barycentric[PACKET_WIDTH];
+    for (int i = 0; i < PACKET_WIDTH; i++) {
+        triangle[i] = -1;
+        barycentric[i] = glm::vec2(0.f);
+    }
+
+    int nodeIndex = nodes.empty() ? -1 : 0;
+    while (nodeIndex >= 0) {
+        const BVH::Node &node = nodes[nodeIndex];
+        Vec tMax = select(bestT > zero, bestT, infinity);
+        Vec reached = rays.active & intersectsBox(node.bounds, rays.origin, rays.invDir, tMax);
+        if (moveMask(reached) == 0) {
+            nodeIndex = node.missIndex;
+            continue;
+        }
+        if (!node.isLeaf()) {
+            nodeIndex++;
+            continue;
+        }
+        for (int i = node.first; i < node.first + node.count; i++) {
+            int objectIndex = objectOrder[i];
+            if (scene.primitives[objectIndex] != ShapeType::MESH) {
+                Vec t = intersectObject(scene.worldToObject[objectIndex], scene.primitives[objectIndex], rays);
+                Vec closer = reached & (t > zero) & ((bestT < zero) | (t < bestT));
+                bestT = select(closer, t, bestT);
+                bestIndex = select(closer, splat(static_cast<float>(objectIndex)), bestIndex);
+                continue;
+            }
+
+            int meshTriangle[PACKET_WIDTH];
+            glm::vec2 meshBarycentric[PACKET_WIDTH];
+            Vec t = intersectMesh(*scene.meshes[scene.meshIndex[objectIndex]], scene.worldToObject[objectIndex],
+                                  rays, reached, meshTriangle, meshBarycentric);
+            Vec closer = reached & (t > zero) & ((bestT < zero) | (t < bestT));
+            bestT = select(closer, t, bestT);
+            bestIndex = select(closer, splat(static_cast<float>(objectIndex)), bestIndex);
+            unsigned int closerLanes = moveMask(closer);
+            for (int j = 0; j < PACKET_WIDTH; j++) {
+                if ((closerLanes >> j) & 1u) {
+                    triangle[j] = meshTriangle[j];
+                    barycentric[j] = meshBarycentric[j];
+                }
+            }
+        }
+        nodeIndex = node.missIndex;
+    }
+
+    alignas(32) float index[PACKET_WIDTH];
+    store(hits.t + lane, bestT);
+    store(index, bestIndex);
+    for (int i = 0; i < PACKET_WIDTH; i++) {
+        // A closer primitive can come after a mesh hit without clearing its triangle
+        int objectIndex = static_cast<int>(index[i]);
+        bool mesh = objectIndex >= 0 && scene.primitives[objectIndex] == ShapeType::MESH;
+        hits.objectIndex[lane + i] = objectIndex;
+        hits.triangle[lane + i] = mesh ? triangle[i] : -1;
+        hits.barycentric[lane + i] = mesh ? barycentric[i] : glm::vec2(0.f);
+    }
+}
+
+// BVH::anyHit for lanes [lane, lane + PACKET_WIDTH), returns a bit per occluded
+// lane. Rays drop out of the walk as soon as they hit something
+PACKET_KERNEL unsigned int anyHitKernel(const BVH &bvh, const Scene &scene, const RayPacket &packet,
+                                        int lane)
+{
+    PacketRays rays;
+    loadRays(packet, lane, rays);
+    Vec tMax = load(packet.tMax + lane);
+
+    const std::vector<BVH::Node> &nodes = bvh.nodes();
+    const std::vector<int> &objectOrder = bvh.objectOrder();
+    Vec zero = splat(0.f);
+    Vec occluded = zero;
+
+    int nodeIndex = nodes.empty() ? -1 : 0;
+    while (nodeIndex >= 0) {
+        const BVH::Node &node = nodes[nodeIndex];
+        Vec reached = rays.active & intersectsBox(node.bounds, rays.origin, rays.invDir, tMax);
+        if (moveMask(reached) == 0) {
+            nodeIndex = node.missIndex;
+            continue;
+        }
+        if (!node.isLeaf()) {
+            nodeIndex++;
+            continue;
+        }
+        for (int i = node.first; i < node.first + node.count; i++) {
+            int objectIndex = objectOrder[i];
+            Vec t = scene.primitives[objectIndex] == ShapeType::MESH ?
+                        meshOccludes(*scene.meshes[scene.meshIndex[objectIndex]], scene.worldToObject[objectIndex],
+                                     rays, reached, packet.tMax + lane) :
+                        intersectObject(scene.worldToObject[objectIndex], scene.primitives[objectIndex], rays);
+            Vec hit = reached & (t > zero) & (t < tMax);
+            occluded = occluded | hit;
+            rays.active = andNot(hit, rays.active);
+            reached = andNot(hit, reached);
+        }
+        if (moveMask(rays.active) == 0) {
+            break;
+        }
+        nodeIndex = node.missIndex;
+    }
+    return moveMask(occluded);
+}
+
+} // namespace
+
+}}
+
+#endif // CPU_PACKETKERNELS_H
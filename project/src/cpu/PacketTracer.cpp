@@ -0,0 +1,137 @@
+#include "PacketTracer.h"
+
+#if PACKET_TRACER_X86 && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+// The scalar fallback, one lane at a time
+#define PACKET_WIDTH 1
+#define PACKET_KERNEL inline
+#include "cpu/PacketKernels.h"
+
+namespace CS123 { namespace CPU {
+
+namespace {
+
+#if PACKET_TRACER_X86
+#if defined(_MSC_VER)
+
+bool cpuHasSSE2() {
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+}
+
+// AVX2 also needs the OS to save the YMM registers (OSXSAVE, then XCR0 bits 1 and 2)
+bool cpuHasAVX2() {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+#else
+
+bool cpuHasSSE2() {
+    return __builtin_cpu_supports("sse2");
+}
+
+// Checks the OS side of AVX as well
+bool cpuHasAVX2() {
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+#endif // PACKET_TRACER_X86
+
+} // namespace
+
+PacketTracer::Isa PacketTracer::bestSupported() {
+    if (isSupported(Isa::AVX2)) {
+        return Isa::AVX2;
+    } else if (isSupported(Isa::SSE)) {
+        return Isa::SSE;
+    }
+    return Isa::SCALAR;
+}
+
+bool PacketTracer::isSupported(Isa isa) {
+    switch (isa) {
+#if PACKET_TRACER_X86
+    case Isa::SSE:  return cpuHasSSE2();
+    case Isa::AVX2: return cpuHasAVX2();
+#endif
+    case Isa::SCALAR: return true;
+    default:          return false;
+    }
+}
+
+const char* PacketTracer::name(Isa isa) {
+    switch (isa) {
+    case Isa::SSE:  return "sse";
+    case Isa::AVX2: return "avx2";
+    default:        return "scalar";
+    }
+}
+
+PacketTracer::PacketTracer(Isa isa) :
+    m_isa(isSupported(isa) ? isa : bestSupported())
+{
+}
+
+PacketTracer::Isa PacketTracer::isa() const {
+    return m_isa;
+}
+
+int PacketTracer::width() const {
+    switch (m_isa) {
+    case Isa::SSE:  return 4;
+    case Isa::AVX2: return 8;
+    default:        return 1;
+    }
+}
+
+void PacketTracer::closestHit(const BVH &bvh, const Scene &scene, const RayPacket &packet,
+                              PacketHits &hits) const {
+#if PACKET_TRACER_X86
+    if (m_isa == Isa::AVX2) {
+        closestHitAVX2(bvh, scene, packet, hits);
+        return;
+    } else if (m_isa == Isa::SSE) {
+        closestHitSSE(bvh, scene, packet, hits);
+        return;
+    }
+#endif
+    for (int lane = 0; lane < RayPacket::MAX_SIZE; lane++) {
+        if ((packet.active >> lane) & 1u) {
+            closestHitKernel(bvh, scene, packet, lane, hits);
+        }
+    }
+}
+
+unsigned int PacketTracer::anyHit(const BVH &bvh, const Scene &scene, const RayPacket &packet) const {
+#if PACKET_TRACER_X86
+    if (m_isa == Isa::AVX2) {
+        return anyHitAVX2(bvh, scene, packet);
+    } else if (m_isa == Isa::SSE) {
+        return anyHitSSE(bvh, scene, packet);
+    }
+#endif
+    unsigned int occluded = 0;
+    for (int lane = 0; lane < RayPacket::MAX_SIZE; lane++) {
+        if ((packet.active >> lane) & 1u) {
+            occluded |= anyHitKernel(bvh, scene, packet, lane) << lane;
+        }
+    }
+    return occluded;
+}
+
+}}
@@ -0,0 +1,96 @@
+#ifndef CPU_PACKETTRACER_H
+#define CPU_PACKETTRACER_H
+
+#include "glm/glm.hpp"
+
+#include "Scene.h"
+#include "BVH.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PACKET_TRACER_X86 1
+#else
+#define PACKET_TRACER_X86 0
+#endif
+
+namespace CS123 { namespace CPU {
+
+// Up to RayPacket::MAX_SIZE rays in structure of arrays layout, one SIMD lane each.
+// Points and directions are homogeneous like the vec4s of the scalar tracer, so
+// the object space rays come out the same. Lanes whose bit is not set in active are ignored
+struct RayPacket {
+    static const int MAX_SIZE = 8;
+
+    alignas(32) float origin[4][MAX_SIZE];
+    alignas(32) float direction[4][MAX_SIZE];
+    alignas(32) float tMax[MAX_SIZE]; // anyHit only, in units of direction
+    unsigned int active;
+};
+
+struct PacketHits {
+    alignas(32) float t[RayPacket::MAX_SIZE];
+    alignas(32) int objectIndex[RayPacket::MAX_SIZE]; // -1 for a miss
+
+    // Hits on a MESH object only, as Mesh::closestHit
+    int triangle[RayPacket::MAX_SIZE];
+    glm::vec2 barycentric[RayPacket::MAX_SIZE];
+};
+
+/**
+  [PACKET TRACING]
+  BVH traversal and intersection tests for 4 (SSE) or 8 (AVX2) rays at a time,
+  the lanes of the SIMD registers. The packet walks the union of the nodes its
+  rays reach, and each ray only counts the leaves whose box it hits itself, so
+  every ray gets exactly the hit BVH::closestHit / anyHit would give it.
+
+  Packets pay off for coherent rays that mostly visit the same nodes: the
+  primary rays of neighbouring pixels and their shadow rays to the same light.
+  AO and reflection rays scatter, and stay single rays.
+
+  Triangle meshes are the exception inside a packet: the lanes that reach a
+  MESH object walk its triangles one ray at a time (Mesh::closestHit /
+  anyHit), the packet goes on together from there.
+
+  The kernels are written once against a small vector type (PacketKernels.h)
+  and compiled per instruction set in PacketTracerSSE.cpp / PacketTracerAVX2.cpp,
+  and lane by lane in PacketTracer.cpp for SCALAR. The widest one the CPU
+  supports is picked at run time; the AVX2 file needs no special compiler
+  flags, its functions carry a target attribute instead.
+**/
+class PacketTracer {
+public:
+    enum class Isa { SCALAR, SSE, AVX2 };
+
+    // Widest instruction set this CPU runs, SCALAR off x86
+    static Isa bestSupported();
+    static bool isSupported(Isa isa);
+    static const char* name(Isa isa);
+
+    // Falls back to the best supported instruction set if isa isn't
+    explicit PacketTracer(Isa isa = bestSupported());
+
+    Isa isa() const;
+
+    // Rays per SIMD register, 1 for SCALAR (which RayTracer leaves to single rays)
+    int width() const;
+
+    // Closest object with t > 0 for each active ray, as BVH::closestHit.
+    void closestHit(const BVH &bvh, const Scene &scene, const RayPacket &packet,
+                    PacketHits &hits) const;
+
+    // Bit per active ray that hits any object with 0 < t < tMax, as BVH::anyHit
+    unsigned int anyHit(const BVH &bvh, const Scene &scene, const RayPacket &packet) const;
+
+private:
+    static void closestHitSSE(const BVH &bvh, const Scene &scene, const RayPacket &packet,
+                              PacketHits &hits);
+    static unsigned int anyHitSSE(const BVH &bvh, const Scene &scene, const RayPacket &packet);
+    static void closestHitAVX2(const BVH &bvh, const Scene &scene, const RayPacket &packet,
+                               PacketHits &hits);
+    static unsigned int anyHitAVX2(const BVH &bvh, const Scene &scene, const RayPacket &packet);
+
+    Isa m_isa;
+};
+
+}}
+
+#endif // CPU_PACKETTRACER_H
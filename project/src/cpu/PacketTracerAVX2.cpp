@@ -0,0 +1,28 @@
+#include "cpu/PacketTracer.h"
+
+#if PACKET_TRACER_X86
+
+// Built without -mavx2 like everything else, the kernels are compiled for AVX2
+// through their target attribute and only called once PacketTracer has checked the CPU
+#define PACKET_WIDTH 8
+#if defined(__GNUC__)
+#define PACKET_KERNEL __attribute__((target("avx2"))) inline
+#else
+#define PACKET_KERNEL inline
+#endif
+#include "cpu/PacketKernels.h"
+
+namespace CS123 { namespace CPU {
+
+void PacketTracer::closestHitAVX2(const BVH &bvh, const Scene &scene, const RayPacket &packet,
+                                  PacketHits &hits) {
+    closestHitKernel(bvh, scene, packet, 0, hits);
+}
+
+unsigned int PacketTracer::anyHitAVX2(const BVH &bvh, const Scene &scene, const RayPacket &packet) {
+    return anyHitKernel(bvh, scene, packet, 0);
+}
+
+}}
+
+#endif // PACKET_TRACER_X86
@@ -0,0 +1,36 @@
+#include "cpu/PacketTracer.h"
+
+#if PACKET_TRACER_X86
+
+#define PACKET_WIDTH 4
+#if defined(__GNUC__)
+#define PACKET_KERNEL __attribute__((target("sse2"))) inline
+#else
+#define PACKET_KERNEL inline
+#endif
+#include "cpu/PacketKernels.h"
+
+namespace CS123 { namespace CPU {
+
+void PacketTracer::closestHitSSE(const BVH &bvh, const Scene &scene, const RayPacket &packet,
+                                 PacketHits &hits) {
+    for (int lane = 0; lane < RayPacket::MAX_SIZE; lane += PACKET_WIDTH) {
+        if ((packet.active >> lane) & 0xf) {
+            closestHitKernel(bvh, scene, packet, lane, hits);
+        }
+    }
+}
+
+unsigned int PacketTracer::anyHitSSE(const BVH &bvh, const Scene &scene, const RayPacket &packet) {
+    unsigned int occluded = 0;
+    for (int lane = 0; lane < RayPacket::MAX_SIZE; lane += PACKET_WIDTH) {
+        if ((packet.active >> lane) & 0xf) {
+            occluded |= anyHitKernel(bvh, scene, packet, lane) << lane;
+        }
+    }
+    return occluded;
+}
+
+}}
+
+#endif // PACKET_TRACER_X86
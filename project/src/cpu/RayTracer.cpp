@@ -0,0 +1,1213 @@
+#include "RayTracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "AdaptiveSampling.h"
+#include "Denoiser.h"
+#include "cpu/ThreadPool.h"
+
+namespace CS123 { namespace CPU {
+
+namespace {
+
+const float SHAPE_EPSILON = .001f;
+const float CONE_SLOPE = 2.f;
+const int MAX_BOUNCE = 3;
+const float PI = 3.1415f;
+
+float glslMod(float x, float y) {
+    return x - y * std::floor(x / y);
+}
+
+// [SHAPES]
+/////////////////////////////////////////////////////////////////////////
+// The shader selects between branches with 0/1 multiplies, here they are plain branches
+
+float cap(const glm::vec4 &objPeye, const glm::vec4 &objD, const glm::vec3 &normal, const glm::vec3 &pt)
+{
+    float tDenom = glm::dot(normal, glm::vec3(objD));
+    float tNum1 = glm::dot(normal, pt);
+    float tNum2 = glm::dot(normal, glm::vec3(objPeye));
+    float t = (tNum1 - tNum2)/tDenom;
+
+    glm::vec4 intersectionPt = objPeye + (t * objD);
+    bool withinCap = intersectionPt.x * intersectionPt.x + intersectionPt.z * intersectionPt.z <= .25f;
+    return withinCap ? t : -1.f;
+}
+
+// finds the intersection 't' of the input ray with a sphere centered at (0,0,0)
+// with r=.5
+// objPeye and objD must already be in object space
+float sphere(const glm::vec4 &objPeye, const glm::vec4 &objD)
+{
+    float a = objD.x * objD.x + objD.y * objD.y + objD.z * objD.z;
+    float b = (2.f * objD.x * objPeye.x) + (2.f * objD.y * objPeye.y) + (2.f * objD.z * objPeye.z);
+    float c = objPeye.x * objPeye.x + objPeye.y * objPeye.y + objPeye.z * objPeye.z - .25f;
+    float discriminant = b * b - (4.f * a * c);
+    if (!(discriminant >= 0.f)) {
+        return -1.f;
+    }
+
+    float t1 = (-b + std::sqrt(discriminant))/(2.f * a);
+    float t2 = (-b - std::sqrt(discriminant))/(2.f * a);
+
+    if (t1 > 0 && t2 > 0) {
+        return std::min(t1, t2);
+    } else if (t1 < 0 && t2 < 0) {
+        return -1.f;
+    }
+    return std::max(t1, t2);
+}
+
+// helper method for cylinder
+float cylinderBody(const glm::vec4 &objPeye, const glm::vec4 &objD)
+{
+    float a = objD.x * objD.x + objD.z * objD.z;
+    float b = (2.f * objD.x * objPeye.x) + (2.f * objD.z * objPeye.z);
+    float c = objPeye.x * objPeye.x + objPeye.z * objPeye.z - .25f;
+    float discriminant = b * b - (4.f * a * c);
+    if (!(discriminant >= 0.f)) {
+        return -1.f;
+    }
+
+    float t1 = (-b + std::sqrt(discriminant))/(2.f * a);
+    float t2 = (-b - std::sqrt(discriminant))/(2.f * a);
+
+    float t3 = std::min(t1, t2);
+    float y = objPeye.y + (t3 * objD.y);
+    bool withinBounds = (y >= -.5f && y <= .5f);
+
+    if (t1 < 0 && t2 < 0) {
+        return -1.f;
+    }
+    return withinBounds ? t3 : -1.f;
+}
+
+// finds the intersection 't' of the input ray with
+// a cylinder centered at (0,0,0) with r=.5 and h=1
+// objPeye and objD must already be in object space.
+float cylinder(const glm::vec4 &objPeye, const glm::vec4 &objD)
+{
+    float currentT = -1.f;
+
+    float bodyT = cylinderBody(objPeye, objD);
+    if (bodyT >= 0) {
+        currentT = bodyT;
+    }
+
+    // top cap
+    float topT = cap(objPeye, objD, glm::vec3(0.f, 1.f, 0.f), glm::vec3(0.f, .5f, 0.f));
+    if (topT >= 0) {
+        currentT = currentT > 0 ? std::min(currentT, topT) : topT;
+    }
+
+    // bottom cap
+    float bottomT = cap(objPeye, objD, glm::vec3(0.f, -1.f, 0.f), glm::vec3(0.f, -.5f, 0.f));
+    if (bottomT >= 0) {
+        currentT = currentT > 0 ? std::min(currentT, bottomT) : bottomT;
+    }
+    return currentT;
+}
+
+// helper method for cone
+float coneBody(const glm::vec4 &objPeye, const glm::vec4 &objD)
+{
+    float a = objD.x * objD.x + objD.z * objD.z - (.25f * objD.y * objD.y);
+
+    float b = (2.f * objPeye.x * objD.x) + (2.f * objPeye.z * objD.z) -
+            (.5f * objPeye.y * objD.y) + (.25f * objD.y);
+
+    float c = objPeye.x * objPeye.x + objPeye.z * objPeye.z -
+            (.25f * objPeye.y * objPeye.y) + (.25f * objPeye.y) - (1.f/16.f);
+
+    float discriminant = b * b - (4.f * a * c);
+    if (!(discriminant >= 0.f)) {
+        return -1.f;
+    }
+
+    float t1 = (-b + std::sqrt(discriminant))/(2.f * a);
+    float t2 = (-b - std::sqrt(discriminant))/(2.f * a);
+
+    float y1 = objPeye.y + (t1 * objD.y);
+    float y2 = objPeye.y + (t2 * objD.y);
+    bool y1Valid = y1 >= -.5f && y1 <= .5f;
+    bool y2Valid = y2 >= -.5f && y2 <= .5f;
+
+    if (y1Valid && y2Valid) {
+        if (t1 > 0 && t2 > 0) {
+            return std::min(t1, t2);
+        } else if (t1 <= 0 && t2 <= 0) {
+            return -1.f;
+        }
+        return std::max(t1, t2);
+    } else if (y1Valid) {
+        return t1 > 0 ? t1 : -1.f;
+    } else if (y2Valid) {
+        return t2 > 0 ? t2 : -1.f;
+    }
+    return -1.f;
+}
+
+// finds the intersection 't' of the input ray with a cone centered at (0,0,0)
+// with r=.5 and h=1
+// objPeye and objD must already be in object space.
+float cone(const glm::vec4 &objPeye, const glm::vec4 &objD)
+{
+    float currentT = -1.f;
+
+    float bodyT = coneBody(objPeye, objD);
+    if (bodyT >= 0) {
+        currentT = bodyT;
+    }
+
+    float capT = cap(objPeye, objD, glm::vec3(0.f, -1.f, 0.f), glm::vec3(0.f, -.5f, 0.f));
+    if (capT >= 0) {
+        currentT = currentT > 0 ? std::min(currentT, capT) : capT;
+    }
+    return currentT;
+}
+
+// planeSignal is the axis of the plane's normal (0 = x, 1 = y, 2 = z)
+float plane(const glm::vec4 &objPeye, const glm::vec4 &objD, const glm::vec3 &normal, const glm::vec3 &pt, int planeSignal)
+{
+    float tDenom = glm::dot(normal, glm::vec3(objD));
+    float tNum1 = glm::dot(normal, pt);
+    float tNum2 = glm::dot(normal, glm::vec3(objPeye));
+    float t = (tNum1 - tNum2)/tDenom;
+    glm::vec4 p = objPeye + (t * objD);
+
+    // the two coordinates that must fall inside the face
+    int i = planeSignal == 0 ? 1 : 0;
+    int j = planeSignal == 2 ? 1 : 2;
+    bool inFace = p[i] >= -.5f && p[i] <= .5f && p[j] >= -.5f && p[j] <= .5f;
+    return inFace ? t : -1.f;
+}
+
+float cube(const glm::vec4 &objPeye, const glm::vec4 &objD)
+{
+    float currentT = -1.f;
+    for (int axis = 0; axis < 3; axis++) {
+        for (float side = 1.f; side >= -1.f; side -= 2.f) {
+            glm::vec3 norm(0.f);
+            norm[axis] = side;
+            float planeT = plane(objPeye, objD, norm, .5f * norm, axis);
+            if (planeT >= 0) {
+                currentT = currentT > 0 ? std::min(planeT, currentT) : planeT;
+            }
+        }
+    }
+    return currentT;
+}
+
+// Based on object space intersection point, get normal
+glm::vec3 sphereNormal(const glm::vec4 &point) {
+    return glm::normalize(glm::vec3(point));
+}
+
+glm::vec3 cylinderNormal(const glm::vec4 &point) {
+    if (std::fabs(point.y - 0.5f) < SHAPE_EPSILON) { // top cap
+        return glm::vec3(0.f, 1.f, 0.f);
+    } else if (std::fabs(point.y + 0.5f) < SHAPE_EPSILON) { // bottom cap
+        return glm::vec3(0.f, -1.f, 0.f);
+    }
+    // normal is just from the center axis (at same y value), to the point of intersection, normalized
+    return glm::vec3(glm::normalize(point - glm::vec4(0.f, point.y, 0.f, 1.f)));
+}
+
+glm::vec3 coneNormal(const glm::vec4 &point) {
+    if (std::fabs(point.y + 0.5f) < SHAPE_EPSILON) { // bottom cap
+        return glm::vec3(0.f, -1.f, 0.f);
+    }
+    // calculate x and z as if the normal is for a cylinder first
+    // and then use the length of that as the "tempradius" to calculate the y component
+    glm::vec3 cylNormal = glm::vec3(point) - glm::vec3(0.f, point.y, 0.f);
+    float yComponent = glm::length(cylNormal)/CONE_SLOPE;
+    return glm::normalize(glm::vec3(cylNormal.x, cylNormal.y + yComponent, cylNormal.z));
+}
+
+// returns normal of cube in object space
+glm::vec3 cubeNormal(const glm::vec4 &point) {
+    if (point.x >= (.5f - SHAPE_EPSILON)) {
+        return glm::vec3(1.f, 0.f, 0.f);
+    } else if (point.x <= (-.5f + SHAPE_EPSILON)) {
+        return glm::vec3(-1.f, 0.f, 0.f);
+    } else if (point.y >= (.5f - SHAPE_EPSILON)) {
+        return glm::vec3(0.f, 1.f, 0.f);
+    } else if (point.y <= (-.5f + SHAPE_EPSILON)) {
+        return glm::vec3(0.f, -1.f, 0.f);
+    } else if (point.z >= (.5f - SHAPE_EPSILON)) {
+        return glm::vec3(0.f, 0.f, 1.f);
+    }
+    return glm::vec3(0.f, 0.f, -1.f);
+}
+
+// Based on object space intersection point, get bitangent
+glm::vec3 sphereBitangent(const glm::vec4 &point) {
+    if (std::fabs(point.y - 0.5f) < SHAPE_EPSILON) { // top pole
+        return glm::vec3(0.f, 0.f, -1.f);
+    } else if (std::fabs(point.y + 0.5f) < SHAPE_EPSILON) { // bottom pole
+        return glm::vec3(0.f, 0.f, 1.f);
+    }
+    return glm::vec3(0.f, 1.f, 0.f);
+}
+
+glm::vec3 cubeBitangent(const glm::vec4 &point) {
+    if (point.x >= (.5f - SHAPE_EPSILON) || point.x <= (-.5f + SHAPE_EPSILON)) {
+        return glm::vec3(0.f, 1.f, 0.f);
+    } else if (point.y >= (.5f - SHAPE_EPSILON)) {
+        return glm::vec3(0.f, 0.f, -1.f);
+    } else if (point.y <= (-.5f + SHAPE_EPSILON)) {
+        return glm::vec3(0.f, 0.f, 1.f);
+    }
+    return glm::vec3(0.f, 1.f, 0.f);
+}
+
+glm::vec3 coneBitangent(const glm::vec4 &point) {
+    if (std::fabs(point.y + 0.5f) < SHAPE_EPSILON) { // bottom cap
+        return glm::vec3(0.f, 0.f, 1.f);
+    }
+    return glm::vec3(0.f, 1.f, 0.f);
+}
+
+glm::vec3 cylinderBitangent(const glm::vec4 &point) {
+    if (std::fabs(point.y - 0.5f) < SHAPE_EPSILON) { // top cap
+        return glm::vec3(0.f, 0.f, -1.f);
+    } else if (std::fabs(point.y + 0.5f) < SHAPE_EPSILON) { // bottom cap
+        return glm::vec3(0.f, 0.f, 1.f);
+    }
+    return glm::vec3(0.f, 1.f, 0.f);
+}
+
+// u around the y axis, shared by cone, sphere and cylinder
+float arcLengthU(const glm::vec4 &point) {
+    float theta = std::atan2(point.z, point.x);
+    return theta < 0.f ? -theta/(2 * PI) : 1.f - theta/(2 * PI);
+}
+
+glm::vec2 clampUV(const glm::vec2 &uv) {
+    return glm::clamp(uv, glm::vec2(0.f), glm::vec2(1.f));
+}
+
+glm::vec2 cubeUV(const glm::vec4 &p) {
+    glm::vec2 uv;
+    if (p.x >= (.5f - SHAPE_EPSILON)) {
+        uv = glm::vec2(1.f - (p.z + .5f), 1.f - (p.y + .5f));
+    } else if (p.x <= (-.5f + SHAPE_EPSILON)) {
+        uv = glm::vec2(p.z + .5f, 1.f - (p.y + .5f));
+    } else if (p.y >= (.5f - SHAPE_EPSILON)) {
+        uv = glm::vec2(p.x + .5f, p.z + .5f);
+    } else if (p.y <= (-.5f + SHAPE_EPSILON)) {
+        uv = glm::vec2(p.x + .5f, 1.f - (p.z + .5f));
+    } else if (p.z >= (.5f - SHAPE_EPSILON)) {
+        uv = glm::vec2(p.x + .5f, 1.f - (p.y + .5f));
+    } else {
+        uv = glm::vec2(1.f - (p.x + .5f), 1.f - (p.y + .5f));
+    }
+    return clampUV(uv);
+}
+
+glm::vec2 coneUV(const glm::vec4 &p) {
+    if (std::fabs(p.y + 0.5f) < SHAPE_EPSILON) { // bottom cap
+        return clampUV(glm::vec2(p.x + 0.5f, 1.f - (p.z + 0.5f)));
+    }
+    return clampUV(glm::vec2(arcLengthU(p), 1.f - (p.y + 0.5f)));
+}
+
+glm::vec2 sphereUV(const glm::vec4 &p) {
+    // At poles (v = 0 or v = 1), no u value. let u = arbitrary 0.5
+    if (std::fabs(p.y - 0.5f) < SHAPE_EPSILON) {
+        return glm::vec2(0.5f, 1.f);
+    } else if (std::fabs(p.y + 0.5f) < SHAPE_EPSILON) {
+        return glm::vec2(0.5f, 0.f);
+    }
+    float phi = std::asin(p.y/0.5f); // Radius is 0.5;
+    float v = 1.f - ((phi / PI) + 0.5f);
+    return clampUV(glm::vec2(arcLengthU(p), v));
+}
+
+glm::vec2 cylinderUV(const glm::vec4 &p) {
+    if (std::fabs(p.y - 0.5f) < SHAPE_EPSILON) { // top cap
+        return clampUV(glm::vec2(p.x + 0.5f, p.z + 0.5f));
+    } else if (std::fabs(p.y + 0.5f) < SHAPE_EPSILON) { // bottom cap
+        return clampUV(glm::vec2(p.x + 0.5f, 1.f - (p.z + 0.5f)));
+    }
+    return clampUV(glm::vec2(arcLengthU(p), 1.f - (p.y + 0.5f)));
+}
+
+// [RAY TRACING]
+/////////////////////////////////////////////////////////////////////////
+
+float checkObjectIntersection(const glm::vec4 &objectSpacePoint, const glm::vec4 &objectSpaceDirection, ShapeType primitive) {
+    switch (primitive) {
+    case ShapeType::SPHERE:   return sphere(objectSpacePoint, objectSpaceDirection);
+    case ShapeType::CONE:     return cone(objectSpacePoint, objectSpaceDirection);
+    case ShapeType::CYLINDER: return cylinder(objectSpacePoint, objectSpaceDirection);
+    case ShapeType::CUBE:     return cube(objectSpacePoint, objectSpaceDirection);
+    default:                  return -1.f;
+    }
+}
+
+glm::vec3 getObjectNormal(const glm::vec4 &point, ShapeType primitive) {
+    switch (primitive) {
+    case ShapeType::SPHERE:   return sphereNormal(point);
+    case ShapeType::CONE:     return coneNormal(point);
+    case ShapeType::CYLINDER: return cylinderNormal(point);
+    case ShapeType::CUBE:     return cubeNormal(point);
+    default:                  return glm::vec3(0.f);
+    }
+}
+
+glm::vec3 getObjectBitangent(const glm::vec4 &point, ShapeType primitive) {
+    switch (primitive) {
+    case ShapeType::SPHERE:   return sphereBitangent(point);
+    case ShapeType::CONE:     return coneBitangent(point);
+    case ShapeType::CYLINDER: return cylinderBitangent(point);
+    case ShapeType::CUBE:     return cubeBitangent(point);
+    default:                  return glm::vec3(0.f);
+    }
+}
+
+glm::vec2 getObjectUV(const glm::vec4 &point, ShapeType primitive) {
+    switch (primitive) {
+    case ShapeType::SPHERE:   return sphereUV(point);
+    case ShapeType::CONE:     return coneUV(point);
+    case ShapeType::CYLINDER: return cylinderUV(point);
+    case ShapeType::CUBE:     return cubeUV(point);
+    default:                  return glm::vec2(0.f);
+    }
+}
+
+// Get light vector, based on lightObject struct point and a world space point of intersection
+glm::vec4 getLightVector(const LightObject &lightObject, const glm::vec4 &worldSpaceIntersection) {
+    if (lightObject.type == ShapeType::LIGHT_POINT) {
+        return lightObject.pos - worldSpaceIntersection;
+    } else if (lightObject.type == ShapeType::LIGHT_DIRECTIONAL) {
+        return -glm::normalize(lightObject.dir);
+    }
+    return glm::vec4(0.f);
+}
+
+// Distance from the offset intersection point to the light, infinite for directional lights
+float getLightDistance(const LightObject &light, const glm::vec4 &offsetIntersection) {
+    if (light.type == ShapeType::LIGHT_POINT) {
+        return glm::length(offsetIntersection - light.pos);
+    }
+    return std::numeric_limits<float>::infinity();
+}
+
+// orthonormal basis with the given normal as its z axis, without branching on or
+// normalizing anything (Duff et al. 2017, "Building an Orthonormal Basis, Revisited")
+glm::mat3x3 getNormalBasis(const glm::vec3 &n)
+{
+    float s = n.z >= 0.f ? 1.f : -1.f;
+    float a = -1.f / (s + n.z);
+    float b = n.x * n.y * a;
+    return glm::mat3x3(glm::vec3(1.f + s * n.x * n.x * a, s * b, -s * n.x),
+                       glm::vec3(b, s + n.y * n.y * a, -n.y),
+                       n);
+}
+
+// Puts a homogeneous ray into one lane of a packet
+void setPacketRay(RayPacket &packet, int lane, const glm::vec4 &point, const glm::vec4 &direction)
+{
+    for (int i = 0; i < 4; i++) {
+        packet.origin[i][lane] = point[i];
+        packet.direction[i][lane] = direction[i];
+    }
+}
+
+} // namespace
+
+RayTracer::RayTracer(int numThreads) :
+    m_pool(std::make_unique<ThreadPool>(numThreads)),
+    m_width(0),
+    m_height(0),
+    m_convergedFraction(0.f),
+    m_bvh(nullptr),
+    m_settings(),
+    m_envMap(nullptr),
+    m_inverseCam(1.f),
+    m_numPasses(0),
+    m_traceGuides(true),
+    m_adaptiveBudget(1.f)
+{
+}
+
+RayTracer::~RayTracer()
+{
+}
+
+void RayTracer::resize(int width, int height) {
+    m_width = std::max(width, 0);
+    m_height = std::max(height, 0);
+    m_color.assign(m_width * m_height, glm::vec4(0.f));
+    m_moments.assign(m_width * m_height, glm::vec4(0.f));
+    m_geometry.assign(m_width * m_height, glm::vec4(0.f, 0.f, 0.f, -1.f));
+    m_albedo.assign(m_width * m_height, glm::vec4(0.f));
+    m_denoised.assign(m_width * m_height, glm::vec4(0.f));
+    m_denoiseScratch.assign(m_width * m_height, glm::vec4(0.f));
+    m_convergedFraction = 0.f;
+}
+
+void RayTracer::setTexture(int texID, Image diffuse, Image normal) {
+    if (texID < 0 || texID >= 3) {
+        return;
+    }
+    m_diffuseTextures[texID] = std::move(diffuse);
+    m_normalTextures[texID] = std::move(normal);
+}
+
+void RayTracer::setSimd(PacketTracer::Isa isa) {
+    m_packetTracer = PacketTracer(isa);
+}
+
+PacketTracer::Isa RayTracer::simd() const {
+    return m_packetTracer.isa();
+}
+
+void RayTracer::setBlueNoise(Image blueNoise) {
+    m_blueNoise = std::move(blueNoise);
+}
+
+const std::vector<glm::vec4>& RayTracer::colorBuffer() const {
+    return m_color;
+}
+
+const std::vector<glm::vec4>& RayTracer::momentsBuffer() const {
+    return m_moments;
+}
+
+const std::vector<glm::vec4>& RayTracer::geometryBuffer() const {
+    return m_geometry;
+}
+
+const std::vector<glm::vec4>& RayTracer::albedoBuffer() const {
+    return m_albedo;
+}
+
+const std::vector<glm::vec4>& RayTracer::denoisedBuffer() const {
+    return m_denoised;
+}
+
+float RayTracer::convergedFraction() const {
+    return m_convergedFraction;
+}
+
+int RayTracer::width() const {
+    return m_width;
+}
+
+int RayTracer::height() const {
+    return m_height;
+}
+
+int RayTracer::numThreads() const {
+    return m_pool->numThreads();
+}
+
+void RayTracer::render(const Scene &scene, const BVH &bvh, const SettingsData &settings,
+                       const CubeMap &envMap, const glm::mat4x4 &inverseCam,
+                       int numPasses, bool sceneChanged) {
+    m_scene = scene;
+    m_bvh = &bvh;
+
+    m_lightIntensities[0] = settings.l1Intensity;
+    m_lightIntensities[1] = settings.l2Intensity;
+    m_lightIntensities[2] = settings.l3Intensity;
+
+    m_settings = settings;
+    m_envMap = &envMap;
+    m_inverseCam = inverseCam;
+    m_numPasses = numPasses;
+    m_traceGuides = numPasses == 0 || sceneChanged;
+
+    // The budget comes from the last pass, like View's does
+    if (numPasses == 0) {
+        m_convergedFraction = 0.f;
+    }
+    m_adaptiveBudget = AdaptiveSampling::budget(m_convergedFraction);
+
+    int tilesX = (m_width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (m_height + TILE_SIZE - 1) / TILE_SIZE;
+    m_tileConverged.assign(tilesX * tilesY, 0);
+    m_pool->parallelFor(tilesX * tilesY, [this](int tile){ renderTile(tile); });
+
+    int converged = 0;
+    for (int count : m_tileConverged) {
+        converged += count;
+    }
+    m_convergedFraction = m_color.empty() ? 0.f : converged / static_cast<float>(m_color.size());
+
+    m_envMap = nullptr;
+    m_bvh = nullptr;
+}
+
+// View::denoise, one Denoiser::filterPixel per pixel and iteration. The first
+// iteration reads the resolved passes, the last one ends up in m_denoised
+void RayTracer::denoise(int iterations) {
+    iterations = std::max(1, std::min(iterations, static_cast<int>(Denoiser::MAX_ITERATIONS)));
+    std::vector<glm::vec4> &input = iterations % 2 == 0 ? m_denoised : m_denoiseScratch;
+    for (size_t i = 0; i < m_color.size(); i++) {
+        input[i] = Denoiser::resolve(m_color[i], m_moments[i]);
+    }
+
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        const std::vector<glm::vec4> &in = (iterations - iteration) % 2 == 0 ? m_denoised : m_denoiseScratch;
+        std::vector<glm::vec4> &out = (iterations - iteration) % 2 == 0 ? m_denoiseScratch : m_denoised;
+        int step = 1 << iteration;
+        m_pool->parallelFor(m_height, [&](int y){
+            for (int x = 0; x < m_width; x++) {
+                out[y * m_width + x] = Denoiser::filterPixel(x, y, step, m_width, m_height, in.data(),
+                                                             m_geometry.data(), m_albedo.data());
+            }
+        });
+    }
+
+    // composite.frag divides by alpha
+    for (glm::vec4 &color : m_denoised) {
+        color.a = 1.f;
+    }
+}
+
+// One tile of main() in ray.frag
+void RayTracer::renderTile(int tile) {
+    int tilesX = (m_width + TILE_SIZE - 1) / TILE_SIZE;
+    int x0 = (tile % tilesX) * TILE_SIZE;
+    int y0 = (tile / tilesX) * TILE_SIZE;
+    int x1 = std::min(x0 + TILE_SIZE, m_width);
+    int y1 = std::min(y0 + TILE_SIZE, m_height);
+
+    // Running sum in rgb and sample count in alpha, resolved by composite.frag
+    bool accumulate = m_settings.useStochastic == 1 && m_numPasses > 0;
+    bool adaptive = m_settings.useAdaptive == 1 && m_settings.useStochastic == 1;
+    const Image *blueNoise = m_settings.useBlueNoise == 1 ? &m_blueNoise : nullptr;
+    bool packets = m_packetTracer.width() > 1 && m_settings.useDOF == 0;
+    int converged = 0;
+    for (int y = y0; y < y1; y++) {
+        // Samples each pixel of the row takes this pass, 0 once it has converged
+        int numPixelSamples[TILE_SIZE];
+        for (int x = x0; x < x1; x++) {
+            if (m_traceGuides) {
+                m_geometry[y * m_width + x] = primaryGeometry(x + .5f, y + .5f, m_albedo[y * m_width + x]);
+            }
+
+            glm::vec4 &out = m_color[y * m_width + x];
+            glm::vec4 &moments = m_moments[y * m_width + x];
+            if (!accumulate) {
+                out = glm::vec4(0.f);
+                moments = glm::vec4(0.f);
+            }
+
+            numPixelSamples[x - x0] = 1;
+            if (adaptive) {
+                if (moments.z > .5f) {
+                    converged++;
+                    numPixelSamples[x - x0] = 0;
+                    continue;
+                }
+                Sampler sampler = Sampler::forPixel(x, y, static_cast<uint32_t>(out.a), blueNoise);
+                numPixelSamples[x - x0] = AdaptiveSampling::samplesThisPass(
+                            moments, out.a, m_settings.adaptiveThreshold, m_adaptiveBudget,
+                            sampler.get2D(SAMPLE_ADAPTIVE).x);
+            }
+        }
+
+        if (packets) {
+            for (int x = x0; x < x1; x += m_packetTracer.width()) {
+                tracePacket(x, std::min(x + m_packetTracer.width(), x1), y, numPixelSamples + (x - x0), blueNoise);
+            }
+        } else {
+            // Each sample is numbered by how many the pixel has accumulated before it
+            for (int x = x0; x < x1; x++) {
+                glm::vec4 &out = m_color[y * m_width + x];
+                glm::vec4 &moments = m_moments[y * m_width + x];
+                for (int i = 0; i < numPixelSamples[x - x0]; i++) {
+                    glm::vec3 currColor(tracePixel(x + .5f, y + .5f,
+                                                   Sampler::forPixel(x, y, static_cast<uint32_t>(out.a), blueNoise)));
+                    out += glm::vec4(currColor, 1.f);
+                    AdaptiveSampling::addSample(moments, out.a, currColor);
+                }
+            }
+        }
+
+        for (int x = x0; x < x1; x++) {
+            if (numPixelSamples[x - x0] == 0) {
+                continue;
+            }
+            glm::vec4 &out = m_color[y * m_width + x];
+            glm::vec4 &moments = m_moments[y * m_width + x];
+            moments.z = AdaptiveSampling::isConverged(moments, out.a, m_settings.adaptiveThreshold) ? 1.f : 0.f;
+            converged += static_cast<int>(moments.z);
+        }
+    }
+    m_tileConverged[tile] = converged;
+}
+
+// Scale frag coord to canonical view volume film plane
+// Positioned at z = -1.0
+glm::vec2 RayTracer::toFilmPlane(float xFragCoord, float yFragCoord) const {
+    float width = static_cast<float>(m_width);
+    float height = static_cast<float>(m_height);
+    float u = (xFragCoord / width) * 2.f - 1.f;
+    float v = (yFragCoord / height) * 2.f - 1.f;
+    return glm::vec2(u * width/height, v);
+}
+
+// Camera space point on the film plane a sample of the pixel goes through
+glm::vec4 RayTracer::getFilmPoint(float xFragCoord, float yFragCoord, const Sampler &sampler) const {
+    float width = static_cast<float>(m_width);
+    float height = static_cast<float>(m_height);
+
+    glm::vec2 film = toFilmPlane(xFragCoord, yFragCoord);
+    float u = film.x;
+    float v = film.y;
+
+    // If using stochastic, jitter the ray within this 'pixel'
+    if (m_settings.useStochastic == 1) {
+        float sizeAcross = 2.f/width;
+        float sizeDown = 2.f/height;
+        glm::vec2 jitter = sampler.get2D(SAMPLE_AA) * 2.f - 1.f;
+        u = u + jitter.x * (sizeAcross/2);
+        v = v + jitter.y * (sizeDown/2);
+    }
+
+    return glm::vec4(u, v, -1.f, 1.f);
+}
+
+// tracePixel() in ray.frag
+glm::vec4 RayTracer::tracePixel(float xFragCoord, float yFragCoord, const Sampler &sampler) const {
+    glm::vec4 eye(0.f, 0.f, 0.f, 1.f);
+    return rayTrace(eye, getFilmPoint(xFragCoord, yFragCoord, sampler), sampler);
+}
+
+// renderTile's samples of pixels [x0, x1) in row y, one packet per sample index.
+// The primary rays and their shadow rays are traced as packets, the rest of
+// shootRay (shading, AO and reflection rays) runs for each pixel on its own
+void RayTracer::tracePacket(int x0, int x1, int y, const int *numPixelSamples, const Image *blueNoise) {
+    int numLanes = x1 - x0;
+    int maxSamples = *std::max_element(numPixelSamples, numPixelSamples + numLanes);
+
+    // rayTrace() without depth of field
+    glm::vec4 eye = m_inverseCam * glm::vec4(0.f, 0.f, 0.f, 1.f);
+    for (int i = 0; i < maxSamples; i++) {
+        RayPacket primary;
+        primary.active = 0;
+        Sampler samplers[RayPacket::MAX_SIZE];
+        glm::vec4 directions[RayPacket::MAX_SIZE];
+        for (int lane = 0; lane < numLanes; lane++) {
+            if (i >= numPixelSamples[lane]) {
+                continue;
+            }
+            int x = x0 + lane;
+            samplers[lane] = Sampler::forPixel(x, y, static_cast<uint32_t>(m_color[y * m_width + x].a), blueNoise);
+            directions[lane] = m_inverseCam * getFilmPoint(x + .5f, y + .5f, samplers[lane]) - eye;
+            setPacketRay(primary, lane, eye, directions[lane]);
+            primary.active |= 1u << lane;
+        }
+
+        PacketHits hits;
+        m_packetTracer.closestHit(*m_bvh, m_scene, primary, hits);
+        PrimitiveType firstHits[RayPacket::MAX_SIZE];
+        unsigned int hitLanes = 0;
+        for (int lane = 0; lane < numLanes; lane++) {
+            int objectIndex = hits.objectIndex[lane];
+            if (((primary.active >> lane) & 1u) && objectIndex >= 0) {
+                firstHits[lane] = {hits.t[lane], m_scene.primitives[objectIndex], objectIndex,
+                                   hits.triangle[lane], hits.barycentric[lane]};
+                hitLanes |= 1u << lane;
+            } else {
+                firstHits[lane] = {-1.f, ShapeType::NO_INTERSECT, -1, -1, glm::vec2(0.f)};
+            }
+        }
+
+        // One packet per light, from the normals calculateLighting will shade with
+        int shadowedLights[RayPacket::MAX_SIZE];
+        std::fill(shadowedLights, shadowedLights + RayPacket::MAX_SIZE, -1);
+        if (m_settings.useShadows == 1 && hitLanes != 0) {
+            glm::vec4 normals[RayPacket::MAX_SIZE];
+            for (int lane = 0; lane < numLanes; lane++) {
+                if ((hitLanes >> lane) & 1u) {
+                    const PrimitiveType &hit = firstHits[lane];
+                    normals[lane] = getWorldSpaceNormal(hit, eye, directions[lane]);
+                    if (m_settings.useNM == 1 && m_scene.material(hit.objectIndex).blend > 0.f) {
+                        normals[lane] = getNormalMappedNormal(hit, normals[lane], eye, directions[lane]);
+                    }
+                    shadowedLights[lane] = 0;
+                }
+            }
+            for (int light = 0; light < 3; light++) {
+                RayPacket shadow;
+                shadow.active = hitLanes;
+                for (int lane = 0; lane < numLanes; lane++) {
+                    if ((hitLanes >> lane) & 1u) {
+                        glm::vec4 start, rayToLight;
+                        shadow.tMax[lane] = getShadowRay(firstHits[lane], eye, directions[lane], normals[lane],
+                                                         m_scene.lights[light], start, rayToLight);
+                        setPacketRay(shadow, lane, start, rayToLight);
+                    }
+                }
+                unsigned int occluded = m_packetTracer.anyHit(*m_bvh, m_scene, shadow);
+                for (int lane = 0; lane < numLanes; lane++) {
+                    if ((occluded >> lane) & 1u) {
+                        shadowedLights[lane] |= 1 << light;
+                    }
+                }
+            }
+        }
+
+        for (int lane = 0; lane < numLanes; lane++) {
+            if ((primary.active >> lane) & 1u) {
+                glm::vec4 &out = m_color[y * m_width + x0 + lane];
+                glm::vec3 currColor(shootRay(eye, directions[lane], samplers[lane],
+                                             &firstHits[lane], shadowedLights[lane]));
+                out += glm::vec4(currColor, 1.f);
+                AdaptiveSampling::addSample(m_moments[y * m_width + x0 + lane], out.a, currColor);
+            }
+        }
+    }
+}
+
+// Diffuse color of a hit, with the texture blended in like calculateLighting does
+glm::vec4 RayTracer::getAlbedo(const PrimitiveType &obj, const glm::vec4 &worldPoint,
+                               const glm::vec4 &worldDirection) const
+{
+    const Material &material = m_scene.material(obj.objectIndex);
+    glm::vec4 albedo = material.cDiffuse;
+    if (m_settings.useTextures == 1) {
+        glm::vec4 objectSpacePoint = worldToObject(obj) * worldPoint;
+        glm::vec4 objectSpaceDirection = worldToObject(obj) * worldDirection;
+        glm::vec4 textureColor = sampleTexture(objectSpacePoint, objectSpaceDirection, obj, false);
+        albedo = material.blend * textureColor + (1.f - material.blend) * albedo;
+    }
+    return albedo;
+}
+
+// The denoiser's guides through a pixel's centre, see [REPROJECTION] in ray.frag
+glm::vec4 RayTracer::primaryGeometry(float xFragCoord, float yFragCoord, glm::vec4 &albedo) const {
+    glm::vec4 eye = m_inverseCam * glm::vec4(0.f, 0.f, 0.f, 1.f);
+    glm::vec4 dir = m_inverseCam * glm::vec4(toFilmPlane(xFragCoord, yFragCoord), -1.f, 1.f) - eye;
+    PrimitiveType hit = getIntersection(eye, dir);
+    if (hit.primitive == ShapeType::NO_INTERSECT) {
+        albedo = getBackgroundColor(dir);
+        return glm::vec4(0.f, 0.f, 0.f, -1.f);
+    }
+    albedo = getAlbedo(hit, eye, dir);
+    glm::vec3 normal = glm::normalize(glm::vec3(getWorldSpaceNormal(hit, eye, dir)));
+    return glm::vec4(normal, hit.t * glm::length(dir));
+}
+
+const glm::mat4x4& RayTracer::worldToObject(const PrimitiveType &obj) const {
+    static const glm::mat4x4 identity(1.f);
+    return obj.objectIndex >= 0 ? m_scene.worldToObject[obj.objectIndex] : identity;
+}
+
+glm::vec4 RayTracer::sampleEnvironment(const glm::vec3 &direction) const {
+    return m_envMap ? m_envMap->sample(direction) : glm::vec4(0.f);
+}
+
+// returns the closest intersected object in the scene.
+RayTracer::PrimitiveType RayTracer::getIntersection(const glm::vec4 &worldSpacePoint, const glm::vec4 &worldSpaceDir) const
+{
+    // The closest mesh hit so far and where on the mesh it was. Should a mesh be the
+    // closest object, it is the closest mesh too, so this is its hit
+    float meshT = -1.f;
+    int triangle = -1;
+    glm::vec2 barycentric(0.f);
+
+    float bestT;
+    int bestIndex = m_bvh->closestHit(worldSpacePoint, worldSpaceDir, bestT, [&](int i) {
+        const glm::mat4x4 &worldToObject = m_scene.worldToObject[i];
+        if (m_scene.primitives[i] != ShapeType::MESH) {
+            return checkObjectIntersection(worldToObject * worldSpacePoint,
+                                           worldToObject * worldSpaceDir, m_scene.primitives[i]);
+        }
+        int meshTriangle;
+        glm::vec2 meshBarycentric;
+        float t = m_scene.meshes[m_scene.meshIndex[i]]->closestHit(worldToObject * worldSpacePoint,
+                                                                   worldToObject * worldSpaceDir,
+                                                                   meshTriangle, meshBarycentric);
+        if (t > 0.f && (meshT < 0.f || t < meshT)) {
+            meshT = t;
+            triangle = meshTriangle;
+            barycentric = meshBarycentric;
+        }
+        return t;
+    });
+
+    if (bestIndex < 0) {
+        return {-1.f, ShapeType::NO_INTERSECT, -1, -1, glm::vec2(0.f)};
+    }
+    if (m_scene.primitives[bestIndex] != ShapeType::MESH) {
+        return {bestT, m_scene.primitives[bestIndex], bestIndex, -1, glm::vec2(0.f)};
+    }
+    return {bestT, ShapeType::MESH, bestIndex, triangle, barycentric};
+}
+
+// returns true if any object is hit closer than tMax, stopping at the first one
+bool RayTracer::isOccluded(const glm::vec4 &worldSpacePoint, const glm::vec4 &worldSpaceDir, float tMax) const
+{
+    return m_bvh->anyHit(worldSpacePoint, worldSpaceDir, tMax, [&](int i) {
+        const glm::mat4x4 &worldToObject = m_scene.worldToObject[i];
+        if (m_scene.primitives[i] == ShapeType::MESH) {
+            return m_scene.meshes[m_scene.meshIndex[i]]->anyHit(worldToObject * worldSpacePoint,
+                                                                worldToObject * worldSpaceDir, tMax);
+        }
+        return checkObjectIntersection(worldToObject * worldSpacePoint,
+                                       worldToObject * worldSpaceDir, m_scene.primitives[i]);
+    });
+}
+
+// the shadow ray from obj's intersection point to the light, returns its tMax
+float RayTracer::getShadowRay(const PrimitiveType &obj, const glm::vec4 &worldPoint, const glm::vec4 &worldDirection,
+                              const glm::vec4 &worldSpaceNormal, const LightObject &light,
+                              glm::vec4 &raisedStartPt, glm::vec4 &rayToLight) const
+{
+    glm::vec4 worldSpaceIntersectionPt = worldPoint + obj.t * worldDirection;
+
+    // raise world space intersection point by epsilon along normal
+    raisedStartPt = worldSpaceIntersectionPt + (SHAPE_EPSILON * worldSpaceNormal);
+    rayToLight = getLightVector(light, worldSpaceIntersectionPt);
+    // distance to light in units of rayToLight (infinite for directional lights)
+    return getLightDistance(light, raisedStartPt) / glm::length(rayToLight);
+}
+
+// checks for shadow intersection and returns appropriate light color.
+// if an object obstructs the given object and light, returns black.
+// otherwise returns light color. shadowed is 0 or 1 if the shadow ray was
+// already traced (see tracePacket), -1 traces it here
+glm::vec4 RayTracer::getLightContribution(const PrimitiveType &obj, const glm::vec4 &worldPoint, const glm::vec4 &worldDirection,
+                                          const glm::vec4 &worldSpaceNormal, const LightObject &light,
+                                          int shadowed) const
+{
+    if (shadowed < 0) {
+        glm::vec4 raisedStartPt, rayToLight;
+        float tMax = getShadowRay(obj, worldPoint, worldDirection, worldSpaceNormal, light, raisedStartPt, rayToLight);
+
+        // any object between the point and the light casts a shadow, the closest one doesn't matter
+        shadowed = isOccluded(raisedStartPt, rayToLight, tMax) ? 1 : 0;
+    }
+    if (shadowed == 1) {
+        return glm::vec4(0.f, 0.f, 0.f, 1.f);
+    }
+    return light.color;
+}
+
+// Texture Mapping
+// Sample a texture, given a material's textureMap and a object space intersection point
+glm::vec4 RayTracer::sampleTexture(const glm::vec4 &objectSpacePoint, const glm::vec4 &objectSpaceDirection,
+                                   const PrimitiveType &obj, bool normalMap) const
+{
+    const Material &material = m_scene.material(obj.objectIndex);
+    if (material.texID < 0 || material.texID >= 3) {
+        return glm::vec4(0.f);
+    }
+
+    glm::vec2 uv = obj.primitive == ShapeType::MESH ?
+                m_scene.meshes[m_scene.meshIndex[obj.objectIndex]]->uv(obj.triangle, obj.barycentric) :
+                getObjectUV(objectSpacePoint + obj.t * objectSpaceDirection, obj.primitive);
+    float sIndex = glslMod(uv[0] * material.repeatU, 1.f);
+    float tIndex = glslMod(uv[1] * material.repeatV, 1.f);
+
+    const Image &texture = normalMap ? m_normalTextures[material.texID] : m_diffuseTextures[material.texID];
+    return glm::vec4(glm::vec3(texture.sample(glm::vec2(sIndex, tIndex))), 1.f);
+}
+
+glm::vec4 RayTracer::getNormalMappedNormal(const PrimitiveType &obj, glm::vec4 worldNormal,
+                                           const glm::vec4 &worldPoint, const glm::vec4 &worldDirection) const
+{
+    const glm::mat4x4 &inverseCtm = worldToObject(obj);
+    glm::vec4 objectSpacePoint = inverseCtm * worldPoint;
+    glm::vec4 objectSpaceDirection = inverseCtm * worldDirection;
+    glm::vec4 objectSpaceIntersection = objectSpacePoint + obj.t * objectSpaceDirection;
+
+    // inverse of normalToWorld, takes the normal back to object space
+    glm::mat3x3 worldToObjectNormal = glm::transpose(glm::mat3x3(m_scene.objectToWorld[obj.objectIndex]));
+    glm::vec3 objectSpaceNormal = worldToObjectNormal * glm::vec3(worldNormal);
+    glm::vec3 objectSpaceBitangent = obj.primitive == ShapeType::MESH ?
+                m_scene.meshes[m_scene.meshIndex[obj.objectIndex]]->bitangent(obj.triangle) :
+                getObjectBitangent(objectSpaceIntersection, obj.primitive);
+    glm::vec3 objectSpaceTangent = glm::cross(objectSpaceBitangent, objectSpaceNormal);
+    glm::mat3x3 tangentToObject(objectSpaceTangent, objectSpaceBitangent, objectSpaceNormal);
+
+    // Sample normal map and remap tangent space texture data into normal domain [-1, 1]
+    glm::vec3 tangentNormal = glm::vec3(sampleTexture(objectSpacePoint, objectSpaceDirection, obj, true)) * 2.f - 1.f;
+
+    // Convert tangent space to object space to normal space
+    objectSpaceNormal = tangentToObject * tangentNormal;
+    return glm::vec4(m_scene.normalToWorld[obj.objectIndex] * objectSpaceNormal, 0.f);
+}
+
+// The primary lighting equation
+// Calculate lighting for this material at this intersection point
+glm::vec4 RayTracer::calculateLighting(glm::vec4 worldNormal, const glm::vec4 &worldPoint,
+                                       const glm::vec4 &worldDirection, const PrimitiveType &obj,
+                                       int shadowedLights) const
+{
+    const Material &material = m_scene.material(obj.objectIndex);
+    glm::vec4 worldIntersection = worldPoint + (obj.t * worldDirection);
+
+    glm::vec4 objDiffuse = globalData.kd * material.cDiffuse; // apply global diffuse before we texture map
+
+    // --------- AMBIENT ---------
+    glm::vec4 ambient = m_settings.useAmbient == 1 ? globalData.ka * material.cAmbient : glm::vec4(0.f);
+
+    // --------- TEXTURE MAPPING ---------
+    if (m_settings.useTextures == 1) {
+        glm::vec4 objectSpacePoint = worldToObject(obj) * worldPoint;
+        glm::vec4 objectSpaceDirection = worldToObject(obj) * worldDirection;
+        glm::vec4 textureColor = sampleTexture(objectSpacePoint, objectSpaceDirection, obj, false);
+        objDiffuse = material.blend * textureColor + (1.f - material.blend) * objDiffuse;
+    }
+
+    // --------- NORMAL MAPPING ---------
+    if (m_settings.useNM == 1 && material.blend > 0.f) {
+        worldNormal = getNormalMappedNormal(obj, worldNormal, worldPoint, worldDirection);
+    }
+
+    glm::vec4 sum(0.f);
+    float lightIntensitySum = 0.f;
+
+    // For each light in the scene, calculate lighting contribution
+    for (int i = 0; i < 3; i++) {
+        const LightObject &light = m_scene.lights[i];
+
+        // from intersection point to light. should NOT be normalized.
+        glm::vec4 lightVec = getLightVector(light, worldIntersection);
+
+        // --------- SHADOWS ---------
+        glm::vec4 lightIntensity = m_settings.useShadows == 1 ?
+                    getLightContribution(obj, worldPoint, worldDirection, worldNormal, light,
+                                         shadowedLights < 0 ? -1 : (shadowedLights >> i) & 1) : light.color;
+
+        // Scale lightIntensity by UI setting
+        lightIntensity *= m_lightIntensities[i];
+        lightIntensitySum += m_lightIntensities[i];
+
+        // --------- DIFFUSE ---------
+        glm::vec4 diffuse(0.f);
+        if (m_settings.useDiffuse == 1) {
+            float lambert = glm::dot(glm::vec3(worldNormal), glm::normalize(glm::vec3(lightVec)));
+            diffuse = objDiffuse * glm::clamp(lambert, 0.f, 1.f);
+        }
+
+        // --------- SPECULAR ---------
+        glm::vec4 specular(0.f);
+        if (m_settings.useSpecular == 1) {
+            glm::vec4 reflectedLightRay = glm::reflect(-glm::normalize(lightVec), worldNormal);
+            glm::vec4 lineOfSight = worldPoint - worldIntersection;
+            float specularDot = glm::clamp(glm::dot(glm::normalize(reflectedLightRay), glm::normalize(lineOfSight)), 0.f, 1.f);
+            specular = glm::clamp(material.cSpecular * globalData.ks * std::pow(specularDot, material.shininess), 0.f, 1.f);
+        }
+
+        // --------- LIGHT ATTENUATION ---------
+        float lightAttenuation = 1.f;
+        if (light.type != ShapeType::LIGHT_DIRECTIONAL) {
+            float lightDistance = glm::length(lightVec);
+            lightAttenuation = 1.f / (light.function[0]
+                                      + light.function[1] * lightDistance
+                                      + light.function[2] * lightDistance * lightDistance);
+        }
+
+        sum += lightAttenuation * lightIntensity * (diffuse + specular);
+    }
+
+    // Scale ambient by average of lightIntensities from UI
+    float avgLightIntensity = lightIntensitySum / 3.f;
+    return (avgLightIntensity * ambient) + sum;
+}
+
+// returns the world space normal from an intersection point of the given world space ray and obj.
+glm::vec4 RayTracer::getWorldSpaceNormal(const PrimitiveType &obj, const glm::vec4 &worldSpacePoint,
+                                         const glm::vec4 &worldSpaceDir) const
+{
+    const glm::mat4x4 &inverseCtm = worldToObject(obj);
+    glm::vec4 objSpaceIntersection = inverseCtm * worldSpacePoint + obj.t * (inverseCtm * worldSpaceDir);
+    glm::vec3 objNormal = obj.primitive == ShapeType::MESH ?
+                m_scene.meshes[m_scene.meshIndex[obj.objectIndex]]->normal(obj.triangle, obj.barycentric,
+                                                                           inverseCtm * worldSpaceDir) :
+                getObjectNormal(objSpaceIntersection, obj.primitive);
+    return glm::vec4(m_scene.normalToWorld[obj.objectIndex] * objNormal, 0.f);
+}
+
+// given the closest intersected object of the ray worldSpacePoint/Dir, finds the
+// fraction of cosine weighted directions above the hit that are open for maxDist
+float RayTracer::getAOcontribution(const PrimitiveType &intersectObject, const glm::vec4 &worldSpacePoint,
+                                   const glm::vec4 &worldSpaceDir, const Sampler &sampler) const
+{
+    glm::vec4 worldNormal = getWorldSpaceNormal(intersectObject, worldSpacePoint, worldSpaceDir);
+    if (m_settings.useNM == 1 && m_scene.material(intersectObject.objectIndex).blend > 0.f) {
+        worldNormal = getNormalMappedNormal(intersectObject, worldNormal, worldSpacePoint, worldSpaceDir);
+    }
+    worldNormal = glm::normalize(worldNormal);
+
+    // raise the intersection point by epsilon
+    glm::vec4 worldSpaceIntersectionPt = worldSpacePoint + (intersectObject.t * worldSpaceDir);
+    glm::vec4 raisedIntersectionPt = worldSpaceIntersectionPt + (SHAPE_EPSILON/2.f * worldNormal);
+
+    // takes hemisphere directions around z+ to directions around the normal
+    glm::mat3x3 normalBasis = getNormalBasis(glm::vec3(worldNormal));
+
+    float maxDist = 1.5f;
+    int sampleNum = m_settings.useStochastic == 0 ? m_settings.numSamples : 5;
+    int occludedCount = 0;
+
+    for (int i = 0; i < sampleNum; i++) {
+        // cosine weighted: a uniform point on the disk, projected up onto the hemisphere
+        glm::vec2 xi = sampler.get2D(SAMPLE_AO, i, sampleNum);
+        float r = std::sqrt(xi.x);
+        float phi = 2.f * PI * xi.y;
+        glm::vec3 hemisphereVec(r * std::cos(phi), r * std::sin(phi), std::sqrt(std::max(0.f, 1.f - xi.x)));
+
+        glm::vec4 sampleDir(normalBasis * hemisphereVec, 0.f);
+        occludedCount += static_cast<int>(isOccluded(raisedIntersectionPt, sampleDir, maxDist));
+    }
+
+    return 1.f - static_cast<float>(occludedCount) / static_cast<float>(sampleNum);
+}
+
+// assuming an intersection of worldSpacePoint/Dir and intersectObject, finds
+// necessary normals and calculates color using 'calculateLighting' based on those values.
+// shadowedLights has bit i set if light i is blocked, or is -1 to trace the shadow rays
+glm::vec4 RayTracer::getColor(const PrimitiveType &intersectObject, const glm::vec4 &worldSpacePoint,
+                              const glm::vec4 &worldSpaceDir, int shadowedLights) const
+{
+    glm::vec4 worldNormal = getWorldSpaceNormal(intersectObject, worldSpacePoint, worldSpaceDir);
+    return calculateLighting(worldNormal, worldSpacePoint, worldSpaceDir, intersectObject, shadowedLights);
+}
+
+// Color of a ray that misses everything
+glm::vec4 RayTracer::getBackgroundColor(const glm::vec4 &worldSpaceDir) const {
+    // default background color is a light gray
+    glm::vec4 outColor(0.8f, 0.8f, 0.8f, 1.f);
+    if (m_settings.useEnvironment == 1) {
+        outColor = glm::vec4(glm::vec3(sampleEnvironment(glm::vec3(worldSpaceDir))), 1.f);
+    }
+    return outColor;
+}
+
+// firstHit is the closest intersection of worldSpacePoint/Dir, already traced by
+// shootRay, and firstShadowedLights its shadows as getColor takes them
+glm::vec4 RayTracer::recursiveRayTrace(const glm::vec4 &worldSpacePoint, const glm::vec4 &worldSpaceDir,
+                                       const PrimitiveType &firstHit, int firstShadowedLights) const
+{
+    glm::vec4 backgroundColor = getBackgroundColor(worldSpaceDir);
+
+    glm::vec4 worldSpaceIncomingPt = worldSpacePoint;
+    glm::vec4 worldSpaceIncomingDir = worldSpaceDir;
+
+    // cumulative color, and the reflection scalar that lessens with each bounce
+    glm::vec3 cumulative(0.f);
+    glm::vec3 scalar(1.f);
+    bool isReflecting = false;
+
+    for (int i = 0; i < MAX_BOUNCE; i++) {
+        PrimitiveType intersectedObj = i == 0 ? firstHit
+                                              : getIntersection(worldSpaceIncomingPt, worldSpaceIncomingDir);
+
+        if (intersectedObj.t > 0) {
+            isReflecting = true;
+
+            glm::vec4 color = getColor(intersectedObj, worldSpaceIncomingPt, worldSpaceIncomingDir,
+                                       i == 0 ? firstShadowedLights : -1);
+            cumulative += scalar * glm::vec3(color);
+            scalar *= glm::vec3(m_scene.material(intersectedObj.objectIndex).cReflective) * globalData.ks;
+
+            // reflectedRay starts at obj's intersection point, raised by epsilon along the normal
+            glm::vec4 reflectedRayStart = worldSpaceIncomingPt + intersectedObj.t * worldSpaceIncomingDir;
+            glm::vec4 worldSpaceNorm = getWorldSpaceNormal(intersectedObj, worldSpaceIncomingPt, worldSpaceIncomingDir);
+            glm::vec4 reflectedRayStartRaised = reflectedRayStart + (SHAPE_EPSILON * worldSpaceNorm);
+
+            // eye line reflected about object's normal at point of intersection
+            glm::vec4 incomingRay = glm::normalize(reflectedRayStart - worldSpaceIncomingPt);
+            glm::vec4 reflectedRayDirection = glm::normalize(glm::reflect(incomingRay, worldSpaceNorm));
+
+            worldSpaceIncomingPt = reflectedRayStartRaised;
+            worldSpaceIncomingDir = reflectedRayDirection;
+        } else {
+            // no intersection, terminate iteration
+            // if environment cube on, sample the reflection on the skybox
+            glm::vec4 refColor = backgroundColor;
+            if (m_settings.useEnvironment == 1 && isReflecting) {
+                // ray.frag swizzles the lookup direction here rather than the color
+                glm::vec4 d = worldSpaceIncomingDir;
+                glm::vec4 texel = sampleEnvironment(glm::vec3(d.z, d.y, d.x));
+                refColor = glm::vec4(texel.b, texel.g, texel.r, texel.a);
+            }
+            cumulative += scalar * glm::vec3(refColor);
+            break;
+        }
+    }
+
+    return glm::vec4(glm::clamp(cumulative, 0.f, 1.f), 1.f);
+}
+
+// shootRay: Iterate through objects in scene and check for intersections
+// This takes in vec4 point and vec4 direction in WORLD SPACE.
+// firstHit and shadowedLights are passed in when a packet already traced them
+glm::vec4 RayTracer::shootRay(const glm::vec4 &worldSpacePoint, const glm::vec4 &worldSpaceDir,
+                              const Sampler &sampler, const PrimitiveType *firstHit, int shadowedLights) const
+{
+    glm::vec4 outColor = getBackgroundColor(worldSpaceDir);
+
+    // the closest intersected object, shared by lighting, reflections and AO
+    PrimitiveType intersectObject = firstHit ? *firstHit : getIntersection(worldSpacePoint, worldSpaceDir);
+
+    if (m_settings.useReflections == 1) {
+        outColor = recursiveRayTrace(worldSpacePoint, worldSpaceDir, intersectObject, shadowedLights);
+    } else if (intersectObject.primitive != ShapeType::NO_INTERSECT) {
+        outColor = getColor(intersectObject, worldSpacePoint, worldSpaceDir, shadowedLights);
+    }
+
+    if (m_settings.useAO == 1) {
+        // rays that miss everything are unoccluded
+        float aoContribution = 1.f;
+        if (intersectObject.primitive != ShapeType::NO_INTERSECT) {
+            aoContribution = getAOcontribution(intersectObject, worldSpacePoint, worldSpaceDir, sampler);
+        }
+
+        // If no lighting features are enabled, make the color _just_ AO
+        if (m_settings.useAmbient == 0 &&
+                m_settings.useDiffuse == 0 &&
+                m_settings.useSpecular == 0 &&
+                m_settings.useReflections == 0) {
+            outColor = glm::vec4(aoContribution, aoContribution, aoContribution, 1.f);
+        } else {
+            outColor = aoContribution * outColor;
+        }
+    }
+    return outColor;
+}
+
+// rayTrace:
+// Given a camera space eye point and a camera space film point
+// Begin the ray tracing process by either shooting from a locally
+// randomized eye point (DOF) or the regular eye point.
+glm::vec4 RayTracer::rayTrace(const glm::vec4 &cameraSpaceEye, const glm::vec4 &cameraSpaceFilmPoint,
+                              const Sampler &sampler) const
+{
+    if (m_settings.useDOF == 1) {
+        int numSamples = m_settings.useStochastic == 0 ? m_settings.numSamples : 1;
+        glm::vec4 xDelta(m_settings.aperture/50000.f, 0.f, 0.f, 0.f);
+        glm::vec4 yDelta(0.f, m_settings.aperture/50000.f, 0.f, 0.f);
+        glm::vec4 filmPoint = m_inverseCam * glm::vec4(glm::vec3(cameraSpaceFilmPoint) * (m_settings.focalLength/100.f), 1.f);
+
+        glm::vec4 outColor(0.f, 0.f, 0.f, 1.f);
+        for (int i = 0; i < numSamples; i++) {
+            // With depth of field. Jitter the eye and move the film point to the focal distance.
+            glm::vec2 lens = sampler.get2D(SAMPLE_DOF, i, numSamples) * 2.f - 1.f;
+
+            glm::vec4 eye = m_inverseCam * (cameraSpaceEye + lens.x * xDelta + lens.y * yDelta);
+            outColor += shootRay(eye, filmPoint - eye, sampler.split(i, numSamples));
+        }
+        return glm::vec4(glm::vec3(outColor) / static_cast<float>(numSamples), 1.f);
+    }
+
+    // No depth of field. Regular eye and film point.
+    glm::vec4 eye = m_inverseCam * cameraSpaceEye;
+    glm::vec4 filmPoint = m_inverseCam * cameraSpaceFilmPoint;
+    return shootRay(eye, filmPoint - eye, sampler);
+}
+
+}}
@@ -0,0 +1,168 @@
+#ifndef CPU_RAYTRACER_H
+#define CPU_RAYTRACER_H
+
+#include <memory>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "scenedata.h"
+#include "BVH.h"
+#include "Scene.h"
+#include "Sampler.h"
+#include "cpu/Image.h"
+#include "cpu/PacketTracer.h"
+
+namespace CS123 { namespace CPU {
+
+class ThreadPool;
+
+/**
+  [CPU RAY TRACER]
+  C++ port of ray.frag for machines without a GPU. Every function below has a
+  counterpart of the same name in the shader and should be kept in step with it.
+  A frame is split into square tiles that are traced on a ThreadPool.
+
+  The color buffer is laid out like the ray FBO: row 0 is the bottom of the image
+  (gl_FragCoord.y = 0.5), and it is accumulated across passes the same way ray.frag
+  adds to its previous pass when stochastic sampling is on (sum in rgb, sample
+  count in alpha, divided out by composite.frag). The moments buffer is the ray
+  FBO's second attachment, used by adaptive sampling (see AdaptiveSampling). The
+  geometry and albedo buffers are its third and fourth, the guides of the denoiser.
+
+  Without depth of field, the primary and shadow rays of neighbouring pixels are
+  traced as SIMD packets (see [PACKET TRACING]), everything else one ray at a time.
+  Both give the same image.
+**/
+class RayTracer {
+public:
+    // numThreads counts the calling thread; 0 uses every hardware thread
+    explicit RayTracer(int numThreads = 0);
+    ~RayTracer();
+
+    // Resizes (and clears) the color, moments and guide buffers
+    void resize(int width, int height);
+
+    // texID matches Material::texID (0 metal, 1 wood, 2 plaster)
+    void setTexture(int texID, Image diffuse, Image normal);
+
+    // Blue noise tiles stacked top to bottom, used when settings.useBlueNoise is set
+    void setBlueNoise(Image blueNoise);
+
+    // Instruction set of the ray packets, the widest the CPU supports by default.
+    // SCALAR traces every ray on its own
+    void setSimd(PacketTracer::Isa isa);
+    PacketTracer::Isa simd() const;
+
+    // Traces one pass. numPasses is the number of passes already accumulated.
+    // bvh must be built or refit over the same scene. The denoiser's guides are
+    // traced on the first pass, and again on passes where sceneChanged is set
+    void render(const Scene &scene, const BVH &bvh, const SettingsData &settings,
+                const CubeMap &envMap, const glm::mat4x4 &inverseCam, int numPasses,
+                bool sceneChanged = false);
+
+    // Filters the accumulated passes into the denoised buffer (see Denoiser),
+    // with iterations clamped to [1, Denoiser::MAX_ITERATIONS]
+    void denoise(int iterations);
+
+    const std::vector<glm::vec4>& colorBuffer() const;
+    const std::vector<glm::vec4>& momentsBuffer() const;
+    const std::vector<glm::vec4>& geometryBuffer() const;
+    const std::vector<glm::vec4>& albedoBuffer() const;
+
+    // Resolved colors (alpha 1) of the last denoise call
+    const std::vector<glm::vec4>& denoisedBuffer() const;
+
+    // Fraction of the pixels adaptive sampling has stopped tracing, as of the last pass
+    float convergedFraction() const;
+    int width() const;
+    int height() const;
+    int numThreads() const;
+
+    static const int TILE_SIZE = 32;
+
+private:
+    // Result of an intersection test, material is looked up through objectIndex
+    struct PrimitiveType {
+        float t;
+        ShapeType primitive; // Can be SPHERE, CUBE, CONE, CYLINDER, MESH, NO_INTERSECT
+        int objectIndex;
+        int triangle;           // MESH only, see Mesh::closestHit
+        glm::vec2 barycentric;  // same
+    };
+
+    void renderTile(int tile);
+    glm::vec2 toFilmPlane(float xFragCoord, float yFragCoord) const;
+    glm::vec4 getFilmPoint(float xFragCoord, float yFragCoord, const Sampler &sampler) const;
+    glm::vec4 tracePixel(float xFragCoord, float yFragCoord, const Sampler &sampler) const;
+    void tracePacket(int x0, int x1, int y, const int *numPixelSamples, const Image *blueNoise);
+    glm::vec4 getAlbedo(const PrimitiveType &obj, const glm::vec4 &worldPoint,
+                        const glm::vec4 &worldDirection) const;
+    glm::vec4 primaryGeometry(float xFragCoord, float yFragCoord, glm::vec4 &albedo) const;
+
+    PrimitiveType getIntersection(const glm::vec4 &worldSpacePoint, const glm::vec4 &worldSpaceDir) const;
+    bool isOccluded(const glm::vec4 &worldSpacePoint, const glm::vec4 &worldSpaceDir, float tMax) const;
+    float getShadowRay(const PrimitiveType &obj, const glm::vec4 &worldPoint, const glm::vec4 &worldDirection,
+                       const glm::vec4 &worldSpaceNormal, const LightObject &light,
+                       glm::vec4 &raisedStartPt, glm::vec4 &rayToLight) const;
+    glm::vec4 getLightContribution(const PrimitiveType &obj, const glm::vec4 &worldPoint, const glm::vec4 &worldDirection,
+                                   const glm::vec4 &worldSpaceNormal, const LightObject &light,
+                                   int shadowed = -1) const;
+    glm::vec4 sampleTexture(const glm::vec4 &objectSpacePoint, const glm::vec4 &objectSpaceDirection,
+                            const PrimitiveType &obj, bool normalMap) const;
+    glm::vec4 getNormalMappedNormal(const PrimitiveType &obj, glm::vec4 worldNormal,
+                                    const glm::vec4 &worldPoint, const glm::vec4 &worldDirection) const;
+    glm::vec4 calculateLighting(glm::vec4 worldNormal, const glm::vec4 &worldPoint,
+                                const glm::vec4 &worldDirection, const PrimitiveType &obj,
+                                int shadowedLights = -1) const;
+    glm::vec4 getWorldSpaceNormal(const PrimitiveType &obj, const glm::vec4 &worldSpacePoint,
+                                  const glm::vec4 &worldSpaceDir) const;
+    float getAOcontribution(const PrimitiveType &intersectObject, const glm::vec4 &worldSpacePoint,
+                            const glm::vec4 &worldSpaceDir, const Sampler &sampler) const;
+    glm::vec4 getColor(const PrimitiveType &intersectObject, const glm::vec4 &worldSpacePoint,
+                       const glm::vec4 &worldSpaceDir, int shadowedLights = -1) const;
+    glm::vec4 getBackgroundColor(const glm::vec4 &worldSpaceDir) const;
+    glm::vec4 recursiveRayTrace(const glm::vec4 &worldSpacePoint, const glm::vec4 &worldSpaceDir,
+                                const PrimitiveType &firstHit, int firstShadowedLights = -1) const;
+    glm::vec4 shootRay(const glm::vec4 &worldSpacePoint, const glm::vec4 &worldSpaceDir,
+                       const Sampler &sampler, const PrimitiveType *firstHit = nullptr,
+                       int shadowedLights = -1) const;
+    glm::vec4 rayTrace(const glm::vec4 &cameraSpaceEye, const glm::vec4 &cameraSpaceFilmPoint,
+                       const Sampler &sampler) const;
+
+    const glm::mat4x4& worldToObject(const PrimitiveType &obj) const;
+    glm::vec4 sampleEnvironment(const glm::vec3 &direction) const;
+
+    std::unique_ptr<ThreadPool> m_pool;
+    PacketTracer m_packetTracer;
+
+    int m_width;
+    int m_height;
+    std::vector<glm::vec4> m_color;
+    std::vector<glm::vec4> m_moments;
+    std::vector<glm::vec4> m_geometry; // (world normal, distance) of each pixel's primary hit
+    std::vector<glm::vec4> m_albedo;
+    std::vector<glm::vec4> m_denoised;
+    std::vector<glm::vec4> m_denoiseScratch; // the other half of denoise's ping pong
+    std::vector<int> m_tileConverged; // converged pixels per tile, summed after each pass
+    float m_convergedFraction;
+
+    Image m_diffuseTextures[3];
+    Image m_normalTextures[3];
+    Image m_blueNoise;
+
+    // Per-frame state, read-only while tiles are being traced
+    Scene m_scene;
+    const BVH *m_bvh;
+    float m_lightIntensities[3];
+    SettingsData m_settings;
+    const CubeMap *m_envMap;
+    glm::mat4x4 m_inverseCam;
+    int m_numPasses;
+    bool m_traceGuides;
+    float m_adaptiveBudget;
+};
+
+}}
+
+#endif // CPU_RAYTRACER_H
@@ -0,0 +1,92 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace CS123 { namespace CPU {
+
+ThreadPool::ThreadPool(int numThreads) :
+    m_job(nullptr),
+    m_count(0),
+    m_next(0),
+    m_busyWorkers(0),
+    m_generation(0),
+    m_quit(false)
+{
+    if (numThreads <= 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // The thread calling parallelFor is the last worker
+    for (int i = 0; i < numThreads - 1; i++) {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    for (std::thread &worker : m_workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)> &job) {
+    if (count <= 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job = &job;
+        m_count = count;
+        m_next = 0;
+        m_busyWorkers = static_cast<int>(m_workers.size());
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    runJobs();
+
+    // Wait for the workers to finish the indices they already claimed
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this]{ return m_busyWorkers == 0; });
+    m_job = nullptr;
+}
+
+int ThreadPool::numThreads() const {
+    return static_cast<int>(m_workers.size()) + 1;
+}
+
+void ThreadPool::workerLoop() {
+    unsigned int seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]{ return m_quit || m_generation != seenGeneration; });
+            if (m_quit) {
+                return;
+            }
+            seenGeneration = m_generation;
+        }
+
+        runJobs();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busyWorkers == 0) {
+            m_done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::runJobs() {
+    int i;
+    while ((i = m_next.fetch_add(1)) < m_count) {
+        (*m_job)(i);
+    }
+}
+
+}}
@@ -0,0 +1,52 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CS123 { namespace CPU {
+
+/**
+ * Fixed set of worker threads that are kept alive between frames.
+ * Work is handed out one index at a time from a shared counter, so
+ * expensive tiles (reflections, AO corners) don't stall a whole thread's share.
+ */
+class ThreadPool {
+public:
+    // numThreads counts the calling thread; 0 uses every hardware thread
+    explicit ThreadPool(int numThreads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &that) = delete;
+    ThreadPool& operator=(const ThreadPool &that) = delete;
+
+    // Runs job(i) for every i in [0, count) and returns once all of them are done.
+    // The calling thread works alongside the pool.
+    void parallelFor(int count, const std::function<void(int)> &job);
+
+    int numThreads() const;
+
+private:
+    void workerLoop();
+    void runJobs();
+
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    const std::function<void(int)> *m_job;
+    int m_count;
+    std::atomic<int> m_next;
+    int m_busyWorkers;
+    unsigned int m_generation;
+    bool m_quit;
+};
+
+}}
+
+#endif // THREADPOOL_H
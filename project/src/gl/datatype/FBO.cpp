@@ -36,6 +36,8 @@ FBO::FBO(int numberOfColorAttachments, DEPTH_STENCIL_ATTACHMENT attachmentType,
 
 FBO::~FBO()
 {
+    // The attachments delete their own textures/renderbuffers
+    glDeleteFramebuffers(1, &m_handle);
 }
 
 void FBO::generateColorAttachments(int count, TextureParameters::WRAP_METHOD wrapMethod,
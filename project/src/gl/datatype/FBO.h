@@ -21,6 +21,8 @@ public:
         TextureParameters::FILTER_METHOD filterMethod = TextureParameters::FILTER_METHOD::LINEAR,
         GLenum type = GL_UNSIGNED_BYTE);
     ~FBO();
+    FBO(const FBO &that) = delete;
+    FBO& operator=(const FBO &that) = delete;
 
     void bind();
     void unbind();
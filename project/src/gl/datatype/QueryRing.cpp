@@ -0,0 +1,60 @@
+#include "QueryRing.h"
+
+namespace CS123 { namespace GL {
+
+QueryRing::QueryRing(GLenum target, int size) :
+    m_target(target),
+    m_queries(size, 0),
+    m_tags(size, 0),
+    m_first(0),
+    m_pending(0),
+    m_active(false)
+{
+    glGenQueries(size, m_queries.data());
+}
+
+QueryRing::~QueryRing()
+{
+    glDeleteQueries(static_cast<GLsizei>(m_queries.size()), m_queries.data());
+}
+
+void QueryRing::begin(int tag) {
+    int size = static_cast<int>(m_queries.size());
+    if (m_pending == size) {
+        return;
+    }
+    int index = (m_first + m_pending) % size;
+    m_tags[index] = tag;
+    glBeginQuery(m_target, m_queries[index]);
+    m_active = true;
+}
+
+void QueryRing::end() {
+    if (!m_active) {
+        return;
+    }
+    glEndQuery(m_target);
+    m_pending++;
+    m_active = false;
+}
+
+bool QueryRing::poll(int &tag, GLuint64 &result) {
+    if (m_pending == 0) {
+        return false;
+    }
+
+    GLint available = GL_FALSE;
+    glGetQueryObjectiv(m_queries[m_first], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return false;
+    }
+
+    glGetQueryObjectui64v(m_queries[m_first], GL_QUERY_RESULT, &result);
+    tag = m_tags[m_first];
+
+    m_first = (m_first + 1) % static_cast<int>(m_queries.size());
+    m_pending--;
+    return true;
+}
+
+}}
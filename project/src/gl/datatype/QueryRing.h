@@ -0,0 +1,42 @@
+#ifndef QUERYRING_H
+#define QUERYRING_H
+
+#include <vector>
+
+#include "GL/glew.h"
+
+namespace CS123 { namespace GL {
+
+/**
+ * Queries of one target (GL_TIME_ELAPSED, GL_SAMPLES_PASSED, ...) recycled in a ring,
+ * so their results can be read back a few frames late without ever stalling on
+ * glGetQueryObject. Each query carries a tag so the result can be matched to what
+ * issued it.
+ */
+class QueryRing {
+public:
+    QueryRing(GLenum target, int size);
+    QueryRing(const QueryRing&) = delete;
+    QueryRing& operator=(const QueryRing&) = delete;
+    ~QueryRing();
+
+    // Queries the GL commands issued until end(). If every query is still waiting
+    // for its result, this one is skipped instead of blocking
+    void begin(int tag);
+    void end();
+
+    // Pops the oldest finished result, false if there is none yet
+    bool poll(int &tag, GLuint64 &result);
+
+private:
+    GLenum m_target;
+    std::vector<GLuint> m_queries;
+    std::vector<int> m_tags;
+    int m_first;   // oldest query waiting for its result
+    int m_pending; // number of queries waiting for their result
+    bool m_active;
+};
+
+}}
+
+#endif // QUERYRING_H
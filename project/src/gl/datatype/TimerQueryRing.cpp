@@ -0,0 +1,19 @@
+#include "TimerQueryRing.h"
+
+namespace CS123 { namespace GL {
+
+TimerQueryRing::TimerQueryRing(int size) :
+    QueryRing(GL_TIME_ELAPSED, size)
+{
+}
+
+bool TimerQueryRing::poll(int &tag, double &milliseconds) {
+    GLuint64 nanoseconds = 0;
+    if (!QueryRing::poll(tag, nanoseconds)) {
+        return false;
+    }
+    milliseconds = nanoseconds / 1e6;
+    return true;
+}
+
+}}
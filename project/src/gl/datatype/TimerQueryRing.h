@@ -0,0 +1,23 @@
+#ifndef TIMERQUERYRING_H
+#define TIMERQUERYRING_H
+
+#include "QueryRing.h"
+
+namespace CS123 { namespace GL {
+
+/**
+ * GL_TIME_ELAPSED queries in a QueryRing, so GPU times can be read back a few
+ * frames late without ever stalling. The tag is the frame number, so the result
+ * can be matched to the frame that issued it.
+ */
+class TimerQueryRing : public QueryRing {
+public:
+    explicit TimerQueryRing(int size = 4);
+
+    // Pops the oldest finished result, false if there is none yet
+    bool poll(int &tag, double &milliseconds);
+};
+
+}}
+
+#endif // TIMERQUERYRING_H
@@ -0,0 +1,47 @@
+#include "UBO.h"
+
+namespace CS123 { namespace GL {
+
+UBO::UBO(int sizeInBytes, GLuint bindingPoint) :
+    m_handle(0),
+    m_bindingPoint(bindingPoint),
+    m_sizeInBytes(sizeInBytes)
+{
+    glGenBuffers(1, &m_handle);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_handle);
+    glBufferData(GL_UNIFORM_BUFFER, m_sizeInBytes, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+UBO::~UBO()
+{
+    glDeleteBuffers(1, &m_handle);
+}
+
+void UBO::setData(const void *data) {
+    glBindBuffer(GL_UNIFORM_BUFFER, m_handle);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, m_sizeInBytes, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UBO::bindBase() const {
+    glBindBufferBase(GL_UNIFORM_BUFFER, m_bindingPoint, m_handle);
+}
+
+void UBO::bind() const {
+    glBindBuffer(GL_UNIFORM_BUFFER, m_handle);
+}
+
+void UBO::unbind() const {
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+GLuint UBO::bindingPoint() const {
+    return m_bindingPoint;
+}
+
+int UBO::size() const {
+    return m_sizeInBytes;
+}
+
+}}
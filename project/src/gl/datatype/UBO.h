@@ -0,0 +1,39 @@
+#ifndef UBO_H
+#define UBO_H
+
+#include "GL/glew.h"
+
+namespace CS123 { namespace GL {
+
+/**
+ * Uniform buffer attached to a fixed binding point. The data is expected to already
+ * be laid out to match the std140 block it backs.
+ */
+class UBO {
+public:
+    UBO(int sizeInBytes, GLuint bindingPoint);
+    UBO(const UBO&) = delete;
+    UBO& operator=(const UBO&) = delete;
+    ~UBO();
+
+    // Replaces the whole buffer in one call, data must be sizeInBytes long
+    void setData(const void *data);
+
+    // Attaches the buffer to its binding point
+    void bindBase() const;
+
+    void bind() const;
+    void unbind() const;
+
+    GLuint bindingPoint() const;
+    int size() const;
+
+private:
+    GLuint m_handle;
+    GLuint m_bindingPoint;
+    int m_sizeInBytes;
+};
+
+}}
+
+#endif // UBO_H
@@ -26,6 +26,7 @@ RenderBuffer& RenderBuffer::operator=(RenderBuffer &&that) {
 
 RenderBuffer::~RenderBuffer()
 {
+    glDeleteRenderbuffers(1, &m_handle);
 }
 
 void RenderBuffer::bind() const {
@@ -30,6 +30,8 @@ Texture& Texture::operator=(Texture &&that) {
 
 Texture::~Texture()
 {
+    // Zero (moved from) handles are ignored by glDeleteTextures
+    glDeleteTextures(1, &m_handle);
 }
 
 unsigned int Texture::id() const {
@@ -0,0 +1,47 @@
+#include "TextureBuffer.h"
+
+#include <algorithm>
+
+namespace CS123 { namespace GL {
+
+TextureBuffer::TextureBuffer(GLenum internalFormat) :
+    m_bufferHandle(0),
+    m_capacity(16)
+{
+    glGenBuffers(1, &m_bufferHandle);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_bufferHandle);
+    glBufferData(GL_TEXTURE_BUFFER, m_capacity, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    // The texture reads straight from the buffer's data store
+    TextureBuffer::bind();
+    glTexBuffer(GL_TEXTURE_BUFFER, internalFormat, m_bufferHandle);
+    TextureBuffer::unbind();
+}
+
+TextureBuffer::~TextureBuffer()
+{
+    glDeleteBuffers(1, &m_bufferHandle);
+}
+
+void TextureBuffer::setData(const void *data, int sizeInBytes) {
+    glBindBuffer(GL_TEXTURE_BUFFER, m_bufferHandle);
+    if (sizeInBytes > m_capacity) {
+        m_capacity = std::max(sizeInBytes, 2 * m_capacity);
+        glBufferData(GL_TEXTURE_BUFFER, m_capacity, nullptr, GL_DYNAMIC_DRAW);
+    }
+    if (sizeInBytes > 0) {
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeInBytes, data);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void TextureBuffer::bind() const {
+    glBindTexture(GL_TEXTURE_BUFFER, m_handle);
+}
+
+void TextureBuffer::unbind() const {
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+}}
@@ -0,0 +1,32 @@
+#ifndef TEXTUREBUFFER_H
+#define TEXTUREBUFFER_H
+
+#include "gl/textures/Texture.h"
+
+#include "GL/glew.h"
+
+namespace CS123 { namespace GL {
+
+/**
+ * Buffer texture (samplerBuffer / texelFetch in GLSL). Used for variable-length
+ * arrays the ray program has to read, since GL 4.0 has no storage buffers.
+ */
+class TextureBuffer : public Texture {
+public:
+    explicit TextureBuffer(GLenum internalFormat = GL_RGBA32F);
+    ~TextureBuffer();
+
+    // Replaces the contents, the buffer only grows when the new data doesn't fit
+    void setData(const void *data, int sizeInBytes);
+
+    virtual void bind() const override;
+    virtual void unbind() const override;
+
+private:
+    GLuint m_bufferHandle;
+    int m_capacity;
+};
+
+}}
+
+#endif // TEXTUREBUFFER_H
@@ -1,8 +1,33 @@
 #include <QApplication>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <iostream>
 #include "mainwindow.h"
+#include "HeadlessRenderer.h"
+#include "settings.h"
 
 int main(int argc, char *argv[]) {
+    // Offline renders don't need a window, display or event loop
+    if (HeadlessRenderer::isRequested(argc, argv)) {
+        QCoreApplication a(argc, argv);
+        HeadlessRenderer::Options options;
+        QString error;
+        if (!HeadlessRenderer::parseArguments(a.arguments(), options, error)) {
+            std::cerr << error.toStdString() << std::endl;
+            return 1;
+        }
+        return HeadlessRenderer(options).run();
+    }
+
     QApplication a(argc, argv);
+
+    // A scene file (see [SCENE FILES]) to show instead of the preset scenes
+    QCommandLineParser parser;
+    QCommandLineOption sceneFileOption("scene-file", "Scene file to render.", "file");
+    parser.addOption(sceneFileOption);
+    parser.parse(a.arguments());
+    settings.sceneFile = parser.value(sceneFileOption);
+
     MainWindow w;
     w.show();
 
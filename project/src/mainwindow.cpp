@@ -86,6 +86,22 @@ void MainWindow::dataBind() {
     // Camera
     BIND(BoolBinding::bindCheckbox(m_ui->cbAnimation, settings.useAnimation));
 
+    // Renderer
+    BIND(BoolBinding::bindCheckbox(m_ui->cbCPU, settings.useCPU));
+    BIND(BoolBinding::bindCheckbox(m_ui->cbTimings, settings.showTimings));
+    connect(m_ui->saveTimingsButton, SIGNAL(clicked()), m_view, SLOT(saveTimings()));
+    BIND(BoolBinding::bindCheckbox(m_ui->cbAdaptive, settings.useAdaptive));
+    BIND(IntBinding::bindSliderAndTextbox(
+        m_ui->adaptiveSlider, m_ui->adaptiveText, settings.adaptiveThreshold, 1, 20));
+    BIND(BoolBinding::bindCheckbox(m_ui->cbBlueNoise, settings.useBlueNoise));
+    BIND(IntBinding::bindSliderAndTextbox(
+        m_ui->budgetSlider, m_ui->budgetText, settings.rayBudget, 1, 100));
+    BIND(BoolBinding::bindCheckbox(m_ui->cbDynamicRes, settings.useDynamicResolution));
+    BIND(BoolBinding::bindCheckbox(m_ui->cbReprojection, settings.useReprojection));
+    BIND(BoolBinding::bindCheckbox(m_ui->cbDenoise, settings.useDenoiser));
+    BIND(IntBinding::bindSliderAndTextbox(
+        m_ui->denoiseSlider, m_ui->denoiseText, settings.denoiseIterations, 1, 5));
+
 
 #undef BIND
 }
@@ -0,0 +1,131 @@
+#ifndef SCENEDATA_H
+#define SCENEDATA_H
+
+#include "glm/glm.hpp"            // glm::vec*, mat*, and basic glm functions
+
+// Plain data shared by the GPU ray program (ray.frag) and the CPU ray tracer.
+// Kept free of Qt/GL so the CPU backend can be built and run without a context.
+
+// Primitive and Light type both in same enums
+// so #define SPHERE, CUBE, CONE, etc. in ray.frag are ensured
+// to not conflict
+enum class ShapeType{
+    SPHERE,
+    CUBE,
+    CONE,
+    CYLINDER,
+    MESH,
+    NO_INTERSECT,
+    LIGHT_POINT,
+    LIGHT_DIRECTIONAL
+};
+
+// [DATA TYPES]
+////////////////////////////////////////////////////////////////////////
+// Final output of data Raytracing spits out to write to color attachments
+struct RayData{
+    float rayT;
+    int rayPrimitiveType;
+    glm::vec4 rayNormal;
+    glm::vec4 rayPoint;
+    glm::vec4 rayDirection;
+};
+
+struct GlobalData{
+    float ka; // global ambient coefficient
+    float kd; // global diffuse coefficeint
+    float ks; // global specular coefficient
+    float kt; // global transparency coefficient
+};
+
+// Light Data
+// Just point lights at the moment
+struct LightObject{
+    glm::vec4 color;
+    glm::vec4 pos; // Only applicable for point lights
+    glm::vec4 dir; // Only applicable for directional lights
+    glm::vec3 function; // attenuation function
+    ShapeType type; // Can be LIGHT_POINT, LIGHT_DIRECTIONAL
+};
+
+// How an object's surface is shaded. Objects that look the same share one
+// entry of the scene's material table (see [SCENE] in Scene.h)
+struct Material{
+    glm::vec4 cDiffuse;
+    glm::vec4 cAmbient;
+    glm::vec4 cSpecular;
+    glm::vec4 cReflective;
+    float shininess;
+
+    // Texture properties
+    float blend;
+    int texID;
+    float repeatU;
+    float repeatV;
+};
+
+struct SceneObject{
+    ShapeType primitive; // Can be SPHERE, CUBE, CONE, CYLINDER, MESH
+    glm::mat4x4 objectToWorld; // cumulative transformation matrix
+    Material material;
+    int mesh = -1; // MESH only, the triangle mesh in Scene::meshes it instances
+};
+
+// Settings as the ray program sees them (mirrors SettingsData in ray.frag)
+// Light intensities are already scaled to [0.0, 1.0], toggles are 0 or 1
+struct SettingsData{
+    float l1Intensity;
+    float l2Intensity;
+    float l3Intensity;
+
+    int useStochastic; // Stochastic Sampling
+    int useAO;         // Ambient Occlusion
+    int useNM;         // Normal Mapping
+    int useDOF;        // Depth of Field
+    int aperture;      // Depth of field aperture size
+    int focalLength;   // Depth of field focal length
+    int numSamples;
+
+    // Lighting equation components
+    int useAmbient;
+    int useDiffuse;
+    int useSpecular;
+    int useShadows;
+    int useReflections;
+    int useEnvironment;
+    int useTextures;
+
+    // Adaptive sampling (see AdaptiveSampling)
+    int useAdaptive;
+    float adaptiveThreshold; // relative confidence interval of a converged pixel
+
+    int useBlueNoise;  // Blue noise sampler (see Sampler)
+};
+
+// [SCENE]
+//////////////////////////////////////////
+
+// [ENVIRONMENT CUBE MAPS] (via)
+// http://www.humus.name/index.php?page=Textures
+
+// Size of the light array in ray.frag's RayBlock (NUM_LIGHTS)
+const int NUM_SCENE_LIGHTS = 3;
+
+// Harcoded data
+// GlobalData, LightData (1 per scene atm)
+// SceneObjects [5 per scene atm]
+const GlobalData globalData = {0.5f, 0.5f, 0.5f, 0.0f};
+
+// Light Object 1
+const LightObject lightObject1 = {glm::vec4(0.8, 0.8, 0.8, 1.0), glm::vec4(0.0, 0.0, 10.0, 1.0), glm::vec4(0.f), glm::vec3(0.9, 0.0, 0.0), ShapeType::LIGHT_POINT};
+
+// Light Object 2
+const LightObject lightObject2 = {glm::vec4(0.2, 0.2, 0.2, 1.0), glm::vec4(-10.0, 0.0, -10.0, 1.0), glm::vec4(0.f), glm::vec3(0.9, 0.0, 0.0), ShapeType::LIGHT_POINT};
+
+// Light Object 3
+const LightObject lightObject3 = {glm::vec4(0.3, 0.3, 0.2, 1.0), glm::vec4(0.0, 8.0, 10.0, 1.0), glm::vec4(0.f), glm::vec3(0.5, 0.0, 0.0), ShapeType::LIGHT_POINT};
+
+// Stands in for the lights a scene file leaves out
+const LightObject lightObjectOff = {glm::vec4(0.f), glm::vec4(0.0, 0.0, 0.0, 1.0), glm::vec4(0.f), glm::vec3(1.0, 0.0, 0.0), ShapeType::LIGHT_POINT};
+
+#endif // SCENEDATA_H
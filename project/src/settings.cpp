@@ -44,6 +44,18 @@ void Settings::loadSettingsOrDefaults() {
 
     // Camera
     useAnimation = s.value("cbAnimation", true).toBool();
+
+    // Renderer
+    useCPU = s.value("cbCPU", false).toBool();
+    showTimings = s.value("cbTimings", false).toBool();
+    useAdaptive = s.value("cbAdaptive", false).toBool();
+    adaptiveThreshold = s.value("adaptiveSlider", 5).toInt();
+    useBlueNoise = s.value("cbBlueNoise", false).toBool();
+    rayBudget = s.value("budgetSlider", 12).toInt();
+    useDynamicResolution = s.value("cbDynamicRes", true).toBool();
+    useReprojection = s.value("cbReprojection", true).toBool();
+    useDenoiser = s.value("cbDenoise", false).toBool();
+    denoiseIterations = s.value("denoiseSlider", 4).toInt();
 }
 
 void Settings::saveSettings() {
@@ -79,4 +91,46 @@ void Settings::saveSettings() {
 
     // Camera
     s.setValue("cbAnimation", useAnimation);
+
+    // Renderer
+    s.setValue("cbCPU", useCPU);
+    s.setValue("cbTimings", showTimings);
+    s.setValue("cbAdaptive", useAdaptive);
+    s.setValue("adaptiveSlider", adaptiveThreshold);
+    s.setValue("cbBlueNoise", useBlueNoise);
+    s.setValue("budgetSlider", rayBudget);
+    s.setValue("cbDynamicRes", useDynamicResolution);
+    s.setValue("cbReprojection", useReprojection);
+    s.setValue("cbDenoise", useDenoiser);
+    s.setValue("denoiseSlider", denoiseIterations);
+}
+
+// Light intensities are scaled from the UI's [0, 100] to [0.0, 1.0],
+// and the adaptive threshold from percent
+SettingsData Settings::getSettingsData() const {
+    SettingsData data;
+    data.l1Intensity = l1Intensity / 100.f;
+    data.l2Intensity = l2Intensity / 100.f;
+    data.l3Intensity = l3Intensity / 100.f;
+
+    data.useStochastic = static_cast<int>(useStochastic);
+    data.useAO = static_cast<int>(useAO);
+    data.useNM = static_cast<int>(useNM);
+    data.useDOF = static_cast<int>(useDOF);
+    data.aperture = aperture;
+    data.focalLength = focalLength;
+    data.numSamples = numSamples;
+
+    data.useAmbient = static_cast<int>(useAmbient);
+    data.useDiffuse = static_cast<int>(useDiffuse);
+    data.useSpecular = static_cast<int>(useSpecular);
+    data.useShadows = static_cast<int>(useShadows);
+    data.useReflections = static_cast<int>(useReflections);
+    data.useEnvironment = static_cast<int>(useEnvironment);
+    data.useTextures = static_cast<int>(useTextures);
+
+    data.useAdaptive = static_cast<int>(useAdaptive);
+    data.adaptiveThreshold = adaptiveThreshold / 100.f;
+    data.useBlueNoise = static_cast<int>(useBlueNoise);
+    return data;
 }
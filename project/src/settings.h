@@ -3,6 +3,8 @@
 
 #include <QObject>
 
+#include "scenedata.h"
+
 // Enumeration values for the modes from which the user can choose in the GUI.
 enum Mode
 {
@@ -32,6 +34,7 @@ struct Settings {
 
     // Scene Selection
     int modeScene;           // The currently selected scene //TODO: Update naming
+    QString sceneFile;       // Rendered instead of the selected scene if set, from --scene-file (not saved)
 
     // Lighting intensities
     int l1Intensity;    // The intensity for light 1
@@ -61,6 +64,21 @@ struct Settings {
     // Animation
     bool useAnimation;
 
+    // Renderer
+    bool useCPU;        // Trace on the CPU instead of the ray program
+    bool showTimings;   // Frame timings overlay
+    bool useAdaptive;   // Adaptive sampling (with stochastic sampling)
+    int adaptiveThreshold; // Relative confidence interval of a converged pixel, in percent
+    bool useBlueNoise;  // Blue noise sampler instead of Sobol
+    int rayBudget;      // GPU time the ray pass may take per frame, in ms
+    bool useDynamicResolution; // Lower resolution ray pass while the camera moves
+    bool useReprojection; // Keep the accumulated passes through camera moves
+    bool useDenoiser;   // Filter the accumulated passes before they are shown
+    int denoiseIterations; // Filter iterations, each doubles the denoiser's footprint
+
+    // Settings as sent to the ray program (and the CPU ray tracer)
+    SettingsData getSettingsData() const;
+
 };
 
 // The global Settings object, will be initialized by MainWindow
@@ -5,20 +5,43 @@
 #include <QMouseEvent>
 #include <QWheelEvent>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 #include "settings.h"
 #include <QImage>
 #include <string>
 
 #include "openglshape.h"
 #include "gl/textures/Texture2D.h"
+#include "gl/textures/TextureParametersBuilder.h"
 #include "gl/shaders/ShaderAttribLocations.h"
 #include "sphere.h"
 #include "cube.h"
 
 #include "SceneBuilder.h"
+#include "RayBlock.h"
+#include "SceneBuffer.h"
+#include "MeshBuffer.h"
+#include "BVH.h"
+#include "Scene.h"
+#include "SceneFile.h"
+#include "CPUImages.h"
+#include "OrbitCamera.h"
+#include "AdaptiveSampling.h"
+#include "Denoiser.h"
 
 using namespace CS123::GL;
 
+// Settings that are compiled into the ray program instead of branched on,
+// in the bit order of View::getRayPermutation (see [PERMUTATIONS] in ray.frag)
+static const char *RAY_PERMUTATION_DEFINES[] = {
+    "USE_SHADOWS", "USE_REFLECTIONS", "USE_AO", "USE_DOF", "USE_NM", "USE_TEXTURES"
+};
+static const int NUM_RAY_PERMUTATION_DEFINES = 6;
+
+const float View::MIN_RENDER_SCALE = .25f;
+const float View::RENDER_SCALE_STEP = .125f;
+
 /**
   [VIEW] Loads shader programs and geometry, executes FBO pipeline to render the
   ray program to the full screen quad, using FBO ping ponging
@@ -27,26 +50,58 @@ using namespace CS123::GL;
 View::View(QGLFormat format, QWidget *parent)
     : QGLWidget(format, parent),
       m_width(width()), m_height(height()),
-      m_phongProgram(0), m_textureProgram(0), m_rayProgram(0),
+      m_phongProgram(0), m_textureProgram(0), m_rayProgram(0), m_denoiseProgram(0),
       m_envCubeID1(0), m_envCubeID2(0), m_envCubeProgram(0),
       m_diffuseID(0), m_normalID(0),
       m_woodDiffuseID(0), m_woodNormalID(0),
-      m_plasterDiffuseID(0), m_plasterNormalID(0),
+      m_plasterDiffuseID(0), m_plasterNormalID(0), m_blueNoiseID(0),
       m_textures(nullptr),
       m_quad(nullptr), m_envCube(nullptr), m_square(nullptr),
       m_angleX(-0.0f), m_angleY(0.0f), m_zoom(10.f),
       m_view(glm::mat4x4(1.f)), m_scale(glm::mat4x4(1.f)),
+      m_rayBlock(nullptr), m_rayUBO(nullptr), m_rayDataDirty(true),
+      m_sceneBuffer(nullptr), m_sceneTexture(nullptr), m_materialTexture(nullptr), m_meshTexture(nullptr),
+      m_scene(std::make_unique<Scene>()), m_sceneFile(nullptr), m_sceneFileWatcher(this), m_bvh(std::make_unique<BVH>()), m_rebuildBVH(true), m_bvhTexture(nullptr),
+      m_cpuTracer(nullptr), m_cpuTexture(nullptr),
       m_rayFBO1(nullptr), m_rayFBO2(nullptr),
+      m_denoiseFBO1(nullptr), m_denoiseFBO2(nullptr), m_denoisedFBO(nullptr),
       m_firstPass(true), m_evenPass(true),
       m_numPasses(0),
+      m_nextTile(0), m_gpuPassMs(-1.0),
+      m_renderScale(1.f), m_lastPassScale(1.f), m_keepPreview(false),
+      m_lastPassInverseCam(1.f), m_reprojectPass(false),
+      m_convergedFraction(0.f), m_convergenceQueries(nullptr), m_convergenceEpoch(0),
       m_timer(this),
       m_fps(60.0f),
       m_increment(0),
-      m_animationIncrement(0)
+      m_animationIncrement(0),
+      m_rayTimer(nullptr), m_compositeTimer(nullptr),
+      m_timingsLabel(new QLabel(this))
 {
     // Set up 60 FPS draw loop.
     connect(&m_timer, SIGNAL(timeout()), this, SLOT(tick()));
     m_timer.start(1000.0f / m_fps);
+
+    // Timings overlay in the top left corner, filled in by updateTimingsOverlay
+    m_timingsLabel->setStyleSheet("QLabel { color: white; background-color: rgba(0, 0, 0, 160); padding: 4px; }");
+    m_timingsLabel->move(8, 8);
+    m_timingsLabel->hide();
+
+    if (!settings.sceneFile.isEmpty()) {
+        m_sceneFile = std::make_unique<SceneFile>();
+        if (loadSceneFile()) {
+            // Reloads keep the camera where the mouse left it
+            if (m_sceneFile->hasCamera()) {
+                m_angleX = m_sceneFile->camera().angleX;
+                m_angleY = m_sceneFile->camera().angleY;
+                m_zoom = m_sceneFile->camera().zoom;
+            }
+            m_sceneFileWatcher.addPath(settings.sceneFile);
+            connect(&m_sceneFileWatcher, SIGNAL(fileChanged(QString)), this, SLOT(sceneFileChanged()));
+        } else {
+            m_sceneFile.reset();
+        }
+    }
 }
 
 // Clean up textures
@@ -59,6 +114,10 @@ View::~View()
     glDeleteTextures(1, &m_woodNormalID);
     glDeleteTextures(1, &m_plasterDiffuseID);
     glDeleteTextures(1, &m_plasterNormalID);
+    glDeleteTextures(1, &m_blueNoiseID);
+    for (GLuint program : m_rayPrograms) {
+        glDeleteProgram(program);
+    }
 }
 
 
@@ -75,13 +134,39 @@ void View::initializeGL() {
                 ":/shaders/phong.vert", ":/shaders/phong.frag");
     m_textureProgram = ResourceLoader::createShaderProgram(
                 ":/shaders/quad.vert", ":/shaders/texture.frag");
-    m_rayProgram = ResourceLoader::createShaderProgram(
-                ":/shaders/quad.vert", ":/shaders/ray.frag");
     m_compositeProgram = ResourceLoader::createShaderProgram(
                 ":/shaders/quad.vert", ":/shaders/composite.frag");
+    m_denoiseProgram = ResourceLoader::createShaderProgram(
+                ":/shaders/quad.vert", ":/shaders/denoise.frag");
+    glUseProgram(m_denoiseProgram);
+    glUniform1i(glGetUniformLocation(m_denoiseProgram, "tex"), 0);
+    glUniform1i(glGetUniformLocation(m_denoiseProgram, "moments"), 1);
+    glUniform1i(glGetUniformLocation(m_denoiseProgram, "geometry"), 2);
+    glUniform1i(glGetUniformLocation(m_denoiseProgram, "albedo"), 3);
+    m_convergedProgram = ResourceLoader::createShaderProgram(
+                ":/shaders/quad.vert", ":/shaders/converged.frag");
+    glUseProgram(m_convergedProgram);
+    glUniform1i(glGetUniformLocation(m_convergedProgram, "moments"), 0);
+    glUseProgram(0);
     m_envCubeProgram = ResourceLoader::createShaderProgram(
                 ":/shaders/cube.vert", ":/shaders/envMap.frag");
 
+    // Scene data for the ray program lives in one uniform buffer and four buffer textures
+    m_rayBlock = std::make_unique<RayBlock>();
+    m_rayUBO = std::make_unique<UBO>(sizeof(RayBlock), 0);
+    m_sceneBuffer = std::make_unique<SceneBuffer>();
+    m_sceneTexture = std::make_unique<TextureBuffer>(GL_RGBA32F);
+    m_materialTexture = std::make_unique<TextureBuffer>(GL_RGBA32F);
+    m_meshTexture = std::make_unique<TextureBuffer>(GL_RGBA32F);
+    m_bvhTexture = std::make_unique<TextureBuffer>(GL_RGBA32F);
+
+    // The ray program has a permutation per combination of feature toggles, see getRayProgram
+    m_rayProgram = getRayProgram(getRayPermutation());
+
+    m_rayTimer = std::make_unique<TimerQueryRing>();
+    m_compositeTimer = std::make_unique<TimerQueryRing>();
+    m_convergenceQueries = std::make_unique<QueryRing>(GL_SAMPLES_PASSED, 4);
+
     GLint maxAttach = 0;
     glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &maxAttach);
 
@@ -158,6 +243,23 @@ void View::initializeGL() {
     glGenTextures(1, &m_envCubeID2);
     View::buildEnvMap(front1, back1, top1, bottom1, left1, right1, m_envCubeID1);
     View::buildEnvMap(front2, back2, top2, bottom2, left2, right2, m_envCubeID2);
+
+    // Blue noise tiles for the blue noise sampler (regenerate with tools/bluenoise)
+    QImage blueNoise = View::loadTexture("../data/bluenoise.pgm").convertToFormat(QImage::Format_RGB32);
+    glGenTextures(1, &m_blueNoiseID);
+    View::buildBlueNoise(blueNoise, m_blueNoiseID);
+
+    // CPU ray tracer gets its own copies of the same images
+    m_cpuTracer = std::make_unique<CS123::CPU::RayTracer>();
+    std::cout << "CPU ray tracer threads: " << m_cpuTracer->numThreads() << ", packets: "
+              << CS123::CPU::PacketTracer::name(m_cpuTracer->simd()) << std::endl;
+    using namespace CS123::CPU;
+    m_cpuTracer->setTexture(0, toCPUImage(diffuse), toCPUImage(normal));
+    m_cpuTracer->setTexture(1, toCPUImage(woodDiffuse), toCPUImage(woodNormal));
+    m_cpuTracer->setTexture(2, toCPUImage(plasterDiffuse), toCPUImage(plasterNormal));
+    m_cpuEnvMap1 = toCPUCubeMap(front1, back1, top1, bottom1, left1, right1);
+    m_cpuEnvMap2 = toCPUCubeMap(front2, back2, top2, bottom2, left2, right2);
+    m_cpuTracer->setBlueNoise(toCPUImage(blueNoise));
 }
 
 // Build a 2D texture map given a QImage type and a texture ID
@@ -169,6 +271,19 @@ void View::buildTextureMap(const QImage &image, GLuint textureID){
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+// Build a 2D texture array from square tiles stacked top to bottom in one image.
+// Texels are read with texelFetch, so there is no filtering or mipmapping
+void View::buildBlueNoise(const QImage &image, GLuint textureID){
+    int size = image.width();
+    int layers = size > 0 ? image.height() / size : 0;
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8, size, size, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 layers > 0 ? image.bits() : nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
 // Build a 3D texture cube given 6 Qimages (faces of the cube) and the texture handle
 void View::buildEnvMap(const QImage &front, const QImage &back, const QImage &top, const QImage &bottom, const QImage &left, const QImage &right, GLuint textureHandle) {
     glActiveTexture(GL_TEXTURE0);
@@ -238,8 +353,92 @@ void View::tick()
 // The main drawing call
 void View::paintGL() {
     m_increment++; // always increment time
+    collectGPUTimings();
+    collectConvergence();
     glClear(GL_COLOR_BUFFER_BIT);
-    drawRayScene();
+    if (settings.useCPU) {
+        drawCPUScene();
+    } else {
+        drawRayScene();
+    }
+    updateTimingsOverlay();
+}
+
+// Matches the GPU times that have come back since last frame to their frames
+void View::collectGPUTimings() {
+    int frame;
+    double milliseconds;
+    while (m_rayTimer->poll(frame, milliseconds)) {
+        if (FrameTiming *timing = m_frameStats.findFrame(frame)) {
+            timing->gpuRayMs = milliseconds;
+
+            // Scaled up to a whole full resolution pass and smoothed, for the tile
+            // budget and the dynamic resolution
+            if (!timing->cpuRenderer && timing->samples > 0.0) {
+                double pixels = static_cast<double>(m_width) * m_height;
+                double passMs = milliseconds / timing->samples * pixels / (timing->width * timing->height);
+                m_gpuPassMs = m_gpuPassMs < 0.0 ? passMs : 0.75 * m_gpuPassMs + 0.25 * passMs;
+            }
+        }
+    }
+    while (m_compositeTimer->poll(frame, milliseconds)) {
+        if (FrameTiming *timing = m_frameStats.findFrame(frame)) {
+            timing->gpuCompositeMs = milliseconds;
+        }
+    }
+}
+
+// Refreshes the timings overlay a few times a second with the average of the last frames,
+// and the converged fraction when adaptive sampling is on
+void View::updateTimingsOverlay() {
+    bool adaptive = settings.useAdaptive && settings.useStochastic;
+    m_timingsLabel->setVisible(settings.showTimings || adaptive);
+    if (!m_timingsLabel->isVisible() || m_increment % TIMINGS_OVERLAY_INTERVAL != 0) {
+        return;
+    }
+
+    QString text;
+    if (adaptive) {
+        text += QString("Converged %1% of pixels after %2 passes")
+                .arg(100.0 * m_convergedFraction, 0, 'f', 1).arg(m_numPasses);
+    }
+    if (!settings.showTimings) {
+        m_timingsLabel->setText(text);
+        m_timingsLabel->adjustSize();
+        return;
+    }
+    if (adaptive) {
+        text += "\n";
+    }
+
+    FrameTiming mean = m_frameStats.average(TIMINGS_OVERLAY_INTERVAL);
+    auto ms = [](double value) {
+        return value >= 0.0 ? QString::number(value, 'f', 2) : QString("-");
+    };
+    if (mean.cpuRenderer) {
+        text += QString("CPU trace %1 ms\n").arg(ms(mean.traceMs));
+    } else {
+        text += QString("GPU ray %1 ms, composite %2 ms\n").arg(ms(mean.gpuRayMs), ms(mean.gpuCompositeMs));
+        text += QString("%1% of a pass per frame").arg(100.0 * mean.samples, 0, 'f', 0);
+        if (m_renderScale < 1.f) {
+            text += QString(" at %1% resolution").arg(100.0 * m_renderScale, 0, 'f', 0);
+        }
+        text += "\n";
+    }
+    text += QString("Scene %1 ms, upload %2 ms, submit %3 ms\n")
+            .arg(ms(mean.sceneMs), ms(mean.uploadMs), ms(mean.submitMs));
+    text += QString("%1 M primary rays/s").arg(mean.raysPerSecond() / 1e6, 0, 'f', 2);
+    m_timingsLabel->setText(text);
+    m_timingsLabel->adjustSize();
+}
+
+// Writes the recorded frame timings to the working directory
+void View::saveTimings() {
+    if (m_frameStats.writeCSV("frame_timings.csv") && m_frameStats.writeJSON("frame_timings.json")) {
+        std::cout << "Saved frame_timings.csv and frame_timings.json" << std::endl;
+    } else {
+        std::cout << "Failed to save frame timings" << std::endl;
+    }
 }
 
 // For fun
@@ -261,229 +460,403 @@ void View::drawEnvCube(){
 // The ray program will sample the bound prevFBO and blend it with the next render
 // via the numPasses as a compositing weight
 // the ray program will write to the nextFBO (to become the prevFBO) and also draw to the screen
+// A pass is traced in screen tiles, as many as fit in the frame's budget; when it
+// doesn't fit it is finished over the next frames, showing the last complete pass
+// meanwhile, so the UI stays responsive at any quality setting
+// While the camera moves the pass is traced at a lower resolution instead, so each
+// frame still shows a complete view
 void View::drawRayScene() {
+    FrameStats::Clock::time_point frameStart = FrameStats::Clock::now();
+
+    // with animation
+    glm::mat4x4 inverseCam = glm::inverse(m_view) * glm::inverse(m_scale);
+
+    // A pass keeps the resolution it started with. Going down, the accumulated passes
+    // are reprojected (or dropped); going back up to full resolution they are dropped,
+    // with the preview kept up until a full pass is done
+    if (m_nextTile == 0) {
+        float renderScale = renderScaleThisPass();
+        if (renderScale != m_renderScale) {
+            bool upscale = renderScale > m_renderScale;
+            if (upscale || !settings.useReprojection) {
+                bool keepPreview = upscale && !m_firstPass;
+                View::clearPasses();
+                m_keepPreview = keepPreview;
+            }
+            m_renderScale = renderScale;
+        }
+        m_reprojectPass = !m_firstPass && (inverseCam != m_lastPassInverseCam ||
+                                           renderSize(m_renderScale) != renderSize(m_lastPassScale));
+    }
+    glm::ivec2 size = renderSize(m_renderScale);
+    FrameTiming &timing = m_frameStats.addFrame(m_increment, false, size.x, size.y);
 
     auto prevFBO = m_evenPass ? m_rayFBO1 : m_rayFBO2;
     auto nextFBO = m_evenPass ? m_rayFBO2 : m_rayFBO1;
     float firstPass = m_firstPass ? 1.0f : 0.0f;
 
-    // time in seconds, absolute time
-    float time = m_increment / static_cast<float>(m_fps);
-    // time in seconds for animation. Separately tracked from time to allow for starting/stoping animation
+    // time in seconds for animation. Tracked separately from m_increment to allow for starting/stoping animation
     float animationTime = m_animationIncrement / static_cast<float>(m_fps);
 
-    // If animation is on, incremnet m_animationTime
-    if (settings.useAnimation){
-        m_animationIncrement++;
-    }
+    // Tiles of this pass traced this frame
+    int numTilesX = (size.x + RAY_TILE_SIZE - 1) / RAY_TILE_SIZE;
+    int numTilesY = (size.y + RAY_TILE_SIZE - 1) / RAY_TILE_SIZE;
+    int numTiles = std::max(1, numTilesX * numTilesY);
+    int firstTile = m_nextTile;
+    int lastTile = firstTile + rayTilesThisFrame(numTiles);
+    bool passComplete = lastTile >= numTiles;
+    timing.samples = static_cast<double>(lastTile - firstTile) / numTiles;
 
     // Bind nextFBO
-    // Move render from prevFBO to nextFBO while compositing with current render
+    // Move render from prevFBO to nextFBO while compositing with current render.
+    // Every pixel is written once per pass, so only a first pass clears it
+    // (tiles not traced yet show up black rather than as an old view)
     nextFBO->bind();
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glViewport(0, 0, m_width, m_height);
+    if (m_firstPass && firstTile == 0) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    glViewport(0, 0, size.x, size.y);
 
+    m_rayProgram = getRayProgram(getRayPermutation());
     glUseProgram(m_rayProgram);
 
-    // Bind the previous render's fragColor as a sampler for this render
+    // Bind the previous render's fragColor, fragMoments, fragGeometry and fragAlbedo
+    // as samplers for this render
     glActiveTexture(GL_TEXTURE0);
     prevFBO->getColorAttachment(0).bind();
-
-    // with animation
-    glm::mat4x4 inverseCam = glm::inverse(m_view) * glm::inverse(m_scale);
+    glActiveTexture(GL_TEXTURE10);
+    prevFBO->getColorAttachment(1).bind();
+    glActiveTexture(GL_TEXTURE12);
+    prevFBO->getColorAttachment(2).bind();
+    glActiveTexture(GL_TEXTURE13);
+    prevFBO->getColorAttachment(3).bind();
 
     // ---------------- RAY DATA -----------------
-    glUniform1i(glGetUniformLocation(m_rayProgram, "prev"), 0);
     glUniform1f(glGetUniformLocation(m_rayProgram, "firstPass"), firstPass);
     glUniform1i(glGetUniformLocation(m_rayProgram, "numPasses"), m_numPasses);
 
-    glUniform2f(glGetUniformLocation(m_rayProgram, "dimensions"), static_cast<float>(m_width), static_cast<float>(m_height));
+    glUniform2f(glGetUniformLocation(m_rayProgram, "dimensions"), static_cast<float>(size.x), static_cast<float>(size.y));
     glUniformMatrix4fv(glGetUniformLocation(m_rayProgram, "inverseCam"), 1, false, glm::value_ptr(inverseCam));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "time"), time);
-
-    // ---------------- GLOBAL DATA -----------------
-    glUniform1f(glGetUniformLocation(m_rayProgram, "globalData.ka"), globalData.ka);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "globalData.kd"), globalData.kd);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "globalData.ks"), globalData.ks);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "globalData.kt"), globalData.kt);
+    glUniform1f(glGetUniformLocation(m_rayProgram, "adaptiveBudget"),
+                AdaptiveSampling::budget(m_convergedFraction));
+
+    // The primary hits only change with the camera or the scene
+    glm::ivec2 prevSize = renderSize(m_lastPassScale);
+    glUniform1i(glGetUniformLocation(m_rayProgram, "reproject"), m_reprojectPass);
+    glUniform1i(glGetUniformLocation(m_rayProgram, "traceGeometry"),
+                m_firstPass || m_reprojectPass || settings.useAnimation);
+    glUniformMatrix4fv(glGetUniformLocation(m_rayProgram, "prevWorldToFilm"), 1, false,
+                       glm::value_ptr(glm::inverse(m_lastPassInverseCam)));
+    glUniform4fv(glGetUniformLocation(m_rayProgram, "prevEye"), 1,
+                 glm::value_ptr(m_lastPassInverseCam * glm::vec4(0.f, 0.f, 0.f, 1.f)));
+    glUniform2f(glGetUniformLocation(m_rayProgram, "prevDimensions"),
+                static_cast<float>(prevSize.x), static_cast<float>(prevSize.y));
 
     // ---------------- TEXTURE DATA -----------------
+    // Sampler units are assigned once in initializeGL
 
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, m_diffuseID);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "metalDiffuseTex"), 1);
 
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, m_normalID);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "metalNormalTex"), 2);
 
     glActiveTexture(GL_TEXTURE3);
     glBindTexture(GL_TEXTURE_2D, m_woodDiffuseID);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "woodDiffuseTex"), 3);
 
     glActiveTexture(GL_TEXTURE4);
     glBindTexture(GL_TEXTURE_2D, m_woodNormalID);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "woodNormalTex"), 4);
 
     glActiveTexture(GL_TEXTURE5);
     glBindTexture(GL_TEXTURE_2D, m_plasterDiffuseID);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "plasterDiffuseTex"), 5);
 
     glActiveTexture(GL_TEXTURE6);
     glBindTexture(GL_TEXTURE_2D, m_plasterNormalID);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "plasterNormalTex"), 6);
 
     // ---------------- ENVIRONMENT MAP --------------
 
     glActiveTexture(GL_TEXTURE7);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, View::getEnvMap(settings.modeScene));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "envMap"), 7);
-
-    // ---------------- LIGHT(S) ------------------
-
-    // Point light (pos no dir)
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "lightObject1.color"), 1, glm::value_ptr(lightObject1.color));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "lightObject1.pos"), 1, glm::value_ptr(lightObject1.pos));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "lightObject1.dir"), 1, glm::value_ptr(lightObject1.dir));
-    glUniform3fv(glGetUniformLocation(m_rayProgram, "lightObject1.function"), 1, glm::value_ptr(lightObject1.function));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "lightObject1.type"), static_cast<int>(lightObject1.type));
-
-    // Point light (pos no dir)
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "lightObject2.color"), 1, glm::value_ptr(lightObject2.color));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "lightObject2.pos"), 1, glm::value_ptr(lightObject2.pos));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "lightObject2.dir"), 1, glm::value_ptr(lightObject2.dir));
-    glUniform3fv(glGetUniformLocation(m_rayProgram, "lightObject2.function"), 1, glm::value_ptr(lightObject2.function));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "lightObject2.type"), static_cast<int>(lightObject2.type));
-
-    // Directional light (dir no pos)
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "lightObject3.color"), 1, glm::value_ptr(lightObject3.color));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "lightObject3.pos"), 1, glm::value_ptr(lightObject3.pos));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "lightObject3.dir"), 1, glm::value_ptr(lightObject3.dir));
-    glUniform3fv(glGetUniformLocation(m_rayProgram, "lightObject3.function"), 1, glm::value_ptr(lightObject3.function));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "lightObject3.type"), static_cast<int>(lightObject3.type));
-
-    // ---------------- SETTINGS DATA ------------------
-    // parse and send the UI's lightIntensity settings as floats [0.0, 1.0]
-    float scaledl1Intensity = View::scale(0.f, 100.f, 0.f, 1.f, settings.l1Intensity);
-    float scaledl2Intensity = View::scale(0.f, 100.f, 0.f, 1.f, settings.l2Intensity);
-    float scaledl3Intensity = View::scale(0.f, 100.f, 0.f, 1.f, settings.l3Intensity);
-
-    glUniform1f(glGetUniformLocation(m_rayProgram, "settings.l1Intensity"), static_cast<float>(scaledl1Intensity));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "settings.l2Intensity"), static_cast<float>(scaledl2Intensity));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "settings.l3Intensity"), static_cast<float>(scaledl3Intensity));
-
-    // lighting equation
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.useAmbient"), static_cast<int>(settings.useAmbient));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.useDiffuse"), static_cast<int>(settings.useDiffuse));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.useSpecular"), static_cast<int>(settings.useSpecular));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.useShadows"), static_cast<int>(settings.useShadows));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.useReflections"), static_cast<int>(settings.useReflections));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.useTextures"), static_cast<int>(settings.useTextures));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.useStochastic"), static_cast<int>(settings.useStochastic));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.useTextures"), static_cast<int>(settings.useTextures));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.useNM"), static_cast<int>(settings.useNM));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.useAO"), static_cast<int>(settings.useAO));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.useDOF"), static_cast<int>(settings.useDOF));
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.aperture"), settings.aperture);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.focalLength"), settings.focalLength);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.numSamples"), settings.numSamples);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "settings.useEnvironment"), static_cast<int>(settings.useEnvironment));
+    glBindTexture(GL_TEXTURE_CUBE_MAP, View::getEnvMap());
+
+    // ---------------- BLUE NOISE -------------------
+
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_blueNoiseID);
 
     // ---------------- SCENE OBJECT(S) ------------------
-    std::vector<SceneObject> scene = SceneBuilder::getScene(animationTime);
-
-    glUniform1i(glGetUniformLocation(m_rayProgram, "sceneObject1.primitive"), static_cast<int>(scene[0].primitive));
-    glUniformMatrix4fv(glGetUniformLocation(m_rayProgram, "sceneObject1.objectToWorld"), 1, false, glm::value_ptr(scene[0].objectToWorld));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject1.cDiffuse"), 1, glm::value_ptr(scene[0].cDiffuse));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject1.cAmbient"), 1, glm::value_ptr(scene[0].cAmbient));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject1.cSpecular"), 1, glm::value_ptr(scene[0].cSpecular));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject1.cReflective"), 1, glm::value_ptr(scene[0].cReflective));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject1.shininess"), scene[0].shininess);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject1.blend"), scene[0].blend);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "sceneObject1.texID"), static_cast<int>(scene[0].texID));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject1.repeatU"), scene[0].repeatU);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject1.repeatV"), scene[0].repeatV);
-
-    glUniform1i(glGetUniformLocation(m_rayProgram, "sceneObject2.primitive"), static_cast<int>(scene[1].primitive));
-    glUniformMatrix4fv(glGetUniformLocation(m_rayProgram, "sceneObject2.objectToWorld"), 1, false, glm::value_ptr(scene[1].objectToWorld));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject2.cDiffuse"), 1, glm::value_ptr(scene[1].cDiffuse));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject2.cAmbient"), 1, glm::value_ptr(scene[1].cAmbient));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject2.cSpecular"), 1, glm::value_ptr(scene[1].cSpecular));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject2.cReflective"), 1, glm::value_ptr(scene[1].cReflective));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject2.shininess"), scene[1].shininess);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject2.blend"), scene[1].blend);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "sceneObject2.texID"), static_cast<int>(scene[1].texID));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject2.repeatU"), scene[1].repeatU);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject2.repeatV"), scene[1].repeatV);
-
-    glUniform1i(glGetUniformLocation(m_rayProgram, "sceneObject3.primitive"), static_cast<int>(scene[2].primitive));
-    glUniformMatrix4fv(glGetUniformLocation(m_rayProgram, "sceneObject3.objectToWorld"), 1, false, glm::value_ptr(scene[2].objectToWorld));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject3.cDiffuse"), 1, glm::value_ptr(scene[2].cDiffuse));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject3.cAmbient"), 1, glm::value_ptr(scene[2].cAmbient));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject3.cSpecular"), 1, glm::value_ptr(scene[2].cSpecular));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject3.cReflective"), 1, glm::value_ptr(scene[2].cReflective));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject3.shininess"), scene[2].shininess);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject3.blend"), scene[2].blend);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "sceneObject3.texID"), static_cast<int>(scene[2].texID));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject3.repeatU"), scene[2].repeatU);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject3.repeatV"), scene[2].repeatV);
-
-    glUniform1i(glGetUniformLocation(m_rayProgram, "sceneObject4.primitive"), static_cast<int>(scene[3].primitive));
-    glUniformMatrix4fv(glGetUniformLocation(m_rayProgram, "sceneObject4.objectToWorld"), 1, false, glm::value_ptr(scene[3].objectToWorld));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject4.cDiffuse"), 1, glm::value_ptr(scene[3].cDiffuse));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject4.cAmbient"), 1, glm::value_ptr(scene[3].cAmbient));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject4.cSpecular"), 1, glm::value_ptr(scene[3].cSpecular));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject4.cReflective"), 1, glm::value_ptr(scene[3].cReflective));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject4.shininess"), scene[3].shininess);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject4.blend"), scene[3].blend);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "sceneObject4.texID"), static_cast<int>(scene[3].texID));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject4.repeatU"), scene[3].repeatU);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject4.repeatV"), scene[3].repeatV);
-
-    glUniform1i(glGetUniformLocation(m_rayProgram, "sceneObject5.primitive"), static_cast<int>(scene[4].primitive));
-    glUniformMatrix4fv(glGetUniformLocation(m_rayProgram, "sceneObject5.objectToWorld"), 1, false, glm::value_ptr(scene[4].objectToWorld));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject5.cDiffuse"), 1, glm::value_ptr(scene[4].cDiffuse));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject5.cAmbient"), 1, glm::value_ptr(scene[4].cAmbient));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject5.cSpecular"), 1, glm::value_ptr(scene[4].cSpecular));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject5.cReflective"), 1, glm::value_ptr(scene[4].cReflective));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject5.shininess"), scene[4].shininess);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject5.blend"), scene[4].blend);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "sceneObject5.texID"), static_cast<int>(scene[4].texID));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject5.repeatU"), scene[4].repeatU);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject5.repeatV"), scene[4].repeatV);
-
-    glUniform1i(glGetUniformLocation(m_rayProgram, "sceneObject6.primitive"), static_cast<int>(scene[5].primitive));
-    glUniformMatrix4fv(glGetUniformLocation(m_rayProgram, "sceneObject6.objectToWorld"), 1, false, glm::value_ptr(scene[5].objectToWorld));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject6.cDiffuse"), 1, glm::value_ptr(scene[5].cDiffuse));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject6.cAmbient"), 1, glm::value_ptr(scene[5].cAmbient));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject6.cSpecular"), 1, glm::value_ptr(scene[5].cSpecular));
-    glUniform4fv(glGetUniformLocation(m_rayProgram, "sceneObject6.cReflective"), 1, glm::value_ptr(scene[5].cReflective));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject6.shininess"), scene[5].shininess);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject6.blend"), scene[5].blend);
-    glUniform1i(glGetUniformLocation(m_rayProgram, "sceneObject6.texID"), static_cast<int>(scene[5].texID));
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject6.repeatU"), scene[5].repeatU);
-    glUniform1f(glGetUniformLocation(m_rayProgram, "sceneObject6.repeatV"), scene[5].repeatV);
-
-    // draw  full screen quad
-    m_quad->draw();
+    // Any number of objects, sent through a buffer texture when the scene changed.
+    // They are packed in BVH order so the BVH's leaves can point straight at them.
+    // Their materials and triangle meshes go to buffer textures of their own, which
+    // animation leaves alone. A scene file has all four buffers packed in its cache already.
+    // The scene only moves on after a settings change or as an animated pass starts, the
+    // frames in between (and the later tiles of a pass) keep what is on the GPU
+    bool sceneMoved = !m_sceneFile && (m_rebuildBVH || (settings.useAnimation && firstTile == 0));
+    FrameStats::Clock::time_point sceneStart = FrameStats::Clock::now();
+    if (sceneMoved) {
+        updateScene(animationTime);
+    }
+    timing.sceneMs = FrameStats::millisecondsSince(sceneStart);
+
+    FrameStats::Clock::time_point uploadStart = FrameStats::Clock::now();
+    if (m_sceneFile) {
+        if (m_rayDataDirty) {
+            m_sceneTexture->setData(m_sceneFile->texels(SceneFile::OBJECT_TEXELS),
+                                    m_sceneFile->texelsSizeInBytes(SceneFile::OBJECT_TEXELS));
+            m_materialTexture->setData(m_sceneFile->texels(SceneFile::MATERIAL_TEXELS),
+                                       m_sceneFile->texelsSizeInBytes(SceneFile::MATERIAL_TEXELS));
+            m_bvhTexture->setData(m_sceneFile->texels(SceneFile::BVH_TEXELS),
+                                  m_sceneFile->texelsSizeInBytes(SceneFile::BVH_TEXELS));
+            m_meshTexture->setData(m_sceneFile->texels(SceneFile::MESH_TEXELS),
+                                   m_sceneFile->texelsSizeInBytes(SceneFile::MESH_TEXELS));
+        }
+    } else if (sceneMoved || m_rayDataDirty) {
+        SceneBuffer sceneBuffer;
+        sceneBuffer.pack(*m_scene, m_bvh->objectOrder());
+        if (m_rayDataDirty || sceneBuffer.texels != m_sceneBuffer->texels) {
+            m_sceneBuffer->texels = std::move(sceneBuffer.texels);
+            m_sceneTexture->setData(m_sceneBuffer->texels.data(), m_sceneBuffer->sizeInBytes());
+        }
+        if (m_rayDataDirty || sceneBuffer.materialTexels != m_sceneBuffer->materialTexels) {
+            m_sceneBuffer->materialTexels = std::move(sceneBuffer.materialTexels);
+            m_materialTexture->setData(m_sceneBuffer->materialTexels.data(), m_sceneBuffer->materialsSizeInBytes());
+        }
+        if (m_rayDataDirty) {
+            MeshBuffer meshBuffer;
+            meshBuffer.pack(*m_scene);
+            m_meshTexture->setData(meshBuffer.texels.data(), meshBuffer.sizeInBytes());
+        }
+
+        std::vector<glm::vec4> bvhTexels;
+        m_bvh->pack(bvhTexels);
+        if (m_rayDataDirty || bvhTexels != m_bvhTexels) {
+            m_bvhTexels = std::move(bvhTexels);
+            m_bvhTexture->setData(m_bvhTexels.data(), static_cast<int>(m_bvhTexels.size() * sizeof(glm::vec4)));
+        }
+    }
+
+    glActiveTexture(GL_TEXTURE8);
+    m_sceneTexture->bind();
+
+    glActiveTexture(GL_TEXTURE9);
+    m_bvhTexture->bind();
+
+    glActiveTexture(GL_TEXTURE14);
+    m_materialTexture->bind();
+
+    glActiveTexture(GL_TEXTURE15);
+    m_meshTexture->bind();
+
+    // ---------------- LIGHTS, SETTINGS ------------------
+    // Packed into the RayBlock UBO, which is only re-uploaded when something in it changed
+    RayBlock rayBlock;
+    rayBlock.pack(m_scene->lights, m_scene->size(), static_cast<int>(m_bvh->nodes().size()),
+                  settings.getSettingsData());
+    if (m_rayDataDirty || rayBlock != *m_rayBlock) {
+        *m_rayBlock = rayBlock;
+        m_rayUBO->setData(m_rayBlock.get());
+    }
+    m_rayDataDirty = false;
+    m_rayUBO->bindBase();
+    timing.uploadMs = FrameStats::millisecondsSince(uploadStart);
+
+    // draw the full screen quad, once per tile clipped to the tile when the pass
+    // is split over frames
+    m_rayTimer->begin(m_increment);
+    if (firstTile == 0 && passComplete) {
+        m_quad->draw();
+    } else {
+        glEnable(GL_SCISSOR_TEST);
+        for (int tile = firstTile; tile < lastTile; tile++) {
+            glScissor((tile % numTilesX) * RAY_TILE_SIZE, (tile / numTilesX) * RAY_TILE_SIZE,
+                      RAY_TILE_SIZE, RAY_TILE_SIZE);
+            m_quad->draw();
+        }
+        glDisable(GL_SCISSOR_TEST);
+    }
+    m_rayTimer->end();
     glUseProgram(0);
 
-    // Now draw the particles from nextFBO
+    // Now draw the particles from nextFBO, or from prevFBO (the last complete pass)
+    // while this pass is only partly traced
+    bool showNext = passComplete || (m_firstPass && !m_keepPreview);
+    auto shownFBO = showNext ? nextFBO : prevFBO;
+    glm::ivec2 shownSize = showNext ? size : renderSize(m_lastPassScale);
     nextFBO->unbind();
+
+    // The denoiser runs when the shown pass changes, its time counts as composite time.
+    // prevFBO was denoised when it was complete
+    m_compositeTimer->begin(m_increment);
+    const FBO *composited = shownFBO.get();
+    if (settings.useDenoiser) {
+        if (showNext || !m_denoisedFBO) {
+            m_denoisedFBO = &View::denoise(*shownFBO, shownSize);
+        }
+        composited = m_denoisedFBO;
+    }
+
     glUseProgram(m_compositeProgram);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glViewport(0, 0, m_width, m_height);
 
     glActiveTexture(GL_TEXTURE0);
-    nextFBO->getColorAttachment(0).bind();
+    composited->getColorAttachment(0).bind();
     glUniform1i(glGetUniformLocation(m_compositeProgram, "tex"), 0);
+    glUniform2i(glGetUniformLocation(m_compositeProgram, "renderSize"), shownSize.x, shownSize.y);
 
     m_quad->draw();
+    m_compositeTimer->end();
+    glUseProgram(0);
+
+    m_nextTile = lastTile;
+    if (passComplete) {
+        if (settings.useAdaptive && settings.useStochastic && m_renderScale == 1.f &&
+                m_numPasses % ADAPTIVE_MEASURE_INTERVAL == 0) {
+            measureConvergence(*nextFBO);
+        }
+
+        // The scene only moves on between passes, so every tile of a pass sees the same frame
+        if (settings.useAnimation){
+            m_animationIncrement++;
+        }
+
+        m_numPasses += 1;
+        m_nextTile = 0;
+        m_firstPass = false;
+        m_keepPreview = false;
+        m_lastPassScale = m_renderScale;
+        m_lastPassInverseCam = inverseCam;
+        m_evenPass = !m_evenPass;
+    }
+
+    // The rest of the frame: GL state setup and the draw calls themselves
+    timing.submitMs = FrameStats::millisecondsSince(frameStart) - timing.sceneMs - timing.uploadMs;
+}
+
+// Runs settings.denoiseIterations of denoise.frag over the bottom left size pixels
+// of a ray FBO, guided by its geometry and albedo attachments (see Denoiser).
+// Returns the denoise FBO holding the resolved colors, alpha 1
+const FBO& View::denoise(const FBO &rayFBO, glm::ivec2 size) {
+    int iterations = glm::clamp(settings.denoiseIterations, 1, static_cast<int>(Denoiser::MAX_ITERATIONS));
+    glUseProgram(m_denoiseProgram);
+    glViewport(0, 0, size.x, size.y);
+    glUniform2i(glGetUniformLocation(m_denoiseProgram, "renderSize"), size.x, size.y);
+
+    glActiveTexture(GL_TEXTURE1);
+    rayFBO.getColorAttachment(1).bind();
+    glActiveTexture(GL_TEXTURE2);
+    rayFBO.getColorAttachment(2).bind();
+    glActiveTexture(GL_TEXTURE3);
+    rayFBO.getColorAttachment(3).bind();
+
+    const FBO *input = &rayFBO;
+    FBO *output = m_denoiseFBO1.get();
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        output->bind();
+        glUniform1i(glGetUniformLocation(m_denoiseProgram, "iteration"), iteration);
+        glUniform1i(glGetUniformLocation(m_denoiseProgram, "lastIteration"), iteration == iterations - 1);
+        glActiveTexture(GL_TEXTURE0);
+        input->getColorAttachment(0).bind();
+        m_quad->draw();
+        output->unbind();
+
+        input = output;
+        output = output == m_denoiseFBO1.get() ? m_denoiseFBO2.get() : m_denoiseFBO1.get();
+    }
+    glUseProgram(0);
+    return *input;
+}
+
+// Number of ray tiles that fit in settings.rayBudget, from the measured GPU time
+// of a whole pass. At least one, so every frame makes progress, and none past the
+// end of the pass. Until the first timer query comes back only one tile is traced
+int View::rayTilesThisFrame(int numTiles) const {
+    int remaining = numTiles - m_nextTile;
+    if (m_gpuPassMs < 0.0) {
+        return 1;
+    }
+    double tileMs = m_gpuPassMs * m_renderScale * m_renderScale / numTiles;
+    int tiles = tileMs > 0.0 ? static_cast<int>(settings.rayBudget / tileMs) : remaining;
+    return std::max(1, std::min(tiles, remaining));
+}
+
+// Resolution of the next pass: full unless the camera moved in the last
+// INTERACTION_IDLE_MS, then the largest that traces a whole pass in settings.rayBudget.
+// Rounded down to RENDER_SCALE_STEP, so the timings' jitter doesn't keep restarting
+// the accumulation when the camera stops
+float View::renderScaleThisPass() const {
+    bool interacting = FrameStats::millisecondsSince(m_lastInput) < INTERACTION_IDLE_MS;
+    if (!settings.useDynamicResolution || !interacting || m_gpuPassMs <= 0.0) {
+        return 1.f;
+    }
+    float renderScale = static_cast<float>(std::sqrt(settings.rayBudget / m_gpuPassMs));
+    renderScale = std::floor(renderScale / RENDER_SCALE_STEP) * RENDER_SCALE_STEP;
+    return glm::clamp(renderScale, MIN_RENDER_SCALE, 1.f);
+}
+
+// Pixels traced by a pass at renderScale of the window
+glm::ivec2 View::renderSize(float renderScale) const {
+    return glm::max(glm::ivec2(glm::vec2(m_width, m_height) * renderScale), glm::ivec2(1));
+}
+
+// CPU counterpart of drawRayScene
+// The CPU ray tracer keeps its own accumulation buffer, so the result is uploaded
+// to m_cpuTexture and drawn with the composite program
+void View::drawCPUScene() {
+    FrameStats::Clock::time_point frameStart = FrameStats::Clock::now();
+    FrameTiming &timing = m_frameStats.addFrame(m_increment, true, m_width, m_height);
+
+    float animationTime = m_animationIncrement / static_cast<float>(m_fps);
+    if (settings.useAnimation){
+        m_animationIncrement++;
+    }
+
+    glm::mat4x4 inverseCam = glm::inverse(m_view) * glm::inverse(m_scale);
+    const CS123::CPU::CubeMap &envMap = getEnvironment() == 2 ? m_cpuEnvMap2 : m_cpuEnvMap1;
+
+    // Every frame is a pass of its own here, so the scene moves on with each animated one
+    FrameStats::Clock::time_point sceneStart = FrameStats::Clock::now();
+    if (settings.useAnimation || m_rebuildBVH) {
+        updateScene(animationTime);
+    }
+    timing.sceneMs = FrameStats::millisecondsSince(sceneStart);
+
+    FrameStats::Clock::time_point traceStart = FrameStats::Clock::now();
+    m_cpuTracer->render(*m_scene, *m_bvh, settings.getSettingsData(),
+                        envMap, inverseCam, m_numPasses, settings.useAnimation);
+    if (settings.useDenoiser) {
+        m_cpuTracer->denoise(settings.denoiseIterations);
+    }
+    m_convergedFraction = m_cpuTracer->convergedFraction();
+    timing.traceMs = FrameStats::millisecondsSince(traceStart);
+
+    FrameStats::Clock::time_point uploadStart = FrameStats::Clock::now();
+    const std::vector<glm::vec4> &color = settings.useDenoiser ? m_cpuTracer->denoisedBuffer()
+                                                               : m_cpuTracer->colorBuffer();
+    m_cpuTexture->bind();
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_cpuTracer->width(), m_cpuTracer->height(),
+                    GL_RGBA, GL_FLOAT, color.data());
+    m_cpuTexture->unbind();
+    timing.uploadMs = FrameStats::millisecondsSince(uploadStart);
+
+    glUseProgram(m_compositeProgram);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glViewport(0, 0, m_width, m_height);
+
+    glActiveTexture(GL_TEXTURE0);
+    m_cpuTexture->bind();
+    glUniform1i(glGetUniformLocation(m_compositeProgram, "tex"), 0);
+    glUniform2i(glGetUniformLocation(m_compositeProgram, "renderSize"), m_width, m_height);
+
+    m_compositeTimer->begin(m_increment);
+    m_quad->draw();
+    m_compositeTimer->end();
     glUseProgram(0);
 
     m_numPasses += 1;
     m_firstPass = false;
-    m_evenPass = !m_evenPass;
+
+    timing.submitMs = FrameStats::millisecondsSince(frameStart) - timing.sceneMs -
+                      timing.traceMs - timing.uploadMs;
 }
 
 // This is called at the beginning of the program between initializeGL and
@@ -492,51 +865,70 @@ void View::resizeGL(int w, int h) {
     m_width = w;
     m_height = h;
     // Initialize FBOs here, with dimensions m_width and m_height.
-    // Pass in TextureParameters::WRAP_METHOD::CLAMP_TO_EDGE as the last parameter
+    // They live until the next resize, clearPasses only resets the pass count
+    // Attachment 0 is the color sum, 1 the moments adaptive sampling keeps per pixel,
+    // 2 the primary hits reprojection compares, 3 their albedo for the denoiser
+    m_rayFBO1 = std::make_shared<FBO>(4, FBO::DEPTH_STENCIL_ATTACHMENT::NONE, m_width, m_height, TextureParameters::WRAP_METHOD::CLAMP_TO_EDGE, TextureParameters::FILTER_METHOD::NEAREST, GL_FLOAT);
+    m_rayFBO2 = std::make_shared<FBO>(4, FBO::DEPTH_STENCIL_ATTACHMENT::NONE, m_width, m_height, TextureParameters::WRAP_METHOD::CLAMP_TO_EDGE, TextureParameters::FILTER_METHOD::NEAREST, GL_FLOAT);
+
+    m_denoiseFBO1 = std::make_shared<FBO>(1, FBO::DEPTH_STENCIL_ATTACHMENT::NONE, m_width, m_height, TextureParameters::WRAP_METHOD::CLAMP_TO_EDGE, TextureParameters::FILTER_METHOD::NEAREST, GL_FLOAT);
+    m_denoiseFBO2 = std::make_shared<FBO>(1, FBO::DEPTH_STENCIL_ATTACHMENT::NONE, m_width, m_height, TextureParameters::WRAP_METHOD::CLAMP_TO_EDGE, TextureParameters::FILTER_METHOD::NEAREST, GL_FLOAT);
+    m_denoisedFBO = nullptr;
+
+    // CPU ray tracer target
+    m_cpuTracer->resize(m_width, m_height);
+    m_cpuTexture = std::make_unique<Texture2D>(nullptr, m_width, m_height, GL_FLOAT);
+    TextureParametersBuilder builder;
+    builder.setFilter(TextureParameters::FILTER_METHOD::NEAREST);
+    builder.setWrap(TextureParameters::WRAP_METHOD::CLAMP_TO_EDGE);
+    builder.build().applyTo(*m_cpuTexture);
 
     View::clearPasses();
     View::rebuildMatrices();
 }
 
 // Mouse interaction code below.
+// Each event counts as camera interaction for the dynamic resolution
 void View::mousePressEvent(QMouseEvent *event) {
     m_prevMousePos = event->pos();
-    View::clearPasses();
+    m_lastInput = FrameStats::Clock::now();
+    View::cameraMoved();
 }
 
 void View::mouseMoveEvent(QMouseEvent *event) {
     m_angleX += 3 * (event->x() - m_prevMousePos.x()) / (float) width();
     m_angleY += 3 * (event->y() - m_prevMousePos.y()) / (float) height();
     m_prevMousePos = event->pos();
+    m_lastInput = FrameStats::Clock::now();
     View::rebuildMatrices();
-    View::clearPasses();
+    View::cameraMoved();
 }
 
 void View::wheelEvent(QWheelEvent *event) {
     m_zoom -= event->delta() / 100.f;
+    m_lastInput = FrameStats::Clock::now();
     View::rebuildMatrices();
-    View::clearPasses();
+    View::cameraMoved();
 }
 
 // Rebuild matrices for camera
 void View::rebuildMatrices() {
-    m_view = glm::translate(glm::vec3(0, 0, -m_zoom)) *
-             glm::rotate(m_angleY, glm::vec3(1.f,0.f,0.f)) *
-             glm::rotate(m_angleX, glm::vec3(0.f,1.f,0.f));
-
-    float farPlane = std::max(CAMERA_FAR, CAMERA_NEAR + 100.f * FLT_EPSILON);
-    float h = farPlane * glm::tan(glm::radians(CAMERA_FOV/2));
-    float aspectRatio = m_width/m_height;
-    float w = aspectRatio * h;
-    m_scale = glm::scale(glm::vec3(1.f/w, 1.f/h, 1.f/farPlane));
+    OrbitCamera camera = {m_angleX, m_angleY, m_zoom};
+    m_view = camera.viewMatrix();
+    m_scale = camera.scaleMatrix(m_width, m_height);
     m_projection = glm::perspective(0.8f, (float)width()/height(), 0.1f, 100.f);
     update();
 }
 
+// The scene's environment map, 1 or 2
+int View::getEnvironment() const {
+    return m_sceneFile ? m_sceneFile->environment() : SceneBuilder::getEnvironment();
+}
+
 // Get the current env map depending on scene mode
-GLuint View::getEnvMap(int modeScene)
+GLuint View::getEnvMap()
 {
-    if (modeScene == 0) {
+    if (getEnvironment() == 2) {
         return m_envCubeID2;
     } else {
         return m_envCubeID1;
@@ -545,16 +937,171 @@ GLuint View::getEnvMap(int modeScene)
 
 // Clear out the current number of passes
 // Called whenever settings are changed or camera moves
+// The FBOs are kept: with numPasses at 0 the next pass gives the previous
+// render no weight, so nothing has to be cleared or reallocated
 void View::clearPasses(){
     m_numPasses = 0.f;
+    m_nextTile = 0;
     m_firstPass = true;
-    m_rayFBO1 = std::make_shared<FBO>(1, FBO::DEPTH_STENCIL_ATTACHMENT::NONE, m_width, m_height, TextureParameters::WRAP_METHOD::CLAMP_TO_EDGE, TextureParameters::FILTER_METHOD::NEAREST);//, GL_FLOAT);
-    m_rayFBO2 = std::make_shared<FBO>(1, FBO::DEPTH_STENCIL_ATTACHMENT::NONE, m_width, m_height, TextureParameters::WRAP_METHOD::CLAMP_TO_EDGE, TextureParameters::FILTER_METHOD::NEAREST);//, GL_FLOAT);
+    m_keepPreview = false;
+    m_convergedFraction = 0.f;
+    m_convergenceEpoch++;
+}
+
+// Called when the camera moves. With reprojection the accumulated passes are kept
+// and only the pass in progress starts over, drawRayScene picks the new camera up;
+// otherwise (and on the CPU ray tracer) everything starts over
+void View::cameraMoved() {
+    if (settings.useReprojection && !settings.useCPU) {
+        m_nextTile = 0;
+        m_convergedFraction = 0.f;
+        m_convergenceEpoch++;
+    } else {
+        View::clearPasses();
+    }
+}
+
+// Counts the pixels in the ray FBO whose moments are marked converged: converged.frag
+// discards the others and a GL_SAMPLES_PASSED query counts what is left. The count is
+// picked up by collectConvergence once it is ready, so nothing waits on the GPU.
+// A denoise FBO is the target as it has the window's size, the color mask keeps it as is
+void View::measureConvergence(const FBO &fbo) {
+    m_denoiseFBO1->bind();
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glUseProgram(m_convergedProgram);
+    glActiveTexture(GL_TEXTURE0);
+    fbo.getColorAttachment(1).bind();
+
+    m_convergenceQueries->begin(m_convergenceEpoch);
+    m_quad->draw();
+    m_convergenceQueries->end();
+
+    glUseProgram(0);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    m_denoiseFBO1->unbind();
+}
+
+// Takes up the converged pixel counts that have come back, the ones measured
+// before the passes last started over are stale
+void View::collectConvergence() {
+    int epoch;
+    GLuint64 convergedPixels;
+    while (m_convergenceQueries->poll(epoch, convergedPixels)) {
+        if (epoch == m_convergenceEpoch) {
+            m_convergedFraction = static_cast<float>(convergedPixels) /
+                                  (static_cast<float>(m_width) * static_cast<float>(m_height));
+        }
+    }
+}
+
+// Moves the scene on to animationTime. A scene file is static and stays as loaded
+void View::updateScene(float animationTime) {
+    if (!m_sceneFile) {
+        m_scene->assign(SceneBuilder::getScene(animationTime));
+        updateBVH(*m_scene);
+    }
+}
+
+// Builds the BVH from scratch after a settings change (the scene may be a different one)
+// and otherwise just refits it to the objects' new transforms
+void View::updateBVH(const Scene &scene) {
+    if (m_rebuildBVH) {
+        m_bvh->build(scene);
+        m_rebuildBVH = false;
+    } else {
+        m_bvh->refit(scene);
+    }
+}
+
+// Key of the ray program permutation for the current settings, one bit per
+// entry of RAY_PERMUTATION_DEFINES
+int View::getRayPermutation() const {
+    bool enabled[NUM_RAY_PERMUTATION_DEFINES] = {
+        settings.useShadows, settings.useReflections, settings.useAO,
+        settings.useDOF, settings.useNM, settings.useTextures
+    };
+    int permutation = 0;
+    for (int i = 0; i < NUM_RAY_PERMUTATION_DEFINES; i++) {
+        permutation |= enabled[i] ? (1 << i) : 0;
+    }
+    return permutation;
+}
+
+// Returns the ray program for a permutation, compiling it the first time it is needed.
+// Every permutation gets the same uniform block binding and texture units
+GLuint View::getRayProgram(int permutation) {
+    auto cached = m_rayPrograms.find(permutation);
+    if (cached != m_rayPrograms.end()) {
+        return cached.value();
+    }
+
+    std::string defines;
+    for (int i = 0; i < NUM_RAY_PERMUTATION_DEFINES; i++) {
+        defines += std::string("#define ") + RAY_PERMUTATION_DEFINES[i] +
+                   ((permutation & (1 << i)) ? " 1\n" : " 0\n");
+    }
+    GLuint program = ResourceLoader::createShaderProgram(
+                ":/shaders/quad.vert", ":/shaders/ray.frag", defines);
+
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "RayBlock"), m_rayUBO->bindingPoint());
+
+    // Texture units for the ray program never change
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "prev"), 0);
+    glUniform1i(glGetUniformLocation(program, "metalDiffuseTex"), 1);
+    glUniform1i(glGetUniformLocation(program, "metalNormalTex"), 2);
+    glUniform1i(glGetUniformLocation(program, "woodDiffuseTex"), 3);
+    glUniform1i(glGetUniformLocation(program, "woodNormalTex"), 4);
+    glUniform1i(glGetUniformLocation(program, "plasterDiffuseTex"), 5);
+    glUniform1i(glGetUniformLocation(program, "plasterNormalTex"), 6);
+    glUniform1i(glGetUniformLocation(program, "envMap"), 7);
+    glUniform1i(glGetUniformLocation(program, "sceneObjectBuffer"), 8);
+    glUniform1i(glGetUniformLocation(program, "bvhBuffer"), 9);
+    glUniform1i(glGetUniformLocation(program, "prevMoments"), 10);
+    glUniform1i(glGetUniformLocation(program, "blueNoise"), 11);
+    glUniform1i(glGetUniformLocation(program, "prevGeometry"), 12);
+    glUniform1i(glGetUniformLocation(program, "prevAlbedo"), 13);
+    glUniform1i(glGetUniformLocation(program, "materialBuffer"), 14);
+    glUniform1i(glGetUniformLocation(program, "meshBuffer"), 15);
+    glUseProgram(0);
+
+    m_rayPrograms.insert(permutation, program);
+    return program;
+}
+
+// Loads settings.sceneFile into m_scene and m_bvh. Returns false after printing the error
+bool View::loadSceneFile() {
+    QString error;
+    if (!m_sceneFile->load(settings.sceneFile, *m_scene, *m_bvh, error)) {
+        std::cerr << error.toStdString() << std::endl;
+        return false;
+    }
+    if (!m_sceneFile->cacheWarning().isEmpty()) {
+        std::cerr << "Warning: " << m_sceneFile->cacheWarning().toStdString()
+                  << ", loaded without a cache" << std::endl;
+    }
+    std::cout << "Loaded " << settings.sceneFile.toStdString() << ": " << m_scene->size() << " objects, "
+              << m_sceneFile->bytesSaved() << " bytes of cache written" << std::endl;
+    m_rayDataDirty = true;
+    return true;
+}
+
+// Editors that save by replacing the file drop it from the watcher, so it is added again.
+// A file with a mistake keeps the last scene up, its texels are on the GPU already
+void View::sceneFileChanged() {
+    if (!m_sceneFileWatcher.files().contains(settings.sceneFile)) {
+        m_sceneFileWatcher.addPath(settings.sceneFile);
+    }
+    if (loadSceneFile()) {
+        View::clearPasses();
+    }
 }
 
 // View::settingsChanged
 // Called when settings are changed on the UI
 void View::settingsChanged() {
+    m_rebuildBVH = true;
+
     // Upon settings changed, reset numPasses to 0 and firstPass to true
     View::clearPasses();
 }
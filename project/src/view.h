@@ -9,6 +9,8 @@
 #include <QFileInfo>
 #include <QMap>
 #include <QRgb>
+#include <QLabel>
+#include <QFileSystemWatcher>
 
 #include "glm/glm.hpp"            // glm::vec*, mat*, and basic glm functions
 #include "glm/gtx/transform.hpp"  // glm::translate, scale, rotate
@@ -17,74 +19,24 @@
 #include <memory>  // std::unique_ptr
 
 #include "gl/datatype/FBO.h"
+#include "gl/datatype/UBO.h"
+#include "gl/datatype/TimerQueryRing.h"
+#include "gl/textures/Texture2D.h"
+#include "gl/textures/TextureBuffer.h"
+
+#include "scenedata.h"
+#include "FrameStats.h"
+#include "cpu/RayTracer.h"
 
 class OpenGLShape;
+struct RayBlock;
+struct SceneBuffer;
+struct Scene;
+class BVH;
+class SceneFile;
 
 using namespace CS123::GL;
 
-// Primitive and Light type both in same enums
-// so #define SPHERE, CUBE, CONE, etc. in ray.frag are ensured
-// to not conflict
-enum class ShapeType{
-    SPHERE,
-    CUBE,
-    CONE,
-    CYLINDER,
-    NO_INTERSECT,
-    LIGHT_POINT,
-    LIGHT_DIRECTIONAL
-};
-
-// [DATA TYPES]
-////////////////////////////////////////////////////////////////////////
-// Final output of data Raytracing spits out to write to color attachments
-struct RayData{
-    float rayT;
-    int rayPrimitiveType;
-    glm::vec4 rayNormal;
-    glm::vec4 rayPoint;
-    glm::vec4 rayDirection;
-};
-
-struct GlobalData{
-    float ka; // global ambient coefficient
-    float kd; // global diffuse coefficeint
-    float ks; // global specular coefficient
-    float kt; // global transparency coefficient
-};
-
-// Light Data
-// Just point lights at the moment
-struct LightObject{
-    glm::vec4 color;
-    glm::vec4 pos; // Only applicable for point lights
-    glm::vec4 dir; // Only applicable for directional lights
-    glm::vec3 function; // attenuation function
-    ShapeType type; // Can be LIGHT_POINT, LIGHT_DIRECTIONAL
-};
-
-// [SCENE]
-//////////////////////////////////////////
-
-// [ENVIRONMENT CUBE MAPS] (via)
-// http://www.humus.name/index.php?page=Textures
-
-// Harcoded data
-// GlobalData, LightData (1 per scene atm)
-// SceneObjects [5 per scene atm]
-const GlobalData globalData = {0.5f, 0.5f, 0.5f, 0.0f};
-
-// Light Object 1
-const LightObject lightObject1 = {glm::vec4(0.8, 0.8, 0.8, 1.0), glm::vec4(0.0, 0.0, 10.0, 1.0), glm::vec4(0.f), glm::vec3(0.9, 0.0, 0.0), ShapeType::LIGHT_POINT};
-
-// Light Object 2
-const LightObject lightObject2 = {glm::vec4(0.2, 0.2, 0.2, 1.0), glm::vec4(-10.0, 0.0, -10.0, 1.0), glm::vec4(0.f), glm::vec3(0.9, 0.0, 0.0), ShapeType::LIGHT_POINT};
-
-// Light Object 3
-const LightObject lightObject3 = {glm::vec4(0.3, 0.3, 0.2, 1.0), glm::vec4(0.0, 8.0, 10.0, 1.0), glm::vec4(0.f), glm::vec3(0.5, 0.0, 0.0), ShapeType::LIGHT_POINT};
-
-struct SceneObject;
-
 class View : public QGLWidget {
     Q_OBJECT
 
@@ -93,6 +45,10 @@ public:
     ~View();
     void settingsChanged();
 
+public slots:
+    // Writes the recorded frame timings to frame_timings.csv and frame_timings.json
+    void saveTimings();
+
 protected:
     void initializeGL();
     void paintGL();
@@ -105,19 +61,39 @@ protected slots:
     /** Repaints the canvas. Called 60 times per second by m_timer. */
     void tick();
 
+    // Reloads the scene file after it was saved
+    void sceneFileChanged();
+
 private:
     void drawRayScene();
+    void drawCPUScene();
+    void updateScene(float animationTime);
+    void updateBVH(const Scene &scene);
+    bool loadSceneFile();
+    int rayTilesThisFrame(int numTiles) const;
+    float renderScaleThisPass() const;
+    glm::ivec2 renderSize(float renderScale) const;
+    void measureConvergence(const FBO &fbo);
+    void collectConvergence();
+    const FBO& denoise(const FBO &rayFBO, glm::ivec2 size);
+    int getRayPermutation() const;
+    GLuint getRayProgram(int permutation);
     void drawEnvCube();
+    void collectGPUTimings();
+    void updateTimingsOverlay();
 
     float scale(float oldMin, float oldMax, float newMin, float newMax, float val);
 
     void rebuildMatrices();
     void clearPasses();
-    GLuint getEnvMap(int modeScene);
+    void cameraMoved();
+    int getEnvironment() const;
+    GLuint getEnvMap();
 
     // Texture mapping
     void buildEnvMap(const QImage &front, const QImage &back, const QImage &top, const QImage &bottom, const QImage &left, const QImage &right, GLuint textureHandle);
     void buildTextureMap(const QImage &image, GLuint textureID);
+    void buildBlueNoise(const QImage &image, GLuint textureID);
 
     std::unique_ptr<QMap<QString, QImage>> m_textures; //pointer to a map of QString, QImage pairs
     bool textureExists(QString filePath);
@@ -128,8 +104,14 @@ private:
 
     GLuint m_phongProgram;
     GLuint m_textureProgram;
-    GLuint m_rayProgram;
+    GLuint m_rayProgram; // permutation used by the current frame
+
+    // ray.frag compiled with each feature toggle defined to 0 or 1, built on first use
+    // and keyed by getRayPermutation()
+    QMap<int, GLuint> m_rayPrograms;
     GLuint m_compositeProgram;
+    GLuint m_denoiseProgram;
+    GLuint m_convergedProgram;
     GLuint m_envCubeProgram;
 
     GLuint m_envCubeID1;
@@ -144,16 +126,88 @@ private:
     GLuint m_woodDiffuseID;
     GLuint m_woodNormalID;
 
+    GLuint m_blueNoiseID;
+
     std::unique_ptr<OpenGLShape> m_quad;
     std::unique_ptr<OpenGLShape> m_envCube;
     std::unique_ptr<OpenGLShape> m_square;
 
+    // Last RayBlock / SceneBuffer uploaded to m_rayUBO / m_sceneTexture and m_materialTexture.
+    // m_meshTexture holds the scene's triangle meshes (see MeshBuffer)
+    std::unique_ptr<RayBlock> m_rayBlock;
+    std::unique_ptr<UBO> m_rayUBO;
+    bool m_rayDataDirty;
+    std::unique_ptr<SceneBuffer> m_sceneBuffer;
+    std::unique_ptr<TextureBuffer> m_sceneTexture;
+    std::unique_ptr<TextureBuffer> m_materialTexture;
+    std::unique_ptr<TextureBuffer> m_meshTexture;
+
+    // The current frame's objects, see [SCENE] in Scene.h
+    std::unique_ptr<Scene> m_scene;
+
+    // With --scene-file, m_scene and m_bvh come from here instead of SceneBuilder
+    // and the texture buffers are uploaded straight from its cache (see [SCENE FILES])
+    std::unique_ptr<SceneFile> m_sceneFile;
+    QFileSystemWatcher m_sceneFileWatcher;
+
+    // BVH over the scene objects, shared by the GPU and CPU ray tracers.
+    // Rebuilt when the scene may have changed, refit when an animated pass moves it on
+    std::unique_ptr<BVH> m_bvh;
+    bool m_rebuildBVH;
+    std::vector<glm::vec4> m_bvhTexels;
+    std::unique_ptr<TextureBuffer> m_bvhTexture;
+
+    // CPU ray tracer, its result is uploaded to m_cpuTexture and composited like the ray FBO
+    std::unique_ptr<CS123::CPU::RayTracer> m_cpuTracer;
+    std::unique_ptr<Texture2D> m_cpuTexture;
+    CS123::CPU::CubeMap m_cpuEnvMap1;
+    CS123::CPU::CubeMap m_cpuEnvMap2;
+
     std::shared_ptr<FBO> m_rayFBO1;
     std::shared_ptr<FBO> m_rayFBO2;
+
+    // Denoiser: denoise.frag ping pongs between these, one iteration each way.
+    // m_denoisedFBO holds the result for the last pass shown, see denoise()
+    std::shared_ptr<FBO> m_denoiseFBO1;
+    std::shared_ptr<FBO> m_denoiseFBO2;
+    const FBO *m_denoisedFBO;
     bool m_firstPass;
     bool m_evenPass;
     int m_numPasses;
 
+    // The ray pass is traced in tiles, as many per frame as fit in settings.rayBudget;
+    // a pass that doesn't fit carries on from m_nextTile next frame
+    int m_nextTile;
+    double m_gpuPassMs; // GPU time of a whole full resolution pass from the timer queries, < 0 until known
+    static const int RAY_TILE_SIZE = 64; // pixels
+
+    // Dynamic resolution: while the camera moves, passes are traced at m_renderScale
+    // of the window (into the bottom left of the ray FBOs) and upsampled by
+    // composite.frag. Full resolution accumulation resumes once the input has been
+    // idle for INTERACTION_IDLE_MS, with the last low resolution pass kept on screen
+    // until the first full one completes
+    float m_renderScale;
+    float m_lastPassScale; // of the pass in the FBO that is not written to
+    bool m_keepPreview;
+    FrameStats::Clock::time_point m_lastInput;
+    static const int INTERACTION_IDLE_MS = 250;
+    static const float MIN_RENDER_SCALE;
+    static const float RENDER_SCALE_STEP;
+
+    // Reprojection: a pass traced from another camera than the last complete one
+    // (m_lastPassInverseCam) takes the accumulated samples over from where each pixel's
+    // primary hit was, see [REPROJECTION] in ray.frag. Set when a pass starts
+    glm::mat4 m_lastPassInverseCam;
+    bool m_reprojectPass;
+
+    // Adaptive sampling: fraction of converged pixels, measured every few passes.
+    // The counts come back a few frames late, tagged with the m_convergenceEpoch
+    // they were measured in, which moves on whenever the passes start over
+    float m_convergedFraction;
+    std::unique_ptr<QueryRing> m_convergenceQueries;
+    int m_convergenceEpoch;
+    static const int ADAPTIVE_MEASURE_INTERVAL = 8; // passes
+
     glm::mat4 m_view, m_projection, m_scale;
 
     /** For mouse interaction. */
@@ -168,26 +222,12 @@ private:
     int m_increment;
     int m_animationIncrement; // used to track the last animation time (used for paused scenes)
 
-    // Camera setting constants
-    const float CAMERA_FAR = 50.f;
-    const float CAMERA_NEAR = 0.1f;
-    const float CAMERA_FOV = 45.f;
-};
-
-struct SceneObject{
-    ShapeType primitive; // Can be SPHERE, CUBE, CONE, CYLINDER
-    glm::mat4x4 objectToWorld; // cumulative transformation matrix
-    glm::vec4 cDiffuse;
-    glm::vec4 cAmbient;
-    glm::vec4 cSpecular;
-    glm::vec4 cReflective;
-    float shininess;
-
-    // Texture properties
-    float blend;
-    int texID;
-    float repeatU;
-    float repeatV;
+    // Frame timings, shown in m_timingsLabel and saved by saveTimings
+    FrameStats m_frameStats;
+    std::unique_ptr<TimerQueryRing> m_rayTimer;
+    std::unique_ptr<TimerQueryRing> m_compositeTimer;
+    QLabel *m_timingsLabel;
+    static const int TIMINGS_OVERLAY_INTERVAL = 15; // frames
 };
 
 #endif // VIEW_H
@@ -0,0 +1,9 @@
+TARGET = bluenoise
+TEMPLATE = app
+
+CONFIG += console c++14
+CONFIG -= qt app_bundle
+
+QMAKE_CXXFLAGS += -std=c++14
+
+SOURCES += main.cpp
@@ -0,0 +1,185 @@
+// Generates the tiled blue noise texture set used by ray.frag's blue noise sampler,
+// with Ulichney's void-and-cluster method ("The void-and-cluster method for dither
+// array generation", 1993). Each layer is an independent size x size tile whose
+// texels hold their rank, so thresholding it at any level gives an evenly spread
+// set of pixels. The layers are stacked top to bottom in one binary PGM:
+//
+//   bluenoise [output.pgm] [size] [layers] [seed]
+//
+// Defaults write data/bluenoise.pgm from the project directory: 64x64, 8 layers, a pair
+// for each of the four SampleDimensions so no two dimensions share a layer.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const float SIGMA = 1.5f;                // Gaussian energy filter, in texels
+const float INITIAL_DENSITY = .1f;       // fraction of the pixels in the initial pattern
+
+// Energy of every pixel from the pattern's ones, on a torus so the tiles wrap
+class VoidAndCluster {
+public:
+    VoidAndCluster(int size, unsigned seed) :
+        m_size(size),
+        m_pattern(size * size, 0),
+        m_energy(size * size, 0.f),
+        m_kernel(size * size),
+        m_rng(seed)
+    {
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                int dx = std::min(x, size - x);
+                int dy = std::min(y, size - y);
+                m_kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.f * SIGMA * SIGMA));
+            }
+        }
+    }
+
+    std::vector<int> ranks() {
+        int numPixels = m_size * m_size;
+        initialPattern(static_cast<int>(numPixels * INITIAL_DENSITY));
+        std::vector<char> prototype = m_pattern;
+        std::vector<float> prototypeEnergy = m_energy;
+        int numOnes = static_cast<int>(std::count(m_pattern.begin(), m_pattern.end(), 1));
+
+        std::vector<int> rank(numPixels, 0);
+
+        // Phase 1: take the tightest clusters out of the prototype, ranking them down from numOnes
+        for (int r = numOnes - 1; r >= 0; r--) {
+            int cluster = tightestCluster();
+            set(cluster, 0);
+            rank[cluster] = r;
+        }
+
+        // Phase 2: fill the largest voids up to half the pixels
+        m_pattern = prototype;
+        m_energy = prototypeEnergy;
+        for (int r = numOnes; r < numPixels / 2; r++) {
+            int largestVoid = largestVoidPixel();
+            set(largestVoid, 1);
+            rank[largestVoid] = r;
+        }
+
+        // Phase 3: past half, the zeros are the minority and their tightest cluster goes
+        // next. The energy from the zeros is the kernel's sum less the energy from the
+        // ones, so that is the zero pixel with the least energy from the ones
+        for (int r = numPixels / 2; r < numPixels; r++) {
+            int cluster = largestVoidPixel();
+            set(cluster, 1);
+            rank[cluster] = r;
+        }
+        return rank;
+    }
+
+private:
+    // Random pixels, then swaps the tightest cluster into the largest void until that is a no-op
+    void initialPattern(int numOnes) {
+        std::uniform_int_distribution<int> pixel(0, m_size * m_size - 1);
+        int placed = 0;
+        while (placed < numOnes) {
+            int i = pixel(m_rng);
+            if (!m_pattern[i]) {
+                set(i, 1);
+                placed++;
+            }
+        }
+        while (true) {
+            int cluster = tightestCluster();
+            set(cluster, 0);
+            int largestVoid = largestVoidPixel();
+            if (largestVoid == cluster) {
+                set(cluster, 1);
+                break;
+            }
+            set(largestVoid, 1);
+        }
+    }
+
+    void set(int i, char value) {
+        if (m_pattern[i] == value) {
+            return;
+        }
+        m_pattern[i] = value;
+        float sign = value ? 1.f : -1.f;
+        int px = i % m_size;
+        int py = i / m_size;
+        for (int y = 0; y < m_size; y++) {
+            int ky = (y - py + m_size) % m_size;
+            for (int x = 0; x < m_size; x++) {
+                int kx = (x - px + m_size) % m_size;
+                m_energy[y * m_size + x] += sign * m_kernel[ky * m_size + kx];
+            }
+        }
+    }
+
+    int tightestCluster() const {
+        int best = -1;
+        for (size_t i = 0; i < m_pattern.size(); i++) {
+            if (m_pattern[i] && (best < 0 || m_energy[i] > m_energy[best])) {
+                best = static_cast<int>(i);
+            }
+        }
+        return best;
+    }
+
+    int largestVoidPixel() const {
+        int best = -1;
+        for (size_t i = 0; i < m_pattern.size(); i++) {
+            if (!m_pattern[i] && (best < 0 || m_energy[i] < m_energy[best])) {
+                best = static_cast<int>(i);
+            }
+        }
+        return best;
+    }
+
+    int m_size;
+    std::vector<char> m_pattern;
+    std::vector<float> m_energy;
+    std::vector<float> m_kernel;
+    std::mt19937 m_rng;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::string output = argc > 1 ? argv[1] : "../data/bluenoise.pgm";
+    int size = argc > 2 ? std::atoi(argv[2]) : 64;
+    int layers = argc > 3 ? std::atoi(argv[3]) : 8;
+    unsigned seed = argc > 4 ? static_cast<unsigned>(std::atoi(argv[4])) : 1u;
+    if (size <= 0 || layers <= 0) {
+        std::fprintf(stderr, "usage: bluenoise [output.pgm] [size] [layers] [seed]\n");
+        return 1;
+    }
+
+    int numPixels = size * size;
+    std::vector<unsigned char> texels;
+    texels.reserve(numPixels * layers);
+    for (int layer = 0; layer < layers; layer++) {
+        VoidAndCluster generator(size, seed + layer);
+        for (int rank : generator.ranks()) {
+            texels.push_back(static_cast<unsigned char>(rank * 256 / numPixels));
+        }
+        std::printf("Layer %d done\n", layer);
+    }
+
+    FILE *file = std::fopen(output.c_str(), "wb");
+    if (!file) {
+        std::fprintf(stderr, "Failed to open %s\n", output.c_str());
+        return 1;
+    }
+    std::fprintf(file, "P5\n%d %d\n255\n", size, size * layers);
+    bool ok = std::fwrite(texels.data(), 1, texels.size(), file) == texels.size();
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok) {
+        std::fprintf(stderr, "Failed to write %s\n", output.c_str());
+        return 1;
+    }
+    std::printf("Wrote %s (%dx%d, %d layers)\n", output.c_str(), size, size, layers);
+    return 0;
+}